@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <stdlib.h>
 
+#include <gio/gio.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 #include <libgnomeui/gnome-window-icon.h>
@@ -31,6 +32,7 @@
 #include "../src/mrulist.h"
 #include "../src/rdpfile.h"
 #include "../src/support.h"
+#include "../src/service.h"
 
 AppletData *g_data;
 
@@ -150,58 +152,237 @@ void tsclient_applet_create (PanelApplet *applet)
   gtk_widget_show_all (GTK_WIDGET (g_data->applet));
 }
 
-void
-create_menu (gpointer key, gpointer value, gpointer menu)
+/***************************************
+*                                      *
+*   applet_menu_refresh                *
+*                                      *
+***************************************/
+
+/*
+ * Names sort case-insensitively, but "Lab" and "lab" are different
+ * folders: they compare equal only when they are the same, so each
+ * group's profiles stay together and match its key in data->groups.
+ */
+static gint
+applet_name_compare (const gchar *a, gsize alen, const gchar *b, gsize blen)
 {
-  GtkMenu* submenu = NULL;
-  GtkMenuItem *subitem =NULL;
-  GtkMenuItem* itemfound = NULL;
-  
-  GList* list = NULL;
-  gchar* label_text = NULL;
-  gchar *name = g_strdup (key);
-  gchar *value_c = g_strdup (value);
-  
-  GtkMenuItem *mi = (GtkMenuItem *) gtk_menu_item_new_with_label (name);
-	
-  list = gtk_container_get_children (GTK_CONTAINER(menu));
-  itemfound = NULL;  
-  for ( ; (list != NULL) && (itemfound == NULL) ; list = g_list_next (list)) {
-    if (GTK_IS_MENU_ITEM(list->data)) {
-      if (GTK_IS_LABEL(GTK_BIN(list->data)->child)) {
-	      label_text = gtk_label_get_text (GTK_LABEL(GTK_BIN(list->data)->child));
-	      if (g_ascii_strcasecmp (label_text, value_c) == 0)
-	        itemfound = GTK_MENU_ITEM(list->data);
-      }
-    }
+  gint ret = g_ascii_strncasecmp (a, b, MIN (alen, blen));
+
+  if (ret == 0)
+    ret = (alen > blen) - (alen < blen);
+  if (ret == 0)
+    ret = strncmp (a, b, alen);
+  return ret;
+}
+
+
+/* Grouped profiles first, then by group, then by name. */
+static gint
+applet_profile_compare (gconstpointer a, gconstpointer b)
+{
+  const gchar *sa = strrchr (a, '/'), *sb = strrchr (b, '/');
+  gint ret;
+
+  if (!sa || !sb)
+    return sa ? -1 : sb ? 1 : applet_name_compare (a, strlen (a), b, strlen (b));
+  ret = applet_name_compare (a, sa - (const gchar *) a, b, sb - (const gchar *) b);
+  return ret ? ret : applet_name_compare (sa + 1, strlen (sa + 1), sb + 1, strlen (sb + 1));
+}
+
+
+static gboolean
+applet_files_equal (GSList *a, GSList *b)
+{
+  for ( ; a && b; a = a->next, b = b->next) {
+    if (strcmp (a->data, b->data) != 0)
+      return FALSE;
   }
+  return a == b;
+}
 
-  if (g_ascii_strcasecmp (value_c, "-1") != 0){
-	  
-  	g_signal_connect (GTK_WIDGET (mi), "activate",GTK_SIGNAL_FUNC (applet_menu_item),
-	  	g_build_path ("/", value_c, name, NULL));
-	  
-    if (itemfound != NULL) {
-	    submenu = gtk_menu_item_get_submenu (itemfound);
-	    subitem = itemfound;
-    } else {
-	    submenu = GTK_MENU (gtk_menu_new ());
-	    subitem = (GtkMenuItem *) gtk_menu_item_new_with_label (value_c);
-	    gtk_menu_shell_append ((GtkMenuShell *) menu, GTK_WIDGET (subitem));
-	    gtk_widget_show (GTK_WIDGET (subitem));
+
+static void
+applet_dir_changed (GFileMonitor *monitor, GFile *file, GFile *other,
+                    GFileMonitorEvent event, AppletData *data)
+{
+  data->stale = TRUE;
+}
+
+
+static GFileMonitor *
+applet_watch (const gchar *dir_name, AppletData *data)
+{
+  GFile *dir = g_file_new_for_path (dir_name);
+  GFileMonitor *monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, NULL, NULL);
+
+  if (monitor)
+    g_signal_connect (monitor, "changed", G_CALLBACK (applet_dir_changed), data);
+  g_object_unref (dir);
+  return monitor;
+}
+
+
+static GtkWidget *
+applet_profile_item (const gchar *file, const gchar *label)
+{
+  GtkWidget *mi = gtk_menu_item_new_with_label (label);
+
+  g_signal_connect_data (mi, "activate", G_CALLBACK (applet_menu_item),
+                         g_strdup (file), (GClosureNotify) g_free, 0);
+  gtk_widget_show (mi);
+  return mi;
+}
+
+
+static void
+applet_group_fill (GtkWidget *submenu, AppletGroup *group)
+{
+  GSList *lptr;
+
+  if (group->filled)
+    return;
+  for (lptr = group->files; lptr; lptr = lptr->next)
+    gtk_menu_shell_append (GTK_MENU_SHELL (submenu),
+                           applet_profile_item (lptr->data, strrchr (lptr->data, '/') + 1));
+  group->filled = TRUE;
+}
+
+
+static void
+applet_group_free (AppletGroup *group)
+{
+  if (group->monitor) {
+    g_file_monitor_cancel (group->monitor);
+    g_object_unref (group->monitor);
+  }
+  if (group->item)
+    gtk_widget_destroy (group->item);
+  g_slist_free_full (group->files, g_free);
+  g_free (group->name);
+  g_free (group);
+}
+
+
+/* Put a group's item at position, replacing its contents if they changed. */
+static void
+applet_group_update (AppletData *data, gchar *name, GSList *files, gint position)
+{
+  AppletGroup *group = g_hash_table_lookup (data->groups, name);
+
+  if (!group) {
+    gchar *home = tsc_home_path ();
+    gchar *dir_name = g_build_path ("/", home, name, NULL);
+
+    group = g_new0 (AppletGroup, 1);
+    group->name = name;
+    group->item = gtk_menu_item_new_with_label (name);
+    group->submenu = gtk_menu_new ();
+    g_signal_connect (group->submenu, "show", G_CALLBACK (applet_group_fill), group);
+    gtk_menu_item_set_submenu (GTK_MENU_ITEM (group->item), group->submenu);
+    gtk_menu_shell_insert (GTK_MENU_SHELL (data->popup), group->item, position);
+    gtk_widget_show (group->item);
+    group->monitor = applet_watch (dir_name, data);
+    g_hash_table_insert (data->groups, name, group);
+    g_free (dir_name);
+    g_free (home);
+  } else {
+    g_free (name);
+    gtk_menu_reorder_child (data->popup, group->item, position);
+  }
+
+  if (!applet_files_equal (group->files, files)) {
+    g_slist_free_full (group->files, g_free);
+    group->files = files;
+    if (group->filled) {
+      gtk_container_foreach (GTK_CONTAINER (group->submenu), (GtkCallback) gtk_widget_destroy, NULL);
+      group->filled = FALSE;
     }
-		
-    gtk_menu_item_set_submenu (subitem, GTK_WIDGET (submenu));
-    gtk_menu_shell_append ((GtkMenuShell *) submenu, GTK_WIDGET (mi));
-    
-    gtk_widget_show (GTK_WIDGET (mi));  
   } else {
-  	g_signal_connect (GTK_WIDGET (mi), "activate",GTK_SIGNAL_FUNC (applet_menu_item), name);
-    if (itemfound == NULL) {
-      gtk_menu_shell_append ((GtkMenuShell *) menu, GTK_WIDGET (mi));
-      gtk_widget_show (GTK_WIDGET (mi));
+    g_slist_free_full (files, g_free);
+  }
+  group->generation = data->generation;
+}
+
+
+static gboolean
+applet_group_gone (gpointer key, AppletGroup *group, AppletData *data)
+{
+  return group->generation != data->generation;
+}
+
+
+/*
+ * One sorted pass over the profiles.  Group items are kept between
+ * refreshes and only their file lists are compared; the items inside a
+ * submenu are not created until it is first shown.
+ */
+void applet_menu_refresh (AppletData *data)
+{
+  GSList *files = NULL, *lptr, *group_files = NULL;
+  gchar *group_name = NULL;
+  gint position = 0;
+
+  data->stale = FALSE;
+  data->generation++;
+  rdp_files_to_list (&files);
+  files = g_slist_sort (files, applet_profile_compare);
+
+  g_list_free_full (data->loose, (GDestroyNotify) gtk_widget_destroy);
+  data->loose = NULL;
+
+  for (lptr = files; lptr; lptr = lptr->next) {
+    gchar *file = lptr->data;
+    gchar *slash = strrchr (file, '/');
+
+    if (group_name && (!slash ||
+                       applet_name_compare (group_name, strlen (group_name), file, slash - file) != 0)) {
+      applet_group_update (data, group_name, g_slist_reverse (group_files), position++);
+      group_name = NULL;
+      group_files = NULL;
+    }
+
+    if (slash) {
+      if (!group_name)
+        group_name = g_strndup (file, slash - file);
+      group_files = g_slist_prepend (group_files, file);
+    } else {
+      GtkWidget *mi = applet_profile_item (file, file);
+      gtk_menu_shell_insert (GTK_MENU_SHELL (data->popup), mi, position++);
+      data->loose = g_list_prepend (data->loose, mi);
+      g_free (file);
     }
   }
+  if (group_name)
+    applet_group_update (data, group_name, g_slist_reverse (group_files), position);
+
+  g_hash_table_foreach_remove (data->groups, (GHRFunc) applet_group_gone, data);
+  g_slist_free (files);
+}
+
+
+static void
+applet_menu_create (AppletData *data)
+{
+  GtkWidget *mi;
+  gchar *home;
+
+  data->popup = GTK_MENU (gtk_menu_new ());
+  data->groups = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                        (GDestroyNotify) applet_group_free);
+
+  data->separator = gtk_separator_menu_item_new ();
+  gtk_menu_shell_append (GTK_MENU_SHELL (data->popup), data->separator);
+  gtk_widget_show (data->separator);
+
+  mi = gtk_menu_item_new_with_label (_("New Connection..."));
+  g_signal_connect (GTK_WIDGET(mi), "activate", GTK_SIGNAL_FUNC(applet_launch_tsclient), NULL);
+  gtk_menu_shell_append (GTK_MENU_SHELL (data->popup), mi);
+  gtk_widget_show (mi);
+
+  home = tsc_home_path ();
+  data->monitor = applet_watch (home, data);
+  g_free (home);
+  data->stale = TRUE;
 }
 
 
@@ -209,10 +390,6 @@ gboolean applet_popup_show (GtkWidget  *widget,
                             GdkEvent   *event,
                             AppletData *data)
 {
-  GtkMenu   *menu = NULL;
-  GtkMenuItem *mi = NULL;
-  GHashTable* hash=NULL;
-  
   g_return_val_if_fail (widget != NULL, FALSE) ;
   g_return_val_if_fail (event != NULL, FALSE) ;
   g_return_val_if_fail (data != NULL, FALSE) ;
@@ -222,27 +399,15 @@ gboolean applet_popup_show (GtkWidget  *widget,
     if (event->button.button == 1) { 
       /*user pressed the left mouse button*/
 
-	  hash = rdp_files_to_hash ();
-	  menu = GTK_MENU (gtk_menu_new ());
-
-	  g_hash_table_foreach (hash, create_menu, menu);
+      // the menu is kept; only rescan when a profile directory changed
+      if (!data->popup)
+        applet_menu_create (data);
+      if (data->stale)
+        applet_menu_refresh (data);
 
-	  mi = (GtkMenuItem *) gtk_separator_menu_item_new ();
-	  gtk_menu_shell_append ((GtkMenuShell *) menu, GTK_WIDGET (mi));
-	  gtk_widget_show (GTK_WIDGET (mi));
-
-	  mi = (GtkMenuItem *) gtk_menu_item_new_with_label (_("New Connection..."));
-	  g_signal_connect (GTK_WIDGET(mi), "activate", GTK_SIGNAL_FUNC(applet_launch_tsclient), NULL);
-	  gtk_menu_shell_append ((GtkMenuShell *) menu, GTK_WIDGET (mi));
-	  gtk_widget_show (GTK_WIDGET (mi));
-
-      gtk_menu_popup (menu, NULL, NULL, NULL, data,
+      gtk_menu_popup (data->popup, NULL, NULL, NULL, data,
 			  event->button.button,
 			  gtk_get_current_event_time ());
-	  
-	  data->popup = menu;
-	  g_hash_table_destroy (hash);
-	  
       return TRUE;
     }
     break ;
@@ -280,10 +445,15 @@ void applet_menu_item (GtkMenuItem *menuitem, gpointer user_data)
   rdp_file *rdp = NULL;
   GtkWidget *dialog;
   // build path to file
-  file_name = g_build_path ((const gchar *)"/", g_get_home_dir (), ".tsclient", g_strdup (user_data), NULL);
+  file_name = g_build_path ((const gchar *)"/", g_get_home_dir (), ".tsclient", (const gchar *) user_data, NULL);
 
   // check for file in ~/
   if (g_file_test (file_name, G_FILE_TEST_EXISTS)) {
+    // hand it to a resident tsclient if there is one
+    if (tsc_service_launch (file_name, NULL) == 0) {
+      g_free (file_name);
+      return;
+    }
     // load if exists
     rdp = g_new (rdp_file, 1);
     rdp_file_init (rdp);
@@ -316,7 +486,7 @@ gboolean applet_key_press_event (GtkWidget *widget, GdkEventKey *event, AppletDa
   case GDK_space:
   case GDK_KP_Space:
     /* Apply. */
-    if (data->popup != NULL)
+    if (data->popup != NULL && GTK_WIDGET_VISIBLE (data->popup))
       applet_popup_hide (data, FALSE);
     else
       applet_popup_show (widget, (GdkEvent *)event, data);
@@ -334,6 +504,15 @@ void applet_destroy (GtkWidget *widget, AppletData *data)
     gtk_timeout_remove (data->timeout);
     data->timeout = 0;
   }
+  if (data->monitor) {
+    g_file_monitor_cancel (data->monitor);
+    g_object_unref (data->monitor);
+  }
+  if (data->groups)
+    g_hash_table_destroy (data->groups);
+  g_list_free (data->loose);
+  if (data->popup)
+    gtk_widget_destroy (GTK_WIDGET (data->popup));
   g_free (data);
 }
 
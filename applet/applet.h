@@ -21,6 +21,18 @@ static const char applet_menu_xml [] =
         "</popup>\n";
 
 
+// one submenu per profile directory, filled the first time it opens
+typedef struct {
+  gchar       *name;
+  GtkWidget   *item;
+  GtkWidget   *submenu;
+  GSList      *files;
+  gboolean     filled;
+  guint        generation;
+  GFileMonitor *monitor;
+} AppletGroup;
+
+
 typedef struct {
   PanelApplet *applet;
   PanelAppletOrient orientation;
@@ -33,6 +45,14 @@ typedef struct {
   GtkWidget   *image;
   GdkPixbuf	  *imgsrc;
   GtkTooltips *tooltips;
+
+  // profile index behind the popup; stale once ~/.tsclient changes
+  GHashTable  *groups;
+  GList       *loose;
+  GtkWidget   *separator;
+  GFileMonitor *monitor;
+  guint        generation;
+  gboolean     stale;
 } AppletData;
 
 
@@ -44,6 +64,8 @@ gboolean applet_popup_show (GtkWidget *widget, GdkEvent *event, AppletData *data
 
 void applet_popup_hide (AppletData *data, gboolean revert);
 
+void applet_menu_refresh (AppletData *data);
+
 void applet_menu_item (GtkMenuItem *menuitem, gpointer user_data);
 
 gboolean applet_key_press_event (GtkWidget *widget, GdkEventKey *event, AppletData *data);
@@ -4,6 +4,17 @@ const Util = imports.misc.util;
 const GLib = imports.gi.GLib;
 const ByteArray = imports.byteArray;
 const Gio = imports.gi.Gio;
+const { parseIndex } = require('./profiles');
+
+const TSC_BUS_NAME = 'com.tsclient.app';
+const TSC_OBJECT_PATH = '/com/tsclient/app';
+const TSC_INTERFACE = 'com.tsclient.Launcher';
+const TSC_CALL_TIMEOUT = 2000;
+const TSC_MRU_SIZE_DEFAULT = 11;
+const TSC_REFRESH_DELAY = 250;
+
+// same frecency buckets as src/mrulist.c: [age in days, weight]
+const TSC_MRU_BUCKETS = [[4, 100], [14, 70], [31, 50], [90, 30], [Infinity, 10]];
 
 function _(str) {
     return str;
@@ -19,13 +30,73 @@ class TsclientApplet extends Applet.IconApplet {
         this.menu = new Applet.AppletPopupMenu(this, orientation);
         this.menuManager.addMenu(this.menu);
 
+        this._dir = GLib.build_filenamev([GLib.get_home_dir(), '.tsclient']);
+        this._mruItems = new Map();
+        this._emptyItem = null;
+        this._refreshId = 0;
+        this._indexId = 0;
+        this._indexStamp = null;
+
         this._buildMenu();
+        this._watchMru();
+
+        // "2h ago" goes stale without any file changing
+        this.menu.connect('open-state-changed', (menu, open) => {
+            if (open)
+                this._refreshMruSection();
+        });
     }
 
     on_applet_clicked(event) {
         this.menu.toggle();
     }
 
+    on_applet_removed_from_panel() {
+        if (this._refreshId) {
+            GLib.source_remove(this._refreshId);
+            this._refreshId = 0;
+        }
+        if (this._indexId) {
+            GLib.source_remove(this._indexId);
+            this._indexId = 0;
+        }
+        this._monitors.forEach(monitor => monitor.cancel());
+        this._monitors = [];
+    }
+
+    // mru.log is appended to and renamed over; nothing writes mru.tsc any more
+    _watchMru() {
+        const log = Gio.File.new_for_path(GLib.build_filenamev([this._dir, 'mru.log']));
+        const logMonitor = log.monitor_file(Gio.FileMonitorFlags.WATCH_MOVES, null);
+        logMonitor.connect('changed', () => this._queueRefresh());
+        this._monitors = [logMonitor];
+
+        // tsclient renames a new profiles.idx over the old one
+        const index = Gio.File.new_for_path(GLib.build_filenamev([this._dir, 'profiles.idx']));
+        const monitor = index.monitor_file(Gio.FileMonitorFlags.WATCH_MOVES, null);
+        monitor.connect('changed', () => {
+            if (this._indexId)
+                return;
+            this._indexId = GLib.timeout_add(GLib.PRIORITY_DEFAULT, TSC_REFRESH_DELAY, () => {
+                this._indexId = 0;
+                this._refreshProfileSection();
+                return GLib.SOURCE_REMOVE;
+            });
+        });
+        this._monitors.push(monitor);
+    }
+
+    // a connect writes twice in quick succession, refresh once
+    _queueRefresh() {
+        if (this._refreshId)
+            return;
+        this._refreshId = GLib.timeout_add(GLib.PRIORITY_DEFAULT, TSC_REFRESH_DELAY, () => {
+            this._refreshId = 0;
+            this._refreshMruSection();
+            return GLib.SOURCE_REMOVE;
+        });
+    }
+
     _buildMenu() {
         this.menu.removeAll();
 
@@ -34,43 +105,145 @@ class TsclientApplet extends Applet.IconApplet {
         this.menu.addMenuItem(openItem);
 
         const refreshItem = new PopupMenu.PopupMenuItem(_('Refresh Profiles'));
-        refreshItem.connect('activate', () => this._rebuildMruSection());
+        refreshItem.connect('activate', () => {
+            this._refreshMruSection();
+            this._refreshProfileSection();
+        });
         this.menu.addMenuItem(refreshItem);
 
         this.menu.addMenuItem(new PopupMenu.PopupSeparatorMenuItem());
 
         this._mruSection = new PopupMenu.PopupMenuSection();
         this.menu.addMenuItem(this._mruSection);
-        this._rebuildMruSection();
+        this._refreshMruSection();
+
+        this._profileSeparator = new PopupMenu.PopupSeparatorMenuItem();
+        this.menu.addMenuItem(this._profileSeparator);
+        this._profileSection = new PopupMenu.PopupMenuSection();
+        this.menu.addMenuItem(this._profileSection);
+        this._refreshProfileSection();
+    }
+
+    // The whole profile tree from tsclient's index: one read, no walk of
+    // ~/.tsclient.  Group submenus are filled the first time they open.
+    _refreshProfileSection() {
+        const filename = GLib.build_filenamev([this._dir, 'profiles.idx']);
+        let index = null;
+        let stamp = null;
+        try {
+            const file = Gio.File.new_for_path(filename);
+            const info = file.query_info('time::modified,standard::size', Gio.FileQueryInfoFlags.NONE, null);
+            stamp = `${info.get_attribute_uint64('time::modified')}:${info.get_size()}`;
+            if (stamp === this._indexStamp)
+                return;
+            const [ok, contents] = file.load_contents(null);
+            if (ok)
+                index = parseIndex(ByteArray.toString(contents));
+        } catch (e) {
+            // no index yet: tsclient has not been run since it learnt to write one
+        }
+
+        this._indexStamp = stamp;
+        this._profileSection.removeAll();
+        const empty = !index || (index.groups.length === 0 && index.loose.length === 0);
+        this._profileSeparator.actor.visible = !empty;
+        if (empty)
+            return;
+
+        index.groups.forEach(([group, profiles]) => {
+            const item = new PopupMenu.PopupSubMenuMenuItem(group);
+            let filled = false;
+            item.menu.connect('open-state-changed', (menu, open) => {
+                if (!open || filled)
+                    return;
+                profiles.forEach(profile => item.menu.addMenuItem(this._profileItem(profile)));
+                filled = true;
+            });
+            this._profileSection.addMenuItem(item);
+        });
+        index.loose.forEach(profile => this._profileSection.addMenuItem(this._profileItem(profile)));
+    }
+
+    _profileItem(profile) {
+        const label = profile.host && profile.host !== profile.name ?
+            `${profile.name}  (${profile.host})` : profile.name;
+        const item = new PopupMenu.PopupMenuItem(label);
+        item.connect('activate', () =>
+            this._launchTsclient(GLib.build_filenamev([this._dir, profile.file])));
+        return item;
     }
 
     _launchTsclient(profilePath = null) {
-        if (profilePath) {
-            const command = `tsclient -x ${GLib.shell_quote(profilePath)}`;
-            Util.spawnCommandLine(command);
-        } else {
+        if (!profilePath) {
             Util.spawnCommandLine('tsclient');
+            return;
         }
+
+        // A running tsclient (e.g. `tsclient --service`) launches without a
+        // cold start; only spawn a new process when nobody answers.
+        Gio.DBus.session.call(
+            TSC_BUS_NAME, TSC_OBJECT_PATH, TSC_INTERFACE, 'Launch',
+            new GLib.Variant('(s)', [profilePath]),
+            new GLib.VariantType('(u)'),
+            Gio.DBusCallFlags.NO_AUTO_START, TSC_CALL_TIMEOUT, null,
+            (connection, result) => {
+                try {
+                    connection.call_finish(result);
+                } catch (e) {
+                    const command = `tsclient -x ${GLib.shell_quote(profilePath)}`;
+                    Util.spawnCommandLine(command);
+                }
+            });
     }
 
-    _rebuildMruSection() {
-        this._mruSection.removeAll();
+    // Bring the menu in line with the list, touching only rows that changed.
+    _refreshMruSection() {
         const entries = this._loadMruEntries();
-        if (entries.length === 0) {
-            const empty = new PopupMenu.PopupMenuItem(_('No saved profiles'), { reactive: false });
-            this._mruSection.addMenuItem(empty);
-            return;
+        const wanted = new Set(entries.map(entry => entry.server));
+
+        for (const [server, item] of this._mruItems) {
+            if (!wanted.has(server)) {
+                item.destroy();
+                this._mruItems.delete(server);
+            }
         }
 
-        entries.forEach(path => {
-            const item = new PopupMenu.PopupMenuItem(path);
-            item.connect('activate', () => this._launchTsclient(path));
-            this._mruSection.addMenuItem(item);
+        entries.forEach((entry, position) => {
+            const label = entry.note ? `${entry.server}  (${entry.note})` : entry.server;
+            let item = this._mruItems.get(entry.server);
+
+            if (!item) {
+                item = new PopupMenu.PopupMenuItem(label);
+                // the running tsclient takes a profile path or a bare host
+                item.connect('activate', () =>
+                    this._launchTsclient(item._tscEntry.profile || item._tscEntry.server));
+                this._mruItems.set(entry.server, item);
+                this._mruSection.addMenuItem(item, position);
+            } else {
+                if (item.label.get_text() !== label)
+                    item.label.set_text(label);
+                if (this._mruSection._getMenuItems().indexOf(item) !== position)
+                    this._mruSection.moveMenuItem(item, position);
+            }
+            item._tscEntry = entry;
         });
+
+        if (entries.length === 0 && !this._emptyItem) {
+            this._emptyItem = new PopupMenu.PopupMenuItem(_('No saved profiles'), { reactive: false });
+            this._mruSection.addMenuItem(this._emptyItem);
+        } else if (entries.length > 0 && this._emptyItem) {
+            this._emptyItem.destroy();
+            this._emptyItem = null;
+        }
     }
 
     _loadMruEntries() {
-        const dir = GLib.build_filenamev([GLib.get_home_dir(), '.tsclient']);
+        const dir = this._dir;
+        const log = this._loadMruLog(dir);
+        if (log)
+            return log;
+
+        // tsclient before 3.5 kept a plain list
         const filename = GLib.build_filenamev([dir, 'mru.tsc']);
         try {
             const file = Gio.File.new_for_path(filename);
@@ -80,12 +253,91 @@ class TsclientApplet extends Applet.IconApplet {
             const text = ByteArray.toString(contents);
             const data = JSON.parse(text);
             if (Array.isArray(data))
-                return data;
+                return data.map(server => ({ server }));
         } catch (e) {
             global.log(`tsclient applet: ${e}`);
         }
         return [];
     }
+
+    // mru.log is only ever appended to or renamed over, so no lock is needed
+    _loadMruLog(dir) {
+        const filename = GLib.build_filenamev([dir, 'mru.log']);
+        let text;
+        try {
+            const [ok, contents] = Gio.File.new_for_path(filename).load_contents(null);
+            if (!ok)
+                return null;
+            text = ByteArray.toString(contents);
+        } catch (e) {
+            return null;
+        }
+
+        // time, visits, server, protocol, profile, status, connect ms,
+        // session seconds; later lines win, empty fields keep what was known
+        const entries = new Map();
+        for (const line of text.split('\n')) {
+            const fields = line.split('\t');
+            const server = fields[2];
+            if (!server)
+                continue;
+            const entry = entries.get(server) ||
+                { server, last: 0, visits: 0, profile: null, status: null, connectMs: -1 };
+            entry.last = Math.max(entry.last, parseInt(fields[0]) || 0);
+            entry.visits += Math.max(parseInt(fields[1]) || 0, 0);
+            if (fields[4])
+                entry.profile = fields[4];
+            if (fields[5]) {
+                entry.status = fields[5];
+                entry.connectMs = fields[6] ? parseInt(fields[6]) : -1;
+            }
+            entries.set(server, entry);
+        }
+
+        const now = GLib.get_real_time() / 1000000;
+        for (const entry of entries.values()) {
+            const days = (now - entry.last) / 86400;
+            const bucket = TSC_MRU_BUCKETS.find(([age]) => days < age);
+            entry.score = entry.visits * bucket[1];
+            if (entry.status && entry.status !== 'ok')
+                entry.score = Math.floor(entry.score / 2);
+            entry.note = this._describe(entry, now);
+        }
+
+        return [...entries.values()]
+            .sort((a, b) => b.score - a.score || b.last - a.last)
+            .slice(0, this._mruSize(dir));
+    }
+
+    // "last used 2h ago · 140 ms", as in tsclient's Recent list
+    _describe(entry, now) {
+        const ago = now - entry.last;
+        let when;
+        if (ago < 60)
+            when = _('last used just now');
+        else if (ago < 3600)
+            when = _('last used %dm ago').replace('%d', Math.floor(ago / 60));
+        else if (ago < 86400)
+            when = _('last used %dh ago').replace('%d', Math.floor(ago / 3600));
+        else
+            when = _('last used %dd ago').replace('%d', Math.floor(ago / 86400));
+
+        if (entry.status && entry.status !== 'ok')
+            return `${when} · failed (${entry.status})`;
+        if (entry.connectMs >= 0)
+            return `${when} · ${entry.connectMs} ms`;
+        return when;
+    }
+
+    _mruSize(dir) {
+        const keys = new GLib.KeyFile();
+        try {
+            keys.load_from_file(GLib.build_filenamev([dir, 'tsclient.conf']), GLib.KeyFileFlags.NONE);
+            return keys.get_integer('mru', 'size');
+        } catch (e) {
+            return TSC_MRU_SIZE_DEFAULT;
+        }
+    }
 }
 
 function main(metadata, orientation, panelHeight, instanceId) {
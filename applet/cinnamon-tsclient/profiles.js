@@ -0,0 +1,44 @@
+// Reader for ~/.tsclient/profiles.idx, kept free of Cinnamon imports so
+// tools/bench-index.js can load it under plain gjs.
+
+var TSC_INDEX_VERSION = 1;
+
+// Returns { groups: [[name, [profile...]]...], loose: [profile...] } in the
+// order tsclient wrote them, or null when the file is from another version.
+function parseIndex(text) {
+    const lines = text.split('\n');
+    let header;
+    try {
+        header = JSON.parse(lines[0]);
+    } catch (e) {
+        return null;
+    }
+    if (!header || header.version !== TSC_INDEX_VERSION)
+        return null;
+
+    const groups = [];
+    const loose = [];
+    let current = null;
+    for (let i = 1; i < lines.length; i++) {
+        if (!lines[i])
+            continue;
+        let profile;
+        try {
+            profile = JSON.parse(lines[i]);
+        } catch (e) {
+            continue;
+        }
+        if (!profile.group) {
+            loose.push(profile);
+        } else if (current && current[0] === profile.group) {
+            current[1].push(profile);
+        } else {
+            current = [profile.group, [profile]];
+            groups.push(current);
+        }
+    }
+    return { groups, loose };
+}
+
+if (typeof module !== 'undefined')
+    module.exports = { TSC_INDEX_VERSION, parseIndex };
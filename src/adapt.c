@@ -0,0 +1,455 @@
+/***************************************
+*                                      *
+*   Link-Adaptive Settings             *
+*                                      *
+***************************************/
+
+/*
+ * With the connection speed set to Auto, an RDP profile's experience is
+ * chosen at each launch instead of being fixed:
+ *
+ *  - a few TCP handshakes with the server ([adapt] samples, each given
+ *    timeout-ms; a host that misses the first is not asked again) give
+ *    the RTT, taken with the median of its last probes;
+ *  - when [adapt] bandwidth-endpoint names a host:port that streams data
+ *    as soon as it is connected to, reading it for bandwidth-ms gives the
+ *    throughput;
+ *  - a host whose recent launches keep ending in network errors or
+ *    dropped links is moved one step down.
+ *
+ * The result is one of the connection speed presets plus a cap on the
+ * color depth.  Every decision is appended with its inputs to
+ * ~/.tsclient/adapt.jsonl, which is also where earlier RTTs come from.
+ * tsclient --adapt HOST prints the decision without connecting.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "probe.h"
+#include "history.h"
+#include "reconnect.h"
+#include "adapt.h"
+#include "tsc-presets.h"
+#include "tsc-trace.h"
+
+typedef struct {
+  gint connection_type;
+  const gchar *name;
+  gint max_rtt_ms;
+  gint min_kbps;
+  gint session_bpp;
+} TscAdaptTier;
+
+/* best first; a link gets the first tier it is good enough for */
+static const TscAdaptTier tsc_adapt_tiers[] = {
+  { TSC_SPEED_LAN,           "lan",           5,        10000, 32 },
+  { TSC_SPEED_BROADBAND,     "broadband",     40,       2000,  32 },
+  { TSC_SPEED_LOW_BROADBAND, "low-broadband", 120,      256,   16 },
+  { TSC_SPEED_MODEM,         "modem",         G_MAXINT, 0,     15 },
+};
+
+/* where Auto stays when nothing could be measured */
+#define TSC_ADAPT_TIER_DEFAULT 1
+
+
+static gchar *
+tsc_adapt_file (const gchar *suffix)
+{
+  gchar *home = tsc_home_path ();
+  gchar *file_name = g_strconcat (home, "/adapt.jsonl", suffix, NULL);
+
+  g_free (home);
+  return file_name;
+}
+
+
+static const gchar *
+tsc_adapt_tier_name (gint connection_type)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (tsc_adapt_tiers); i++) {
+    if (tsc_adapt_tiers[i].connection_type == connection_type)
+      return tsc_adapt_tiers[i].name;
+  }
+  return "custom";
+}
+
+
+static gint
+tsc_adapt_compare (gconstpointer a, gconstpointer b)
+{
+  return *(const gint *) a - *(const gint *) b;
+}
+
+
+static gint
+tsc_adapt_median (GArray *values)
+{
+  GArray *sorted;
+  gint median;
+
+  if (!values->len)
+    return -1;
+  sorted = g_array_copy (values);
+  g_array_sort (sorted, tsc_adapt_compare);
+  median = g_array_index (sorted, gint, sorted->len / 2);
+  g_array_unref (sorted);
+  return median;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_adapt_measure                  *
+*                                      *
+***************************************/
+
+static GSocketAddress *
+tsc_adapt_resolve (const gchar *address, guint16 default_port)
+{
+  GSocketConnectable *connectable;
+  GSocketAddressEnumerator *enumerator;
+  GSocketAddress *sockaddr;
+
+  connectable = g_network_address_parse (address, default_port, NULL);
+  if (!connectable)
+    return NULL;
+  enumerator = g_socket_connectable_enumerate (connectable);
+  sockaddr = g_socket_address_enumerator_next (enumerator, NULL, NULL);
+  g_object_unref (enumerator);
+  g_object_unref (connectable);
+  return sockaddr;
+}
+
+
+/* A socket connected to sockaddr within timeout_ms, with *ms the handshake time. */
+static GSocket *
+tsc_adapt_connect (GSocketAddress *sockaddr, gint timeout_ms, gint *ms)
+{
+  GSocket *sock;
+  GError *err = NULL;
+  gboolean connected;
+  gint64 start;
+
+  sock = g_socket_new (g_socket_address_get_family (sockaddr), G_SOCKET_TYPE_STREAM,
+                       G_SOCKET_PROTOCOL_TCP, NULL);
+  if (!sock)
+    return NULL;
+  g_socket_set_blocking (sock, FALSE);
+
+  start = g_get_monotonic_time ();
+  connected = g_socket_connect (sock, sockaddr, NULL, &err);
+  if (!connected && g_error_matches (err, G_IO_ERROR, G_IO_ERROR_PENDING))
+    connected = g_socket_condition_timed_wait (sock, G_IO_OUT, (gint64) timeout_ms * 1000, NULL, NULL) &&
+                g_socket_check_connect_result (sock, NULL);
+  g_clear_error (&err);
+
+  if (!connected) {
+    g_object_unref (sock);
+    return NULL;
+  }
+  // rounded up, so a LAN round trip is 1 ms rather than 0
+  *ms = (gint) ((g_get_monotonic_time () - start + 999) / 1000);
+  return sock;
+}
+
+
+/* The fastest of a few handshakes with address, or -1 if it did not answer. */
+static gint
+tsc_adapt_measure_rtt (const gchar *address, gint protocol, gint *samples)
+{
+  gint count = MAX (1, tsc_config_get_int ("adapt", "samples", TSC_ADAPT_SAMPLES_DEFAULT));
+  gint timeout_ms = tsc_config_get_int ("adapt", "timeout-ms", TSC_ADAPT_TIMEOUT_DEFAULT);
+  GSocketAddress *sockaddr;
+  gint best = -1, i;
+
+  *samples = 0;
+  sockaddr = tsc_adapt_resolve (address, tsc_probe_default_port (protocol));
+  if (!sockaddr)
+    return -1;
+
+  for (i = 0; i < count; i++) {
+    GSocket *sock;
+    gint ms;
+
+    sock = tsc_adapt_connect (sockaddr, timeout_ms, &ms);
+    if (!sock) {
+      // a host that is down would cost a timeout per sample
+      if (i == 0)
+        break;
+      continue;
+    }
+    g_socket_close (sock, NULL);
+    g_object_unref (sock);
+    (*samples)++;
+    if (best < 0 || ms < best)
+      best = ms;
+  }
+
+  g_object_unref (sockaddr);
+  return best;
+}
+
+
+/* Kbit/s read from [adapt] bandwidth-endpoint, or -1 without one. */
+static gint
+tsc_adapt_measure_bandwidth (void)
+{
+  gchar *endpoint = tsc_config_get_string ("adapt", "bandwidth-endpoint");
+  gint budget_ms = tsc_config_get_int ("adapt", "bandwidth-ms", TSC_ADAPT_BANDWIDTH_MS_DEFAULT);
+  gint timeout_ms = tsc_config_get_int ("adapt", "timeout-ms", TSC_ADAPT_TIMEOUT_DEFAULT);
+  GSocketAddress *sockaddr;
+  GSocket *sock;
+  gchar buf[16384];
+  gint64 start, deadline, now, bytes = 0;
+  gint ms, kbps = -1;
+
+  if (!endpoint)
+    return -1;
+  sockaddr = tsc_adapt_resolve (endpoint, 0);
+  g_free (endpoint);
+  if (!sockaddr)
+    return -1;
+  sock = tsc_adapt_connect (sockaddr, timeout_ms, &ms);
+  g_object_unref (sockaddr);
+  if (!sock)
+    return -1;
+
+  start = g_get_monotonic_time ();
+  deadline = start + (gint64) budget_ms * 1000;
+  while ((now = g_get_monotonic_time ()) < deadline) {
+    gssize len;
+
+    if (!g_socket_condition_timed_wait (sock, G_IO_IN, deadline - now, NULL, NULL))
+      break;
+    len = g_socket_receive (sock, buf, sizeof (buf), NULL, NULL);
+    if (len <= 0)
+      break;
+    bytes += len;
+  }
+  now = g_get_monotonic_time ();
+  if (bytes > 0 && now > start)
+    kbps = (gint) (bytes * 8 * 1000 / (now - start));
+
+  g_socket_close (sock, NULL);
+  g_object_unref (sock);
+  return kbps;
+}
+
+
+/* The RTTs measured for host by earlier launches, oldest first. */
+static GArray *
+tsc_adapt_read_rtts (const gchar *host)
+{
+  GArray *rtts = g_array_new (FALSE, FALSE, sizeof (gint));
+  gchar *file_name = tsc_adapt_file (NULL);
+  gchar *escaped = g_strescape (host, NULL);
+  gchar *needle = g_strdup_printf ("\"host\":\"%s\",", escaped);
+  gchar *contents = NULL;
+  gchar **lines;
+  gint i;
+
+  if (g_file_get_contents (file_name, &contents, NULL, NULL)) {
+    lines = g_strsplit (contents, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+      const gchar *rtt;
+      gint value;
+
+      if (!strstr (lines[i], needle) || !(rtt = strstr (lines[i], "\"rtt_ms\":")))
+        continue;
+      value = atoi (rtt + strlen ("\"rtt_ms\":"));
+      if (value >= 0)
+        g_array_append_val (rtts, value);
+    }
+    g_strfreev (lines);
+  }
+  if (rtts->len > TSC_ADAPT_HISTORY)
+    g_array_remove_range (rtts, 0, rtts->len - TSC_ADAPT_HISTORY);
+
+  g_free (contents);
+  g_free (needle);
+  g_free (escaped);
+  g_free (file_name);
+  return rtts;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_adapt_decide                   *
+*                                      *
+***************************************/
+
+static void
+tsc_adapt_decide (rdp_file *rdp, TscAdaptDecision *decision)
+{
+  const gint last = G_N_ELEMENTS (tsc_adapt_tiers) - 1;
+  GArray *rtts, *statuses;
+  gint tier = 0, rtt;
+  guint i;
+
+  decision->rtt_ms = tsc_adapt_measure_rtt (rdp->full_address, rdp->protocol, &decision->samples);
+  rtts = tsc_adapt_read_rtts (rdp->full_address);
+  decision->history_rtt_ms = tsc_adapt_median (rtts);
+  if (decision->rtt_ms >= 0)
+    g_array_append_val (rtts, decision->rtt_ms);
+  rtt = tsc_adapt_median (rtts);
+  g_array_unref (rtts);
+
+  decision->bandwidth_kbps = tsc_adapt_measure_bandwidth ();
+
+  statuses = tsc_history_statuses (rdp->full_address, TSC_ADAPT_LAUNCHES);
+  decision->launches = statuses->len;
+  decision->dropped = 0;
+  for (i = 0; i < statuses->len; i++) {
+    TscHistoryLaunch *launch = &g_array_index (statuses, TscHistoryLaunch, i);
+
+    // -1 is a client that never started, which says nothing about the link
+    if (launch->status > 0 &&
+        tsc_reconnect_is_transient (tsc_reconnect_classify (launch->client, W_EXITCODE (launch->status, 0), NULL)))
+      decision->dropped++;
+  }
+  g_array_unref (statuses);
+
+  if (rtt < 0 && decision->bandwidth_kbps < 0) {
+    tier = TSC_ADAPT_TIER_DEFAULT;
+  } else {
+    while (tier < last &&
+           ((rtt >= 0 && rtt > tsc_adapt_tiers[tier].max_rtt_ms) ||
+            (decision->bandwidth_kbps >= 0 && decision->bandwidth_kbps < tsc_adapt_tiers[tier].min_kbps)))
+      tier++;
+  }
+  if (decision->launches >= 3 && decision->dropped * 3 >= decision->launches)
+    tier = MIN (tier + 1, last);
+
+  decision->connection_type = tsc_adapt_tiers[tier].connection_type;
+  decision->session_bpp = tsc_adapt_tiers[tier].session_bpp;
+  // the profile's color depth is a ceiling; RDPv4 keeps its own
+  if (rdp->protocol != 4 || (rdp->session_bpp > 0 && rdp->session_bpp < decision->session_bpp))
+    decision->session_bpp = rdp->session_bpp;
+}
+
+
+static void
+tsc_adapt_log (rdp_file *rdp, const TscAdaptDecision *decision)
+{
+  gchar *file_name = tsc_adapt_file (NULL);
+  gchar *escaped, *line;
+  GStatBuf st;
+  FILE *fp;
+
+  if (g_stat (file_name, &st) == 0 && st.st_size >= (goffset) TSC_ADAPT_LOG_MAX_KB * 1024) {
+    gchar *old_name = tsc_adapt_file (".1");
+    g_rename (file_name, old_name);
+    g_free (old_name);
+  }
+
+  escaped = g_strescape (rdp->full_address, NULL);
+  line = g_strdup_printf ("{\"time\":%" G_GINT64_FORMAT ",\"host\":\"%s\",\"rtt_ms\":%d,\"samples\":%d,"
+                          "\"history_rtt_ms\":%d,\"bandwidth_kbps\":%d,\"launches\":%d,\"dropped\":%d,"
+                          "\"speed\":\"%s\",\"bpp\":%d,\"compression\":%d,\"flags\":%d,\"bitmapcache\":%d}\n",
+                          g_get_real_time () / G_USEC_PER_SEC, escaped, decision->rtt_ms,
+                          decision->samples, decision->history_rtt_ms, decision->bandwidth_kbps,
+                          decision->launches, decision->dropped,
+                          tsc_adapt_tier_name (decision->connection_type), rdp->session_bpp,
+                          rdp->compression, rdp_file_performance_flags (rdp),
+                          rdp->bitmapcachepersistenable);
+
+  fp = fopen (file_name, "a");
+  if (fp) {
+    fputs (line, fp);
+    fclose (fp);
+  } else {
+    g_warning ("Could not append to %s", file_name);
+  }
+
+  g_free (line);
+  g_free (escaped);
+  g_free (file_name);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_adapt_apply                    *
+*                                      *
+***************************************/
+
+/* Measure the link to rdp's host and set its experience fields to suit. */
+void tsc_adapt_apply (rdp_file *rdp, TscAdaptDecision *decision)
+{
+  TscAdaptDecision local;
+
+  if (!decision)
+    decision = &local;
+
+  // only RDP has anything to turn down
+  if (rdp->protocol != 0 && rdp->protocol != 4) {
+    rdp_file_apply_speed (rdp);
+    return;
+  }
+
+  tsc_adapt_decide (rdp, decision);
+  rdp_file_apply_preset (rdp, decision->connection_type);
+  rdp->session_bpp = decision->session_bpp;
+  tsc_adapt_log (rdp, decision);
+  TSC_TRACE3 (launch__adapt, rdp->full_address, decision->rtt_ms, decision->connection_type);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_adapt_apply: %s rtt %d ms (history %d ms), %d kbit/s, %d/%d dropped: %s, %d bpp\n",
+          rdp->full_address, decision->rtt_ms, decision->history_rtt_ms, decision->bandwidth_kbps,
+          decision->dropped, decision->launches, tsc_adapt_tier_name (decision->connection_type),
+          decision->session_bpp);
+  #endif
+}
+
+
+static void
+tsc_adapt_print (const gchar *label, gint value, const gchar *unit)
+{
+  if (value < 0)
+    printf ("  %-18s -\n", label);
+  else
+    printf ("  %-18s %d %s\n", label, value, unit);
+}
+
+
+/* Print what Auto would choose for address; 1 when nothing could be measured. */
+int tsc_adapt_report (const gchar *address)
+{
+  rdp_file *rdp = g_new0 (rdp_file, 1);
+  TscAdaptDecision decision;
+
+  rdp_file_init (rdp);
+  g_free (rdp->full_address);
+  rdp->full_address = g_strdup (address);
+  rdp->protocol = 4;
+  rdp->connection_type = TSC_SPEED_AUTO;
+  tsc_adapt_decide (rdp, &decision);
+  rdp_file_apply_preset (rdp, decision.connection_type);
+
+  printf ("\n  %s\n\n", address);
+  tsc_adapt_print ("handshake rtt", decision.rtt_ms, "ms");
+  tsc_adapt_print ("samples", decision.samples, "");
+  tsc_adapt_print ("earlier rtt (p50)", decision.history_rtt_ms, "ms");
+  tsc_adapt_print ("bandwidth", decision.bandwidth_kbps, "kbit/s");
+  printf ("  %-18s %d of %d\n", "dropped launches", decision.dropped, decision.launches);
+  printf ("\n  speed %s, %d bit color, compression %s, experience flags 0x%02x, bitmap cache %s\n\n",
+          tsc_adapt_tier_name (decision.connection_type), decision.session_bpp,
+          rdp->compression ? "on" : "off", rdp_file_performance_flags (rdp),
+          rdp->bitmapcachepersistenable ? "on" : "off");
+
+  rdp_file_free (rdp);
+  return decision.rtt_ms < 0 && decision.history_rtt_ms < 0 && decision.bandwidth_kbps < 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ADAPT_H
+#define ADAPT_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_ADAPT_SAMPLES_DEFAULT 3
+#define TSC_ADAPT_TIMEOUT_DEFAULT 500
+#define TSC_ADAPT_BANDWIDTH_MS_DEFAULT 300
+#define TSC_ADAPT_HISTORY 5
+#define TSC_ADAPT_LAUNCHES 10
+#define TSC_ADAPT_LOG_MAX_KB 256
+
+typedef struct
+{
+  gint rtt_ms;
+  gint samples;
+  gint history_rtt_ms;
+  gint bandwidth_kbps;
+  gint launches;
+  gint dropped;
+  gint connection_type;
+  gint session_bpp;
+} TscAdaptDecision;
+
+void tsc_adapt_apply (rdp_file *rdp, TscAdaptDecision *decision);
+int tsc_adapt_report (const gchar *address);
+
+#endif /* ADAPT_H */
@@ -0,0 +1,275 @@
+/***************************************
+*                                      *
+*   Profile Bundles                    *
+*                                      *
+***************************************/
+
+/*
+ * A bundle is a read-only set of profiles in one file, for admins who
+ * push the same thousands of profiles to every workstation.  It is a
+ * GVariant of type (uua(say)) in normal form: magic, version, then the
+ * profiles sorted by name ("group/name.rdp") with their JSON text.  The
+ * file is mapped and profiles are found by binary search and parsed in
+ * place; nothing is extracted.
+ *
+ * Bundles listed in [bundle] files (separated by ;) are searched first,
+ * then PACKAGE_DATA_DIR/tsclient/profiles.bundle.  A profile of the same
+ * name under ~/.tsclient always wins over a bundled one.
+ *
+ * tsclient --pack DIR OUT builds a bundle from a profile tree.
+ */
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "scan.h"
+#include "bundle.h"
+
+typedef struct {
+  gchar *file_name;
+  GMappedFile *mapped;
+  GVariant *root;
+  GVariant *entries;
+  gint64 mtime;
+} TscBundle;
+
+static GPtrArray *bundles = NULL;
+
+
+static void
+tsc_bundle_open (const gchar *file_name)
+{
+  GError *err = NULL;
+  GMappedFile *mapped;
+  GBytes *bytes;
+  TscBundle *bundle;
+  GVariant *root;
+  guint32 magic, version;
+  GStatBuf st;
+
+  mapped = g_mapped_file_new (file_name, FALSE, &err);
+  if (!mapped) {
+    if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Could not open %s: %s", file_name, err->message);
+    g_error_free (err);
+    return;
+  }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  root = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (TSC_BUNDLE_TYPE), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  g_variant_get (root, "(uu@a(say))", &magic, &version, NULL);
+  if (magic == GUINT32_SWAP_LE_BE (TSC_BUNDLE_MAGIC)) {
+    // packed on a machine of the other byte order: usable, but as a copy
+    GVariant *swapped = g_variant_ref_sink (g_variant_byteswap (root));
+    g_variant_unref (root);
+    root = swapped;
+    g_variant_get (root, "(uu@a(say))", &magic, &version, NULL);
+  }
+  // normal form means every child is a slice of the mapping, checked once
+  if (magic != TSC_BUNDLE_MAGIC || version != TSC_BUNDLE_VERSION ||
+      !g_variant_is_normal_form (root)) {
+    g_warning ("%s is not a tsclient profile bundle", file_name);
+    g_variant_unref (root);
+    g_mapped_file_unref (mapped);
+    return;
+  }
+
+  bundle = g_new0 (TscBundle, 1);
+  bundle->file_name = g_strdup (file_name);
+  bundle->mapped = mapped;
+  bundle->root = root;
+  bundle->entries = g_variant_get_child_value (root, 2);
+  bundle->mtime = g_stat (file_name, &st) == 0 ? st.st_mtime : 0;
+  g_ptr_array_add (bundles, bundle);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_bundle_open: %s, %" G_GSIZE_FORMAT " profiles\n", file_name,
+          g_variant_n_children (bundle->entries));
+  #endif
+}
+
+
+static void
+tsc_bundle_init (void)
+{
+  static gsize loaded = 0;
+  gchar *files;
+
+  // the background rescan may get here first, on its worker thread
+  if (!g_once_init_enter (&loaded))
+    return;
+
+  bundles = g_ptr_array_new ();
+  files = tsc_config_get_string ("bundle", "files");
+  if (files) {
+    gchar **names = g_strsplit (files, ";", -1);
+    gint i;
+
+    for (i = 0; names[i]; i++) {
+      g_strstrip (names[i]);
+      if (*names[i])
+        tsc_bundle_open (names[i]);
+    }
+    g_strfreev (names);
+    g_free (files);
+  }
+  tsc_bundle_open (PACKAGE_DATA_DIR "/tsclient/profiles.bundle");
+  g_once_init_leave (&loaded, 1);
+}
+
+
+/* Binary search of one bundle; returns the (say) entry or NULL. */
+static GVariant *
+tsc_bundle_find (TscBundle *bundle, const gchar *name)
+{
+  gsize low = 0, high = g_variant_n_children (bundle->entries);
+
+  while (low < high) {
+    gsize mid = low + (high - low) / 2;
+    GVariant *entry = g_variant_get_child_value (bundle->entries, mid);
+    const gchar *key;
+    gint cmp;
+
+    g_variant_get_child (entry, 0, "&s", &key);
+    cmp = strcmp (name, key);
+    if (cmp == 0)
+      return entry;
+    g_variant_unref (entry);
+    if (cmp < 0)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+  return NULL;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_bundle_lookup                  *
+*                                      *
+***************************************/
+
+/*
+ * Find name ("group/name.rdp") in the bundles.  *data points into the
+ * mapping and stays valid until exit; it is not NUL-terminated.
+ */
+gboolean tsc_bundle_lookup (const gchar *name, const gchar **data, gsize *length,
+                            gint64 *mtime)
+{
+  guint i;
+
+  tsc_bundle_init ();
+  for (i = 0; i < bundles->len; i++) {
+    TscBundle *bundle = g_ptr_array_index (bundles, i);
+    GVariant *entry = tsc_bundle_find (bundle, name);
+    GVariant *text;
+
+    if (!entry)
+      continue;
+    text = g_variant_get_child_value (entry, 1);
+    if (data)
+      *data = g_variant_get_fixed_array (text, length, 1);
+    else if (length)
+      *length = g_variant_n_children (text);
+    if (mtime)
+      *mtime = bundle->mtime;
+    g_variant_unref (text);
+    g_variant_unref (entry);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+
+/* Append every bundled profile not in skip (a set of names) to *list. */
+void tsc_bundle_list (GSList **list, GHashTable *skip)
+{
+  GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+  GSList *found = NULL;
+  guint i;
+
+  tsc_bundle_init ();
+  for (i = 0; i < bundles->len; i++) {
+    TscBundle *bundle = g_ptr_array_index (bundles, i);
+    gsize n = g_variant_n_children (bundle->entries), j;
+
+    for (j = 0; j < n; j++) {
+      const gchar *name;
+
+      g_variant_get_child (bundle->entries, j, "(&s@ay)", &name, NULL);
+      if (g_hash_table_contains (seen, name) || (skip && g_hash_table_contains (skip, name)))
+        continue;
+      g_hash_table_add (seen, (gpointer) name);
+      found = g_slist_prepend (found, g_strdup (name));
+    }
+  }
+  g_hash_table_destroy (seen);
+  *list = g_slist_concat (*list, g_slist_reverse (found));
+}
+
+
+/***************************************
+*                                      *
+*   tsc_bundle_pack                    *
+*                                      *
+***************************************/
+
+/* Build a bundle at out from every profile under dir; 0 on success. */
+int tsc_bundle_pack (const gchar *dir, const gchar *out, gchar **error)
+{
+  GVariantBuilder builder;
+  GSList *files = NULL, *lptr;
+  GError *err = NULL;
+  GVariant *bundle;
+  gint count = 0;
+
+  *error = NULL;
+  if (!g_file_test (dir, G_FILE_TEST_IS_DIR)) {
+    *error = g_strdup_printf (_("%s is not a folder."), dir);
+    return 1;
+  }
+
+  tsc_scan_profiles (dir, TSC_SCAN_THREADS_DEFAULT, &files);
+  files = g_slist_sort (files, (GCompareFunc) strcmp);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(say)"));
+  for (lptr = files; lptr; lptr = lptr->next) {
+    gchar *fqpath = g_build_path ("/", dir, lptr->data, NULL);
+    rdp_file *rdp = g_new0 (rdp_file, 1);
+
+    // legacy .rdp files go in as JSON so every lookup parses the same way
+    rdp_file_init (rdp);
+    if (rdp_file_load (rdp, fqpath) == 0) {
+      gchar *json = rdp_file_to_json (rdp);
+      g_variant_builder_add (&builder, "(s@ay)", lptr->data,
+                             g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, json, strlen (json), 1));
+      g_free (json);
+      count++;
+    } else {
+      g_warning ("Skipping %s: could not read it", fqpath);
+    }
+    rdp_file_free (rdp);
+    g_free (fqpath);
+  }
+  g_slist_free_full (files, g_free);
+
+  bundle = g_variant_ref_sink (g_variant_new ("(uu@a(say))", TSC_BUNDLE_MAGIC, TSC_BUNDLE_VERSION,
+                                              g_variant_builder_end (&builder)));
+  if (!g_file_set_contents (out, g_variant_get_data (bundle), g_variant_get_size (bundle), &err)) {
+    *error = g_strdup (err->message);
+    g_error_free (err);
+  } else {
+    printf ("  %d profiles packed into %s\n", count, out);
+  }
+  g_variant_unref (bundle);
+
+  return *error ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_BUNDLE_MAGIC 0x42435354   /* "TSCB" little-endian */
+#define TSC_BUNDLE_VERSION 1
+#define TSC_BUNDLE_TYPE "(uua(say))"
+
+gboolean tsc_bundle_lookup (const gchar *name, const gchar **data, gsize *length,
+                            gint64 *mtime);
+void tsc_bundle_list (GSList **list, GHashTable *skip);
+int tsc_bundle_pack (const gchar *dir, const gchar *out, gchar **error);
+
+#endif /* BUNDLE_H */
@@ -0,0 +1,513 @@
+/***************************************
+*                                      *
+*   Persistent Bitmap Cache            *
+*                                      *
+***************************************/
+
+/*
+ * The clients' persistent bitmap caches are kept per host, under
+ * ~/.tsclient/cache/HOST/, and held to a size budget:
+ *
+ *   [cache]
+ *   budget-mb=256
+ *   host-mb=64
+ *   keep-warm=3
+ *
+ * FreeRDP is given a cache file in HOST/.  rdesktop always uses
+ * ~/.rdesktop/cache, so its pstcache_* files are moved there from HOST/
+ * before a session and back afterwards.  pstcache_* files already there
+ * belong to an rdesktop we did not start and stay where they are, host
+ * files of the same name with them.  An flock on cache/rdesktop.lock
+ * lets one session at a time do that; a second rdesktop session started
+ * meanwhile, or one that cannot take the lock, shares the cache as it
+ * is and moves nothing either way.
+ *
+ * Between sessions a host over host-mb loses its cache, then the least
+ * recently used hosts go until the rest fits in budget-mb.  Hosts with a
+ * session running or waiting to reconnect are left alone, and the
+ * keep-warm most frecent recent servers go last.  budget-mb=0 leaves the
+ * caches to the clients.
+ */
+
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "mrulist.h"
+#include "cache.h"
+
+#define TSC_CACHE_RDESKTOP_PREFIX "pstcache_"
+
+typedef struct {
+  gchar *key;
+  gchar *path;
+  gint64 bytes;
+  gint64 last;
+  gboolean warm;
+  gboolean busy;
+} TscCacheDir;
+
+static TscCacheStats stats = { 0, -1, 0, 0 };
+
+// pstcache_* names in ~/.rdesktop/cache that were there before the lock holder's checkout
+static GHashTable *rdesktop_unowned = NULL;
+
+
+static gint64
+tsc_cache_limit (const gchar *key, gint fallback_mb)
+{
+  return (gint64) MAX (tsc_config_get_int ("cache", key, fallback_mb), 0) * 1024 * 1024;
+}
+
+
+static gchar *
+tsc_cache_root (void)
+{
+  gchar *home = tsc_home_path ();
+  gchar *root = g_build_path ("/", home, "cache", NULL);
+
+  g_free (home);
+  return root;
+}
+
+
+/* A host as a directory name: "TS1.example.com:3390" is "ts1.example.com_3390". */
+static gchar *
+tsc_cache_key (const gchar *host)
+{
+  gchar *key = g_ascii_strdown (host && *host ? host : "_", -1);
+  gchar *p;
+
+  for (p = key; *p; p++) {
+    if (!g_ascii_isalnum (*p) && *p != '.' && *p != '-')
+      *p = '_';
+  }
+  // never "." or ".."
+  if (*key == '.')
+    *key = '_';
+  return key;
+}
+
+
+static gchar *
+tsc_cache_host_dir (const gchar *host)
+{
+  gchar *root = tsc_cache_root ();
+  gchar *key = tsc_cache_key (host);
+  gchar *dir = g_build_path ("/", root, key, NULL);
+
+  g_mkdir_with_parents (dir, 0700);
+  g_free (key);
+  g_free (root);
+  return dir;
+}
+
+
+static gchar *
+tsc_cache_rdesktop_dir (void)
+{
+  return g_build_path ("/", g_get_home_dir (), ".rdesktop", "cache", NULL);
+}
+
+
+/* rdesktop's cache files in path, as a set of names. */
+static GHashTable *
+tsc_cache_rdesktop_files (const gchar *path)
+{
+  GHashTable *names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+
+  if (!dir)
+    return names;
+
+  while ((name = g_dir_read_name (dir)))
+    if (g_str_has_prefix (name, TSC_CACHE_RDESKTOP_PREFIX))
+      g_hash_table_add (names, g_strdup (name));
+  g_dir_close (dir);
+  return names;
+}
+
+
+/* Move rdesktop's cache files from one directory to another, leaving those named in skip. */
+static void
+tsc_cache_move (const gchar *from, const gchar *to, GHashTable *skip)
+{
+  GDir *dir = g_dir_open (from, 0, NULL);
+  const gchar *name;
+
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *src, *dst;
+
+    if (!g_str_has_prefix (name, TSC_CACHE_RDESKTOP_PREFIX) ||
+        (skip && g_hash_table_contains (skip, name)))
+      continue;
+    src = g_build_path ("/", from, name, NULL);
+    dst = g_build_path ("/", to, name, NULL);
+    // a cache is only worth a rename; across file systems it is dropped
+    if (g_rename (src, dst) != 0)
+      g_unlink (src);
+    g_free (dst);
+    g_free (src);
+  }
+  g_dir_close (dir);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_cache_checkout                 *
+*                                      *
+***************************************/
+
+/* The file FreeRDP keeps host's cache in, or NULL when caches are not managed. */
+gchar *tsc_cache_persist_file (const gchar *host, const gchar *name)
+{
+  gchar *dir, *file_name;
+
+  if (!tsc_cache_limit ("budget-mb", TSC_CACHE_BUDGET_MB_DEFAULT) || !host || !*host)
+    return NULL;
+
+  dir = tsc_cache_host_dir (host);
+  file_name = g_build_path ("/", dir, name, NULL);
+  g_free (dir);
+  return file_name;
+}
+
+
+/*
+ * A session to host is about to start client.  Marks the host's cache
+ * as used and, for rdesktop, puts its files in ~/.rdesktop/cache next
+ * to any already there.  Returns the lock to hand to tsc_cache_checkin,
+ * or -1 when nothing was moved and nothing is to be moved back.
+ */
+int tsc_cache_checkout (const gchar *host, const gchar *client)
+{
+  gchar *dir, *rdesktop_dir, *lock_name, *root;
+  int fd;
+
+  if (!tsc_cache_limit ("budget-mb", TSC_CACHE_BUDGET_MB_DEFAULT) || !host || !*host)
+    return -1;
+
+  dir = tsc_cache_host_dir (host);
+  g_utime (dir, NULL);
+  if (!client || strcmp (client, "rdesktop") != 0) {
+    g_free (dir);
+    return -1;
+  }
+
+  root = tsc_cache_root ();
+  lock_name = g_build_path ("/", root, "rdesktop.lock", NULL);
+  fd = open (lock_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd >= 0 && flock (fd, LOCK_EX | LOCK_NB) != 0) {
+    close (fd);
+    fd = -1;
+  }
+
+  if (fd >= 0) {
+    rdesktop_dir = tsc_cache_rdesktop_dir ();
+    g_mkdir_with_parents (rdesktop_dir, 0700);
+    // left by an rdesktop we did not start: not ours to move or replace
+    g_clear_pointer (&rdesktop_unowned, g_hash_table_unref);
+    rdesktop_unowned = tsc_cache_rdesktop_files (rdesktop_dir);
+    tsc_cache_move (dir, rdesktop_dir, rdesktop_unowned);
+    g_free (rdesktop_dir);
+  }
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_cache_checkout: %s %s%s\n", host, client, fd >= 0 ? "" : " (shared)");
+  #endif
+
+  g_free (lock_name);
+  g_free (root);
+  g_free (dir);
+  return fd;
+}
+
+
+/* The session tsc_cache_checkout returned lock_fd for has exited. */
+void tsc_cache_checkin (const gchar *host, int lock_fd)
+{
+  gchar *dir, *rdesktop_dir;
+
+  if (lock_fd < 0)
+    return;
+
+  dir = tsc_cache_host_dir (host);
+  rdesktop_dir = tsc_cache_rdesktop_dir ();
+  tsc_cache_move (rdesktop_dir, dir, rdesktop_unowned);
+  g_clear_pointer (&rdesktop_unowned, g_hash_table_unref);
+  close (lock_fd);
+
+  g_free (rdesktop_dir);
+  g_free (dir);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_cache_trim                     *
+*                                      *
+***************************************/
+
+static void
+tsc_cache_dir_free (TscCacheDir *entry)
+{
+  g_free (entry->key);
+  g_free (entry->path);
+  g_free (entry);
+}
+
+
+/* Bytes in the files of path; *last becomes the newest mtime. */
+static gint64
+tsc_cache_usage (const gchar *path, gint64 *last)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+  GStatBuf st;
+  gint64 bytes = 0;
+
+  if (g_stat (path, &st) == 0)
+    *last = st.st_mtime;
+  if (!dir)
+    return 0;
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *file_name = g_build_path ("/", path, name, NULL);
+
+    if (g_stat (file_name, &st) == 0 && S_ISREG (st.st_mode)) {
+      bytes += st.st_size;
+      *last = MAX (*last, (gint64) st.st_mtime);
+    }
+    g_free (file_name);
+  }
+  g_dir_close (dir);
+  return bytes;
+}
+
+
+/* Every host's cache; busy lists the hosts that have a session. */
+static GList *
+tsc_cache_list (GPtrArray *busy)
+{
+  gint keep = MAX (tsc_config_get_int ("cache", "keep-warm", TSC_CACHE_KEEP_WARM_DEFAULT), 0);
+  GHashTable *warm = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  GHashTable *running = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  gchar *root = tsc_cache_root ();
+  GList *list = NULL, *mru, *lptr;
+  const gchar *name;
+  GDir *dir;
+  guint i;
+
+  if (keep > 0) {
+    mru = mru_load (keep);
+    for (lptr = mru; lptr; lptr = lptr->next)
+      g_hash_table_add (warm, tsc_cache_key (((TscMruEntry *) lptr->data)->server));
+    g_list_free_full (mru, (GDestroyNotify) mru_entry_free);
+  }
+  for (i = 0; busy && i < busy->len; i++)
+    g_hash_table_add (running, tsc_cache_key (g_ptr_array_index (busy, i)));
+
+  dir = g_dir_open (root, 0, NULL);
+  while (dir && (name = g_dir_read_name (dir))) {
+    gchar *path = g_build_path ("/", root, name, NULL);
+    TscCacheDir *entry;
+
+    if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+      g_free (path);
+      continue;
+    }
+    entry = g_new0 (TscCacheDir, 1);
+    entry->key = g_strdup (name);
+    entry->path = path;
+    entry->bytes = tsc_cache_usage (path, &entry->last);
+    entry->warm = g_hash_table_contains (warm, name);
+    entry->busy = g_hash_table_contains (running, name);
+    list = g_list_prepend (list, entry);
+  }
+  if (dir)
+    g_dir_close (dir);
+
+  g_hash_table_destroy (running);
+  g_hash_table_destroy (warm);
+  g_free (root);
+  return list;
+}
+
+
+/* Eviction order: cold before warm, least recently used first. */
+static gint
+tsc_cache_compare (gconstpointer a, gconstpointer b)
+{
+  const TscCacheDir *x = a, *y = b;
+
+  if (x->warm != y->warm)
+    return x->warm ? 1 : -1;
+  return x->last < y->last ? -1 : x->last > y->last;
+}
+
+
+static void
+tsc_cache_remove (TscCacheDir *entry)
+{
+  GDir *dir = g_dir_open (entry->path, 0, NULL);
+  const gchar *name;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_cache_remove: %s %" G_GINT64_FORMAT " bytes\n", entry->key, entry->bytes);
+  #endif
+
+  while (dir && (name = g_dir_read_name (dir))) {
+    gchar *file_name = g_build_path ("/", entry->path, name, NULL);
+
+    g_unlink (file_name);
+    g_free (file_name);
+  }
+  if (dir)
+    g_dir_close (dir);
+  g_rmdir (entry->path);
+
+  stats.evictions++;
+  stats.evicted_bytes += entry->bytes;
+}
+
+
+/*
+ * Bring the caches within [cache] host-mb and budget-mb, sparing the
+ * hosts in busy (full addresses of sessions that are not over yet).
+ */
+void tsc_cache_trim (GPtrArray *busy)
+{
+  gint64 budget = tsc_cache_limit ("budget-mb", TSC_CACHE_BUDGET_MB_DEFAULT);
+  gint64 host_max = tsc_cache_limit ("host-mb", TSC_CACHE_HOST_MB_DEFAULT);
+  gint64 total = 0;
+  GList *list, *lptr;
+
+  if (!budget)
+    return;
+
+  list = g_list_sort (tsc_cache_list (busy), tsc_cache_compare);
+  for (lptr = list; lptr; lptr = lptr->next)
+    total += ((TscCacheDir *) lptr->data)->bytes;
+  stats.hosts = g_list_length (list);
+
+  // one runaway host should not push every other one out
+  for (lptr = list; lptr; lptr = lptr->next) {
+    TscCacheDir *entry = lptr->data;
+
+    if (!entry->busy && host_max && entry->bytes > host_max) {
+      tsc_cache_remove (entry);
+      total -= entry->bytes;
+      entry->bytes = 0;
+      stats.hosts--;
+    }
+  }
+  for (lptr = list; lptr && total > budget; lptr = lptr->next) {
+    TscCacheDir *entry = lptr->data;
+
+    if (!entry->busy && entry->bytes) {
+      tsc_cache_remove (entry);
+      total -= entry->bytes;
+      stats.hosts--;
+    }
+  }
+  stats.bytes = total;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_cache_trim: %d hosts, %" G_GINT64_FORMAT " of %" G_GINT64_FORMAT " bytes\n",
+          stats.hosts, total, budget);
+  #endif
+
+  g_list_free_full (list, (GDestroyNotify) tsc_cache_dir_free);
+}
+
+
+/* bytes is -1 until the first trim. */
+void tsc_cache_get_stats (TscCacheStats *out)
+{
+  *out = stats;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_cache_report                   *
+*                                      *
+***************************************/
+
+/* Most recently used first. */
+static gint
+tsc_cache_compare_recent (gconstpointer a, gconstpointer b)
+{
+  const TscCacheDir *x = a, *y = b;
+
+  return x->last > y->last ? -1 : x->last < y->last;
+}
+
+
+static gchar *
+tsc_cache_age (gint64 last)
+{
+  gint64 ago = g_get_real_time () / G_USEC_PER_SEC - last;
+
+  if (ago < 60 * 60)
+    return g_strdup_printf ("%dm ago", (gint) (MAX (ago, 0) / 60));
+  if (ago < 24 * 60 * 60)
+    return g_strdup_printf ("%dh ago", (gint) (ago / (60 * 60)));
+  return g_strdup_printf ("%dd ago", (gint) (ago / (24 * 60 * 60)));
+}
+
+
+/* Print every host's cache for tsclient --cache. */
+int tsc_cache_report (void)
+{
+  gint64 budget = tsc_cache_limit ("budget-mb", TSC_CACHE_BUDGET_MB_DEFAULT);
+  gchar *root = tsc_cache_root ();
+  gchar *rdesktop_dir = tsc_cache_rdesktop_dir ();
+  gint64 total = 0, shared, last = 0;
+  GList *list, *lptr;
+
+  list = g_list_sort (tsc_cache_list (NULL), tsc_cache_compare_recent);
+  for (lptr = list; lptr; lptr = lptr->next)
+    total += ((TscCacheDir *) lptr->data)->bytes;
+
+  printf ("\n  %u hosts in %s, %" G_GINT64_FORMAT " KB", g_list_length (list), root, total / 1024);
+  if (budget)
+    printf (" of %" G_GINT64_FORMAT " KB\n\n", budget / 1024);
+  else
+    printf (", not managed ([cache] budget-mb=0)\n\n");
+
+  if (list)
+    printf ("  %-32s %10s %10s\n", "host", "KB", "last used");
+  for (lptr = list; lptr; lptr = lptr->next) {
+    TscCacheDir *entry = lptr->data;
+    gchar *age = tsc_cache_age (entry->last);
+
+    printf ("  %-32s %10" G_GINT64_FORMAT " %10s%s\n", entry->key, entry->bytes / 1024, age,
+            entry->warm ? "  warm" : "");
+    g_free (age);
+  }
+
+  shared = tsc_cache_usage (rdesktop_dir, &last);
+  if (shared)
+    printf ("\n  %s holds %" G_GINT64_FORMAT " KB outside the budget\n", rdesktop_dir, shared / 1024);
+  printf ("\n");
+
+  g_list_free_full (list, (GDestroyNotify) tsc_cache_dir_free);
+  g_free (rdesktop_dir);
+  g_free (root);
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_CACHE_BUDGET_MB_DEFAULT 256
+#define TSC_CACHE_HOST_MB_DEFAULT 64
+#define TSC_CACHE_KEEP_WARM_DEFAULT 3
+
+typedef struct
+{
+  gint hosts;
+  gint64 bytes;
+  gint evictions;
+  gint64 evicted_bytes;
+} TscCacheStats;
+
+gchar *tsc_cache_persist_file (const gchar *host, const gchar *name);
+int tsc_cache_checkout (const gchar *host, const gchar *client);
+void tsc_cache_checkin (const gchar *host, int lock_fd);
+void tsc_cache_trim (GPtrArray *busy);
+void tsc_cache_get_stats (TscCacheStats *stats);
+int tsc_cache_report (void);
+
+#endif /* CACHE_H */
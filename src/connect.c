@@ -25,10 +25,13 @@
 #include "support.h"
 #include "connect.h"
 #include "mrulist.h"
+#include "probe.h"
+#include "resolve.h"
 #include "main.h"
 #include "tsc-presets.h"
 
 static void on_recent_server_selected (GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_data);
+static void on_computer_changed (GtkEditable *editable, gpointer user_data);
 static GtkFileDialog *tsc_create_rdp_dialog (const gchar *title, gboolean include_all_filter);
 static GFile *tsc_file_dialog_run_open (GtkWindow *parent, GtkFileDialog *dialog);
 static GFile *tsc_file_dialog_run_save (GtkWindow *parent, GtkFileDialog *dialog);
@@ -38,6 +41,7 @@ static void tsc_ensure_form_css (void);
 static void tsc_align_panel_icon (GtkWidget *widget);
 static void tsc_update_size_controls (void);
 static void tsc_update_color_controls (void);
+static void on_connection_speed_changed (GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_data);
 
 GtkWidget *gConnect = NULL;
 
@@ -337,12 +341,24 @@ tsc_create_rdp_dialog (const gchar *title, gboolean include_all_filter)
 *                                      *
 ***************************************/
 
+/* A background rescan of ~/.tsclient found profiles added or removed. */
+static void
+tsc_reload_profiles (gpointer unused, gpointer user_data)
+{
+  GtkWidget *main_window = user_data;
+
+  rdp_load_profile_launcher (main_window);
+  rdp_load_group_launcher (main_window);
+}
+
+
 int 
 create_frmConnect (void)
 {
   gint i = 0;
   gsize preset_count = 0;
   const gchar **size_items = NULL;
+  const gchar **speed_items = NULL;
   const gchar *color_items[] = {
     _("256 Colors (8 bit)"),
     _("High Color (15 bit)"),
@@ -351,6 +367,47 @@ create_frmConnect (void)
     _("True Color (32 bit)"),
 	  NULL
   };
+  const gchar *restart_policy_labels[] = {
+    _("Do not restart"),
+    _("Restart if it fails"),
+    _("Always restart"),
+    NULL
+  };
+  const gchar *rdp_client_labels[] = {
+    _("Automatic"),
+    "rdesktop",
+    "xfreerdp",
+    "xfreerdp3",
+    NULL
+  };
+  const gchar *graphics_codec_labels[] = {
+    _("Automatic"),
+    _("H.264 AVC444"),
+    _("H.264 AVC420"),
+    _("RemoteFX"),
+    _("Off (bitmaps only)"),
+    NULL
+  };
+  const gchar *pool_policy_labels[] = {
+    _("In turn"),
+    _("Any"),
+    _("Nearest"),
+    _("Least busy"),
+    NULL
+  };
+  const gchar *vnc_encoding_labels[] = {
+    _("Viewer default"),
+    "Tight",
+    "ZRLE",
+    "Hextile",
+    _("Raw (LAN only)"),
+    NULL
+  };
+  const gchar *vnc_level_labels[] = {
+    _("Viewer default"),
+    "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+    NULL
+  };
   const gchar *tls_version_labels[] = {
     _("Negotiate TLS (default)"),
     _("TLS 1.0"),
@@ -376,6 +433,7 @@ create_frmConnect (void)
   // Profile Launcher Widgets
   GtkWidget *hbxProfileLauncher;
   GtkWidget *optProfileLauncher;
+  GtkWidget *optGroupLauncher;
   // Profile File Ops
   GtkWidget *hbxFileOps;
   GtkWidget *btnSaveAs;
@@ -407,6 +465,12 @@ create_frmConnect (void)
   GtkWidget *txtClientHostname;
   GtkWidget *lblProtoFile;
   GtkWidget *hbxProtoFile;
+  GtkWidget *lblProtocols;
+  GtkWidget *txtProtocols;
+  GtkWidget *lblPool;
+  GtkWidget *hbxPool;
+  GtkWidget *txtPool;
+  GtkWidget *optPoolPolicy;
   GtkWidget *txtProtoFile;
   GtkWidget *btnProtoFile;
 
@@ -487,6 +551,8 @@ create_frmConnect (void)
   GtkWidget *txtProgramPath;
   GtkWidget *lblStartFolder;
   GtkWidget *txtStartFolder;
+  GtkWidget *lblRestartPolicy;
+  GtkWidget *optRestartPolicy;
 
   // Performance Tab Widgets
   GtkWidget *lblPerformanceTab1;
@@ -498,6 +564,20 @@ create_frmConnect (void)
   GtkWidget *imgPerform;
   GtkWidget *lblPerformanceOptions;
   GtkWidget *vbxExpChecks;
+  GtkWidget *lblConnectionSpeed;
+  GtkWidget *optConnectionSpeed;
+  GtkWidget *chkCompression;
+  GtkWidget *lblRdpClient;
+  GtkWidget *optRdpClient;
+  GtkWidget *lblGraphicsCodec;
+  GtkWidget *optGraphicsCodec;
+  GtkWidget *chkGlyphCache;
+  GtkWidget *lblVncEncoding;
+  GtkWidget *optVncEncoding;
+  GtkWidget *lblVncCompress;
+  GtkWidget *optVncCompress;
+  GtkWidget *lblVncQuality;
+  GtkWidget *optVncQuality;
   GtkWidget *chkDesktopBackground;
   GtkWidget *chkWindowContent;
   GtkWidget *chkAnimation;
@@ -514,6 +594,7 @@ create_frmConnect (void)
 
   // Complete Button Box Widgets
   GtkWidget *hbbAppOps;
+  GtkWidget *btnTest;
   GtkWidget *btnConnect;
   GtkWidget *alnConnect;
   GtkWidget *hbxConnect;
@@ -521,6 +602,7 @@ create_frmConnect (void)
   GtkWidget *lblConnect;
   GtkWidget *btnQuit;
   GtkWidget *btnHelp;
+  GtkWidget *lblSessionStatus;
 
   #ifdef TSCLIENT_DEBUG
   printf ("create_frmConnect\n");
@@ -611,7 +693,7 @@ create_frmConnect (void)
   gtk_misc_set_padding (GTK_MISC (imgGeneralLogon), 3, 3);
   tsc_align_panel_icon (imgGeneralLogon);
 
-  tblLogon1 = gtk_table_new (6, 2, FALSE);
+  tblLogon1 = gtk_table_new (9, 2, FALSE);
   gtk_table_attach (GTK_TABLE (tblLogon0), tblLogon1, 1, 2, 1, 2,
                     (GtkAttachOptions) (GTK_FILL),
                     (GtkAttachOptions) (GTK_FILL), 0, 0);
@@ -667,6 +749,20 @@ create_frmConnect (void)
   gtk_label_set_justify (GTK_LABEL (lblProtoFile), GTK_JUSTIFY_LEFT);
   gtk_misc_set_alignment (GTK_MISC (lblProtoFile), 0, 0.5);
 
+  lblProtocols = gtk_label_new_with_mnemonic (_("Also _Try:"));
+  gtk_table_attach (GTK_TABLE (tblLogon1), lblProtocols, 0, 1, 7, 8,
+                    (GtkAttachOptions) (GTK_FILL),
+                    (GtkAttachOptions) (0), 6, 6);
+  gtk_label_set_justify (GTK_LABEL (lblProtocols), GTK_JUSTIFY_LEFT);
+  gtk_misc_set_alignment (GTK_MISC (lblProtocols), 0, 0.5);
+
+  lblPool = gtk_label_new_with_mnemonic (_("_Host Pool:"));
+  gtk_table_attach (GTK_TABLE (tblLogon1), lblPool, 0, 1, 8, 9,
+                    (GtkAttachOptions) (GTK_FILL),
+                    (GtkAttachOptions) (0), 6, 6);
+  gtk_label_set_justify (GTK_LABEL (lblPool), GTK_JUSTIFY_LEFT);
+  gtk_misc_set_alignment (GTK_MISC (lblPool), 0, 0.5);
+
   GtkWidget *hbxComputer = gtk_hbox_new (FALSE, 6);
   gtk_table_attach (GTK_TABLE (tblLogon1), hbxComputer, 1, 2, 0, 1,
                     (GtkAttachOptions) (GTK_EXPAND | GTK_FILL),
@@ -676,10 +772,13 @@ create_frmConnect (void)
   gtk_box_pack_start (GTK_BOX (hbxComputer), txtComputer, TRUE, TRUE, 0);
   gtk_entry_set_activates_default (GTK_ENTRY (txtComputer), TRUE);
   gtk_widget_set_tooltip_text (txtComputer, _("Enter the name or address of the remote system."));
+  g_signal_connect (txtComputer, "changed",
+                    G_CALLBACK (on_computer_changed), NULL);
 
   cboComputer = tsc_dropdown_new ((const gchar * const []) { _("Recent"), NULL });
   gtk_box_pack_start (GTK_BOX (hbxComputer), cboComputer, FALSE, FALSE, 0);
   gtk_widget_set_sensitive (cboComputer, FALSE);
+  tsc_probe_attach (cboComputer);
   g_signal_connect (cboComputer, "notify::selected",
                     G_CALLBACK (on_recent_server_selected), txtComputer);
 
@@ -740,6 +839,27 @@ create_frmConnect (void)
   gtk_box_pack_start (GTK_BOX (hbxProtoFile), txtProtoFile, TRUE, TRUE, 0);
   gtk_widget_set_tooltip_text (txtProtoFile, _("Some protocols require a file containing settings. If required, enter the path to the file here."));
 
+  txtProtocols = gtk_entry_new ();
+  gtk_entry_set_activates_default (GTK_ENTRY (txtProtocols), TRUE);
+  gtk_table_attach (GTK_TABLE (tblLogon1), txtProtocols, 1, 2, 7, 8,
+                    (GtkAttachOptions) (GTK_EXPAND | GTK_FILL),
+                    (GtkAttachOptions) (0), 0, 0);
+  gtk_widget_set_tooltip_text (txtProtocols, _("Protocols to try at once, with optional ports, such as \"rdp,vnc:1\". The first to answer is launched; leave empty to use only the protocol above."));
+
+  hbxPool = gtk_hbox_new (FALSE, 6);
+  gtk_table_attach (GTK_TABLE (tblLogon1), hbxPool, 1, 2, 8, 9,
+                    (GtkAttachOptions) (GTK_EXPAND | GTK_FILL),
+                    (GtkAttachOptions) (0), 0, 0);
+
+  txtPool = gtk_entry_new ();
+  gtk_entry_set_activates_default (GTK_ENTRY (txtPool), TRUE);
+  gtk_box_pack_start (GTK_BOX (hbxPool), txtPool, TRUE, TRUE, 0);
+  gtk_widget_set_tooltip_text (txtPool, _("Identical hosts to launch on instead of the computer above, such as \"ts1,ts2,ts3:3390\". Hosts that are down are left out for a while."));
+
+  optPoolPolicy = tsc_dropdown_new (pool_policy_labels);
+  gtk_box_pack_start (GTK_BOX (hbxPool), optPoolPolicy, FALSE, FALSE, 0);
+  gtk_widget_set_tooltip_text (optPoolPolicy, _("How a host is picked from the pool for each launch."));
+
   btnProtoFile = gtk_button_new_with_label ("...");
   gtk_widget_add_css_class (btnProtoFile, "tsc-action");
   gtk_container_add (GTK_CONTAINER (hbxProtoFile), btnProtoFile);
@@ -1026,7 +1146,7 @@ create_frmConnect (void)
   gtk_frame_set_label_widget (GTK_FRAME (frameProgram), lblProgramFrame);
   gtk_label_set_justify (GTK_LABEL (lblProgramFrame), GTK_JUSTIFY_LEFT);
 
-  tblProgram = gtk_table_new (2, 5, FALSE);
+  tblProgram = gtk_table_new (2, 7, FALSE);
   gtk_container_add (GTK_CONTAINER (frameProgram), tblProgram);
 
   imgProgram = create_pixmap (frmConnect, "icon_program.png");
@@ -1064,6 +1184,18 @@ create_frmConnect (void)
                     (GtkAttachOptions) (GTK_EXPAND | GTK_FILL),
                     (GtkAttachOptions) (GTK_FILL), 0, 0);
 
+  lblRestartPolicy = gtk_label_new (_("When a group or -x session ends"));
+  gtk_table_attach (GTK_TABLE (tblProgram), lblRestartPolicy, 1, 2, 5, 6,
+                    (GtkAttachOptions) (GTK_EXPAND | GTK_FILL),
+                    (GtkAttachOptions) (GTK_FILL), 0, 0);
+  gtk_label_set_justify (GTK_LABEL (lblRestartPolicy), GTK_JUSTIFY_LEFT);
+
+  optRestartPolicy = tsc_dropdown_new (restart_policy_labels);
+  gtk_table_attach (GTK_TABLE (tblProgram), optRestartPolicy, 1, 2, 6, 7,
+                    (GtkAttachOptions) (GTK_EXPAND | GTK_FILL),
+                    (GtkAttachOptions) (GTK_FILL), 0, 0);
+  gtk_widget_set_tooltip_text (optRestartPolicy, _("Sessions started by the supervisor can be restarted when the client exits."));
+
 
   framePerform = gtk_frame_new (NULL);
   gtk_container_add (GTK_CONTAINER (nbkComplete), framePerform);
@@ -1092,16 +1224,81 @@ create_frmConnect (void)
                     (GtkAttachOptions) (GTK_FILL),
                     (GtkAttachOptions) (GTK_EXPAND | GTK_FILL), 0, 0);
 
-  chkDesktopBackground = gtk_check_button_new_with_mnemonic (_("Desktop background (u)"));
+  lblConnectionSpeed = gtk_label_new_with_mnemonic (_("Connection _speed:"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), lblConnectionSpeed, FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (lblConnectionSpeed), 0, 0.5);
+
+  speed_items = g_new0 (const gchar *, TSC_SPEED_PRESET_COUNT + 1);
+  for (gsize idx = 0; idx < TSC_SPEED_PRESET_COUNT; idx++) {
+    speed_items[idx] = _(tsc_speed_presets[idx].label);
+  }
+  optConnectionSpeed = tsc_dropdown_new (speed_items);
+  g_free ((gpointer) speed_items);
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), optConnectionSpeed, FALSE, FALSE, 3);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblConnectionSpeed), optConnectionSpeed);
+  gtk_widget_set_tooltip_text (optConnectionSpeed, _("Choose your connection speed to set the options below, or Custom to pick them yourself."));
+  g_signal_connect (optConnectionSpeed, "notify::selected",
+                    G_CALLBACK (on_connection_speed_changed), frmConnect);
+
+  chkCompression = gtk_check_button_new_with_mnemonic (_("Compress data"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), chkCompression, FALSE, FALSE, 0);
+
+  lblRdpClient = gtk_label_new_with_mnemonic (_("RDP _client:"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), lblRdpClient, FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (lblRdpClient), 0, 0.5);
+
+  optRdpClient = tsc_dropdown_new (rdp_client_labels);
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), optRdpClient, FALSE, FALSE, 3);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblRdpClient), optRdpClient);
+  gtk_widget_set_tooltip_text (optRdpClient, _("Automatic prefers FreeRDP when it is installed. RDPv4 always uses rdesktop."));
+
+  lblGraphicsCodec = gtk_label_new_with_mnemonic (_("_Graphics codec (FreeRDP):"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), lblGraphicsCodec, FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (lblGraphicsCodec), 0, 0.5);
+
+  optGraphicsCodec = tsc_dropdown_new (graphics_codec_labels);
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), optGraphicsCodec, FALSE, FALSE, 3);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblGraphicsCodec), optGraphicsCodec);
+  gtk_widget_set_tooltip_text (optGraphicsCodec, _("Automatic uses the graphics pipeline with the best codec both ends support."));
+
+  chkGlyphCache = gtk_check_button_new_with_mnemonic (_("Cache glyphs (FreeRDP)"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), chkGlyphCache, FALSE, FALSE, 0);
+
+  lblVncEncoding = gtk_label_new_with_mnemonic (_("VNC _encoding:"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), lblVncEncoding, FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (lblVncEncoding), 0, 0.5);
+
+  optVncEncoding = tsc_dropdown_new (vnc_encoding_labels);
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), optVncEncoding, FALSE, FALSE, 3);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblVncEncoding), optVncEncoding);
+  gtk_widget_set_tooltip_text (optVncEncoding, _("Tight or ZRLE for slow links. Viewers without the one chosen get the nearest they have."));
+
+  lblVncCompress = gtk_label_new_with_mnemonic (_("VNC compression _level (9 is smallest):"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), lblVncCompress, FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (lblVncCompress), 0, 0.5);
+
+  optVncCompress = tsc_dropdown_new (vnc_level_labels);
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), optVncCompress, FALSE, FALSE, 3);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblVncCompress), optVncCompress);
+
+  lblVncQuality = gtk_label_new_with_mnemonic (_("VNC JPEG _quality (9 is best):"));
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), lblVncQuality, FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (lblVncQuality), 0, 0.5);
+
+  optVncQuality = tsc_dropdown_new (vnc_level_labels);
+  gtk_box_pack_start (GTK_BOX (vbxExpChecks), optVncQuality, FALSE, FALSE, 3);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblVncQuality), optVncQuality);
+
+  chkDesktopBackground = gtk_check_button_new_with_mnemonic (_("Desktop background"));
   gtk_box_pack_start (GTK_BOX (vbxExpChecks), chkDesktopBackground, FALSE, FALSE, 0);
 
-  chkWindowContent = gtk_check_button_new_with_mnemonic (_("Show content of window while dragging (u)"));
+  chkWindowContent = gtk_check_button_new_with_mnemonic (_("Show content of window while dragging"));
   gtk_box_pack_start (GTK_BOX (vbxExpChecks), chkWindowContent, FALSE, FALSE, 0);
 
-  chkAnimation = gtk_check_button_new_with_mnemonic (_("Menu and window animation (u)"));
+  chkAnimation = gtk_check_button_new_with_mnemonic (_("Menu and window animation"));
   gtk_box_pack_start (GTK_BOX (vbxExpChecks), chkAnimation, FALSE, FALSE, 0);
 
-  chkThemes = gtk_check_button_new_with_mnemonic (_("Themes (u)"));
+  chkThemes = gtk_check_button_new_with_mnemonic (_("Themes"));
   gtk_box_pack_start (GTK_BOX (vbxExpChecks), chkThemes, FALSE, FALSE, 0);
 
   chkBitmapCache = gtk_check_button_new_with_mnemonic (_("Enable bitmap caching"));
@@ -1159,6 +1356,8 @@ create_frmConnect (void)
   gtk_label_set_mnemonic_widget (GTK_LABEL (lblDomain), txtDomain);
   gtk_label_set_mnemonic_widget (GTK_LABEL (lblClientHostname), txtClientHostname);
   gtk_label_set_mnemonic_widget (GTK_LABEL (lblProtoFile), txtProtoFile);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblProtocols), txtProtocols);
+  gtk_label_set_mnemonic_widget (GTK_LABEL (lblPool), txtPool);
 
 
   /*
@@ -1172,9 +1371,16 @@ create_frmConnect (void)
   optProfileLauncher = tsc_dropdown_new ((const gchar * const []) { _("Quick Connect"), NULL });
   gtk_widget_set_tooltip_text (optProfileLauncher, _("Select a saved profile to launch it immediately."));
   gtk_box_pack_start (GTK_BOX (hbxProfileLauncher), optProfileLauncher, TRUE, TRUE, 0);
+  tsc_probe_attach (optProfileLauncher);
   g_signal_connect (optProfileLauncher, "notify::selected",
                     G_CALLBACK (tsc_quick_pick_activate), NULL);
 
+  optGroupLauncher = tsc_dropdown_new ((const gchar * const []) { _("Launch Group"), NULL });
+  gtk_widget_set_tooltip_text (optGroupLauncher, _("Start every profile in a profile folder."));
+  gtk_box_pack_start (GTK_BOX (hbxProfileLauncher), optGroupLauncher, FALSE, TRUE, 0);
+  g_signal_connect (optGroupLauncher, "notify::selected",
+                    G_CALLBACK (tsc_group_launch_activate), NULL);
+
   hbxFileOps = gtk_hbox_new (TRUE, 0);
   gtk_box_pack_start (GTK_BOX (hbxProfileLauncher), hbxFileOps, FALSE, TRUE, 0);
   gtk_container_set_border_width (GTK_CONTAINER (hbxFileOps), 0);
@@ -1201,6 +1407,10 @@ create_frmConnect (void)
   gtk_widget_set_halign (hbbAppOps, GTK_ALIGN_END);
   gtk_container_set_border_width (GTK_CONTAINER (hbbAppOps), 6);
 
+  lblSessionStatus = gtk_label_new (NULL);
+  gtk_box_pack_start (GTK_BOX (hbbAppOps), lblSessionStatus, FALSE, FALSE, 0);
+  gtk_widget_set_visible (lblSessionStatus, FALSE);
+
   btnHelp = gtk_button_new_with_mnemonic (_("_About"));
   gtk_widget_add_css_class (btnHelp, "tsc-action");
   gtk_box_pack_start (GTK_BOX (hbbAppOps), btnHelp, FALSE, FALSE, 0);
@@ -1209,6 +1419,11 @@ create_frmConnect (void)
   gtk_widget_add_css_class (btnQuit, "tsc-action");
   gtk_box_pack_start (GTK_BOX (hbbAppOps), btnQuit, FALSE, FALSE, 0);
 
+  btnTest = gtk_button_new_with_mnemonic (_("Test Connect_ion"));
+  gtk_widget_add_css_class (btnTest, "tsc-action");
+  gtk_widget_set_tooltip_text (btnTest, _("Check the server's handshake without connecting."));
+  gtk_box_pack_start (GTK_BOX (hbbAppOps), btnTest, FALSE, FALSE, 0);
+
   btnConnect = gtk_button_new ();
   gtk_widget_add_css_class (btnConnect, "tsc-action");
   gtk_box_pack_start (GTK_BOX (hbbAppOps), btnConnect, FALSE, FALSE, 0);
@@ -1229,6 +1444,9 @@ create_frmConnect (void)
   g_signal_connect (G_OBJECT (btnConnect), "clicked",
                     G_CALLBACK (on_btnConnect_clicked),
                     NULL);
+  g_signal_connect (G_OBJECT (btnTest), "clicked",
+                    G_CALLBACK (on_btnTest_clicked),
+                    NULL);
   g_signal_connect (G_OBJECT (btnQuit), "clicked",
                     G_CALLBACK (on_btnQuit_clicked),
                     NULL);
@@ -1303,6 +1521,12 @@ create_frmConnect (void)
   HOOKUP_OBJECT (frmConnect, txtClientHostname, "txtClientHostname");
   HOOKUP_OBJECT (frmConnect, lblProtoFile, "lblProtoFile");
   HOOKUP_OBJECT (frmConnect, hbxProtoFile, "hbxProtoFile");
+  HOOKUP_OBJECT (frmConnect, lblProtocols, "lblProtocols");
+  HOOKUP_OBJECT (frmConnect, txtProtocols, "txtProtocols");
+  HOOKUP_OBJECT (frmConnect, lblPool, "lblPool");
+  HOOKUP_OBJECT (frmConnect, hbxPool, "hbxPool");
+  HOOKUP_OBJECT (frmConnect, txtPool, "txtPool");
+  HOOKUP_OBJECT (frmConnect, optPoolPolicy, "optPoolPolicy");
   HOOKUP_OBJECT (frmConnect, txtProtoFile, "txtProtoFile");
   HOOKUP_OBJECT (frmConnect, btnProtoFile, "btnProtoFile");
   HOOKUP_OBJECT (frmConnect, frameSecurity, "frameSecurity");
@@ -1315,6 +1539,7 @@ create_frmConnect (void)
   // Profile Launcher Widgets
   HOOKUP_OBJECT (frmConnect, hbxProfileLauncher, "hbxProfileLauncher");
   HOOKUP_OBJECT (frmConnect, optProfileLauncher, "optProfileLauncher");
+  HOOKUP_OBJECT (frmConnect, optGroupLauncher, "optGroupLauncher");
   // Profile File Ops Widgets
   HOOKUP_OBJECT (frmConnect, hbxFileOps, "hbxFileOps");
   HOOKUP_OBJECT (frmConnect, btnSaveAs, "btnSaveAs");
@@ -1391,6 +1616,8 @@ create_frmConnect (void)
   HOOKUP_OBJECT (frmConnect, txtProgramPath, "txtProgramPath");
   HOOKUP_OBJECT (frmConnect, lblStartFolder, "lblStartFolder");
   HOOKUP_OBJECT (frmConnect, txtStartFolder, "txtStartFolder");
+  HOOKUP_OBJECT (frmConnect, lblRestartPolicy, "lblRestartPolicy");
+  HOOKUP_OBJECT (frmConnect, optRestartPolicy, "optRestartPolicy");
 
   // Performance Tab Widgets
   HOOKUP_OBJECT (frmConnect, lblPerformanceTab1, "lblPerformanceTab1");
@@ -1402,6 +1629,20 @@ create_frmConnect (void)
   HOOKUP_OBJECT (frmConnect, imgPerform, "imgPerform");
   HOOKUP_OBJECT (frmConnect, lblPerformanceOptions, "lblPerformanceOptions");
   HOOKUP_OBJECT (frmConnect, vbxExpChecks, "vbxExpChecks");
+  HOOKUP_OBJECT (frmConnect, lblConnectionSpeed, "lblConnectionSpeed");
+  HOOKUP_OBJECT (frmConnect, optConnectionSpeed, "optConnectionSpeed");
+  HOOKUP_OBJECT (frmConnect, chkCompression, "chkCompression");
+  HOOKUP_OBJECT (frmConnect, lblRdpClient, "lblRdpClient");
+  HOOKUP_OBJECT (frmConnect, optRdpClient, "optRdpClient");
+  HOOKUP_OBJECT (frmConnect, lblGraphicsCodec, "lblGraphicsCodec");
+  HOOKUP_OBJECT (frmConnect, optGraphicsCodec, "optGraphicsCodec");
+  HOOKUP_OBJECT (frmConnect, chkGlyphCache, "chkGlyphCache");
+  HOOKUP_OBJECT (frmConnect, lblVncEncoding, "lblVncEncoding");
+  HOOKUP_OBJECT (frmConnect, optVncEncoding, "optVncEncoding");
+  HOOKUP_OBJECT (frmConnect, lblVncCompress, "lblVncCompress");
+  HOOKUP_OBJECT (frmConnect, optVncCompress, "optVncCompress");
+  HOOKUP_OBJECT (frmConnect, lblVncQuality, "lblVncQuality");
+  HOOKUP_OBJECT (frmConnect, optVncQuality, "optVncQuality");
   HOOKUP_OBJECT (frmConnect, chkDesktopBackground, "chkDesktopBackground");
   HOOKUP_OBJECT (frmConnect, chkWindowContent, "chkWindowContent");
   HOOKUP_OBJECT (frmConnect, chkAnimation, "chkAnimation");
@@ -1414,7 +1655,9 @@ create_frmConnect (void)
 
   // Complete Button Box Widgets
   HOOKUP_OBJECT (frmConnect, hbbAppOps, "hbbAppOps");
+  HOOKUP_OBJECT (frmConnect, btnTest, "btnTest");
   HOOKUP_OBJECT (frmConnect, btnConnect, "btnConnect");
+  HOOKUP_OBJECT (frmConnect, lblSessionStatus, "lblSessionStatus");
   HOOKUP_OBJECT (frmConnect, alnConnect, "alnConnect");
   HOOKUP_OBJECT (frmConnect, hbxConnect, "hbxConnect");
   HOOKUP_OBJECT (frmConnect, imgConnect, "imgConnect");
@@ -1438,13 +1681,13 @@ create_frmConnect (void)
   // load mru & profile launcher
   mru_to_screen (frmConnect);
   rdp_load_profile_launcher (frmConnect);
-
-  gtk_widget_set_visible (chkDesktopBackground, FALSE);
-  gtk_widget_set_visible (chkWindowContent, FALSE);
-  gtk_widget_set_visible (chkAnimation, FALSE);
-  gtk_widget_set_visible (chkThemes, FALSE);
+  rdp_load_group_launcher (frmConnect);
+  rdp_files_set_changed_func (tsc_reload_profiles, frmConnect);
 
   gConnect = frmConnect;
+  g_signal_connect (frmConnect, "destroy",
+                    G_CALLBACK (on_frmConnect_destroy), NULL);
+  tsc_session_status_update ();
   tsc_update_size_controls ();
   tsc_update_color_controls ();
 
@@ -1466,6 +1709,8 @@ on_btnConnect_clicked                  (GtkButton       *button,
 {
   GtkWidget *main_window;
   rdp_file *rdp = NULL;
+  TscTiming *timing;
+  gint64 start;
   gchar *home = tsc_home_path ();
   gchar *filename = g_build_path ("/", home, "last.tsc", NULL);
 
@@ -1475,36 +1720,55 @@ on_btnConnect_clicked                  (GtkButton       *button,
 
   main_window = lookup_widget((GtkWidget*)button, "frmConnect");
 
+  timing = tsc_timing_new ();
+  start = g_get_monotonic_time ();
   rdp = g_new0 (rdp_file, 1);
   rdp_file_init (rdp);
   rdp_file_get_screen (rdp, main_window);
+  tsc_timing_since (timing, TSC_PHASE_FORM_READ, start);
   // save the damn thing as last
+  start = g_get_monotonic_time ();
   rdp_file_save (rdp, filename);
-
-  gtk_widget_set_visible (main_window, FALSE);
-  gtk_window_destroy (GTK_WINDOW (main_window));
-
-  gchar** error = g_malloc(sizeof(gchar*));
-
-  if (tsc_launch_remote (rdp, 0, error) == 0) {
-    mru_add_server (rdp->full_address);
+  tsc_timing_since (timing, TSC_PHASE_SAVE, start);
+
+  // no point waiting out the client's connect timeout on a dead host;
+  // a pool skips its dead hosts itself
+  if (!*rdp->pool && tsc_probe_is_down (rdp->full_address, rdp->protocol)) {
+    tsc_connect_unreachable (rdp);
+    rdp_file_free (rdp);
+    g_free (timing);
   } else {
-    tsc_connect_error (rdp,*error);
+    // the supervisor takes it from here; failures come back as a
+    // reconnect countdown instead of a blocking dialog
+    tsc_connect_session (rdp, timing);
   }
-  if (*error)
-    g_free (*error);
-  g_free (error);
-
-  // recreate the main window
-  create_frmConnect ();
-  rdp_file_set_screen (rdp, gConnect);
-  g_free (rdp);
 
   g_free (filename);
   g_free (home);
 }
 
 
+void
+on_btnTest_clicked                     (GtkButton       *button,
+                                        gpointer         user_data)
+{
+  GtkWidget *main_window;
+  rdp_file *rdp = NULL;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("on_btnTest_clicked\n");
+  #endif
+
+  main_window = lookup_widget((GtkWidget*)button, "frmConnect");
+
+  rdp = g_new0 (rdp_file, 1);
+  rdp_file_init (rdp);
+  rdp_file_get_screen (rdp, main_window);
+  // the form takes what was changed to suit the server once the check is done
+  tsc_connect_test (rdp);
+}
+
+
 void
 on_btnQuit_clicked                     (GtkButton       *button,
                                         gpointer         user_data)
@@ -1526,16 +1790,28 @@ on_btnQuit_clicked                     (GtkButton       *button,
   rdp_file_init (rdp_last);
   rdp_file_get_screen (rdp_last, main_window);
   rdp_file_save (rdp_last, filename);
-  g_free (rdp_last);
+  rdp_file_free (rdp_last);
 
   g_free (filename);
   g_free (home);
 
-  if (tsc_app)
+  // a resident instance keeps running for the applets and the CLI
+  if (tsc_resident)
+    gtk_window_destroy (GTK_WINDOW (main_window));
+  else if (tsc_app)
     g_application_quit (G_APPLICATION (tsc_app));
 }
 
 
+void
+on_frmConnect_destroy                  (GtkWidget       *widget,
+                                        gpointer         user_data)
+{
+  if (gConnect == widget)
+    gConnect = NULL;
+}
+
+
 void
 on_btnHelp_clicked                     (GtkButton       *button,
                                         gpointer         user_data)
@@ -1598,6 +1874,13 @@ on_optColor2_clicked                   (GtkToggleButton *button,
   tsc_update_color_controls ();
 }
 
+static void
+on_computer_changed (GtkEditable *editable, gpointer user_data)
+{
+  // resolve while the user is still filling in the rest of the form
+  tsc_resolve_host_later (gtk_editable_get_text (editable));
+}
+
 static void
 on_recent_server_selected (GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_data)
 {
@@ -1656,7 +1939,7 @@ on_btnSaveAs_clicked                   (GtkButton       *button,
     rdp_file_init (rdp);
     rdp_file_get_screen (rdp, main_window);
     rdp_file_save (rdp, filename);
-    g_free (rdp);
+    rdp_file_free (rdp);
     // Add to quick pick list
     lastdelim = g_strrstr (filename, home);
     if (lastdelim) {
@@ -1708,7 +1991,7 @@ on_btnOpen_clicked                     (GtkButton       *button,
       rdp_file_init (rdp);
       rdp_file_load (rdp, filename);
       rdp_file_set_screen (rdp, main_window);
-      g_free (rdp);
+      rdp_file_free (rdp);
     }
     g_free (filename);
     g_object_unref (file);
@@ -1774,6 +2057,36 @@ on_chkStartProgram_toggled             (GtkToggleButton *togglebutton,
 }
 
 
+/* A preset fills in the experience boxes and locks them; Custom unlocks them. */
+static void
+on_connection_speed_changed (GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_data)
+{
+  (void) pspec;
+  GtkWidget *main_win = user_data ? GTK_WIDGET (user_data) : gConnect;
+  guint idx = MIN (gtk_drop_down_get_selected (dropdown), TSC_SPEED_PRESET_COUNT - 1);
+  const TscSpeedPreset *preset = &tsc_speed_presets[idx];
+  gboolean custom = preset->connection_type == TSC_SPEED_CUSTOM;
+  const gchar *boxes[] = { "chkCompression", "chkDesktopBackground", "chkWindowContent",
+                           "chkAnimation", "chkThemes", NULL };
+  gint i;
+
+  if (!custom) {
+    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (lookup_widget (main_win, "chkCompression")),
+                                  preset->compression == 1);
+    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (lookup_widget (main_win, "chkDesktopBackground")),
+                                  preset->disable_wallpaper != 1);
+    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (lookup_widget (main_win, "chkWindowContent")),
+                                  preset->disable_full_window_drag != 1);
+    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (lookup_widget (main_win, "chkAnimation")),
+                                  preset->disable_menu_anims != 1);
+    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (lookup_widget (main_win, "chkThemes")),
+                                  preset->disable_themes != 1);
+  }
+  for (i = 0; boxes[i]; i++)
+    gtk_widget_set_sensitive (lookup_widget (main_win, boxes[i]), custom);
+}
+
+
 void
 on_protocol_changed (GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_data)
 {
@@ -1801,4 +2114,6 @@ on_protocol_changed (GtkDropDown *dropdown, GParamSpec *pspec, gpointer user_dat
   }
 
   tsc_set_protocol_widgets (main_win, protocol);
+  // the recent servers are checked on the new protocol's port
+  mru_probe (main_win);
 }
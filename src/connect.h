@@ -8,8 +8,12 @@ int create_frmConnect (void);
 
 void on_btnConnect_clicked (GtkButton *button, gpointer user_data);
 
+void on_btnTest_clicked (GtkButton *button, gpointer user_data);
+
 void on_btnQuit_clicked (GtkButton *button, gpointer user_data);
 
+void on_frmConnect_destroy (GtkWidget *widget, gpointer user_data);
+
 void on_btnHelp_clicked (GtkButton *button, gpointer user_data);
 
 void on_optSize1_clicked (GtkToggleButton *button, gpointer user_data);
@@ -0,0 +1,780 @@
+/***************************************
+*                                      *
+*   Handshake Preflight                *
+*                                      *
+***************************************/
+
+/*
+ * A connection that is bound to fail can be told before the client is
+ * started, from the first packets of the server's own protocol:
+ *
+ *  - RDP gets three X.224 Connection Requests at once, offering TLS and
+ *    NLA, TLS only, and standard RDP security only.  The Confirms (or
+ *    negotiation failures) say which security layers the server takes;
+ *    a Confirm without a negotiation response is a server that only
+ *    speaks standard RDP security.  When asked, the TLS handshake is
+ *    then run on a connection that selected it, for the version.
+ *  - VNC must send its "RFB xxx.yyy" banner; the version is answered and
+ *    the security types the server offers are read, or the reason it
+ *    refuses the connection.
+ *
+ * tsc_handshake_apply turns that into a refusal with the reason, when
+ * the profile's settings or client cannot work with the server, or
+ * adjusts the settings rdesktop would otherwise get wrong.  All of it
+ * is bounded by [preflight] handshake-timeout-ms.  It runs before each
+ * launch with [preflight] handshake=true, and from Test Connection in
+ * the main window.  tsclient --handshake HOST PROTOCOL prints the check
+ * without connecting.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "probe.h"
+#include "handshake.h"
+#include "tsc-trace.h"
+
+/* RDP_NEG_REQ requestedProtocols, one request each */
+static const guchar tsc_handshake_offers[] = { 0x03, 0x01, 0x00 };
+#define TSC_HANDSHAKE_OFFERS G_N_ELEMENTS (tsc_handshake_offers)
+
+/* RDP_NEG_FAILURE failureCode */
+#define TSC_HANDSHAKE_SSL_REQUIRED        1
+#define TSC_HANDSHAKE_SSL_NOT_ALLOWED     2
+#define TSC_HANDSHAKE_CERT_NOT_ON_SERVER  3
+#define TSC_HANDSHAKE_HYBRID_REQUIRED     5
+#define TSC_HANDSHAKE_SSL_WITH_USER_AUTH  6
+
+
+/* ms since start, rounded up so a LAN round trip is 1 ms rather than 0 */
+static gint
+tsc_handshake_ms (gint64 start)
+{
+  return (gint) ((g_get_monotonic_time () - start + 999) / 1000);
+}
+
+
+static gboolean
+tsc_handshake_wait (GSocket *sock, GIOCondition condition, gint64 deadline)
+{
+  gint64 remaining = deadline - g_get_monotonic_time ();
+
+  return remaining > 0 &&
+         g_socket_condition_timed_wait (sock, condition, remaining, NULL, NULL);
+}
+
+
+/* Up to len bytes from sock, as many as came before deadline or the end. */
+static gsize
+tsc_handshake_read (GSocket *sock, guchar *buf, gsize len, gint64 deadline)
+{
+  gsize got = 0;
+
+  while (got < len) {
+    gssize n;
+
+    if (!tsc_handshake_wait (sock, G_IO_IN, deadline))
+      break;
+    n = g_socket_receive (sock, (gchar *) buf + got, len - got, NULL, NULL);
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  return got;
+}
+
+
+/* A non-blocking socket connecting to sockaddr, or NULL. */
+static GSocket *
+tsc_handshake_open (GSocketAddress *sockaddr)
+{
+  GSocket *sock;
+  GError *err = NULL;
+
+  sock = g_socket_new (g_socket_address_get_family (sockaddr), G_SOCKET_TYPE_STREAM,
+                       G_SOCKET_PROTOCOL_TCP, NULL);
+  if (!sock)
+    return NULL;
+  g_socket_set_blocking (sock, FALSE);
+  if (!g_socket_connect (sock, sockaddr, NULL, &err) &&
+      !g_error_matches (err, G_IO_ERROR, G_IO_ERROR_PENDING)) {
+    g_error_free (err);
+    g_object_unref (sock);
+    return NULL;
+  }
+  g_clear_error (&err);
+  return sock;
+}
+
+
+static gboolean
+tsc_handshake_connected (GSocket *sock, gint64 deadline)
+{
+  return tsc_handshake_wait (sock, G_IO_OUT, deadline) &&
+         g_socket_check_connect_result (sock, NULL);
+}
+
+
+static void
+tsc_handshake_drop (GSocket **sock)
+{
+  if (*sock) {
+    g_socket_close (*sock, NULL);
+    g_object_unref (*sock);
+    *sock = NULL;
+  }
+}
+
+
+static GSocketAddress *
+tsc_handshake_resolve (const gchar *address, gint protocol, guint16 *port)
+{
+  GSocketConnectable *connectable;
+  GSocketAddressEnumerator *enumerator;
+  GSocketAddress *sockaddr, *found;
+
+  connectable = g_network_address_parse (address, tsc_probe_default_port (protocol), NULL);
+  if (!connectable)
+    return NULL;
+  *port = g_network_address_get_port (G_NETWORK_ADDRESS (connectable));
+  // vncviewer reads host:N as display N
+  if (protocol == 1 && *port < 100)
+    *port += TSC_PORT_VNC;
+
+  enumerator = g_socket_connectable_enumerate (connectable);
+  found = g_socket_address_enumerator_next (enumerator, NULL, NULL);
+  g_object_unref (enumerator);
+  g_object_unref (connectable);
+  if (!found)
+    return NULL;
+
+  sockaddr = g_inet_socket_address_new (
+    g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (found)), *port);
+  g_object_unref (found);
+  return sockaddr;
+}
+
+
+/***************************************
+*                                      *
+*   RDP                                *
+*                                      *
+***************************************/
+
+/* Record whether the server takes the security layers in layers. */
+static void
+tsc_handshake_learn (TscHandshakeResult *result, guint layers, gboolean accepted)
+{
+  result->settled |= layers;
+  // one answer taking a layer outweighs another turning it down
+  if (accepted)
+    result->security |= layers;
+}
+
+
+/* What the answer to offer tells of the server; TRUE if it selected TLS or NLA. */
+static gboolean
+tsc_handshake_rdp_answer (TscHandshakeResult *result, guchar offer,
+                          const guchar *buf, gsize len)
+{
+  guint requested = (offer & 0x01 ? TSC_HANDSHAKE_TLS : 0) |
+                    (offer & 0x02 ? TSC_HANDSHAKE_NLA : 0);
+  guint32 value;
+
+  if (len < 19) {
+    // a Confirm without RDP_NEG_RSP: a server from before TLS
+    tsc_handshake_learn (result, TSC_HANDSHAKE_RDP, TRUE);
+    tsc_handshake_learn (result, TSC_HANDSHAKE_TLS | TSC_HANDSHAKE_NLA, FALSE);
+    return FALSE;
+  }
+
+  value = buf[15] | (buf[16] << 8) | (buf[17] << 16) | ((guint32) buf[18] << 24);
+  if (buf[11] == 0x02) {
+    switch (value) {
+    case 0:
+      tsc_handshake_learn (result, TSC_HANDSHAKE_RDP, TRUE);
+      tsc_handshake_learn (result, requested, FALSE);
+      return FALSE;
+    case 1:
+      tsc_handshake_learn (result, TSC_HANDSHAKE_TLS, TRUE);
+      tsc_handshake_learn (result, requested & TSC_HANDSHAKE_NLA, FALSE);
+      return TRUE;
+    default:
+      // CredSSP, or CredSSP with early user authorization
+      tsc_handshake_learn (result, TSC_HANDSHAKE_NLA, TRUE);
+      return TRUE;
+    }
+  }
+
+  if (buf[11] != 0x03)
+    return FALSE;
+  if (!result->failure)
+    result->failure = value;
+  switch (value) {
+  case TSC_HANDSHAKE_SSL_REQUIRED:
+    tsc_handshake_learn (result, TSC_HANDSHAKE_RDP, FALSE);
+    break;
+  case TSC_HANDSHAKE_SSL_NOT_ALLOWED:
+    tsc_handshake_learn (result, TSC_HANDSHAKE_TLS | TSC_HANDSHAKE_NLA, FALSE);
+    tsc_handshake_learn (result, TSC_HANDSHAKE_RDP, TRUE);
+    break;
+  case TSC_HANDSHAKE_CERT_NOT_ON_SERVER:
+    tsc_handshake_learn (result, TSC_HANDSHAKE_TLS | TSC_HANDSHAKE_NLA, FALSE);
+    break;
+  case TSC_HANDSHAKE_HYBRID_REQUIRED:
+  case TSC_HANDSHAKE_SSL_WITH_USER_AUTH:
+    tsc_handshake_learn (result, requested ? requested : TSC_HANDSHAKE_RDP, FALSE);
+    tsc_handshake_learn (result, TSC_HANDSHAKE_NLA, TRUE);
+    break;
+  }
+  return FALSE;
+}
+
+
+// RDP servers mostly use self-signed certificates; only the version is asked
+static gboolean
+tsc_handshake_accept_certificate (GTlsConnection *connection, GTlsCertificate *certificate,
+                                  GTlsCertificateFlags errors, gpointer user_data)
+{
+  return TRUE;
+}
+
+
+/* The TLS handshake on sock, which selected TLS or NLA. */
+static void
+tsc_handshake_tls (GSocket *sock, gint64 deadline, TscHandshakeResult *result)
+{
+  GSocketConnection *connection;
+  GIOStream *tls;
+  GError *err = NULL;
+  gint64 start, remaining = deadline - g_get_monotonic_time ();
+
+  if (remaining <= 0)
+    return;
+  g_socket_set_blocking (sock, TRUE);
+  g_socket_set_timeout (sock, (guint) MAX (1, (remaining + 999999) / 1000000));
+
+  connection = g_socket_connection_factory_create_connection (sock);
+  tls = g_tls_client_connection_new (G_IO_STREAM (connection), NULL, &err);
+  if (!tls) {
+    // no TLS backend: nothing to learn
+    g_error_free (err);
+    g_object_unref (connection);
+    return;
+  }
+  g_signal_connect (tls, "accept-certificate",
+                    G_CALLBACK (tsc_handshake_accept_certificate), NULL);
+
+  start = g_get_monotonic_time ();
+  if (g_tls_connection_handshake (G_TLS_CONNECTION (tls), NULL, &err)) {
+    result->tls_ms = tsc_handshake_ms (start);
+    switch (g_tls_connection_get_protocol_version (G_TLS_CONNECTION (tls))) {
+    case G_TLS_PROTOCOL_VERSION_TLS_1_0:
+      result->tls = "1.0";
+      break;
+    case G_TLS_PROTOCOL_VERSION_TLS_1_1:
+      result->tls = "1.1";
+      break;
+    case G_TLS_PROTOCOL_VERSION_TLS_1_2:
+      result->tls = "1.2";
+      break;
+    case G_TLS_PROTOCOL_VERSION_TLS_1_3:
+      result->tls = "1.3";
+      break;
+    default:
+      break;
+    }
+  } else {
+    // the server selected TLS, yet the handshake failed: an old protocol
+    // version is one cause among many (ciphers, certificate, a reset), so
+    // it is reported as it came and no version is guessed from it
+    if (g_error_matches (err, G_TLS_ERROR, G_TLS_ERROR_HANDSHAKE) ||
+        g_error_matches (err, G_TLS_ERROR, G_TLS_ERROR_MISC)) {
+      result->tls_failed = TRUE;
+      g_free (result->reason);
+      result->reason = g_strdup (err->message);
+    }
+    g_error_free (err);
+  }
+
+  g_io_stream_close (tls, NULL, NULL);
+  g_object_unref (tls);
+  g_object_unref (connection);
+}
+
+
+static void
+tsc_handshake_rdp (GSocketAddress *sockaddr, gint64 deadline, gboolean tls,
+                   TscHandshakeResult *result)
+{
+  GSocket *socks[TSC_HANDSHAKE_OFFERS];
+  gint64 start, sent[TSC_HANDSHAKE_OFFERS];
+  gint tls_sock = -1;
+  guint i;
+
+  // all three at once, so the check costs one round trip
+  start = g_get_monotonic_time ();
+  for (i = 0; i < TSC_HANDSHAKE_OFFERS; i++)
+    socks[i] = tsc_handshake_open (sockaddr);
+
+  for (i = 0; i < TSC_HANDSHAKE_OFFERS; i++) {
+    guchar request[] = {
+      0x03, 0x00, 0x00, 0x13,
+      0x0e, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x01, 0x00, 0x08, 0x00, tsc_handshake_offers[i], 0x00, 0x00, 0x00
+    };
+
+    if (!socks[i] || !tsc_handshake_connected (socks[i], deadline)) {
+      tsc_handshake_drop (&socks[i]);
+      continue;
+    }
+    if (!result->reachable) {
+      result->reachable = TRUE;
+      result->connect_ms = tsc_handshake_ms (start);
+    }
+    sent[i] = g_get_monotonic_time ();
+    if (g_socket_send (socks[i], (const gchar *) request, sizeof (request), NULL, NULL) < 0)
+      tsc_handshake_drop (&socks[i]);
+  }
+
+  for (i = 0; i < TSC_HANDSHAKE_OFFERS; i++) {
+    guchar buf[64];
+    gsize len, got;
+    gint ms;
+
+    if (!socks[i])
+      continue;
+    got = tsc_handshake_read (socks[i], buf, 4, deadline);
+    if (got < 4 || buf[0] != 0x03) {
+      // anything but a TPKT is some other server
+      if (got > 0 && buf[0] != 0x03)
+        result->foreign = TRUE;
+      tsc_handshake_drop (&socks[i]);
+      continue;
+    }
+    len = (buf[2] << 8) | buf[3];
+    if (len < 11 || len > sizeof (buf) ||
+        tsc_handshake_read (socks[i], buf + 4, len - 4, deadline) < len - 4 ||
+        (buf[5] & 0xf0) != 0xd0) {
+      result->foreign = TRUE;
+      tsc_handshake_drop (&socks[i]);
+      continue;
+    }
+
+    result->answered = TRUE;
+    ms = (gint) ((g_get_monotonic_time () - sent[i] + 999) / 1000);
+    if (result->handshake_ms < 0 || ms < result->handshake_ms)
+      result->handshake_ms = ms;
+    if (tsc_handshake_rdp_answer (result, tsc_handshake_offers[i], buf, len) && tls_sock < 0)
+      tls_sock = i;
+  }
+  // a server that spoke RDP is not some other server after all
+  if (result->answered)
+    result->foreign = FALSE;
+
+  if (tls && tls_sock >= 0)
+    tsc_handshake_tls (socks[tls_sock], deadline, result);
+
+  for (i = 0; i < TSC_HANDSHAKE_OFFERS; i++)
+    tsc_handshake_drop (&socks[i]);
+}
+
+
+/***************************************
+*                                      *
+*   VNC                                *
+*                                      *
+***************************************/
+
+static const gchar *
+tsc_handshake_vnc_type (guchar type)
+{
+  switch (type) {
+  case 1:  return "None";
+  case 2:  return "VNC password";
+  case 5:  return "RA2";
+  case 6:  return "RA2ne";
+  case 16: return "Tight";
+  case 17: return "Ultra";
+  case 18: return "TLS";
+  case 19: return "VeNCrypt";
+  case 20: return "SASL";
+  case 30: return "Apple";
+  default: return NULL;
+  }
+}
+
+
+/* The reason a VNC server gives for refusing, after a failed security step. */
+static void
+tsc_handshake_vnc_reason (GSocket *sock, gint64 deadline, TscHandshakeResult *result)
+{
+  guchar buf[256];
+  guint32 len;
+
+  if (tsc_handshake_read (sock, buf, 4, deadline) < 4)
+    return;
+  len = ((guint32) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+  len = tsc_handshake_read (sock, buf, MIN (len, sizeof (buf) - 1), deadline);
+  g_free (result->reason);
+  result->reason = g_utf8_make_valid ((const gchar *) buf, len);
+}
+
+
+static void
+tsc_handshake_vnc (GSocketAddress *sockaddr, gint64 deadline, TscHandshakeResult *result)
+{
+  GSocket *sock;
+  guchar buf[256];
+  const gchar *reply;
+  gint64 start;
+  gint minor;
+  gsize got;
+
+  start = g_get_monotonic_time ();
+  sock = tsc_handshake_open (sockaddr);
+  if (!sock || !tsc_handshake_connected (sock, deadline)) {
+    tsc_handshake_drop (&sock);
+    return;
+  }
+  result->reachable = TRUE;
+  result->connect_ms = tsc_handshake_ms (start);
+
+  start = g_get_monotonic_time ();
+  got = tsc_handshake_read (sock, buf, 12, deadline);
+  if (got < 12 || memcmp (buf, "RFB ", 4) != 0 || buf[11] != '\n') {
+    result->foreign = got > 0;
+    tsc_handshake_drop (&sock);
+    return;
+  }
+  result->answered = TRUE;
+  result->handshake_ms = tsc_handshake_ms (start);
+  result->rfb = g_strndup ((const gchar *) buf + 4, 7);
+
+  // the newest version both sides speak
+  minor = atoi ((const gchar *) buf + 8);
+  if (atoi ((const gchar *) buf + 4) > 3 || minor >= 8) {
+    reply = "RFB 003.008\n";
+    minor = 8;
+  } else if (minor == 7) {
+    reply = "RFB 003.007\n";
+  } else {
+    reply = "RFB 003.003\n";
+    minor = 3;
+  }
+  if (g_socket_send (sock, reply, 12, NULL, NULL) < 0) {
+    tsc_handshake_drop (&sock);
+    return;
+  }
+
+  if (minor >= 7) {
+    if (tsc_handshake_read (sock, buf, 1, deadline) == 1) {
+      gsize count = buf[0];
+
+      if (count == 0) {
+        result->n_vnc_types = 0;
+        tsc_handshake_vnc_reason (sock, deadline, result);
+      } else if (tsc_handshake_read (sock, buf, count, deadline) == count) {
+        result->n_vnc_types = MIN (count, TSC_HANDSHAKE_VNC_TYPES);
+        memcpy (result->vnc_types, buf, result->n_vnc_types);
+      }
+    }
+  } else if (tsc_handshake_read (sock, buf, 4, deadline) == 4) {
+    // 3.3: the server picks the one type
+    guint32 type = ((guint32) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+
+    if (type == 0) {
+      result->n_vnc_types = 0;
+      tsc_handshake_vnc_reason (sock, deadline, result);
+    } else {
+      result->n_vnc_types = 1;
+      result->vnc_types[0] = MIN (type, 255);
+    }
+  }
+
+  tsc_handshake_drop (&sock);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_handshake_check                *
+*                                      *
+***************************************/
+
+/*
+ * Check the handshake of protocol (RDP or VNC) at address, with the TLS
+ * handshake too when tls is set.  Returns 0 when the server answered as
+ * one; result is filled in either way, free it with
+ * tsc_handshake_result_clear.
+ */
+int tsc_handshake_check (const gchar *address, gint protocol, gboolean tls,
+                         TscHandshakeResult *result)
+{
+  gint timeout_ms = tsc_config_get_int ("preflight", "handshake-timeout-ms",
+                                        TSC_HANDSHAKE_TIMEOUT_DEFAULT);
+  GSocketAddress *sockaddr;
+  gint64 deadline;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_handshake_check: %s\n", address);
+  #endif
+
+  memset (result, 0, sizeof (TscHandshakeResult));
+  result->protocol = protocol;
+  result->connect_ms = -1;
+  result->handshake_ms = -1;
+  result->tls_ms = -1;
+  result->n_vnc_types = -1;
+
+  if (!address || !address[0] || (protocol != 0 && protocol != 4 && protocol != 1))
+    return 1;
+  sockaddr = tsc_handshake_resolve (address, protocol, &result->port);
+  if (!sockaddr)
+    return 1;
+
+  deadline = g_get_monotonic_time () + (gint64) MAX (1, timeout_ms) * 1000;
+  if (protocol == 1)
+    tsc_handshake_vnc (sockaddr, deadline, result);
+  else
+    tsc_handshake_rdp (sockaddr, deadline, tls, result);
+  g_object_unref (sockaddr);
+
+  TSC_TRACE3 (launch__handshake, address, result->security, result->handshake_ms);
+  return !result->answered;
+}
+
+
+void tsc_handshake_result_clear (TscHandshakeResult *result)
+{
+  g_free (result->rfb);
+  g_free (result->reason);
+  result->rfb = NULL;
+  result->reason = NULL;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_handshake_apply                *
+*                                      *
+***************************************/
+
+static gboolean
+tsc_handshake_refused (const TscHandshakeResult *result, guint layer)
+{
+  return (result->settled & layer) && !(result->security & layer);
+}
+
+
+/*
+ * Check rdp, to be launched with client, against what the server said.
+ * Returns 1 with *error set when the connection would fail; otherwise
+ * fixes what rdesktop would get wrong, with a line in changes (if given)
+ * for each, and returns 0.  A server that did not answer is left to the
+ * client and its retries.
+ */
+int tsc_handshake_apply (rdp_file *rdp, const gchar *client, const TscHandshakeResult *result,
+                         GString *changes, gchar **error)
+{
+  gboolean rdesktop = client && strcmp (client, "rdesktop") == 0;
+
+  if (error)
+    *error = NULL;
+
+  if (!result->answered) {
+    if (!result->foreign)
+      return 0;
+    if (error)
+      *error = g_strdup_printf (_("The server answered, but not as an %s server. "
+                                  "Check the port."),
+                                result->protocol == 1 ? "VNC" : "RDP");
+    return 1;
+  }
+
+  if (result->protocol == 1) {
+    if (result->n_vnc_types == 0) {
+      if (error)
+        *error = g_strdup_printf (_("The VNC server refused the connection: %s"),
+                                  result->reason && result->reason[0] ? result->reason
+                                                                      : _("no reason given"));
+      return 1;
+    }
+    return 0;
+  }
+
+  if (rdp->protocol == 0 && tsc_handshake_refused (result, TSC_HANDSHAKE_RDP)) {
+    if (error)
+      *error = g_strdup (_("The server requires TLS or NLA, which RDPv4 cannot do. "
+                           "Choose RDPv5 as the protocol."));
+    return 1;
+  }
+  if (rdesktop && tsc_handshake_refused (result, TSC_HANDSHAKE_RDP) &&
+      tsc_handshake_refused (result, TSC_HANDSHAKE_TLS)) {
+    if (error)
+      *error = g_strdup (_("The server only accepts NLA, which rdesktop cannot do with a password. "
+                           "Choose FreeRDP as the RDP client."));
+    return 1;
+  }
+
+  if (!rdesktop)
+    return 0;
+
+  // -e and -E only apply to standard RDP security
+  if ((rdp->disable_encryption || rdp->disable_client_encryption) &&
+      tsc_handshake_refused (result, TSC_HANDSHAKE_RDP)) {
+    rdp->disable_encryption = 0;
+    rdp->disable_client_encryption = 0;
+    if (changes)
+      g_string_append_printf (changes, "%s\n",
+                              _("Encryption is left on: the server requires TLS."));
+  }
+
+  if (result->tls && rdp->tls_version && rdp->tls_version[0] &&
+      strcmp (result->tls, rdp->tls_version) < 0) {
+    g_free (rdp->tls_version);
+    rdp->tls_version = g_strdup (result->tls);
+    if (changes)
+      g_string_append_printf (changes, _("TLS version %s, the newest the server speaks.\n"),
+                              result->tls);
+  }
+  return 0;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_handshake_describe             *
+*                                      *
+***************************************/
+
+static const gchar *
+tsc_handshake_layer (const TscHandshakeResult *result, guint layer)
+{
+  if (result->security & layer)
+    return _("yes");
+  if (result->settled & layer)
+    return _("no");
+  return _("unknown");
+}
+
+
+/* What the check found, a line each. */
+gchar *tsc_handshake_describe (const TscHandshakeResult *result)
+{
+  GString *text = g_string_new (NULL);
+  gint i;
+
+  if (!result->reachable) {
+    g_string_append_printf (text, _("port %d: no connection\n"), result->port);
+    return g_string_free (text, FALSE);
+  }
+  g_string_append_printf (text, _("port %d: connect %d ms"), result->port, result->connect_ms);
+  if (result->handshake_ms >= 0)
+    g_string_append_printf (text, _(", handshake %d ms"), result->handshake_ms);
+  g_string_append (text, "\n");
+
+  if (!result->answered) {
+    g_string_append (text, result->foreign ? _("answered as some other server\n")
+                                           : _("no handshake\n"));
+    return g_string_free (text, FALSE);
+  }
+
+  if (result->protocol == 1) {
+    g_string_append_printf (text, "RFB %s\n", result->rfb);
+    if (result->n_vnc_types == 0) {
+      g_string_append_printf (text, _("refused: %s\n"),
+                              result->reason && result->reason[0] ? result->reason
+                                                                  : _("no reason given"));
+    } else if (result->n_vnc_types > 0) {
+      g_string_append (text, _("security types:"));
+      for (i = 0; i < result->n_vnc_types; i++) {
+        const gchar *name = tsc_handshake_vnc_type (result->vnc_types[i]);
+
+        if (name)
+          g_string_append_printf (text, "%s %s", i ? "," : "", name);
+        else
+          g_string_append_printf (text, "%s %d", i ? "," : "", result->vnc_types[i]);
+      }
+      g_string_append (text, "\n");
+    }
+    return g_string_free (text, FALSE);
+  }
+
+  g_string_append_printf (text, _("RDP security %s, TLS %s, NLA %s\n"),
+                          tsc_handshake_layer (result, TSC_HANDSHAKE_RDP),
+                          tsc_handshake_layer (result, TSC_HANDSHAKE_TLS),
+                          tsc_handshake_layer (result, TSC_HANDSHAKE_NLA));
+  if (result->tls)
+    g_string_append_printf (text, _("TLS %s, handshake %d ms\n"), result->tls, result->tls_ms);
+  else if (result->tls_failed)
+    g_string_append_printf (text, _("TLS handshake failed (%s)\n"), result->reason);
+  return g_string_free (text, FALSE);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_handshake_report               *
+*                                      *
+***************************************/
+
+int tsc_handshake_report (const gchar *address, const gchar *protocol)
+{
+  static const gchar *const clients[] = { "rdesktop", "xfreerdp" };
+  TscHandshakeResult result;
+  gchar *text, **lines;
+  gint code, ret, i, j;
+
+  if (g_ascii_strcasecmp (protocol, "vnc") == 0)
+    code = 1;
+  else if (g_ascii_strcasecmp (protocol, "rdp4") == 0)
+    code = 0;
+  else
+    code = 4;
+
+  ret = tsc_handshake_check (address, code, TRUE, &result);
+
+  printf ("\n  %s\n\n", address);
+  text = tsc_handshake_describe (&result);
+  lines = g_strsplit (g_strchomp (text), "\n", -1);
+  for (i = 0; lines[i]; i++)
+    printf ("  %s\n", lines[i]);
+  g_strfreev (lines);
+  g_free (text);
+  printf ("\n");
+
+  // FreeRDP does not speak RDPv4
+  for (i = 0; i < (code == 4 ? (gint) G_N_ELEMENTS (clients) : 1); i++) {
+    const gchar *client = code == 1 ? "vncviewer" : clients[i];
+    GString *changes = g_string_new (NULL);
+    gchar *error = NULL;
+    rdp_file *rdp = g_new0 (rdp_file, 1);
+
+    rdp_file_init (rdp);
+    rdp->protocol = code;
+    if (tsc_handshake_apply (rdp, client, &result, changes, &error)) {
+      printf ("  %-10s %s\n", client, error);
+    } else if (changes->len) {
+      lines = g_strsplit (g_strchomp (changes->str), "\n", -1);
+      for (j = 0; lines[j]; j++)
+        printf ("  %-10s %s\n", j ? "" : client, lines[j]);
+      g_strfreev (lines);
+    } else
+      printf ("  %-10s %s\n", client, result.answered ? "ok" : "left to the client");
+    g_string_free (changes, TRUE);
+    g_free (error);
+    rdp_file_free (rdp);
+  }
+  printf ("\n");
+
+  tsc_handshake_result_clear (&result);
+  return ret;
+}
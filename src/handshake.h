@@ -0,0 +1,47 @@
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_HANDSHAKE_TIMEOUT_DEFAULT 2000
+#define TSC_HANDSHAKE_VNC_TYPES 16
+
+/* RDP security layers, as a server accepts them */
+#define TSC_HANDSHAKE_RDP 0x01
+#define TSC_HANDSHAKE_TLS 0x02
+#define TSC_HANDSHAKE_NLA 0x04
+
+typedef struct
+{
+  gint protocol;
+  guint16 port;
+  gboolean reachable;
+  gboolean answered;
+  gboolean foreign;
+  gint connect_ms;
+  gint handshake_ms;
+  guint security;
+  guint settled;
+  guint32 failure;
+  const gchar *tls;
+  gint tls_ms;
+  gboolean tls_failed;
+  gchar *rfb;
+  guchar vnc_types[TSC_HANDSHAKE_VNC_TYPES];
+  gint n_vnc_types;
+  gchar *reason;
+} TscHandshakeResult;
+
+int tsc_handshake_check (const gchar *address, gint protocol, gboolean tls,
+                         TscHandshakeResult *result);
+void tsc_handshake_result_clear (TscHandshakeResult *result);
+int tsc_handshake_apply (rdp_file *rdp, const gchar *client, const TscHandshakeResult *result,
+                         GString *changes, gchar **error);
+gchar *tsc_handshake_describe (const TscHandshakeResult *result);
+int tsc_handshake_report (const gchar *address, const gchar *protocol);
+
+#endif /* HANDSHAKE_H */
@@ -0,0 +1,437 @@
+/***************************************
+*                                      *
+*   Launch History                     *
+*                                      *
+***************************************/
+
+/*
+ * Every client start appends one line to ~/.tsclient/history.jsonl:
+ *
+ *   {"time":1760000000,"host":"ts1","protocol":4,"client":"rdesktop",
+ *    "status":0,"form_read":850,"save":410,"argv":95,"spawn":1210,...}
+ *
+ * Phase timings are in microseconds and only the phases that were
+ * measured are written; "first_output" is the first thing the client
+ * wrote to stderr and "exit" the whole session.  A status of -1 means
+ * the client never started.  The file moves to history.jsonl.1 once it
+ * reaches [history] max-kb (0 turns the log off).
+ *
+ * tsclient --stats [--host H] reads both files back and prints p50,
+ * p90 and p99 per phase and per host.
+ */
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "history.h"
+
+static const gchar *const tsc_phase_names[TSC_PHASE_COUNT] = {
+  "profile_load",
+  "form_read",
+  "save",
+  "find_program",
+  "argv",
+  "spawn",
+  "first_output",
+  "exit"
+};
+
+typedef struct {
+  gchar *host;
+  gchar *client;
+  gint status;
+  gint64 phase[TSC_PHASE_COUNT];
+} TscHistoryRecord;
+
+
+/***************************************
+*                                      *
+*   tsc_timing_new                     *
+*                                      *
+***************************************/
+
+TscTiming *tsc_timing_new (void)
+{
+  TscTiming *timing = g_new0 (TscTiming, 1);
+
+  tsc_timing_reset (timing);
+  return timing;
+}
+
+
+void tsc_timing_reset (TscTiming *timing)
+{
+  gint i;
+
+  for (i = 0; i < TSC_PHASE_COUNT; i++)
+    timing->phase[i] = -1;
+  timing->spawned = 0;
+}
+
+
+void tsc_timing_set (TscTiming *timing, TscPhase phase, gint64 usec)
+{
+  if (timing)
+    timing->phase[phase] = usec;
+}
+
+
+/* Record the time from start (monotonic) until now. */
+void tsc_timing_since (TscTiming *timing, TscPhase phase, gint64 start)
+{
+  if (timing)
+    timing->phase[phase] = g_get_monotonic_time () - start;
+}
+
+
+/* Click to first output: every measured phase but the session itself. */
+gint64 tsc_timing_connect (const TscTiming *timing)
+{
+  gint64 total = 0;
+  gint i;
+
+  for (i = 0; i < TSC_PHASE_COUNT; i++) {
+    if (i != TSC_PHASE_EXIT && timing->phase[i] >= 0)
+      total += timing->phase[i];
+  }
+  return total;
+}
+
+
+static gchar *
+tsc_history_file (const gchar *suffix)
+{
+  gchar *home = tsc_home_path ();
+  gchar *file_name = g_strconcat (home, "/history.jsonl", suffix, NULL);
+
+  g_free (home);
+  return file_name;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_history_append                 *
+*                                      *
+***************************************/
+
+void tsc_history_append (const TscTiming *timing, const gchar *host, gint protocol,
+                         const gchar *client, gint exit_status)
+{
+  gint max_kb = tsc_config_get_int ("history", "max-kb", TSC_HISTORY_MAX_KB_DEFAULT);
+  gchar *file_name, *escaped;
+  GString *line;
+  GStatBuf st;
+  FILE *fp;
+  gint i;
+
+  if (max_kb <= 0 || !timing)
+    return;
+
+  file_name = tsc_history_file (NULL);
+  if (g_stat (file_name, &st) == 0 && st.st_size >= (goffset) max_kb * 1024) {
+    gchar *old_name = tsc_history_file (".1");
+    g_rename (file_name, old_name);
+    g_free (old_name);
+  }
+
+  line = g_string_new (NULL);
+  escaped = g_strescape (host ? host : "", NULL);
+  g_string_append_printf (line, "{\"time\":%" G_GINT64_FORMAT ",\"host\":\"%s\",\"protocol\":%d",
+                          g_get_real_time () / G_USEC_PER_SEC, escaped, protocol);
+  g_free (escaped);
+  escaped = g_strescape (client ? client : "", NULL);
+  g_string_append_printf (line, ",\"client\":\"%s\",\"status\":%d", escaped, exit_status);
+  g_free (escaped);
+  for (i = 0; i < TSC_PHASE_COUNT; i++) {
+    if (timing->phase[i] >= 0)
+      g_string_append_printf (line, ",\"%s\":%" G_GINT64_FORMAT,
+                              tsc_phase_names[i], timing->phase[i]);
+  }
+  g_string_append (line, "}\n");
+
+  // one write per record, so concurrent instances do not interleave lines
+  fp = fopen (file_name, "a");
+  if (fp) {
+    fwrite (line->str, 1, line->len, fp);
+    fclose (fp);
+  } else {
+    g_warning ("Could not append to %s", file_name);
+  }
+
+  g_string_free (line, TRUE);
+  g_free (file_name);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_history_report                 *
+*                                      *
+***************************************/
+
+static gboolean
+tsc_history_parse (const gchar *text, TscHistoryRecord *record)
+{
+  GScanner *scanner = g_scanner_new (NULL);
+  gboolean success = FALSE;
+  gint i;
+
+  record->host = NULL;
+  record->client = NULL;
+  record->status = 0;
+  for (i = 0; i < TSC_PHASE_COUNT; i++)
+    record->phase[i] = -1;
+
+  scanner->config->store_int64 = TRUE;
+  g_scanner_input_text (scanner, text, strlen (text));
+  if (g_scanner_get_next_token (scanner) != '{') {
+    g_scanner_destroy (scanner);
+    return FALSE;
+  }
+
+  while (TRUE) {
+    GTokenType token = g_scanner_get_next_token (scanner);
+    gboolean negative = FALSE;
+    gchar *key;
+
+    if (token == '}') {
+      success = TRUE;
+      break;
+    }
+    if (token != G_TOKEN_STRING)
+      break;
+    key = g_strdup (scanner->value.v_string);
+    if (g_scanner_get_next_token (scanner) != ':') {
+      g_free (key);
+      break;
+    }
+
+    token = g_scanner_get_next_token (scanner);
+    if (token == '-') {
+      negative = TRUE;
+      token = g_scanner_get_next_token (scanner);
+    }
+    if (token == G_TOKEN_STRING && strcmp (key, "host") == 0) {
+      g_free (record->host);
+      record->host = g_strdup (scanner->value.v_string);
+    } else if (token == G_TOKEN_STRING && strcmp (key, "client") == 0) {
+      g_free (record->client);
+      record->client = g_strdup (scanner->value.v_string);
+    } else if (token == G_TOKEN_INT) {
+      if (strcmp (key, "status") == 0)
+        record->status = negative ? -(gint) scanner->value.v_int64 : (gint) scanner->value.v_int64;
+      for (i = 0; i < TSC_PHASE_COUNT; i++) {
+        if (strcmp (key, tsc_phase_names[i]) == 0)
+          record->phase[i] = scanner->value.v_int64;
+      }
+    } else if (token != G_TOKEN_STRING) {
+      g_free (key);
+      break;
+    }
+    g_free (key);
+
+    if (g_scanner_peek_next_token (scanner) == ',')
+      g_scanner_get_next_token (scanner);
+  }
+
+  g_scanner_destroy (scanner);
+  if (!success || !record->host) {
+    g_clear_pointer (&record->host, g_free);
+    g_clear_pointer (&record->client, g_free);
+  }
+  return record->host != NULL;
+}
+
+
+static gint
+tsc_history_compare (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+
+/* Nearest-rank percentile of a sorted array, in milliseconds. */
+static gdouble
+tsc_history_percentile (GArray *values, gint pct)
+{
+  guint rank = (pct * values->len + 99) / 100;
+
+  return g_array_index (values, gint64, MAX (rank, 1) - 1) / 1000.0;
+}
+
+
+static void
+tsc_history_print_row (const gchar *label, GArray *values)
+{
+  if (!values->len)
+    return;
+
+  g_array_sort (values, tsc_history_compare);
+  printf ("  %-24s %6u %10.1f %10.1f %10.1f\n", label, values->len,
+          tsc_history_percentile (values, 50),
+          tsc_history_percentile (values, 90),
+          tsc_history_percentile (values, 99));
+}
+
+
+static void
+tsc_history_read (const gchar *file_name, const gchar *host,
+                  GArray **phases, GHashTable *hosts, gint *records)
+{
+  gchar *contents = NULL;
+  gchar **lines;
+  gint i, j;
+
+  if (!g_file_get_contents (file_name, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    TscHistoryRecord record;
+    GArray *connect;
+    TscTiming timing;
+    gint64 total;
+
+    if (!*lines[i] || !tsc_history_parse (lines[i], &record))
+      continue;
+    g_free (record.client);
+    if (host && g_ascii_strcasecmp (host, record.host) != 0) {
+      g_free (record.host);
+      continue;
+    }
+
+    (*records)++;
+    for (j = 0; j < TSC_PHASE_COUNT; j++) {
+      timing.phase[j] = record.phase[j];
+      if (record.phase[j] >= 0)
+        g_array_append_val (phases[j], record.phase[j]);
+    }
+    total = tsc_timing_connect (&timing);
+
+    connect = g_hash_table_lookup (hosts, record.host);
+    if (!connect) {
+      connect = g_array_new (FALSE, FALSE, sizeof (gint64));
+      g_hash_table_insert (hosts, record.host, connect);
+    } else {
+      g_free (record.host);
+    }
+    g_array_append_val (connect, total);
+  }
+
+  g_strfreev (lines);
+  g_free (contents);
+}
+
+
+/* Append host's launches in file_name to launches, oldest first. */
+static void
+tsc_history_read_statuses (const gchar *file_name, const gchar *host, GArray *launches)
+{
+  gchar *contents = NULL;
+  gchar **lines;
+  gint i;
+
+  if (!g_file_get_contents (file_name, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    TscHistoryRecord record;
+
+    if (!*lines[i] || !tsc_history_parse (lines[i], &record))
+      continue;
+    if (g_ascii_strcasecmp (host, record.host) == 0) {
+      TscHistoryLaunch launch = { record.client, record.status };
+
+      g_array_append_val (launches, launch);
+    } else {
+      g_free (record.client);
+    }
+    g_free (record.host);
+  }
+
+  g_strfreev (lines);
+  g_free (contents);
+}
+
+
+static void
+tsc_history_launch_clear (gpointer data)
+{
+  g_free (((TscHistoryLaunch *) data)->client);
+}
+
+
+/* The client and exit status of host's last limit launches, oldest first. */
+GArray *tsc_history_statuses (const gchar *host, gint limit)
+{
+  GArray *statuses = g_array_new (FALSE, FALSE, sizeof (TscHistoryLaunch));
+  gchar *file_name;
+
+  g_array_set_clear_func (statuses, tsc_history_launch_clear);
+  file_name = tsc_history_file (".1");
+  tsc_history_read_statuses (file_name, host, statuses);
+  g_free (file_name);
+  file_name = tsc_history_file (NULL);
+  tsc_history_read_statuses (file_name, host, statuses);
+  g_free (file_name);
+
+  if (statuses->len > (guint) limit)
+    g_array_remove_range (statuses, 0, statuses->len - limit);
+  return statuses;
+}
+
+
+/* Print the percentile report; returns 1 when there is no history. */
+int tsc_history_report (const gchar *host)
+{
+  GArray *phases[TSC_PHASE_COUNT];
+  GHashTable *hosts;
+  GList *names, *lptr;
+  gchar *file_name;
+  gint records = 0;
+  gint i;
+
+  hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                 (GDestroyNotify) g_array_unref);
+  for (i = 0; i < TSC_PHASE_COUNT; i++)
+    phases[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  file_name = tsc_history_file (".1");
+  tsc_history_read (file_name, host, phases, hosts, &records);
+  g_free (file_name);
+  file_name = tsc_history_file (NULL);
+  tsc_history_read (file_name, host, phases, hosts, &records);
+
+  if (!records) {
+    printf ("  no launches recorded in %s%s%s\n", file_name,
+            host ? " for " : "", host ? host : "");
+  } else {
+    printf ("\n  %d launches from %s\n\n", records, file_name);
+    printf ("  %-24s %6s %10s %10s %10s\n", "phase (ms)", "n", "p50", "p90", "p99");
+    for (i = 0; i < TSC_PHASE_COUNT; i++)
+      tsc_history_print_row (tsc_phase_names[i], phases[i]);
+
+    printf ("\n  %-24s %6s %10s %10s %10s\n", "connect by host (ms)", "n", "p50", "p90", "p99");
+    names = g_list_sort (g_hash_table_get_keys (hosts), (GCompareFunc) g_ascii_strcasecmp);
+    for (lptr = names; lptr; lptr = lptr->next)
+      tsc_history_print_row (lptr->data, g_hash_table_lookup (hosts, lptr->data));
+    g_list_free (names);
+    printf ("\n");
+  }
+
+  for (i = 0; i < TSC_PHASE_COUNT; i++)
+    g_array_unref (phases[i]);
+  g_hash_table_destroy (hosts);
+  g_free (file_name);
+
+  return records ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_HISTORY_MAX_KB_DEFAULT 1024
+
+typedef enum
+{
+  TSC_PHASE_PROFILE_LOAD,
+  TSC_PHASE_FORM_READ,
+  TSC_PHASE_SAVE,
+  TSC_PHASE_FIND_PROGRAM,
+  TSC_PHASE_ARGV,
+  TSC_PHASE_SPAWN,
+  TSC_PHASE_FIRST_OUTPUT,
+  TSC_PHASE_EXIT,
+  TSC_PHASE_COUNT
+} TscPhase;
+
+typedef struct
+{
+  gint64 phase[TSC_PHASE_COUNT];
+  gint64 spawned;
+} TscTiming;
+
+typedef struct
+{
+  gchar *client;
+  gint status;
+} TscHistoryLaunch;
+
+TscTiming *tsc_timing_new (void);
+void tsc_timing_reset (TscTiming *timing);
+void tsc_timing_set (TscTiming *timing, TscPhase phase, gint64 usec);
+void tsc_timing_since (TscTiming *timing, TscPhase phase, gint64 start);
+gint64 tsc_timing_connect (const TscTiming *timing);
+void tsc_history_append (const TscTiming *timing, const gchar *host, gint protocol,
+                         const gchar *client, gint exit_status);
+int tsc_history_report (const gchar *host);
+GArray *tsc_history_statuses (const gchar *host, gint limit);
+
+#endif /* HISTORY_H */
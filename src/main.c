@@ -6,11 +6,25 @@
 #include <sys/types.h> 
 #include <sys/stat.h> 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "main.h"
 #include "rdpfile.h"
 #include "connect.h"
 #include "support.h"
+#include "session.h"
+#include "history.h"
+#include "metrics.h"
+#include "profiles.h"
+#include "bundle.h"
+#include "adapt.h"
+#include "preflight.h"
+#include "pool.h"
+#include "handshake.h"
+#include "cache.h"
+#include "probe.h"
+#include "resolve.h"
+#include "service.h"
 #include "rdpfile.h"
 #include "connect.h"
 #include "support.h"
@@ -18,21 +32,36 @@
 static void tsc_print_help (void);
 static void tsc_print_version (void);
 static void tsc_activate (GtkApplication *app, gpointer user_data);
+static void tsc_startup (GApplication *app, gpointer user_data);
+static void tsc_shutdown (GApplication *app, gpointer user_data);
 static void tsc_add_dev_pixmap_dirs (const char *argv0);
+static int tsc_supervise (GPtrArray *files, GPtrArray *groups);
 
 typedef struct {
   gchar *rdp_file_name;
+  gboolean service;
 } TscStartupContext;
 
 GtkApplication *tsc_app = NULL;
+gboolean tsc_resident = FALSE;
 
 int
 main (int argc, char *argv[])
 {
-  gint i;
+  gint i, ret = 0;
   TscStartupContext ctx = {0};
   gchar *home, *tsc_default, *tsc_last;
-  rdp_file *rdp = NULL;
+  GPtrArray *launch_files = g_ptr_array_new ();
+  GPtrArray *launch_groups = g_ptr_array_new ();
+  gint max_sessions = -1, stagger = -1;
+  gboolean stats = FALSE, reindex = FALSE;
+  const gchar *stats_host = NULL;
+  const gchar *pack_dir = NULL, *pack_out = NULL;
+  const gchar *adapt_host = NULL;
+  const gchar *preflight_host = NULL, *preflight_protocols = NULL;
+  const gchar *pool_list = NULL, *pool_policy = NULL;
+  const gchar *handshake_host = NULL, *handshake_protocol = NULL;
+  gboolean cache_report = FALSE, probe_report = FALSE;
 
   #ifdef TSCLIENT_DEBUG
   printf ("debugging messages are on\n");
@@ -66,53 +95,249 @@ main (int argc, char *argv[])
   for (i = 1; i < argc; i++) {
     if (strcmp("--help", argv[i]) == 0 || strcmp("-h", argv[i]) == 0) {
       tsc_print_help ();
-      g_free (ctx.rdp_file_name);
-      g_free (tsc_last);
-      g_free (tsc_default);
-      return 0;
+      goto out;
     }
     if (strcmp("--version", argv[i]) == 0 || strcmp("-v", argv[i]) == 0) {
       tsc_print_version ();
-      g_free (ctx.rdp_file_name);
-      g_free (tsc_last);
-      g_free (tsc_default);
-      return 0;
+      goto out;
     }
     if (strcmp("-x", argv[i]) == 0 && (i + 1) < argc) {
-      if (g_file_test (argv[i+1], G_FILE_TEST_EXISTS)) {
-        rdp = g_new0 (rdp_file, 1);
-        rdp_file_init (rdp);
-        rdp_file_load (rdp, argv[i+1]);
-        gchar **error = g_malloc (sizeof (gchar*));
-        if (tsc_launch_remote (rdp, 1, error) == 0) {
-          g_free (rdp);
-          g_free (error);
-          g_free (ctx.rdp_file_name);
-          g_free (tsc_last);
-          g_free (tsc_default);
-          return 0;
-        }
-        if (*error)
-          g_free (*error);
-        g_free (error);
-        g_free (rdp);
+      // every following argument up to the next option is a file, and
+      // after "--" every argument is, so -x -- -foo.rdp works
+      while ((i + 1) < argc && argv[i+1][0] != '-')
+        g_ptr_array_add (launch_files, argv[++i]);
+      if ((i + 1) < argc && strcmp ("--", argv[i+1]) == 0) {
+        i++;
+        while ((i + 1) < argc)
+          g_ptr_array_add (launch_files, argv[++i]);
       }
+    } else if ((strcmp("-g", argv[i]) == 0 || strcmp("--group", argv[i]) == 0) && (i + 1) < argc) {
+      g_ptr_array_add (launch_groups, argv[++i]);
+    } else if (strcmp("--max-sessions", argv[i]) == 0 && (i + 1) < argc) {
+      max_sessions = atoi (argv[++i]);
+    } else if (strcmp("--stagger", argv[i]) == 0 && (i + 1) < argc) {
+      stagger = atoi (argv[++i]);
+    } else if (strcmp("--service", argv[i]) == 0) {
+      ctx.service = TRUE;
+    } else if (strcmp("--stats", argv[i]) == 0) {
+      stats = TRUE;
+    } else if (strcmp("--pack", argv[i]) == 0 && (i + 2) < argc) {
+      pack_dir = argv[++i];
+      pack_out = argv[++i];
+    } else if (strcmp("--index", argv[i]) == 0) {
+      reindex = TRUE;
+    } else if (strcmp("--adapt", argv[i]) == 0 && (i + 1) < argc) {
+      adapt_host = argv[++i];
+    } else if (strcmp("--preflight", argv[i]) == 0 && (i + 2) < argc) {
+      preflight_host = argv[++i];
+      preflight_protocols = argv[++i];
+    } else if (strcmp("--pool", argv[i]) == 0 && (i + 2) < argc) {
+      pool_list = argv[++i];
+      pool_policy = argv[++i];
+    } else if (strcmp("--handshake", argv[i]) == 0 && (i + 2) < argc) {
+      handshake_host = argv[++i];
+      handshake_protocol = argv[++i];
+    } else if (strcmp("--cache", argv[i]) == 0) {
+      cache_report = TRUE;
+    } else if (strcmp("--probe", argv[i]) == 0) {
+      probe_report = TRUE;
+    } else if (strcmp("--host", argv[i]) == 0 && (i + 1) < argc) {
+      stats_host = argv[++i];
     } else if (g_file_test (argv[i], G_FILE_TEST_EXISTS)) {
       g_free (ctx.rdp_file_name);
       ctx.rdp_file_name = g_strdup (argv[i]);
     }
   }
 
-  tsc_app = gtk_application_new ("com.tsclient.app", G_APPLICATION_DEFAULT_FLAGS);
+  if (stats) {
+    ret = tsc_history_report (stats_host);
+    goto out;
+  }
+
+  if (pack_dir) {
+    gchar *error = NULL;
+
+    ret = tsc_bundle_pack (pack_dir, pack_out, &error);
+    if (error) {
+      printf ("  %s\n", error);
+      g_free (error);
+    }
+    goto out;
+  }
+
+  if (reindex) {
+    ret = tsc_profiles_update () < 0 ? 1 : 0;
+    goto out;
+  }
+
+  if (adapt_host) {
+    ret = tsc_adapt_report (adapt_host);
+    goto out;
+  }
+
+  if (preflight_host) {
+    ret = tsc_preflight_report (preflight_host, preflight_protocols);
+    goto out;
+  }
+
+  if (pool_list) {
+    ret = tsc_pool_report (pool_list, pool_policy, 4);
+    goto out;
+  }
+
+  if (handshake_host) {
+    ret = tsc_handshake_report (handshake_host, handshake_protocol);
+    goto out;
+  }
+
+  if (cache_report) {
+    ret = tsc_cache_report ();
+    goto out;
+  }
+
+  if (probe_report) {
+    ret = tsc_probe_report ();
+    goto out;
+  }
+
+  if (launch_files->len || launch_groups->len) {
+    tsc_session_set_limits (max_sessions, stagger, -1);
+    ret = tsc_supervise (launch_files, launch_groups);
+    goto out;
+  }
+
+  tsc_app = gtk_application_new (TSC_SERVICE_NAME, G_APPLICATION_DEFAULT_FLAGS);
   gtk_window_set_default_icon_name ("tsclient");
+  g_signal_connect (tsc_app, "startup", G_CALLBACK (tsc_startup), NULL);
+  g_signal_connect (tsc_app, "shutdown", G_CALLBACK (tsc_shutdown), NULL);
   g_signal_connect (tsc_app, "activate", G_CALLBACK (tsc_activate), &ctx);
-  g_application_run (G_APPLICATION (tsc_app), argc, argv);
+
+  if (ctx.service) {
+    if (!g_application_register (G_APPLICATION (tsc_app), NULL, NULL) ||
+        g_application_get_is_remote (G_APPLICATION (tsc_app))) {
+      printf ("  tsclient is already running\n");
+      g_object_unref (tsc_app);
+      goto out;
+    }
+    // stay resident with no window until someone activates us
+    tsc_resident = TRUE;
+    tsc_profiles_update ();
+    g_application_hold (G_APPLICATION (tsc_app));
+  }
+
+  // our own options are already handled, GApplication would reject them
+  g_application_run (G_APPLICATION (tsc_app), 1, argv);
   g_object_unref (tsc_app);
 
+out:
+  g_ptr_array_free (launch_files, TRUE);
+  g_ptr_array_free (launch_groups, TRUE);
   g_free (ctx.rdp_file_name);
   g_free (tsc_last);
   g_free (tsc_default);
-  return 0;
+  return ret;
+}
+
+static void
+tsc_supervise_changed (TscSession *session, gpointer user_data)
+{
+  GMainLoop *loop = user_data;
+
+  switch (session->state) {
+  case TSC_SESSION_QUEUED:
+    if (session->restarts)
+      printf ("  %s: restarting (%d)\n", session->name, session->restarts);
+    break;
+  case TSC_SESSION_RUNNING:
+    if (session->display >= 0)
+      printf ("  %s: running on :%d (pid %d)\n", session->name, session->display, (int) session->pid);
+    else
+      printf ("  %s: running (pid %d)\n", session->name, (int) session->pid);
+    break;
+  case TSC_SESSION_EXITED:
+    printf ("  %s: exited\n", session->name);
+    break;
+  case TSC_SESSION_RETRYING:
+    printf ("  %s: %s reconnecting in %d ms (attempt %d)\n", session->name,
+            tsc_reconnect_describe (session->failure),
+            (int) ((session->retry_at - g_get_monotonic_time ()) / 1000),
+            session->attempts);
+    break;
+  case TSC_SESSION_FAILED:
+    if (session->error)
+      printf ("  %s: failed: %s\n", session->name, session->error);
+    else
+      printf ("  %s: failed (status %d)\n", session->name, session->exit_status);
+    break;
+  }
+  fflush (stdout);
+
+  if (!tsc_session_pending ())
+    g_main_loop_quit (loop);
+}
+
+/* Run every -x file and -g group under the supervisor until all exit. */
+static int
+tsc_supervise (GPtrArray *files, GPtrArray *groups)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  TscSessionStats stats;
+  gchar *status;
+  guint i;
+  GSList *paths = NULL, *lptr;
+  gint forwarded = 0;
+  gboolean try_service = TRUE;
+
+  tsc_session_add_notify (tsc_supervise_changed, loop);
+
+  for (i = 0; i < files->len; i++)
+    paths = g_slist_append (paths, g_canonicalize_filename (g_ptr_array_index (files, i), NULL));
+  for (i = 0; i < groups->len; i++) {
+    if (rdp_files_in_group (g_ptr_array_index (groups, i), &paths) == 0)
+      printf ("  no profiles found in group %s\n", (gchar *) g_ptr_array_index (groups, i));
+  }
+
+  // a running instance is already warm, let it do the work
+  for (lptr = paths; lptr; lptr = lptr->next) {
+    gchar *error = NULL;
+
+    if (try_service && g_file_test (lptr->data, G_FILE_TEST_IS_REGULAR)) {
+      if (tsc_service_launch (lptr->data, NULL) == 0) {
+        printf ("  %s: handed to the running tsclient\n", (gchar *) lptr->data);
+        forwarded++;
+        continue;
+      }
+      try_service = FALSE;
+    }
+    if (tsc_session_queue_file (lptr->data, &error) != 0) {
+      printf ("  %s\n", error);
+      g_free (error);
+    }
+  }
+  g_slist_free_full (paths, g_free);
+
+  if (tsc_session_pending ())
+    g_main_loop_run (loop);
+  tsc_session_remove_notify (tsc_supervise_changed, loop);
+  g_main_loop_unref (loop);
+  tsc_metrics_flush ();
+
+  status = tsc_session_stats_text ();
+  printf ("  %s\n", status);
+  g_free (status);
+  status = tsc_reconnect_stats_text ();
+  if (status)
+    printf ("  %s\n", status);
+  g_free (status);
+  status = tsc_resolve_stats_text ();
+  if (status)
+    printf ("  %s\n", status);
+  g_free (status);
+
+  tsc_session_get_stats (&stats);
+  if (stats.failed)
+    return 1;
+  return (forwarded || stats.exited) ? 0 : 1;
 }
 
 static void
@@ -127,11 +352,25 @@ tsc_apply_rdp_defaults (TscStartupContext *ctx)
   rdp_file_init (rdp);
   rdp_file_load (rdp, ctx->rdp_file_name);
   rdp_file_set_screen (rdp, gConnect);
-  g_free (rdp);
+  rdp_file_free (rdp);
 
   g_clear_pointer (&ctx->rdp_file_name, g_free);
 }
 
+static void
+tsc_startup (GApplication *app, gpointer user_data)
+{
+  tsc_service_register (app);
+  tsc_freerdp_prefetch ();
+}
+
+static void
+tsc_shutdown (GApplication *app, gpointer user_data)
+{
+  tsc_service_unregister ();
+  tsc_metrics_flush ();
+}
+
 static void
 tsc_activate (GtkApplication *app, gpointer user_data)
 {
@@ -139,6 +378,12 @@ tsc_activate (GtkApplication *app, gpointer user_data)
 
   tsc_register_icon_theme_dirs ();
 
+  if (ctx->service) {
+    // the activation from our own g_application_run, keep quiet
+    ctx->service = FALSE;
+    return;
+  }
+
   if (!gConnect)
     create_frmConnect ();
 
@@ -200,7 +445,27 @@ void tsc_print_help () {
   printf ("  FILE           an rdp format file containing options\n");
   printf ("  -h, --help     display this help and exit\n");
   printf ("  -v, --version  output version information and exit\n");
-  printf ("  -x FILE        launch rdesktop with options specified in FILE\n");
+  printf ("  -x FILE...     launch rdesktop with options specified in each FILE\n");
+  printf ("                 (-x -- FILE... for files whose names start with -)\n");
+  printf ("  -g, --group GROUP\n");
+  printf ("                 launch every profile in the ~/.tsclient/GROUP folder\n");
+  printf ("  --max-sessions N\n");
+  printf ("                 start at most N sessions at once (0 = no limit)\n");
+  printf ("  --stagger MS   wait MS milliseconds between session starts\n");
+  printf ("  --service      stay resident and accept launches over D-Bus\n");
+  printf ("  --stats        print launch timing percentiles from the history log\n");
+  printf ("  --host HOST    limit --stats to one host\n");
+  printf ("  --index        refresh ~/.tsclient/profiles.idx for the panel applets\n");
+  printf ("  --pack DIR OUT pack the profiles under DIR into the bundle OUT\n");
+  printf ("  --adapt HOST   print the speed an automatic profile would get for HOST\n");
+  printf ("  --preflight HOST LIST\n");
+  printf ("                 race the protocols in LIST (\"rdp,vnc:1\") on HOST and print the winner\n");
+  printf ("  --pool LIST POLICY\n");
+  printf ("                 check the RDP hosts in LIST (\"ts1,ts2\") and print which POLICY would pick\n");
+  printf ("  --handshake HOST PROTOCOL\n");
+  printf ("                 check HOST's rdp, rdp4 or vnc handshake and print what a launch would make of it\n");
+  printf ("  --cache        print the size and age of each host's bitmap cache\n");
+  printf ("  --probe        check every profile's host as the Quick Connect list does\n");
   printf ("\n");
   return;
 
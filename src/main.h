@@ -3,3 +3,4 @@
 #include <gtk/gtk.h>
 
 extern GtkApplication *tsc_app;
+extern gboolean tsc_resident;
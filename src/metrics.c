@@ -0,0 +1,557 @@
+/***************************************
+*                                      *
+*   Metrics Exporter                   *
+*                                      *
+***************************************/
+
+/*
+ * Writes launcher and session metrics in the Prometheus text format for
+ * node_exporter's textfile collector.  Point [metrics] file in
+ * ~/.tsclient/tsclient.conf at a .prom file in the collector directory:
+ *
+ *   [metrics]
+ *   file=/var/lib/node_exporter/textfile/tsclient.prom
+ *   interval-ms=5000
+ *
+ * The file is rewritten after session state changes and profile scans,
+ * at most once per interval-ms, through a temporary file and a rename so
+ * the collector never reads half of it.  Nothing is written while file
+ * is unset.
+ *
+ * The main window, the service and -x runs may all share one file, so
+ * each write takes an flock on file.lock, reads back what is there and
+ * adds what this process counted since its last write.  Counters,
+ * histograms and the session gauges add up that way; the profile and
+ * bitmap cache gauges describe ~/.tsclient itself, so the last writer's
+ * value stands.
+ */
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "session.h"
+#include "resolve.h"
+#include "cache.h"
+#include "metrics.h"
+
+typedef struct {
+  guint64 counts[TSC_METRICS_BUCKETS];
+  gdouble sum;
+  guint64 count;
+} TscHistogram;
+
+typedef struct {
+  gchar *help;
+  gchar *type;
+  GPtrArray *series;
+} TscMetricsFamily;
+
+/* A parsed exposition: families in order, and the value of every series. */
+typedef struct {
+  GPtrArray *names;
+  GHashTable *families;
+  GHashTable *values;
+} TscMetricsDoc;
+
+/* gauges of shared state, where the last writer is right */
+static const gchar *const tsc_metrics_shared[] = {
+  "tsclient_profiles",
+  "tsclient_bitmap_cache_bytes",
+  "tsclient_bitmap_cache_hosts",
+  NULL
+};
+
+/* upper bounds in seconds; the last bucket is +Inf */
+static const gdouble connect_bounds[TSC_METRICS_BUCKETS - 1] = {
+  0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30
+};
+static const gdouble scan_bounds[TSC_METRICS_BUCKETS - 1] = {
+  0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1
+};
+
+static gboolean loaded = FALSE;
+static gchar *file_name = NULL;
+static gint interval_ms = TSC_METRICS_INTERVAL_DEFAULT;
+
+static GHashTable *launches = NULL;
+static TscHistogram connect_hist = {{0}};
+static TscHistogram scan_hist = {{0}};
+static gint profiles = -1;
+
+static gint64 last_write = 0;
+static guint write_id = 0;
+static gboolean dirty = FALSE;
+static GHashTable *written = NULL;
+
+
+static void
+tsc_metrics_init (void)
+{
+  if (loaded)
+    return;
+
+  file_name = tsc_config_get_string ("metrics", "file");
+  interval_ms = MAX (tsc_config_get_int ("metrics", "interval-ms", TSC_METRICS_INTERVAL_DEFAULT), 0);
+  launches = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  loaded = TRUE;
+}
+
+
+static const gchar *
+tsc_metrics_protocol (gint protocol)
+{
+  switch (protocol) {
+  case 0:
+    return "rdp4";
+  case 4:
+    return "rdp5";
+  case 1:
+    return "vnc";
+  case 2:
+    return "xdmcp";
+  case 3:
+    return "ica";
+  default:
+    return "other";
+  }
+}
+
+
+static void
+tsc_histogram_observe (TscHistogram *hist, const gdouble *bounds, gdouble value)
+{
+  gint i;
+
+  for (i = 0; i < TSC_METRICS_BUCKETS - 1 && value > bounds[i]; i++)
+    ;
+  hist->counts[i]++;
+  hist->sum += value;
+  hist->count++;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_metrics_launch                 *
+*                                      *
+***************************************/
+
+/*
+ * Count one client start.  outcome is "spawn" when it never ran, else
+ * how it ended (see tsc_reconnect_name).
+ */
+void tsc_metrics_launch (gint protocol, const gchar *outcome)
+{
+  gchar *labels;
+  gint count;
+
+  tsc_metrics_init ();
+  labels = g_strdup_printf ("protocol=\"%s\",outcome=\"%s\"",
+                            tsc_metrics_protocol (protocol), outcome);
+  count = GPOINTER_TO_INT (g_hash_table_lookup (launches, labels));
+  g_hash_table_replace (launches, labels, GINT_TO_POINTER (count + 1));
+  tsc_metrics_changed ();
+}
+
+
+/* A session reached RUNNING connect_us after Connect was pressed. */
+void tsc_metrics_connect (gint64 connect_us)
+{
+  tsc_metrics_init ();
+  tsc_histogram_observe (&connect_hist, connect_bounds, connect_us / 1e6);
+  tsc_metrics_changed ();
+}
+
+
+/* A scan of ~/.tsclient found count profiles in elapsed_us. */
+void tsc_metrics_scan (gint count, gint64 elapsed_us)
+{
+  tsc_metrics_init ();
+  profiles = count;
+  tsc_histogram_observe (&scan_hist, scan_bounds, elapsed_us / 1e6);
+  tsc_metrics_changed ();
+}
+
+
+/***************************************
+*                                      *
+*   tsc_metrics_text                   *
+*                                      *
+***************************************/
+
+static void
+tsc_metrics_header (GString *out, const gchar *name, const gchar *type, const gchar *help)
+{
+  g_string_append_printf (out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+static void
+tsc_metrics_histogram (GString *out, const gchar *name, const gchar *help,
+                       const TscHistogram *hist, const gdouble *bounds)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  guint64 cumulative = 0;
+  gint i;
+
+  // g_ascii_dtostr keeps the C locale whatever LC_NUMERIC says
+  tsc_metrics_header (out, name, "histogram", help);
+  for (i = 0; i < TSC_METRICS_BUCKETS - 1; i++) {
+    cumulative += hist->counts[i];
+    g_string_append_printf (out, "%s_bucket{le=\"%s\"} %" G_GUINT64_FORMAT "\n", name,
+                            g_ascii_dtostr (buf, sizeof (buf), bounds[i]), cumulative);
+  }
+  g_string_append_printf (out, "%s_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+                          name, hist->count);
+  g_string_append_printf (out, "%s_sum %s\n", name,
+                          g_ascii_dtostr (buf, sizeof (buf), hist->sum));
+  g_string_append_printf (out, "%s_count %" G_GUINT64_FORMAT "\n", name, hist->count);
+}
+
+
+/* Everything we export, in the Prometheus text format. */
+gchar *tsc_metrics_text (void)
+{
+  GString *out = g_string_new (NULL);
+  TscSessionStats sessions;
+  TscReconnectStats reconnects;
+  TscResolveStats dns;
+  TscCacheStats cache;
+  GList *keys, *lptr;
+
+  tsc_metrics_init ();
+  tsc_session_get_stats (&sessions);
+  tsc_reconnect_get_stats (&reconnects);
+  tsc_resolve_get_stats (&dns);
+  tsc_cache_get_stats (&cache);
+
+  tsc_metrics_header (out, "tsclient_launches_total", "counter",
+                      "Client starts by protocol and outcome.");
+  keys = g_list_sort (g_hash_table_get_keys (launches), (GCompareFunc) strcmp);
+  for (lptr = keys; lptr; lptr = lptr->next)
+    g_string_append_printf (out, "tsclient_launches_total{%s} %d\n", (gchar *) lptr->data,
+                            GPOINTER_TO_INT (g_hash_table_lookup (launches, lptr->data)));
+  g_list_free (keys);
+
+  tsc_metrics_histogram (out, "tsclient_connect_seconds",
+                         "Time from Connect until the client was running.",
+                         &connect_hist, connect_bounds);
+
+  tsc_metrics_header (out, "tsclient_sessions", "gauge", "Sessions by state.");
+  g_string_append_printf (out, "tsclient_sessions{state=\"running\"} %d\n", sessions.running);
+  g_string_append_printf (out, "tsclient_sessions{state=\"queued\"} %d\n", sessions.queued);
+
+  tsc_metrics_header (out, "tsclient_reconnects_total", "counter",
+                      "Reconnect attempts after transient failures, and how they ended.");
+  g_string_append_printf (out, "tsclient_reconnects_total{result=\"attempt\"} %d\n", reconnects.attempts);
+  g_string_append_printf (out, "tsclient_reconnects_total{result=\"recovered\"} %d\n", reconnects.recovered);
+  g_string_append_printf (out, "tsclient_reconnects_total{result=\"given_up\"} %d\n", reconnects.given_up);
+
+  tsc_metrics_header (out, "tsclient_restarts_total", "counter",
+                      "Sessions restarted by their restart policy.");
+  g_string_append_printf (out, "tsclient_restarts_total %d\n", sessions.restarts);
+
+  tsc_metrics_header (out, "tsclient_dns_cache_total", "counter",
+                      "Connects that found their host in the DNS cache, or not.");
+  g_string_append_printf (out, "tsclient_dns_cache_total{result=\"hit\"} %d\n", dns.hits);
+  g_string_append_printf (out, "tsclient_dns_cache_total{result=\"miss\"} %d\n", dns.misses);
+
+  if (cache.bytes >= 0) {
+    tsc_metrics_header (out, "tsclient_bitmap_cache_bytes", "gauge",
+                        "Size of the per-host persistent bitmap caches after the last trim.");
+    g_string_append_printf (out, "tsclient_bitmap_cache_bytes %" G_GINT64_FORMAT "\n", cache.bytes);
+    tsc_metrics_header (out, "tsclient_bitmap_cache_hosts", "gauge",
+                        "Hosts with a persistent bitmap cache after the last trim.");
+    g_string_append_printf (out, "tsclient_bitmap_cache_hosts %d\n", cache.hosts);
+    tsc_metrics_header (out, "tsclient_bitmap_cache_evictions_total", "counter",
+                        "Host caches removed to stay within the budget.");
+    g_string_append_printf (out, "tsclient_bitmap_cache_evictions_total %d\n", cache.evictions);
+    tsc_metrics_header (out, "tsclient_bitmap_cache_evicted_bytes_total", "counter",
+                        "Bytes freed by those removals.");
+    g_string_append_printf (out, "tsclient_bitmap_cache_evicted_bytes_total %" G_GINT64_FORMAT "\n",
+                            cache.evicted_bytes);
+  }
+
+  if (profiles >= 0) {
+    tsc_metrics_header (out, "tsclient_profiles", "gauge",
+                        "Profiles found by the last scan of ~/.tsclient.");
+    g_string_append_printf (out, "tsclient_profiles %d\n", profiles);
+    tsc_metrics_histogram (out, "tsclient_profile_scan_seconds",
+                           "Time taken to scan ~/.tsclient for profiles.",
+                           &scan_hist, scan_bounds);
+  }
+
+  return g_string_free (out, FALSE);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_metrics_changed                *
+*                                      *
+***************************************/
+
+static void
+tsc_metrics_family_free (TscMetricsFamily *family)
+{
+  g_free (family->help);
+  g_free (family->type);
+  g_ptr_array_unref (family->series);
+  g_free (family);
+}
+
+
+static void
+tsc_metrics_doc_init (TscMetricsDoc *doc)
+{
+  doc->names = g_ptr_array_new_with_free_func (g_free);
+  doc->families = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify) tsc_metrics_family_free);
+  doc->values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+
+static void
+tsc_metrics_doc_clear (TscMetricsDoc *doc)
+{
+  g_ptr_array_unref (doc->names);
+  g_hash_table_destroy (doc->families);
+  g_hash_table_destroy (doc->values);
+}
+
+
+static TscMetricsFamily *
+tsc_metrics_doc_family (TscMetricsDoc *doc, const gchar *name)
+{
+  TscMetricsFamily *family = g_hash_table_lookup (doc->families, name);
+
+  if (!family) {
+    family = g_new0 (TscMetricsFamily, 1);
+    family->help = g_strdup ("");
+    family->type = g_strdup ("untyped");
+    family->series = g_ptr_array_new_with_free_func (g_free);
+    g_hash_table_insert (doc->families, g_strdup (name), family);
+    g_ptr_array_add (doc->names, g_strdup (name));
+  }
+  return family;
+}
+
+
+static void
+tsc_metrics_doc_set (TscMetricsDoc *doc, TscMetricsFamily *family,
+                     const gchar *series, gdouble value)
+{
+  gdouble *slot = g_hash_table_lookup (doc->values, series);
+
+  if (!slot) {
+    slot = g_new (gdouble, 1);
+    g_hash_table_insert (doc->values, g_strdup (series), slot);
+    g_ptr_array_add (family->series, g_strdup (series));
+  }
+  *slot = value;
+}
+
+
+/* Read text in the format tsc_metrics_text writes; samples before any header are dropped. */
+static void
+tsc_metrics_doc_parse (TscMetricsDoc *doc, const gchar *text)
+{
+  gchar **lines = g_strsplit (text, "\n", -1);
+  TscMetricsFamily *family = NULL;
+  gint i;
+
+  for (i = 0; lines[i]; i++) {
+    gchar *line = lines[i], *space, *end;
+    gdouble value;
+
+    if (g_str_has_prefix (line, "# HELP ") || g_str_has_prefix (line, "# TYPE ")) {
+      gboolean help = line[2] == 'H';
+      gchar **field;
+
+      space = strchr (line + 7, ' ');
+      if (!space)
+        continue;
+      *space = '\0';
+      family = tsc_metrics_doc_family (doc, line + 7);
+      field = help ? &family->help : &family->type;
+      g_free (*field);
+      *field = g_strdup (space + 1);
+      continue;
+    }
+    if (!family || !*line || *line == '#' || !(space = strrchr (line, ' ')))
+      continue;
+    *space = '\0';
+    value = g_ascii_strtod (space + 1, &end);
+    if (end != space + 1)
+      tsc_metrics_doc_set (doc, family, line, value);
+  }
+  g_strfreev (lines);
+}
+
+
+static gchar *
+tsc_metrics_doc_text (TscMetricsDoc *doc)
+{
+  GString *out = g_string_new (NULL);
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  guint i, j;
+
+  for (i = 0; i < doc->names->len; i++) {
+    const gchar *name = g_ptr_array_index (doc->names, i);
+    TscMetricsFamily *family = g_hash_table_lookup (doc->families, name);
+
+    tsc_metrics_header (out, name, family->type, family->help);
+    for (j = 0; j < family->series->len; j++) {
+      const gchar *series = g_ptr_array_index (family->series, j);
+      gdouble *value = g_hash_table_lookup (doc->values, series);
+
+      g_string_append_printf (out, "%s %s\n", series,
+                              g_ascii_dtostr (buf, sizeof (buf), *value));
+    }
+  }
+  return g_string_free (out, FALSE);
+}
+
+
+/*
+ * Fold what this process counted since its last write into the file's
+ * contents old, and remember what was folded in.
+ */
+static gchar *
+tsc_metrics_merge (const gchar *old)
+{
+  TscMetricsDoc doc, own;
+  gchar *text;
+  guint i, j;
+
+  tsc_metrics_doc_init (&doc);
+  tsc_metrics_doc_init (&own);
+  tsc_metrics_doc_parse (&doc, old);
+  text = tsc_metrics_text ();
+  tsc_metrics_doc_parse (&own, text);
+  g_free (text);
+
+  if (!written)
+    written = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  for (i = 0; i < own.names->len; i++) {
+    const gchar *name = g_ptr_array_index (own.names, i);
+    TscMetricsFamily *mine = g_hash_table_lookup (own.families, name);
+    TscMetricsFamily *family = tsc_metrics_doc_family (&doc, name);
+    gboolean shared = strcmp (mine->type, "gauge") == 0 &&
+                      g_strv_contains (tsc_metrics_shared, name);
+
+    // ours describes the metric as this version exports it
+    g_free (family->help);
+    family->help = g_strdup (mine->help);
+    g_free (family->type);
+    family->type = g_strdup (mine->type);
+
+    for (j = 0; j < mine->series->len; j++) {
+      const gchar *series = g_ptr_array_index (mine->series, j);
+      gdouble value = *(gdouble *) g_hash_table_lookup (own.values, series);
+      gdouble *before = g_hash_table_lookup (doc.values, series);
+      gdouble *sent = g_hash_table_lookup (written, series);
+      gdouble merged = value;
+
+      if (!shared)
+        merged = (before ? *before : 0) + value - (sent ? *sent : 0);
+      tsc_metrics_doc_set (&doc, family, series, merged);
+
+      if (!sent) {
+        sent = g_new (gdouble, 1);
+        g_hash_table_insert (written, g_strdup (series), sent);
+      }
+      *sent = value;
+    }
+  }
+
+  text = tsc_metrics_doc_text (&doc);
+  tsc_metrics_doc_clear (&own);
+  tsc_metrics_doc_clear (&doc);
+  return text;
+}
+
+
+static void
+tsc_metrics_write (void)
+{
+  GError *err = NULL;
+  gchar *lock_name, *old = NULL, *text;
+  int fd;
+
+  dirty = FALSE;
+  last_write = g_get_monotonic_time ();
+
+  lock_name = g_strconcat (file_name, ".lock", NULL);
+  fd = open (lock_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0 || flock (fd, LOCK_EX) != 0) {
+    g_warning ("Could not lock %s", lock_name);
+    if (fd >= 0)
+      close (fd);
+    g_free (lock_name);
+    return;
+  }
+
+  g_file_get_contents (file_name, &old, NULL, NULL);
+  text = tsc_metrics_merge (old ? old : "");
+  // g_file_set_contents writes a temporary file and renames it over
+  if (!g_file_set_contents (file_name, text, -1, &err)) {
+    g_warning ("Could not write %s: %s", file_name, err->message);
+    g_error_free (err);
+  }
+
+  close (fd);
+  g_free (text);
+  g_free (old);
+  g_free (lock_name);
+}
+
+
+static gboolean
+tsc_metrics_write_cb (gpointer user_data)
+{
+  write_id = 0;
+  tsc_metrics_write ();
+  return G_SOURCE_REMOVE;
+}
+
+
+/* Something worth exporting changed; write now or once the interval is up. */
+void tsc_metrics_changed (void)
+{
+  gint64 elapsed;
+
+  tsc_metrics_init ();
+  if (!file_name)
+    return;
+
+  dirty = TRUE;
+  if (write_id)
+    return;
+
+  elapsed = (g_get_monotonic_time () - last_write) / 1000;
+  if (!last_write || elapsed >= interval_ms)
+    tsc_metrics_write ();
+  else
+    write_id = g_timeout_add (interval_ms - elapsed, tsc_metrics_write_cb, NULL);
+}
+
+
+/* Write anything still held back by the rate limit, before exiting. */
+void tsc_metrics_flush (void)
+{
+  if (write_id) {
+    g_source_remove (write_id);
+    write_id = 0;
+  }
+  if (dirty && file_name)
+    tsc_metrics_write ();
+}
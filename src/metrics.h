@@ -0,0 +1,20 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_METRICS_INTERVAL_DEFAULT 5000
+#define TSC_METRICS_BUCKETS 10
+
+void tsc_metrics_launch (gint protocol, const gchar *outcome);
+void tsc_metrics_connect (gint64 connect_us);
+void tsc_metrics_scan (gint count, gint64 elapsed_us);
+void tsc_metrics_changed (void);
+void tsc_metrics_flush (void);
+gchar *tsc_metrics_text (void);
+
+#endif /* METRICS_H */
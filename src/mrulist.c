@@ -12,24 +12,351 @@
 #include <string.h>
 #include <sys/types.h> 
 #include <sys/stat.h> 
+#include <sys/file.h>
 #include <dirent.h> 
+#include <fcntl.h>
+#include <unistd.h>
 #include <glib/gi18n.h>
 
 #include "mrulist.h"
 #include "rdpfile.h"
 #include "support.h"
+#include "probe.h"
+#include "resolve.h"
+#include "tsc-trace.h"
 
 static int mru_file_to_list (GSList** list);
-static int mru_list_to_file (GSList** list);
 static gboolean mru_file_to_list_json (GSList **list, const gchar *data, gsize length);
 static int mru_file_to_list_legacy (GSList **list, const gchar *mru_filename);
 
+/*
+ * Recent servers live in ~/.tsclient/mru.log, one line per event:
+ *
+ *   <unix time> TAB <visits> TAB <server> TAB <protocol> TAB <profile>
+ *     TAB <status> TAB <connect ms> TAB <session seconds>
+ *
+ * A connect appends a line with one visit, protocol and profile; the
+ * end of the session appends one with no visit, how it ended ("ok" or
+ * a tsc_reconnect_name), the connect latency and how long it ran.
+ * Later lines win, empty fields keep what was known.  Once the log passes
+ * TSC_MRU_COMPACT_BYTES the lines are folded into one per server (the
+ * latest time and the sum of the visits) and the file is replaced.
+ * Every access holds an flock on ~/.tsclient/mru.lock, which is never
+ * replaced, so the main window, -x runs and the applets never lose each
+ * other's entries.
+ *
+ * Servers are ranked by frecency: visits weighted by how long ago the
+ * last one was, as Firefox ranks its history.  The old mru.tsc list is
+ * imported the first time the log is missing.
+ */
+
+/* age (days) and weight of the frecency buckets, newest first */
+static const struct {
+  gint days;
+  gint weight;
+} mru_buckets[] = {
+  { 4, 100 },
+  { 14, 70 },
+  { 31, 50 },
+  { 90, 30 },
+  { G_MAXINT, 10 }
+};
+
+#define MRU_FIELDS 8
+
+static GHashTable *shown = NULL;
+
+
+static gchar *
+mru_log_file (void)
+{
+  gchar *home = tsc_home_path ();
+  gchar *file_name = g_build_path ("/", home, "mru.log", NULL);
+
+  g_free (home);
+  return file_name;
+}
+
+
+/*
+ * Take the lock every access to the log holds.  It is on a file of its
+ * own, so compaction can rename a new log over the old one and creating
+ * the log for the import is covered as well.
+ */
+static int
+mru_log_lock (int operation)
+{
+  gchar *home = tsc_home_path ();
+  gchar *lock_name = g_build_path ("/", home, "mru.lock", NULL);
+  int fd;
+
+  fd = open (lock_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd >= 0 && flock (fd, operation) != 0) {
+    close (fd);
+    fd = -1;
+  }
+
+  g_free (lock_name);
+  g_free (home);
+  return fd;
+}
+
+
+/* Open the log; the caller holds mru_log_lock. */
+static int
+mru_log_open (int flags)
+{
+  gchar *file_name = mru_log_file ();
+  int fd = open (file_name, flags | O_CLOEXEC, 0600);
+
+  g_free (file_name);
+  return fd;
+}
+
+
+static gchar *
+mru_log_read (int fd)
+{
+  GString *text = g_string_new (NULL);
+  gchar buf[4096];
+  ssize_t len;
+
+  lseek (fd, 0, SEEK_SET);
+  while ((len = read (fd, buf, sizeof (buf))) > 0)
+    g_string_append_len (text, buf, len);
+  return g_string_free (text, FALSE);
+}
+
+
+void mru_entry_init (TscMruEntry *entry)
+{
+  memset (entry, 0, sizeof (TscMruEntry));
+  entry->protocol = -1;
+  entry->connect_ms = -1;
+  entry->duration_s = -1;
+}
+
+
+void mru_entry_free (TscMruEntry *entry)
+{
+  g_free (entry->server);
+  g_free (entry->profile);
+  g_free (entry);
+}
+
+
+/*
+ * Fold the log's lines into one entry per server.  Splits text in
+ * place rather than with g_strsplit: a thousand servers' worth of log
+ * parses in well under a millisecond.
+ */
+static GHashTable *
+mru_log_parse (gchar *text)
+{
+  GHashTable *entries;
+  gchar *line, *next;
+
+  entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                   (GDestroyNotify) mru_entry_free);
+  for (line = text; line && *line; line = next) {
+    gchar *fields[MRU_FIELDS], *ptr = line;
+    TscMruEntry *entry;
+    gint n = 0;
+
+    next = strchr (line, '\n');
+    if (next)
+      *next++ = '\0';
+    while (n < MRU_FIELDS) {
+      fields[n++] = ptr;
+      ptr = strchr (ptr, '\t');
+      if (!ptr)
+        break;
+      *ptr++ = '\0';
+    }
+    if (n < 3 || !*fields[2])
+      continue;
+
+    entry = g_hash_table_lookup (entries, fields[2]);
+    if (!entry) {
+      entry = g_new (TscMruEntry, 1);
+      mru_entry_init (entry);
+      entry->server = g_strdup (fields[2]);
+      g_hash_table_insert (entries, entry->server, entry);
+    }
+    entry->last = MAX (entry->last, g_ascii_strtoll (fields[0], NULL, 10));
+    entry->visits += MAX (atoi (fields[1]), 0);
+
+    if (n > 3 && *fields[3])
+      entry->protocol = atoi (fields[3]);
+    if (n > 4 && *fields[4] && g_strcmp0 (entry->profile, fields[4]) != 0) {
+      g_free (entry->profile);
+      entry->profile = g_strdup (fields[4]);
+    }
+    if (n > 5 && *fields[5]) {
+      entry->status = g_intern_string (fields[5]);
+      entry->connect_ms = n > 6 && *fields[6] ? atoi (fields[6]) : -1;
+      entry->duration_s = n > 7 && *fields[7] ? atoi (fields[7]) : -1;
+    }
+  }
+
+  return entries;
+}
+
+
+static gint
+mru_compare (gconstpointer a, gconstpointer b)
+{
+  const TscMruEntry *x = a, *y = b;
+
+  if (x->score != y->score)
+    return x->score < y->score ? 1 : -1;
+  return (x->last < y->last) - (x->last > y->last);
+}
+
+
+/* Rank and free the table's entries; keeps the best max of them. */
+static GList *
+mru_rank (GHashTable *entries, gint max)
+{
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  GHashTableIter iter;
+  GList *ranked = NULL, *rest;
+  gpointer value;
+  guint i;
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    TscMruEntry *entry = value;
+    gint64 days = (now - entry->last) / (24 * 60 * 60);
+
+    for (i = 0; days >= mru_buckets[i].days; i++)
+      ;
+    entry->score = entry->visits * mru_buckets[i].weight;
+    // a server that failed last time drops below its peers
+    if (entry->status && strcmp (entry->status, "ok") != 0)
+      entry->score /= 2;
+    g_hash_table_iter_steal (&iter);
+    ranked = g_list_prepend (ranked, entry);
+  }
+  g_hash_table_destroy (entries);
+
+  ranked = g_list_sort (ranked, mru_compare);
+  rest = max > 0 ? g_list_nth (ranked, max) : NULL;
+  if (rest) {
+    rest->prev->next = NULL;
+    rest->prev = NULL;
+    g_list_free_full (rest, (GDestroyNotify) mru_entry_free);
+  }
+  return ranked;
+}
+
+
+static void
+mru_log_append (GString *line, const TscMruEntry *entry)
+{
+  g_string_append_printf (line, "%" G_GINT64_FORMAT "\t%d\t%s\t",
+                          entry->last, entry->visits, entry->server);
+  if (entry->protocol >= 0)
+    g_string_append_printf (line, "%d", entry->protocol);
+  g_string_append_printf (line, "\t%s\t%s\t", entry->profile ? entry->profile : "",
+                          entry->status ? entry->status : "");
+  if (entry->connect_ms >= 0)
+    g_string_append_printf (line, "%d", entry->connect_ms);
+  g_string_append_c (line, '\t');
+  if (entry->duration_s >= 0)
+    g_string_append_printf (line, "%d", entry->duration_s);
+  g_string_append_c (line, '\n');
+}
+
+
+/* Rewrite the log as one line per server; the caller holds the lock. */
+static void
+mru_log_compact (int fd)
+{
+  gchar *text, *file_name;
+  GHashTable *entries;
+  GList *ranked, *lptr;
+  GString *out;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("mru_log_compact\n");
+  #endif
+
+  text = mru_log_read (fd);
+  entries = mru_log_parse (text);
+  g_free (text);
+  ranked = mru_rank (entries, TSC_MRU_KEEP);
+
+  // oldest first, as if the visits had been appended in that order
+  out = g_string_new (NULL);
+  for (lptr = g_list_last (ranked); lptr; lptr = lptr->prev)
+    mru_log_append (out, lptr->data);
+
+  file_name = mru_log_file ();
+  if (!g_file_set_contents (file_name, out->str, out->len, NULL))
+    g_warning ("Could not write %s", file_name);
+
+  g_free (file_name);
+  g_string_free (out, TRUE);
+  g_list_free_full (ranked, (GDestroyNotify) mru_entry_free);
+}
+
+
+/* Seed the log from mru.tsc, keeping its order, the first time round. */
+static void
+mru_log_import (void)
+{
+  gchar *file_name = mru_log_file ();
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  GSList *list = NULL, *lptr;
+  GString *out;
+  gint i, fd, lock;
+  gboolean exists = g_file_test (file_name, G_FILE_TEST_EXISTS);
+
+  g_free (file_name);
+  if (exists)
+    return;
+
+  // whoever gets the lock first imports, the others find the log there
+  lock = mru_log_lock (LOCK_EX);
+  if (lock < 0)
+    return;
+  fd = mru_log_open (O_WRONLY | O_CREAT | O_EXCL);
+  if (fd < 0) {
+    close (lock);
+    return;
+  }
+
+  mru_file_to_list (&list);
+  list = g_slist_reverse (list);
+  out = g_string_new (NULL);
+  for (lptr = list, i = g_slist_length (list); lptr; lptr = lptr->next, i--) {
+    TscMruEntry entry;
+
+    mru_entry_init (&entry);
+    entry.server = lptr->data;
+    entry.visits = 1;
+    entry.last = now - i;
+    if (!strpbrk (entry.server, "\t\r\n"))
+      mru_log_append (out, &entry);
+  }
+  if (write (fd, out->str, out->len) != (ssize_t) out->len)
+    g_warning ("Could not import mru.tsc");
+
+  close (fd);
+  close (lock);
+  g_string_free (out, TRUE);
+  g_slist_free_full (list, g_free);
+}
+
+
 /***************************************
 *                                      *
 *   mru_file_to_list                   *
 *                                      *
 ***************************************/
 
+/* The pre-3.5 list, read once to seed mru.log. */
 int mru_file_to_list (GSList** list)
 {
   gchar *mru_filename;
@@ -63,51 +390,6 @@ int mru_file_to_list (GSList** list)
   return ret;
 }
 
-
-/***************************************
-*                                      *
-*   mru_list_to_file                   *
-*                                      *
-***************************************/
- 
-int mru_list_to_file (GSList** list)
-{
-  GSList* lptr = NULL;
-  gchar *mru_filename;
-  GString *json;
-  gboolean ok;
-  int i;
-  gboolean first = TRUE;
-
-  #ifdef TSCLIENT_DEBUG
-  printf ("mru_list_to_file\n");
-  #endif
-
-  mru_filename = g_build_path ("/", tsc_home_path(), "mru.tsc", NULL);
-
-  json = g_string_new ("[\\n");
-  lptr = *list;
-  i = 0;
-  while ((lptr != NULL && i <= 10)) {
-    gchar *escaped = g_strescape ((gchar*)lptr->data, NULL);
-    g_string_append_printf (json, "%s  \\\"%s\\\"",
-                            first ? "" : ",\\n",
-                            escaped);
-    g_free (escaped);
-    lptr = lptr->next;
-    i++;
-    first = FALSE;
-  }
-  g_string_append (json, "\\n]\\n");
-
-  ok = g_file_set_contents (mru_filename, json->str, json->len, NULL);
-
-  g_string_free (json, TRUE);
-  g_free (mru_filename);
-
-  return ok ? 0 : 1;
-}
-
 static gboolean
 mru_file_to_list_json (GSList **list, const gchar *data, gsize length)
 {
@@ -175,6 +457,48 @@ mru_file_to_list_legacy (GSList **list, const gchar *mru_filename)
 }
 
 
+/***************************************
+*                                      *
+*   mru_load                           *
+*                                      *
+***************************************/
+
+/*
+ * The recent servers, best first; at most max of them, or the [mru]
+ * size from tsclient.conf when max is 0.  Free with mru_entry_free.
+ */
+GList *mru_load (gint max)
+{
+  GHashTable *entries;
+  gchar *text;
+  int fd, lock;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("mru_load\n");
+  #endif
+
+  if (!max)
+    max = tsc_config_get_int ("mru", "size", TSC_MRU_SIZE_DEFAULT);
+
+  mru_log_import ();
+  lock = mru_log_lock (LOCK_SH);
+  if (lock < 0)
+    return NULL;
+  fd = mru_log_open (O_RDONLY);
+  if (fd < 0) {
+    close (lock);
+    return NULL;
+  }
+  text = mru_log_read (fd);
+  close (fd);
+  close (lock);
+
+  entries = mru_log_parse (text);
+  g_free (text);
+  return mru_rank (entries, max);
+}
+
+
 /***************************************
 *                                      *
 *   mru_add_server                     *
@@ -183,36 +507,60 @@ mru_file_to_list_legacy (GSList **list, const gchar *mru_filename)
  
 int mru_add_server (const char *server_name)
 {
-  GSList* list = NULL;
-  GSList* list_new = NULL;
+  TscMruEntry entry;
+
+  mru_entry_init (&entry);
+  entry.server = (gchar *) server_name;
+  entry.visits = 1;
+  return mru_add_visit (&entry);
+}
+
+
+/*
+ * Append one event for visit->server, stamped now.  Fields the caller
+ * leaves unknown keep their earlier values.
+ */
+int mru_add_visit (const TscMruEntry *visit)
+{
+  TscMruEntry entry = *visit;
+  struct stat st;
+  GString *line;
+  int fd, lock, ret = 0;
 
   #ifdef TSCLIENT_DEBUG
-  printf ("mru_add_server\n");
+  printf ("mru_add_visit\n");
   #endif
 
-  mru_file_to_list (&list);
+  TSC_TRACE1 (mru__add, visit->server);
 
-  while (list) {
-    if (strcmp(server_name, (char*)list->data) != 0) {
-      list_new = g_slist_append (list_new, (gpointer)g_strdup ((gchar*)list->data));
-    }
-    g_free (list->data);
-    list = list->next;
+  if (!visit->server || !*visit->server || strpbrk (visit->server, "\t\r\n"))
+    return 1;
+  if (entry.profile && strpbrk (entry.profile, "\t\r\n"))
+    entry.profile = NULL;
+
+  mru_log_import ();
+  lock = mru_log_lock (LOCK_EX);
+  if (lock < 0)
+    return 1;
+  fd = mru_log_open (O_RDWR | O_APPEND | O_CREAT);
+  if (fd < 0) {
+    close (lock);
+    return 1;
   }
-  g_slist_free (list);
-  
-  list_new = g_slist_prepend (list_new, (gpointer)g_strdup (server_name));
 
-  mru_list_to_file (&list_new);
+  entry.last = g_get_real_time () / G_USEC_PER_SEC;
+  line = g_string_new (NULL);
+  mru_log_append (line, &entry);
+  if (write (fd, line->str, line->len) != (ssize_t) line->len)
+    ret = 1;
+  g_string_free (line, TRUE);
 
-  while (list_new) {
-    g_free (list_new->data);
-    list_new = list_new->next;
-  }
-  g_slist_free (list_new);
+  if (fstat (fd, &st) == 0 && st.st_size > TSC_MRU_COMPACT_BYTES)
+    mru_log_compact (fd);
+  close (fd);
+  close (lock);
 
-  /* complete successfully */
-  return 0;
+  return ret;
 }
 
 
@@ -222,40 +570,117 @@ int mru_add_server (const char *server_name)
 *                                      *
 ***************************************/
  
+/* "last used 2h ago · 140 ms" */
+gchar *mru_describe (const TscMruEntry *entry)
+{
+  gint64 ago = g_get_real_time () / G_USEC_PER_SEC - entry->last;
+  gchar *when, *text;
+
+  if (ago < 60)
+    when = g_strdup (_("last used just now"));
+  else if (ago < 60 * 60)
+    when = g_strdup_printf (_("last used %dm ago"), (gint) (ago / 60));
+  else if (ago < 24 * 60 * 60)
+    when = g_strdup_printf (_("last used %dh ago"), (gint) (ago / (60 * 60)));
+  else
+    when = g_strdup_printf (_("last used %dd ago"), (gint) (ago / (24 * 60 * 60)));
+
+  if (entry->status && strcmp (entry->status, "ok") != 0)
+    text = g_strdup_printf (_("%s · failed (%s)"), when, entry->status);
+  else if (entry->connect_ms >= 0)
+    text = g_strdup_printf (_("%s · %d ms"), when, entry->connect_ms);
+  else
+    return when;
+
+  g_free (when);
+  return text;
+}
+
+
+static gchar *
+mru_annotate (const gchar *label)
+{
+  TscMruEntry *entry = shown ? g_hash_table_lookup (shown, label) : NULL;
+
+  return entry ? mru_describe (entry) : NULL;
+}
+
+
 int mru_to_screen (GtkWidget *main_window)
 {
-  GList *server_items = NULL;
-  GSList *server_list = NULL;
+  GList *server_items, *lptr;
   GtkWidget *widget;
-  int i;
 
   #ifdef TSCLIENT_DEBUG
   printf ("mru_to_screen\n");
   #endif
 
-  // Get the mru.tsc
-  mru_file_to_list (&server_list);
+  // the rows' notes come from the entries last put on screen
+  if (shown)
+    g_hash_table_remove_all (shown);
+  else
+    shown = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                   (GDestroyNotify) mru_entry_free);
+
+  server_items = mru_load (0);
+  for (lptr = server_items; lptr; lptr = lptr->next) {
+    TscMruEntry *entry = lptr->data;
+    tsc_resolve_host (entry->server);
+    g_hash_table_replace (shown, entry->server, entry);
+  }
 
   // load mru combos
-  i = 0;
-  while ((server_list != NULL && i <= 10)) {
-    server_items = g_list_append (server_items, g_strdup (server_list->data));
-    server_list = server_list->next;
-    i++;
-  }
   widget = lookup_widget (main_window, "cboComputer");
+  if (widget && !g_object_get_data (G_OBJECT (widget), "tsc-mru")) {
+    tsc_dropdown_add_annotate (widget, mru_annotate);
+    g_object_set_data (G_OBJECT (widget), "tsc-mru", GINT_TO_POINTER (1));
+  }
   if (widget) {
     tsc_dropdown_clear (widget);
     tsc_dropdown_append (widget, _("Recent"));
-    for (GList *iter = server_items; iter != NULL; iter = iter->next) {
-      tsc_dropdown_append (widget, (const gchar *) iter->data);
-    }
+    for (lptr = server_items; lptr; lptr = lptr->next)
+      tsc_dropdown_append (widget, ((TscMruEntry *) lptr->data)->server);
     tsc_dropdown_set_selected (widget, 0);
     GtkStringList *model = tsc_dropdown_get_model (widget);
     gtk_widget_set_sensitive (widget,
       model && g_list_model_get_n_items (G_LIST_MODEL (model)) > 1);
   }
-  g_list_free_full (server_items, g_free);
+  g_list_free (server_items);
+
+  mru_probe (main_window);
+
+  return 0;
+}
+
+
+/***************************************
+*                                      *
+*   mru_probe                          *
+*                                      *
+***************************************/
+
+/* Check the recent servers on the port of the selected protocol. */
+int mru_probe (GtkWidget *main_window)
+{
+  GtkWidget *widget;
+  GtkStringList *model;
+  gint protocol;
+  guint i, items;
+
+  widget = lookup_widget (main_window, "cboComputer");
+  model = widget ? tsc_dropdown_get_model (widget) : NULL;
+  if (!model)
+    return 1;
+
+  protocol = tsc_screen_protocol (main_window);
+  items = g_list_model_get_n_items (G_LIST_MODEL (model));
+  // row 0 is the "Recent" caption
+  for (i = 1; i < items; i++) {
+    const gchar *server = gtk_string_list_get_string (model, i);
+    tsc_probe_set_alias (server, server, protocol);
+    tsc_probe_host (server, protocol);
+  }
+  tsc_dropdown_refresh (widget);
 
   return 0;
 }
@@ -5,7 +5,30 @@
 ***************************************/
 
 #define MAX_SERVER_SIZE 256
+#define TSC_MRU_SIZE_DEFAULT 11
+#define TSC_MRU_KEEP 200
+#define TSC_MRU_COMPACT_BYTES 16384
+
+/* -1 or NULL where a field is unknown */
+typedef struct
+{
+  gchar *server;
+  gint visits;
+  gint64 last;
+  gint score;
+  gint protocol;
+  gchar *profile;
+  const gchar *status;
+  gint connect_ms;
+  gint duration_s;
+} TscMruEntry;
 
 int mru_add_server (const char* server_name);
+int mru_add_visit (const TscMruEntry *visit);
+void mru_entry_init (TscMruEntry *entry);
+GList *mru_load (gint max);
+gchar *mru_describe (const TscMruEntry *entry);
+void mru_entry_free (TscMruEntry *entry);
 int mru_to_screen (GtkWidget *main_window);
+int mru_probe (GtkWidget *main_window);
 
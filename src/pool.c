@@ -0,0 +1,599 @@
+/***************************************
+*                                      *
+*   Host Pools                         *
+*                                      *
+***************************************/
+
+/*
+ * A profile whose pool field lists several interchangeable hosts
+ * ("ts1,ts2:3390,ts3") is launched on one of them, picked just before
+ * the client starts by the profile's pool_policy:
+ *
+ *  - round-robin (the default) takes the hosts in turn;
+ *  - random takes any of them;
+ *  - rtt takes the one that connects first, from the background checks
+ *    when they have a fresh result for every host, otherwise by
+ *    connecting to all of them at once (tsc_preflight_members);
+ *  - sessions takes the one with the fewest sessions of this tsclient
+ *    running, in turn among equals.
+ *
+ * While a pool is in use its hosts are checked every check-ms through
+ * the prober (probe.c); the session supervisor starts that on the main
+ * loop once a client is running, since picks happen on a launch's
+ * worker thread, and stops it when the pool's last session is gone.
+ * A host found down, or whose session ends with a network failure, is
+ * out of rotation for quarantine-s; when every host is out, all of them
+ * are tried again rather than none.
+ *
+ *   [pool]
+ *   quarantine-s=60
+ *   check-ms=10000
+ *
+ * Quarantines and whose turn it is are kept in ~/.tsclient/pool.state,
+ * so launches from separate processes share them.  Every change to it
+ * holds an flock on ~/.tsclient/pool.lock from reading it to writing it
+ * back, but never across a race.  The host picked is what the launch
+ * history records.  tsclient --pool LIST POLICY checks the hosts once
+ * and picks one, as a launch would.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "probe.h"
+#include "preflight.h"
+#include "session.h"
+#include "pool.h"
+#include "tsc-trace.h"
+
+static const gchar *const tsc_pool_policies[] = {
+  "round-robin",
+  "random",
+  "rtt",
+  "sessions",
+  NULL
+};
+
+typedef struct {
+  gint protocol;
+  gint sessions;
+} TscPoolWatch;
+
+static GHashTable *watched = NULL;
+static guint check_id = 0;
+
+
+static gchar *
+tsc_pool_state_file (void)
+{
+  gchar *home = tsc_home_path ();
+  gchar *file_name = g_build_path ("/", home, "pool.state", NULL);
+
+  g_free (home);
+  return file_name;
+}
+
+
+/* Take the lock held across a change to pool.state; -1 when it cannot be. */
+static int
+tsc_pool_lock (void)
+{
+  gchar *home = tsc_home_path ();
+  gchar *lock_name = g_build_path ("/", home, "pool.lock", NULL);
+  int fd;
+
+  fd = open (lock_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd >= 0 && flock (fd, LOCK_EX) != 0) {
+    close (fd);
+    fd = -1;
+  }
+
+  g_free (lock_name);
+  g_free (home);
+  return fd;
+}
+
+
+static void
+tsc_pool_unlock (int lock)
+{
+  if (lock >= 0)
+    close (lock);
+}
+
+
+static GKeyFile *
+tsc_pool_load (void)
+{
+  GKeyFile *state = g_key_file_new ();
+  gchar *file_name = tsc_pool_state_file ();
+
+  g_key_file_load_from_file (state, file_name, G_KEY_FILE_NONE, NULL);
+  g_free (file_name);
+  return state;
+}
+
+
+/* Write state back, leaving out quarantines that are over. */
+static void
+tsc_pool_save (GKeyFile *state)
+{
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gchar **groups = g_key_file_get_groups (state, NULL);
+  gchar *file_name = tsc_pool_state_file ();
+  gint i;
+
+  for (i = 0; groups[i]; i++) {
+    if (g_key_file_has_key (state, groups[i], "down-until", NULL) &&
+        g_key_file_get_int64 (state, groups[i], "down-until", NULL) <= now)
+      g_key_file_remove_group (state, groups[i], NULL);
+  }
+  if (!g_key_file_save_to_file (state, file_name, NULL))
+    g_warning ("Could not write %s", file_name);
+  g_strfreev (groups);
+  g_free (file_name);
+}
+
+
+/* "host:port" as the prober would connect, so ts1 and TS1:3389 are one host. */
+static gchar *
+tsc_pool_key (const gchar *member, gint protocol)
+{
+  GSocketConnectable *connectable;
+  gchar *host, *key;
+  guint16 port;
+
+  connectable = g_network_address_parse (member, tsc_probe_default_port (protocol), NULL);
+  if (!connectable)
+    return g_ascii_strdown (member, -1);
+
+  host = g_ascii_strdown (g_network_address_get_hostname (G_NETWORK_ADDRESS (connectable)), -1);
+  port = g_network_address_get_port (G_NETWORK_ADDRESS (connectable));
+  g_object_unref (connectable);
+  if (protocol == 1 && port < 100)
+    port += TSC_PORT_VNC;
+
+  key = port ? g_strdup_printf ("%s:%u", host, port) : g_strdup (host);
+  g_free (host);
+  return key;
+}
+
+
+/* The state group holding whose turn it is in members. */
+static gchar *
+tsc_pool_group (gchar **members, gint protocol)
+{
+  GString *group = g_string_new ("pool ");
+  gint i;
+
+  for (i = 0; members[i]; i++) {
+    gchar *key = tsc_pool_key (members[i], protocol);
+
+    g_string_append_printf (group, i ? ",%s" : "%s", key);
+    g_free (key);
+  }
+  return g_string_free (group, FALSE);
+}
+
+
+static void
+tsc_pool_quarantine (GKeyFile *state, const gchar *key)
+{
+  gint quarantine_s = tsc_config_get_int ("pool", "quarantine-s", TSC_POOL_QUARANTINE_DEFAULT);
+
+  if (quarantine_s <= 0)
+    return;
+  g_key_file_set_int64 (state, key, "down-until",
+                        g_get_real_time () / G_USEC_PER_SEC + quarantine_s);
+}
+
+
+/* The hosts in pool, a list separated by commas, semicolons or spaces. */
+gchar **tsc_pool_members (const gchar *pool)
+{
+  GPtrArray *members = g_ptr_array_new ();
+  gchar **items = g_strsplit_set (pool ? pool : "", ",; \t\n", -1);
+  gint i;
+
+  for (i = 0; items[i]; i++) {
+    if (*items[i])
+      g_ptr_array_add (members, g_strdup (items[i]));
+  }
+  g_ptr_array_add (members, NULL);
+  g_strfreev (items);
+  return (gchar **) g_ptr_array_free (members, FALSE);
+}
+
+
+TscPoolPolicy tsc_pool_policy (const gchar *name)
+{
+  gint i;
+
+  for (i = 1; name && tsc_pool_policies[i]; i++) {
+    if (g_ascii_strcasecmp (name, tsc_pool_policies[i]) == 0)
+      return i;
+  }
+  return TSC_POOL_ROUND_ROBIN;
+}
+
+
+/* Unix time member's quarantine ends, 0 when it is in rotation. */
+gint64 tsc_pool_down_until (const gchar *member, gint protocol)
+{
+  GKeyFile *state = tsc_pool_load ();
+  gchar *key = tsc_pool_key (member, protocol);
+  gint64 until = g_key_file_get_int64 (state, key, "down-until", NULL);
+
+  g_free (key);
+  g_key_file_free (state);
+  return until > g_get_real_time () / G_USEC_PER_SEC ? until : 0;
+}
+
+
+/* Take member out of rotation for [pool] quarantine-s. */
+void tsc_pool_mark_down (const gchar *member, gint protocol)
+{
+  int lock = tsc_pool_lock ();
+  GKeyFile *state = tsc_pool_load ();
+  gchar *key = tsc_pool_key (member, protocol);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_pool_mark_down: %s\n", key);
+  #endif
+
+  tsc_pool_quarantine (state, key);
+  tsc_pool_save (state);
+  tsc_pool_unlock (lock);
+  g_free (key);
+  g_key_file_free (state);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_pool_pick                      *
+*                                      *
+***************************************/
+
+/*
+ * The usable member that connects first: from the prober when it has a
+ * fresh result for all of them, otherwise from a race, whose members
+ * found down are added to down by key.  -1 when none connected.
+ */
+static gint
+tsc_pool_nearest (gchar **members, gboolean *usable, gint protocol, GPtrArray *down)
+{
+  TscPreflightResult *result;
+  GPtrArray *racing = g_ptr_array_new ();
+  gint map[TSC_PREFLIGHT_MAX];
+  gint best = -1, best_ms = -1, winner, i;
+
+  for (i = 0; members[i]; i++) {
+    gint rtt_ms;
+
+    if (!usable[i])
+      continue;
+    rtt_ms = tsc_probe_rtt (members[i], protocol);
+    if (rtt_ms < 0) {
+      best = -2;
+      break;
+    }
+    if (best < 0 || rtt_ms < best_ms) {
+      best = i;
+      best_ms = rtt_ms;
+    }
+  }
+  if (best != -2) {
+    g_ptr_array_free (racing, TRUE);
+    return best;
+  }
+
+  for (i = 0; members[i] && racing->len < TSC_PREFLIGHT_MAX; i++) {
+    if (usable[i]) {
+      map[racing->len] = i;
+      g_ptr_array_add (racing, members[i]);
+    }
+  }
+  g_ptr_array_add (racing, NULL);
+
+  result = g_new0 (TscPreflightResult, 1);
+  winner = tsc_preflight_members ((gchar **) racing->pdata, protocol, result);
+  for (i = 0; i < result->count; i++) {
+    TscPreflightCandidate *candidate = &result->candidates[i];
+
+    // a host with an address still connecting may yet be up
+    if (candidate->state == TSC_PREFLIGHT_DOWN)
+      g_ptr_array_add (down, tsc_pool_key (members[map[candidate->entry]], protocol));
+  }
+  if (winner >= 0)
+    winner = map[winner];
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_pool_nearest: %s in %d ms\n", winner >= 0 ? members[winner] : "none", result->ms);
+  #endif
+
+  tsc_preflight_result_clear (result);
+  g_free (result);
+  g_ptr_array_free (racing, TRUE);
+  return winner;
+}
+
+
+/*
+ * Index in members of the host to launch, recording the turn taken.
+ * pool.lock is held throughout, except while rtt races the members.
+ */
+static gint
+tsc_pool_choose (gchar **members, TscPoolPolicy policy, gint protocol)
+{
+  int lock = tsc_pool_lock ();
+  GKeyFile *state = tsc_pool_load ();
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gint n = g_strv_length (members);
+  gboolean *usable = g_new0 (gboolean, n);
+  gint *load = g_new0 (gint, n);
+  gchar *group = tsc_pool_group (members, protocol);
+  gint count = 0, chosen = -1, next, i;
+
+  for (i = 0; i < n; i++) {
+    gchar *key = tsc_pool_key (members[i], protocol);
+
+    if (g_key_file_get_int64 (state, key, "down-until", NULL) > now) {
+      usable[i] = FALSE;
+    } else if (tsc_probe_is_down (members[i], protocol)) {
+      // the health checks saw it go before anyone launched on it
+      tsc_pool_quarantine (state, key);
+      usable[i] = FALSE;
+    } else {
+      usable[i] = TRUE;
+      count++;
+    }
+    g_free (key);
+  }
+  // with every host out, any of them is a better bet than none
+  if (!count) {
+    for (i = 0; i < n; i++)
+      usable[i] = TRUE;
+    count = n;
+  }
+
+  if (policy == TSC_POOL_RANDOM) {
+    gint skip = g_random_int_range (0, count);
+
+    for (i = 0; i < n && chosen < 0; i++) {
+      if (usable[i] && skip-- == 0)
+        chosen = i;
+    }
+  } else if (policy == TSC_POOL_RTT) {
+    GPtrArray *down = g_ptr_array_new_with_free_func (g_free);
+    guint k;
+
+    // the race can take seconds: let other launches have the state meanwhile
+    tsc_pool_save (state);
+    tsc_pool_unlock (lock);
+    chosen = tsc_pool_nearest (members, usable, protocol, down);
+    lock = tsc_pool_lock ();
+    g_key_file_free (state);
+    state = tsc_pool_load ();
+    for (k = 0; k < down->len; k++)
+      tsc_pool_quarantine (state, g_ptr_array_index (down, k));
+    // nor are the hosts found down in the race anyone's turn
+    for (i = 0; i < n; i++) {
+      gchar *key = tsc_pool_key (members[i], protocol);
+
+      for (k = 0; k < down->len && usable[i]; k++) {
+        if (!strcmp (key, g_ptr_array_index (down, k))) {
+          usable[i] = FALSE;
+          count--;
+        }
+      }
+      g_free (key);
+    }
+    if (!count) {
+      for (i = 0; i < n; i++)
+        usable[i] = TRUE;
+      count = n;
+    }
+    g_ptr_array_free (down, TRUE);
+  } else if (policy == TSC_POOL_SESSIONS) {
+    for (i = 0; i < n; i++)
+      load[i] = tsc_session_count_host (members[i]);
+  }
+
+  // hosts take turns: all of them for round-robin, the least busy for
+  // sessions, and for rtt when none answered the race
+  next = g_key_file_get_integer (state, group, "next", NULL);
+  for (i = 0; i < n; i++) {
+    gint j = (MAX (next, 0) + i) % n;
+
+    if (usable[j] && (chosen < 0 || load[j] < load[chosen]))
+      chosen = j;
+  }
+
+  g_key_file_set_integer (state, group, "next", (chosen + 1) % n);
+  tsc_pool_save (state);
+  tsc_pool_unlock (lock);
+
+  g_free (group);
+  g_free (load);
+  g_free (usable);
+  g_key_file_free (state);
+  return chosen;
+}
+
+
+/*
+ * The host in pool to launch on, by policy (see above); NULL with
+ * *error set when the pool lists none.
+ */
+gchar *tsc_pool_pick (const gchar *pool, const gchar *policy, gint protocol, gchar **error)
+{
+  gchar **members = tsc_pool_members (pool);
+  gchar *member;
+  gint chosen;
+
+  if (!members[0]) {
+    if (error)
+      *error = g_strdup_printf (_("The host pool \"%s\" lists no hosts."), pool);
+    g_strfreev (members);
+    return NULL;
+  }
+
+  chosen = tsc_pool_choose (members, tsc_pool_policy (policy), protocol);
+  member = g_strdup (members[chosen]);
+  TSC_TRACE3 (launch__pool, member, (gint) tsc_pool_policy (policy), g_strv_length (members));
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_pool_pick: %s from %s (%s)\n", member, pool,
+          tsc_pool_policies[tsc_pool_policy (policy)]);
+  #endif
+
+  g_strfreev (members);
+  return member;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_pool_watch                     *
+*                                      *
+***************************************/
+
+static void
+tsc_pool_check (const gchar *pool, gint protocol)
+{
+  gchar **members = tsc_pool_members (pool);
+  gint i;
+
+  for (i = 0; members[i]; i++) {
+    const TscProbeResult *result = tsc_probe_lookup (members[i], protocol);
+
+    if (result && result->state == TSC_PROBE_DOWN && !tsc_pool_down_until (members[i], protocol))
+      tsc_pool_mark_down (members[i], protocol);
+    tsc_probe_host (members[i], protocol);
+  }
+  g_strfreev (members);
+}
+
+
+static gboolean
+tsc_pool_check_cb (gpointer user_data)
+{
+  GHashTableIter iter;
+  gpointer pool, watch;
+
+  g_hash_table_iter_init (&iter, watched);
+  while (g_hash_table_iter_next (&iter, &pool, &watch))
+    tsc_pool_check (pool, ((TscPoolWatch *) watch)->protocol);
+  return G_SOURCE_CONTINUE;
+}
+
+
+/*
+ * Keep checking pool's hosts in the background for one more session,
+ * until it calls tsc_pool_unwatch; [pool] check-ms=0 turns it off.
+ */
+void tsc_pool_watch (const gchar *pool, gint protocol)
+{
+  gint check_ms = tsc_config_get_int ("pool", "check-ms", TSC_POOL_CHECK_DEFAULT);
+  TscPoolWatch *watch;
+
+  if (!pool || !*pool || check_ms <= 0 || !tsc_probe_default_port (protocol))
+    return;
+
+  if (!watched)
+    watched = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  watch = g_hash_table_lookup (watched, pool);
+  if (watch) {
+    watch->sessions++;
+    return;
+  }
+  watch = g_new0 (TscPoolWatch, 1);
+  watch->protocol = protocol;
+  watch->sessions = 1;
+  g_hash_table_insert (watched, g_strdup (pool), watch);
+  tsc_pool_check (pool, protocol);
+  if (!check_id)
+    check_id = g_timeout_add (check_ms, tsc_pool_check_cb, NULL);
+}
+
+
+/* A session that had tsc_pool_watch check pool is gone; the last one stops the checks. */
+void tsc_pool_unwatch (const gchar *pool)
+{
+  TscPoolWatch *watch = watched && pool ? g_hash_table_lookup (watched, pool) : NULL;
+
+  if (!watch || --watch->sessions > 0)
+    return;
+  g_hash_table_remove (watched, pool);
+  if (!g_hash_table_size (watched) && check_id) {
+    g_source_remove (check_id);
+    check_id = 0;
+  }
+}
+
+
+/*
+ * Check pool's hosts once, as the background checks would, then pick
+ * one as a launch would, taking its turn.  Prints both.
+ */
+int tsc_pool_report (const gchar *pool, const gchar *policy, gint protocol)
+{
+  gchar **members = tsc_pool_members (pool);
+  TscPreflightResult result;
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gint winner, chosen, i, j;
+
+  if (!members[0]) {
+    printf ("\n  The host pool \"%s\" lists no hosts.\n\n", pool);
+    g_strfreev (members);
+    return 1;
+  }
+
+  winner = tsc_preflight_members (members, protocol, &result);
+  printf ("\n  %s, %s\n\n", pool, tsc_pool_policies[tsc_pool_policy (policy)]);
+  for (i = 0; members[i]; i++) {
+    gint64 until;
+    gint ms = -1;
+    gboolean down = result.count > 0;
+
+    for (j = 0; j < result.count; j++) {
+      if (result.candidates[j].entry != i)
+        continue;
+      if (result.candidates[j].state == TSC_PREFLIGHT_HEALTHY)
+        ms = result.candidates[j].ms;
+      if (result.candidates[j].state != TSC_PREFLIGHT_DOWN)
+        down = FALSE;
+    }
+    if (down && !tsc_pool_down_until (members[i], protocol))
+      tsc_pool_mark_down (members[i], protocol);
+    until = tsc_pool_down_until (members[i], protocol);
+
+    printf ("  %-28s", members[i]);
+    if (!result.count)
+      printf (" not checked");
+    else if (ms >= 0)
+      printf (" connected in %d ms%s", ms, i == winner ? ", first" : "");
+    else
+      printf (" %s", down ? "down" : "slower");
+    if (until)
+      printf (", out of rotation for %d s", (gint) (until - now));
+    printf ("\n");
+  }
+
+  chosen = tsc_pool_choose (members, tsc_pool_policy (policy), protocol);
+  printf ("\n  launch on %s\n\n", members[chosen]);
+
+  tsc_preflight_result_clear (&result);
+  g_strfreev (members);
+  return winner < 0;
+}
@@ -0,0 +1,30 @@
+#ifndef POOL_H
+#define POOL_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_POOL_QUARANTINE_DEFAULT 60
+#define TSC_POOL_CHECK_DEFAULT 10000
+
+typedef enum
+{
+  TSC_POOL_ROUND_ROBIN,
+  TSC_POOL_RANDOM,
+  TSC_POOL_RTT,
+  TSC_POOL_SESSIONS
+} TscPoolPolicy;
+
+gchar **tsc_pool_members (const gchar *pool);
+TscPoolPolicy tsc_pool_policy (const gchar *name);
+gchar *tsc_pool_pick (const gchar *pool, const gchar *policy, gint protocol, gchar **error);
+void tsc_pool_watch (const gchar *pool, gint protocol);
+void tsc_pool_unwatch (const gchar *pool);
+void tsc_pool_mark_down (const gchar *member, gint protocol);
+gint64 tsc_pool_down_until (const gchar *member, gint protocol);
+int tsc_pool_report (const gchar *pool, const gchar *policy, gint protocol);
+
+#endif /* POOL_H */
@@ -0,0 +1,798 @@
+/***************************************
+*                                      *
+*   Protocol Preflight                 *
+*                                      *
+***************************************/
+
+/*
+ * A profile whose protocols field lists several protocols, each with an
+ * optional port ("rdp,vnc:5901"), is launched with whichever of them
+ * answers.  An entry for the profile's own protocol without a port of
+ * its own takes the one in the profile's address.  Before the client
+ * starts, every entry is tried at once on the profile's host, each with
+ * the first packet of its own protocol:
+ *
+ *  - RDP gets an X.224 Connection Request and must send back a
+ *    Connection Confirm;
+ *  - VNC must send its "RFB xxx.yyy" version banner.
+ *
+ * With [preflight] policy=first (the default) the first healthy answer
+ * wins; with policy=order an earlier entry still pending is given
+ * grace-ms after a later one answered.  A port that takes the connection
+ * but never completes its handshake is launched only when nothing did.
+ *
+ * Each entry is tried on every address of the host, the families taking
+ * turns as in RFC 8305: the next address is tried attempt-delay-ms after
+ * the last, or at once when the last was refused, and the first to take
+ * the connection ends the others.  tsc_preflight_eyeballs runs the same
+ * race with nothing but a connect, to pick the address a client is given
+ * (see resolve.c), and tsc_preflight_members across the hosts of a pool
+ * to find the nearest (see pool.c).
+ *
+ * The whole race is bounded by timeout-ms, so a host is as quick to
+ * start as its fastest live protocol.  tsclient --preflight HOST LIST
+ * prints the race without connecting.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "probe.h"
+#include "resolve.h"
+#include "preflight.h"
+#include "tsc-trace.h"
+
+static const struct {
+  const gchar *name;
+  gint protocol;
+} tsc_preflight_protocols[] = {
+  { "rdp",  4 },
+  { "rdp4", 0 },
+  { "vnc",  1 },
+};
+
+/* TPKT + X.224 Connection Request + RDP_NEG_REQ offering TLS and CredSSP */
+static const guchar tsc_preflight_x224_request[] = {
+  0x03, 0x00, 0x00, 0x13,
+  0x0e, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x01, 0x00, 0x08, 0x00, 0x03, 0x00, 0x00, 0x00
+};
+
+typedef struct {
+  gint protocol;
+  guint16 port;
+} TscPreflightEntry;
+
+typedef struct {
+  TscPreflightCandidate *candidate;
+  GInetAddress *inet;
+  gint entry;
+  gint64 start_at;
+  GSocket *sock;
+  gboolean started;
+  gboolean connected;
+  guchar buf[12];
+  gsize len;
+} TscPreflightProbe;
+
+typedef struct {
+  TscPreflightResult *result;
+  TscPreflightProbe probes[TSC_PREFLIGHT_MAX];
+  gboolean handshake;
+  gint64 start;
+} TscPreflightRace;
+
+
+static const gchar *
+tsc_preflight_name (gint protocol)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (tsc_preflight_protocols); i++) {
+    if (tsc_preflight_protocols[i].protocol == protocol)
+      return tsc_preflight_protocols[i].name;
+  }
+  return "tcp";
+}
+
+
+static gint
+tsc_preflight_family (GInetAddress *inet)
+{
+  return g_inet_address_get_family (inet) == G_SOCKET_FAMILY_IPV6 ? 6 : 4;
+}
+
+
+/* Whether protocols a and b are both RDP or the same. */
+static gboolean
+tsc_preflight_same (gint a, gint b)
+{
+  return a == b || ((a == 0 || a == 4) && (b == 0 || b == 4));
+}
+
+
+/*
+ * Entries from a list such as "rdp,vnc:1"; their count.  own_port, if
+ * not 0, is the port of those for own_protocol that give none.
+ */
+static gint
+tsc_preflight_parse (const gchar *protocols, gint own_protocol, guint16 own_port,
+                     TscPreflightEntry *entries)
+{
+  gchar **items = g_strsplit_set (protocols, ", ", -1);
+  gint count = 0, i;
+
+  for (i = 0; items[i] && count < TSC_PREFLIGHT_MAX; i++) {
+    gchar *colon = strchr (items[i], ':');
+    gint port = colon ? atoi (colon + 1) : 0;
+    guint j;
+
+    if (colon)
+      *colon = '\0';
+    for (j = 0; j < G_N_ELEMENTS (tsc_preflight_protocols); j++) {
+      if (g_ascii_strcasecmp (items[i], tsc_preflight_protocols[j].name) == 0)
+        break;
+    }
+    if (j == G_N_ELEMENTS (tsc_preflight_protocols) || port < 0 || port > 65535) {
+      #ifdef TSCLIENT_DEBUG
+      if (*items[i])
+        printf ("tsc_preflight_parse: skipping %s\n", items[i]);
+      #endif
+      continue;
+    }
+
+    entries[count].protocol = tsc_preflight_protocols[j].protocol;
+    if (!port && own_port && tsc_preflight_same (entries[count].protocol, own_protocol))
+      port = own_port;
+    if (!port)
+      port = tsc_probe_default_port (entries[count].protocol);
+    // as vncviewer reads it, vnc:1 is display 1
+    else if (entries[count].protocol == 1 && port < 100)
+      port += TSC_PORT_VNC;
+    entries[count].port = port;
+    count++;
+  }
+
+  g_strfreev (items);
+  return count;
+}
+
+
+/*
+ * Indices of inets in the order RFC 8305 tries them: the families taking
+ * turns, starting with family (4 or 6), or with the resolver's first
+ * address when family is 0.  Each family keeps the resolver's order.
+ */
+static gint
+tsc_preflight_order (GInetAddress **inets, gint n, gint family, gint *order)
+{
+  gint first, a = 0, b = 0, count = 0;
+
+  if (!n)
+    return 0;
+  first = family ? family : tsc_preflight_family (inets[0]);
+  while (count < n) {
+    while (a < n && tsc_preflight_family (inets[a]) != first)
+      a++;
+    if (a < n)
+      order[count++] = a++;
+    while (b < n && tsc_preflight_family (inets[b]) == first)
+      b++;
+    if (b < n)
+      order[count++] = b++;
+  }
+  return count;
+}
+
+
+/* Add a candidate for inet to race, its attempt due after delay_ms. */
+static void
+tsc_preflight_add (TscPreflightRace *race, GInetAddress *inet, gint entry,
+                   gint protocol, guint16 port, gint delay_ms)
+{
+  TscPreflightResult *result = race->result;
+  TscPreflightCandidate *candidate = &result->candidates[result->count];
+  TscPreflightProbe *probe = &race->probes[result->count];
+
+  candidate->protocol = protocol;
+  candidate->entry = entry;
+  candidate->port = port;
+  candidate->ip = g_inet_address_to_string (inet);
+  candidate->state = TSC_PREFLIGHT_PENDING;
+  candidate->ms = -1;
+  probe->candidate = candidate;
+  probe->inet = inet;
+  probe->entry = entry;
+  probe->start_at = race->start + (gint64) delay_ms * 1000;
+  result->count++;
+}
+
+
+/* The address a client of protocol takes for host and port. */
+static gchar *
+tsc_preflight_address (const gchar *host, gint protocol, guint16 port)
+{
+  gboolean v6 = strchr (host, ':') != NULL;
+  const gchar *open = v6 ? "[" : "";
+  const gchar *close = v6 ? "]" : "";
+
+  if (protocol == 1 && port >= TSC_PORT_VNC && port < TSC_PORT_VNC + 100)
+    return g_strdup_printf ("%s%s%s:%d", open, host, close, port - TSC_PORT_VNC);
+  if (protocol == 1)
+    return g_strdup_printf ("%s%s%s::%d", open, host, close, port);
+  if (port == TSC_PORT_RDP && !v6)
+    return g_strdup (host);
+  return g_strdup_printf ("%s%s%s:%d", open, host, close, port);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_preflight_probe                *
+*                                      *
+***************************************/
+
+static void
+tsc_preflight_settle (TscPreflightRace *race, TscPreflightProbe *probe, TscPreflightState state)
+{
+  probe->candidate->state = state;
+  if (state != TSC_PREFLIGHT_SKIPPED)
+    probe->candidate->ms = (gint) ((g_get_monotonic_time () - race->start + 999) / 1000);
+  if (probe->sock) {
+    g_socket_close (probe->sock, NULL);
+    g_clear_object (&probe->sock);
+  }
+}
+
+
+/*
+ * Once one of an entry's addresses takes the connection its other
+ * attempts are dropped; when one is refused, the next starts at once
+ * instead of waiting out the attempt delay.
+ */
+static void
+tsc_preflight_siblings (TscPreflightRace *race, TscPreflightProbe *probe, gboolean connected)
+{
+  gint i;
+
+  for (i = 0; i < race->result->count; i++) {
+    TscPreflightProbe *sibling = &race->probes[i];
+
+    if (sibling == probe || sibling->entry != probe->entry ||
+        sibling->candidate->state != TSC_PREFLIGHT_PENDING)
+      continue;
+    if (connected) {
+      tsc_preflight_settle (race, sibling, TSC_PREFLIGHT_SKIPPED);
+    } else if (!sibling->started) {
+      sibling->start_at = MIN (sibling->start_at, g_get_monotonic_time ());
+      break;
+    }
+  }
+}
+
+
+/* RDP speaks first from our side; VNC from the server's. */
+static gboolean
+tsc_preflight_greet (TscPreflightProbe *probe)
+{
+  if (probe->candidate->protocol == 1)
+    return TRUE;
+  return g_socket_send (probe->sock, (const gchar *) tsc_preflight_x224_request,
+                        sizeof (tsc_preflight_x224_request), NULL, NULL) ==
+         sizeof (tsc_preflight_x224_request);
+}
+
+
+static void
+tsc_preflight_connected (TscPreflightRace *race, TscPreflightProbe *probe)
+{
+  probe->connected = TRUE;
+  tsc_preflight_siblings (race, probe, TRUE);
+  // picking an address needs nothing more than the connection
+  if (!race->handshake)
+    tsc_preflight_settle (race, probe, TSC_PREFLIGHT_HEALTHY);
+  else if (!tsc_preflight_greet (probe))
+    tsc_preflight_settle (race, probe, TSC_PREFLIGHT_SILENT);
+}
+
+
+static void
+tsc_preflight_start (TscPreflightRace *race, TscPreflightProbe *probe)
+{
+  GSocketAddress *sockaddr;
+  GError *err = NULL;
+  gboolean connected;
+
+  probe->started = TRUE;
+  probe->sock = g_socket_new (g_inet_address_get_family (probe->inet), G_SOCKET_TYPE_STREAM,
+                              G_SOCKET_PROTOCOL_TCP, NULL);
+  if (!probe->sock) {
+    tsc_preflight_settle (race, probe, TSC_PREFLIGHT_DOWN);
+    tsc_preflight_siblings (race, probe, FALSE);
+    return;
+  }
+  g_socket_set_blocking (probe->sock, FALSE);
+
+  sockaddr = g_inet_socket_address_new (probe->inet, probe->candidate->port);
+  connected = g_socket_connect (probe->sock, sockaddr, NULL, &err);
+  g_object_unref (sockaddr);
+  if (connected) {
+    tsc_preflight_connected (race, probe);
+  } else if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_PENDING)) {
+    tsc_preflight_settle (race, probe, TSC_PREFLIGHT_DOWN);
+    tsc_preflight_siblings (race, probe, FALSE);
+  }
+  g_clear_error (&err);
+}
+
+
+/* Whether what has been read is the answer protocol would give; -1 for more. */
+static gint
+tsc_preflight_check (TscPreflightProbe *probe)
+{
+  const guchar *buf = probe->buf;
+
+  if (probe->candidate->protocol == 1) {
+    if (probe->len < 12)
+      return -1;
+    return memcmp (buf, "RFB ", 4) == 0 && buf[7] == '.' && buf[11] == '\n';
+  }
+  // TPKT version 3, then a Connection Confirm; a negotiation failure still
+  // comes from an RDP server
+  if (probe->len < 6)
+    return -1;
+  return buf[0] == 0x03 && buf[1] == 0x00 && (buf[5] & 0xf0) == 0xd0;
+}
+
+
+static void
+tsc_preflight_event (TscPreflightRace *race, TscPreflightProbe *probe)
+{
+  gssize len;
+  gint healthy;
+
+  if (!probe->connected) {
+    if (g_socket_check_connect_result (probe->sock, NULL)) {
+      tsc_preflight_connected (race, probe);
+    } else {
+      tsc_preflight_settle (race, probe, TSC_PREFLIGHT_DOWN);
+      tsc_preflight_siblings (race, probe, FALSE);
+    }
+    return;
+  }
+
+  len = g_socket_receive (probe->sock, (gchar *) probe->buf + probe->len,
+                          sizeof (probe->buf) - probe->len, NULL, NULL);
+  if (len <= 0) {
+    tsc_preflight_settle (race, probe, TSC_PREFLIGHT_SILENT);
+    return;
+  }
+  probe->len += len;
+  healthy = tsc_preflight_check (probe);
+  if (healthy >= 0)
+    tsc_preflight_settle (race, probe, healthy ? TSC_PREFLIGHT_HEALTHY : TSC_PREFLIGHT_SILENT);
+}
+
+
+/*
+ * The candidate to launch, -1 to keep waiting or -2 when none can be.
+ * With wait_for_earlier, a pending entry holds back those after it.
+ */
+static gint
+tsc_preflight_pick (TscPreflightResult *result, gboolean wait_for_earlier)
+{
+  gboolean pending = FALSE;
+  gint fallback = -1;
+  gint i;
+
+  for (i = 0; i < result->count; i++) {
+    TscPreflightCandidate *candidate = &result->candidates[i];
+
+    if (candidate->state == TSC_PREFLIGHT_PENDING) {
+      if (wait_for_earlier)
+        return -1;
+      pending = TRUE;
+    } else if (candidate->state == TSC_PREFLIGHT_HEALTHY) {
+      return i;
+    } else if (candidate->state == TSC_PREFLIGHT_SILENT && fallback < 0) {
+      fallback = i;
+    }
+  }
+  if (pending)
+    return -1;
+  return fallback >= 0 ? fallback : -2;
+}
+
+
+/* Run race's attempts; the index of the winner, or -2. */
+static gint
+tsc_preflight_run (TscPreflightRace *race)
+{
+  TscPreflightResult *result = race->result;
+  GPollFD fds[TSC_PREFLIGHT_MAX];
+  gint map[TSC_PREFLIGHT_MAX];
+  gchar *policy = tsc_config_get_string ("preflight", "policy");
+  gboolean in_order = race->handshake && policy && strcmp (policy, "order") == 0;
+  gint timeout_ms = tsc_config_get_int ("preflight", "timeout-ms", TSC_PREFLIGHT_TIMEOUT_DEFAULT);
+  gint grace_ms = tsc_config_get_int ("preflight", "grace-ms", TSC_PREFLIGHT_GRACE_DEFAULT);
+  gint64 now, deadline, grace_end = 0;
+  gint winner, nfds, i;
+
+  g_free (policy);
+  deadline = race->start + (gint64) MAX (timeout_ms, 1) * 1000;
+
+  for (;;) {
+    gint64 until;
+
+    now = g_get_monotonic_time ();
+    for (i = 0; i < result->count; i++) {
+      TscPreflightProbe *probe = &race->probes[i];
+
+      if (probe->candidate->state == TSC_PREFLIGHT_PENDING && !probe->started && probe->start_at <= now)
+        tsc_preflight_start (race, probe);
+    }
+
+    now = g_get_monotonic_time ();
+    for (i = 0; i < result->count && !grace_end; i++) {
+      if (result->candidates[i].state == TSC_PREFLIGHT_HEALTHY)
+        grace_end = now + (gint64) grace_ms * 1000;
+    }
+    winner = tsc_preflight_pick (result, in_order && (!grace_end || now < grace_end));
+    if (winner != -1 || now >= deadline)
+      break;
+
+    nfds = 0;
+    until = grace_end && in_order ? MIN (deadline, grace_end) : deadline;
+    for (i = 0; i < result->count; i++) {
+      TscPreflightProbe *probe = &race->probes[i];
+
+      if (probe->candidate->state != TSC_PREFLIGHT_PENDING)
+        continue;
+      if (!probe->started) {
+        until = MIN (until, probe->start_at);
+        continue;
+      }
+      fds[nfds].fd = g_socket_get_fd (probe->sock);
+      fds[nfds].events = probe->connected ? G_IO_IN : G_IO_OUT;
+      fds[nfds].revents = 0;
+      map[nfds++] = i;
+    }
+
+    g_poll (fds, nfds, (gint) MAX ((until - now + 999) / 1000, 0));
+    for (i = 0; i < nfds; i++) {
+      if (fds[i].revents)
+        tsc_preflight_event (race, &race->probes[map[i]]);
+    }
+  }
+
+  for (i = 0; i < result->count; i++) {
+    TscPreflightProbe *probe = &race->probes[i];
+
+    if (probe->candidate->state != TSC_PREFLIGHT_PENDING)
+      continue;
+    if (!probe->started)
+      tsc_preflight_settle (race, probe, TSC_PREFLIGHT_SKIPPED);
+    // out of time: a port that took the connection can still be launched
+    else if (winner == -1)
+      tsc_preflight_settle (race, probe, probe->connected ? TSC_PREFLIGHT_SILENT : TSC_PREFLIGHT_DOWN);
+    // too slow to matter; the report shows them as still pending
+    else if (probe->sock) {
+      g_socket_close (probe->sock, NULL);
+      g_clear_object (&probe->sock);
+    }
+  }
+  if (winner == -1)
+    winner = tsc_preflight_pick (result, FALSE);
+  return winner;
+}
+
+
+/* inets for the strings in addresses, at most TSC_PREFLIGHT_MAX; their count. */
+static gint
+tsc_preflight_inets (gchar **addresses, GInetAddress **inets)
+{
+  gint n = 0, i;
+
+  for (i = 0; addresses && addresses[i] && n < TSC_PREFLIGHT_MAX; i++) {
+    inets[n] = g_inet_address_new_from_string (addresses[i]);
+    if (inets[n])
+      n++;
+  }
+  return n;
+}
+
+
+/* The addresses of host, or host itself when it is one; NULL if none. */
+static gchar **
+tsc_preflight_host_addresses (const gchar *host)
+{
+  gchar **addresses;
+
+  if (!g_hostname_is_ip_address (host))
+    return tsc_resolve_addresses (host);
+  addresses = g_new0 (gchar *, 2);
+  addresses[0] = g_strdup (host);
+  return addresses;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_preflight_race                 *
+*                                      *
+***************************************/
+
+/*
+ * Race protocols on address's host, each on every address of the host
+ * in turn; a port in address is kept for protocol, the profile's own
+ * (-1 for none).  On success result holds the protocol and the address
+ * to give its client.  Either way, clear result with
+ * tsc_preflight_result_clear.
+ */
+int tsc_preflight_race (const gchar *address, gint protocol, const gchar *protocols,
+                        TscPreflightResult *result, gchar **error)
+{
+  TscPreflightEntry entries[TSC_PREFLIGHT_MAX];
+  GInetAddress *inets[TSC_PREFLIGHT_MAX];
+  gint order[TSC_PREFLIGHT_MAX];
+  TscPreflightRace *race;
+  GSocketConnectable *connectable;
+  gchar **addresses;
+  gchar *host;
+  guint16 port;
+  gint delay_ms = tsc_config_get_int ("preflight", "attempt-delay-ms", TSC_PREFLIGHT_ATTEMPT_DELAY_DEFAULT);
+  gint n_entries, n, per_entry, winner, e, j;
+
+  memset (result, 0, sizeof (*result));
+  result->protocol = -1;
+  result->ms = -1;
+
+  connectable = address ? g_network_address_parse (address, 0, NULL) : NULL;
+  if (!connectable) {
+    if (error)
+      *error = g_strdup_printf (_("%s is not a valid address."), address ? address : "");
+    return 1;
+  }
+  host = g_strdup (g_network_address_get_hostname (G_NETWORK_ADDRESS (connectable)));
+  port = g_network_address_get_port (G_NETWORK_ADDRESS (connectable));
+  g_object_unref (connectable);
+  // as vncviewer reads it, host:1 is display 1
+  if (protocol == 1 && port && port < 100)
+    port += TSC_PORT_VNC;
+
+  n_entries = tsc_preflight_parse (protocols, protocol, port, entries);
+  if (!n_entries) {
+    if (error)
+      *error = g_strdup_printf (_("No protocol in \"%s\" can be tried."), protocols);
+    g_free (host);
+    return 1;
+  }
+
+  addresses = tsc_preflight_host_addresses (host);
+  n = tsc_preflight_inets (addresses, inets);
+  g_strfreev (addresses);
+  if (!n) {
+    if (error)
+      *error = g_strdup_printf (_("%s could not be resolved."), host);
+    g_free (host);
+    return 1;
+  }
+
+  race = g_new0 (TscPreflightRace, 1);
+  race->result = result;
+  race->handshake = TRUE;
+  race->start = g_get_monotonic_time ();
+  tsc_preflight_order (inets, n, tsc_resolve_family (host), order);
+  per_entry = MAX (TSC_PREFLIGHT_MAX / n_entries, 1);
+  for (e = 0; e < n_entries && result->count < TSC_PREFLIGHT_MAX; e++) {
+    for (j = 0; j < MIN (n, per_entry) && result->count < TSC_PREFLIGHT_MAX; j++)
+      tsc_preflight_add (race, inets[order[j]], e, entries[e].protocol, entries[e].port, j * delay_ms);
+  }
+  winner = tsc_preflight_run (race);
+  if (winner >= 0)
+    tsc_resolve_set_family (host, tsc_preflight_family (race->probes[winner].inet));
+  g_free (race);
+  for (j = 0; j < n; j++)
+    g_object_unref (inets[j]);
+
+  if (winner < 0) {
+    if (error)
+      *error = g_strdup_printf (_("%s did not answer on any of %s."), host, protocols);
+    g_free (host);
+    return 1;
+  }
+
+  result->protocol = result->candidates[winner].protocol;
+  result->ms = result->candidates[winner].ms;
+  result->address = tsc_preflight_address (host, result->protocol, result->candidates[winner].port);
+  TSC_TRACE3 (launch__preflight, result->address, result->protocol, result->ms);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_preflight_race: %s answered %s first on %s in %d ms (%s)\n",
+          host, tsc_preflight_name (result->protocol), result->candidates[winner].ip, result->ms,
+          result->candidates[winner].state == TSC_PREFLIGHT_HEALTHY ? "healthy" : "no handshake");
+  #endif
+
+  g_free (host);
+  return 0;
+}
+
+
+/*
+ * Happy eyeballs (RFC 8305): connect to port on each of addresses in
+ * turn, family first, the next attempt starting [preflight]
+ * attempt-delay-ms after the last or as soon as it is refused.  The
+ * index in addresses of the first to connect, or -1.
+ */
+gint tsc_preflight_eyeballs (gchar **addresses, gint family, guint16 port, gint *ms)
+{
+  GInetAddress *inets[TSC_PREFLIGHT_MAX];
+  gint order[TSC_PREFLIGHT_MAX];
+  TscPreflightResult *result = g_new0 (TscPreflightResult, 1);
+  TscPreflightRace *race = g_new0 (TscPreflightRace, 1);
+  gint delay_ms = tsc_config_get_int ("preflight", "attempt-delay-ms", TSC_PREFLIGHT_ATTEMPT_DELAY_DEFAULT);
+  gint n, winner, i;
+
+  n = tsc_preflight_inets (addresses, inets);
+  race->result = result;
+  race->start = g_get_monotonic_time ();
+  tsc_preflight_order (inets, n, family, order);
+  for (i = 0; i < n; i++)
+    tsc_preflight_add (race, inets[order[i]], 0, -1, port, i * delay_ms);
+
+  winner = tsc_preflight_run (race);
+  if (winner >= 0) {
+    *ms = result->candidates[winner].ms;
+    // inets skipped the strings that did not parse
+    for (i = 0; addresses[i]; i++) {
+      GInetAddress *inet = g_inet_address_new_from_string (addresses[i]);
+      gboolean same = inet && g_inet_address_equal (inet, race->probes[winner].inet);
+
+      g_clear_object (&inet);
+      if (same)
+        break;
+    }
+    winner = addresses[i] ? i : -1;
+  } else {
+    winner = -1;
+  }
+
+  for (i = 0; i < n; i++)
+    g_object_unref (inets[i]);
+  tsc_preflight_result_clear (result);
+  g_free (result);
+  g_free (race);
+  return winner;
+}
+
+
+/*
+ * Connect to all of members ("host" or "host:port") at once, on the port
+ * protocol would use and each on its addresses in turn as above, so the
+ * first to connect is the nearest.  result holds the attempts, each
+ * candidate's entry being its index in members.  The index of the
+ * winner, or -1; clear result with tsc_preflight_result_clear either way.
+ */
+gint tsc_preflight_members (gchar **members, gint protocol, TscPreflightResult *result)
+{
+  GPtrArray *held = g_ptr_array_new_with_free_func (g_object_unref);
+  TscPreflightRace *race;
+  guint16 default_port = tsc_probe_default_port (protocol);
+  gint delay_ms = tsc_config_get_int ("preflight", "attempt-delay-ms", TSC_PREFLIGHT_ATTEMPT_DELAY_DEFAULT);
+  gint n_members = members ? g_strv_length (members) : 0;
+  gint per_member, winner, m, j;
+
+  memset (result, 0, sizeof (*result));
+  result->protocol = protocol;
+  result->ms = -1;
+  if (!n_members || !default_port) {
+    g_ptr_array_free (held, TRUE);
+    return -1;
+  }
+
+  race = g_new0 (TscPreflightRace, 1);
+  race->result = result;
+  race->start = g_get_monotonic_time ();
+  per_member = MAX (TSC_PREFLIGHT_MAX / n_members, 1);
+  for (m = 0; m < n_members && result->count < TSC_PREFLIGHT_MAX; m++) {
+    GInetAddress *inets[TSC_PREFLIGHT_MAX];
+    gint order[TSC_PREFLIGHT_MAX];
+    GSocketConnectable *connectable;
+    gchar **addresses;
+    gchar *host;
+    guint16 port;
+    gint n;
+
+    connectable = g_network_address_parse (members[m], default_port, NULL);
+    if (!connectable)
+      continue;
+    host = g_strdup (g_network_address_get_hostname (G_NETWORK_ADDRESS (connectable)));
+    port = g_network_address_get_port (G_NETWORK_ADDRESS (connectable));
+    g_object_unref (connectable);
+    // vncviewer reads host:N as display N
+    if (protocol == 1 && port < 100)
+      port += TSC_PORT_VNC;
+
+    addresses = tsc_preflight_host_addresses (host);
+    n = tsc_preflight_inets (addresses, inets);
+    g_strfreev (addresses);
+    tsc_preflight_order (inets, n, tsc_resolve_family (host), order);
+    for (j = 0; j < n; j++) {
+      g_ptr_array_add (held, inets[j]);
+      if (j < per_member && result->count < TSC_PREFLIGHT_MAX)
+        tsc_preflight_add (race, inets[order[j]], m, protocol, port, j * delay_ms);
+    }
+    g_free (host);
+  }
+
+  winner = result->count ? tsc_preflight_run (race) : -2;
+  if (winner >= 0) {
+    result->ms = result->candidates[winner].ms;
+    result->address = g_strdup (members[result->candidates[winner].entry]);
+    winner = result->candidates[winner].entry;
+  } else {
+    winner = -1;
+  }
+
+  g_free (race);
+  g_ptr_array_free (held, TRUE);
+  return winner;
+}
+
+
+void tsc_preflight_result_clear (TscPreflightResult *result)
+{
+  gint i;
+
+  for (i = 0; i < result->count; i++)
+    g_clear_pointer (&result->candidates[i].ip, g_free);
+  result->count = 0;
+  g_clear_pointer (&result->address, g_free);
+}
+
+
+/* Print how a race over protocols for address goes; 1 when nothing answered. */
+int tsc_preflight_report (const gchar *address, const gchar *protocols)
+{
+  static const gchar *const states[] = { "still pending", "not tried", "down", "no handshake", "healthy" };
+  TscPreflightResult result;
+  gchar *error = NULL;
+  gint ret, i;
+
+  ret = tsc_preflight_race (address, -1, protocols, &result, &error);
+
+  printf ("\n  %s\n\n", address);
+  for (i = 0; i < result.count; i++) {
+    TscPreflightCandidate *candidate = &result.candidates[i];
+
+    if (candidate->ms < 0)
+      printf ("  %-5s %5d  %-28s %s\n", tsc_preflight_name (candidate->protocol), candidate->port,
+              candidate->ip, states[candidate->state]);
+    else
+      printf ("  %-5s %5d  %-28s %-13s %d ms\n", tsc_preflight_name (candidate->protocol), candidate->port,
+              candidate->ip, states[candidate->state], candidate->ms);
+  }
+  if (ret) {
+    printf ("\n  %s\n\n", error);
+  } else {
+    // only FreeRDP, which speaks RDPv5 alone, is handed a raced address
+    gchar *connect = result.protocol == 4 ? tsc_resolve_connect_address (result.address, 4, TRUE) : NULL;
+
+    printf ("\n  launch %s at %s", tsc_preflight_name (result.protocol), result.address);
+    if (connect)
+      printf (", given to FreeRDP as %s", connect);
+    printf ("\n\n");
+    g_free (connect);
+  }
+
+  tsc_preflight_result_clear (&result);
+  g_free (error);
+  return ret;
+}
@@ -0,0 +1,50 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_PREFLIGHT_TIMEOUT_DEFAULT 3000
+#define TSC_PREFLIGHT_GRACE_DEFAULT 150
+#define TSC_PREFLIGHT_ATTEMPT_DELAY_DEFAULT 250
+#define TSC_PREFLIGHT_MAX 16
+
+typedef enum
+{
+  TSC_PREFLIGHT_PENDING,
+  TSC_PREFLIGHT_SKIPPED,
+  TSC_PREFLIGHT_DOWN,
+  TSC_PREFLIGHT_SILENT,
+  TSC_PREFLIGHT_HEALTHY
+} TscPreflightState;
+
+typedef struct
+{
+  gint protocol;
+  gint entry;
+  guint16 port;
+  gchar *ip;
+  TscPreflightState state;
+  gint ms;
+} TscPreflightCandidate;
+
+typedef struct
+{
+  gint protocol;
+  gchar *address;
+  gint ms;
+  gint count;
+  TscPreflightCandidate candidates[TSC_PREFLIGHT_MAX];
+} TscPreflightResult;
+
+int tsc_preflight_race (const gchar *address, gint protocol, const gchar *protocols,
+                        TscPreflightResult *result, gchar **error);
+gint tsc_preflight_eyeballs (gchar **addresses, gint family, guint16 port, gint *ms);
+gint tsc_preflight_members (gchar **members, gint protocol, TscPreflightResult *result);
+void tsc_preflight_result_clear (TscPreflightResult *result);
+int tsc_preflight_report (const gchar *address, const gchar *protocols);
+
+#endif /* PREFLIGHT_H */
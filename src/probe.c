@@ -0,0 +1,455 @@
+/***************************************
+*                                      *
+*   Reachability Prober                *
+*                                      *
+***************************************/
+
+/*
+ * Opens non-blocking TCP connects to the hosts shown in the recent
+ * server and profile dropdowns, on the port their protocol would use,
+ * so the rows can say "up, 12 ms" or "down" before anyone clicks
+ * Connect.  At most max-inflight probes run at once; a result is good
+ * for ttl-ms and a probe gives up after timeout-ms.  The RTT includes
+ * name resolution, since that is part of what the client will pay.
+ *
+ * Settings come from the [probe] group of ~/.tsclient/tsclient.conf;
+ * max-inflight=0 turns probing off.
+ *
+ * Probes run on the main loop, but a launch reads the results from its
+ * worker thread (see tsc_probe_is_down and tsc_probe_rtt), so the table
+ * and what the probes write into it are under results_lock.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "profiles.h"
+#include "probe.h"
+
+typedef struct {
+  gchar *address;
+  gint protocol;
+} TscProbeAlias;
+
+typedef struct {
+  TscProbeResult *result;
+  GCancellable *cancellable;
+  guint timeout_id;
+} TscProbeContext;
+
+static void tsc_probe_pump (void);
+
+static GHashTable *results = NULL;
+static GRecMutex results_lock;
+static GHashTable *aliases = NULL;
+static GQueue waiting = G_QUEUE_INIT;
+static GSocketClient *client = NULL;
+static GSList *watched = NULL;
+static gint inflight = 0;
+
+static gint ttl_ms = TSC_PROBE_TTL_DEFAULT;
+static gint timeout_ms = TSC_PROBE_TIMEOUT_DEFAULT;
+static gint max_inflight = TSC_PROBE_INFLIGHT_DEFAULT;
+
+
+static void
+tsc_probe_alias_free (gpointer data)
+{
+  TscProbeAlias *alias = data;
+
+  g_free (alias->address);
+  g_free (alias);
+}
+
+
+static void
+tsc_probe_init (void)
+{
+  g_rec_mutex_lock (&results_lock);
+  if (results) {
+    g_rec_mutex_unlock (&results_lock);
+    return;
+  }
+
+  results = g_hash_table_new (g_str_hash, g_str_equal);
+  aliases = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, tsc_probe_alias_free);
+  client = g_socket_client_new ();
+
+  ttl_ms = tsc_config_get_int ("probe", "ttl-ms", TSC_PROBE_TTL_DEFAULT);
+  timeout_ms = MAX (tsc_config_get_int ("probe", "timeout-ms", TSC_PROBE_TIMEOUT_DEFAULT), 1);
+  max_inflight = tsc_config_get_int ("probe", "max-inflight", TSC_PROBE_INFLIGHT_DEFAULT);
+  g_rec_mutex_unlock (&results_lock);
+}
+
+
+/* Port the client would connect to, or 0 if there is nothing to probe. */
+guint16 tsc_probe_default_port (gint protocol)
+{
+  switch (protocol) {
+  case 0:
+  case 4:
+    return TSC_PORT_RDP;
+  case 1:
+    return TSC_PORT_VNC;
+  case 3:
+    return TSC_PORT_ICA;
+  default:
+    // XDMCP is UDP, a connect would prove nothing
+    return 0;
+  }
+}
+
+
+static gboolean
+tsc_probe_parse (const gchar *address, gint protocol, gchar **host, guint16 *port)
+{
+  GSocketConnectable *connectable;
+  guint16 default_port = tsc_probe_default_port (protocol);
+
+  if (!address || !*address || !default_port)
+    return FALSE;
+
+  connectable = g_network_address_parse (address, default_port, NULL);
+  if (!connectable)
+    return FALSE;
+
+  *host = g_strdup (g_network_address_get_hostname (G_NETWORK_ADDRESS (connectable)));
+  *port = g_network_address_get_port (G_NETWORK_ADDRESS (connectable));
+  // vncviewer reads host:N as display N
+  if (protocol == 1 && *port < 100)
+    *port += TSC_PORT_VNC;
+
+  g_object_unref (connectable);
+  return TRUE;
+}
+
+
+static TscProbeResult *
+tsc_probe_get (const gchar *address, gint protocol, gboolean create)
+{
+  TscProbeResult *result;
+  gchar *host, *key;
+  guint16 port;
+
+  tsc_probe_init ();
+  if (!tsc_probe_parse (address, protocol, &host, &port))
+    return NULL;
+
+  key = g_strdup_printf ("%s:%u", host, port);
+  g_rec_mutex_lock (&results_lock);
+  result = g_hash_table_lookup (results, key);
+  if (!result && create) {
+    result = g_new0 (TscProbeResult, 1);
+    result->host = host;
+    result->port = port;
+    result->labels = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert (results, key, result);
+    g_rec_mutex_unlock (&results_lock);
+    return result;
+  }
+  g_rec_mutex_unlock (&results_lock);
+
+  g_free (key);
+  g_free (host);
+  return result;
+}
+
+
+static gboolean
+tsc_probe_fresh (const TscProbeResult *result)
+{
+  return result->checked &&
+         g_get_monotonic_time () - result->checked < (gint64) ttl_ms * 1000;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_probe_host                     *
+*                                      *
+***************************************/
+
+/* Queue a probe unless a fresh result is cached or one is under way. */
+void tsc_probe_host (const gchar *address, gint protocol)
+{
+  TscProbeResult *result;
+
+  tsc_probe_init ();
+  if (max_inflight <= 0)
+    return;
+
+  result = tsc_probe_get (address, protocol, TRUE);
+  if (!result || result->busy || tsc_probe_fresh (result))
+    return;
+
+  result->busy = TRUE;
+  g_queue_push_tail (&waiting, result);
+  tsc_probe_pump ();
+}
+
+
+/* Dropdown rows show labels; tell the prober which host a label means. */
+void tsc_probe_set_alias (const gchar *label, const gchar *address, gint protocol)
+{
+  TscProbeAlias *alias;
+  TscProbeResult *result;
+
+  tsc_probe_init ();
+  alias = g_hash_table_lookup (aliases, label);
+  if (alias && (result = tsc_probe_get (alias->address, alias->protocol, FALSE)))
+    g_hash_table_remove (result->labels, label);
+
+  alias = g_new0 (TscProbeAlias, 1);
+  alias->address = g_strdup (address);
+  alias->protocol = protocol;
+  g_hash_table_replace (aliases, g_strdup (label), alias);
+
+  // so a result only redraws the rows that show it
+  result = tsc_probe_get (address, protocol, TRUE);
+  if (result)
+    g_hash_table_add (result->labels, g_strdup (label));
+}
+
+
+static void
+tsc_probe_changed (TscProbeResult *result)
+{
+  GHashTableIter iter;
+  const gchar *label;
+  GSList *lptr;
+
+  for (lptr = watched; lptr; lptr = lptr->next) {
+    g_hash_table_iter_init (&iter, result->labels);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &label, NULL))
+      tsc_dropdown_refresh_label (lptr->data, label);
+  }
+}
+
+
+static gboolean
+tsc_probe_timeout_cb (gpointer user_data)
+{
+  TscProbeContext *ctx = user_data;
+
+  ctx->timeout_id = 0;
+  g_cancellable_cancel (ctx->cancellable);
+  return G_SOURCE_REMOVE;
+}
+
+
+static void
+tsc_probe_connected (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  TscProbeContext *ctx = user_data;
+  TscProbeResult *result = ctx->result;
+  GSocketConnection *connection;
+  gint64 now = g_get_monotonic_time ();
+
+  connection = g_socket_client_connect_finish (G_SOCKET_CLIENT (source), res, NULL);
+  g_rec_mutex_lock (&results_lock);
+  if (connection) {
+    result->state = TSC_PROBE_UP;
+    result->rtt_ms = (now - result->started) / 1000;
+    g_object_unref (connection);
+  } else {
+    result->state = TSC_PROBE_DOWN;
+    result->rtt_ms = -1;
+  }
+  result->checked = now;
+  result->busy = FALSE;
+  g_rec_mutex_unlock (&results_lock);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_probe_connected: %s:%u %s %d ms\n", result->host, result->port,
+          connection ? "up" : "down", result->rtt_ms);
+  #endif
+
+  if (ctx->timeout_id)
+    g_source_remove (ctx->timeout_id);
+  g_object_unref (ctx->cancellable);
+  g_free (ctx);
+
+  inflight--;
+  tsc_probe_changed (result);
+  tsc_probe_pump ();
+}
+
+
+static void
+tsc_probe_pump (void)
+{
+  while (inflight < max_inflight && !g_queue_is_empty (&waiting)) {
+    TscProbeResult *result = g_queue_pop_head (&waiting);
+    TscProbeContext *ctx = g_new0 (TscProbeContext, 1);
+    GSocketConnectable *connectable;
+
+    ctx->result = result;
+    ctx->cancellable = g_cancellable_new ();
+    ctx->timeout_id = g_timeout_add (timeout_ms, tsc_probe_timeout_cb, ctx);
+
+    g_rec_mutex_lock (&results_lock);
+    result->state = TSC_PROBE_PENDING;
+    result->started = g_get_monotonic_time ();
+    g_rec_mutex_unlock (&results_lock);
+    inflight++;
+
+    connectable = g_network_address_new (result->host, result->port);
+    g_socket_client_connect_async (client, connectable, ctx->cancellable,
+                                   tsc_probe_connected, ctx);
+    g_object_unref (connectable);
+  }
+}
+
+
+/***************************************
+*                                      *
+*   tsc_probe_lookup                   *
+*                                      *
+***************************************/
+
+/* The cached result while it is fresh, NULL otherwise; main thread only. */
+const TscProbeResult *tsc_probe_lookup (const gchar *address, gint protocol)
+{
+  TscProbeResult *result = tsc_probe_get (address, protocol, FALSE);
+
+  if (!result || !tsc_probe_fresh (result))
+    return NULL;
+  return result;
+}
+
+
+/* Any thread may ask this and tsc_probe_rtt. */
+gboolean tsc_probe_is_down (const gchar *address, gint protocol)
+{
+  const TscProbeResult *result;
+  gboolean down;
+
+  g_rec_mutex_lock (&results_lock);
+  result = tsc_probe_lookup (address, protocol);
+  down = result && result->state == TSC_PROBE_DOWN;
+  g_rec_mutex_unlock (&results_lock);
+  return down;
+}
+
+
+/* The RTT of a fresh result that found address up, else -1. */
+gint tsc_probe_rtt (const gchar *address, gint protocol)
+{
+  const TscProbeResult *result;
+  gint rtt_ms;
+
+  g_rec_mutex_lock (&results_lock);
+  result = tsc_probe_lookup (address, protocol);
+  rtt_ms = result && result->state == TSC_PROBE_UP ? result->rtt_ms : -1;
+  g_rec_mutex_unlock (&results_lock);
+  return rtt_ms;
+}
+
+
+gchar *tsc_probe_describe (const TscProbeResult *result)
+{
+  if (!result)
+    return NULL;
+
+  switch (result->state) {
+  case TSC_PROBE_UP:
+    return g_strdup_printf (_("up, %d ms"), result->rtt_ms);
+  case TSC_PROBE_DOWN:
+    return g_strdup (_("down"));
+  default:
+    return NULL;
+  }
+}
+
+
+static gchar *
+tsc_probe_annotate (const gchar *label)
+{
+  TscProbeAlias *alias;
+
+  tsc_probe_init ();
+  alias = g_hash_table_lookup (aliases, label);
+  if (!alias)
+    return NULL;
+
+  return tsc_probe_describe (tsc_probe_lookup (alias->address, alias->protocol));
+}
+
+
+static gint
+tsc_probe_compare (gconstpointer a, gconstpointer b)
+{
+  return g_ascii_strcasecmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+
+static void
+tsc_probe_detach (gpointer data, GObject *dropdown)
+{
+  watched = g_slist_remove (watched, dropdown);
+}
+
+
+/* Annotate a dropdown's rows and refresh them as results come in. */
+void tsc_probe_attach (GtkWidget *dropdown)
+{
+  tsc_dropdown_add_annotate (dropdown, tsc_probe_annotate);
+  watched = g_slist_prepend (watched, dropdown);
+  g_object_weak_ref (G_OBJECT (dropdown), tsc_probe_detach, NULL);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_probe_report                   *
+*                                      *
+***************************************/
+
+static void
+tsc_probe_report_profile (const gchar *file, const gchar *host, gint protocol,
+                          const gchar *pool, gpointer user_data)
+{
+  if (!*host)
+    return;
+  tsc_probe_set_alias (file, host, protocol);
+  tsc_probe_host (host, protocol);
+  g_ptr_array_add (user_data, g_strdup (file));
+}
+
+
+/* Check every indexed profile as the Quick Connect list would; 1 when there are none. */
+int tsc_probe_report (void)
+{
+  GPtrArray *files = g_ptr_array_new_with_free_func (g_free);
+  guint i;
+
+  tsc_profiles_update ();
+  tsc_profiles_foreach (tsc_probe_report_profile, files);
+  if (!files->len) {
+    printf ("\n  no profiles with a host in the index\n\n");
+    g_ptr_array_unref (files);
+    return 1;
+  }
+
+  while (inflight > 0 || !g_queue_is_empty (&waiting))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_ptr_array_sort (files, (GCompareFunc) tsc_probe_compare);
+  printf ("\n");
+  for (i = 0; i < files->len; i++) {
+    gchar *note = tsc_probe_annotate (g_ptr_array_index (files, i));
+
+    printf ("  %-28s %s\n", (gchar *) g_ptr_array_index (files, i), note ? note : _("not checked"));
+    g_free (note);
+  }
+  printf ("\n");
+
+  g_ptr_array_unref (files);
+  return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_PROBE_TTL_DEFAULT 30000
+#define TSC_PROBE_TIMEOUT_DEFAULT 2000
+#define TSC_PROBE_INFLIGHT_DEFAULT 8
+
+#define TSC_PORT_RDP 3389
+#define TSC_PORT_VNC 5900
+#define TSC_PORT_ICA 1494
+
+typedef enum
+{
+  TSC_PROBE_UNKNOWN,
+  TSC_PROBE_PENDING,
+  TSC_PROBE_UP,
+  TSC_PROBE_DOWN
+} TscProbeState;
+
+typedef struct
+{
+  gchar *host;
+  guint16 port;
+  TscProbeState state;
+  gint rtt_ms;
+  gint64 checked;
+  gint64 started;
+  gboolean busy;
+  GHashTable *labels;
+} TscProbeResult;
+
+guint16 tsc_probe_default_port (gint protocol);
+void tsc_probe_host (const gchar *address, gint protocol);
+void tsc_probe_set_alias (const gchar *label, const gchar *address, gint protocol);
+const TscProbeResult *tsc_probe_lookup (const gchar *address, gint protocol);
+gboolean tsc_probe_is_down (const gchar *address, gint protocol);
+gint tsc_probe_rtt (const gchar *address, gint protocol);
+gchar *tsc_probe_describe (const TscProbeResult *result);
+void tsc_probe_attach (GtkWidget *dropdown);
+int tsc_probe_report (void);
+
+#endif /* PROBE_H */
@@ -0,0 +1,474 @@
+/***************************************
+*                                      *
+*   Profile Index                      *
+*                                      *
+***************************************/
+
+/*
+ * ~/.tsclient/profiles.idx lists every .rdp profile for the panel
+ * applets, which cannot afford to walk and parse the tree themselves.
+ * One JSON object per line, a header first and then the profiles sorted
+ * by group and name (ungrouped profiles last):
+ *
+ *   {"version":1,"count":2}
+ *   {"file":"lab/ts1.rdp","group":"lab","name":"ts1","host":"ts1","pool":"","protocol":4,"mtime":1760000000,"size":812}
+ *   {"file":"home.rdp","group":"","name":"home","host":"10.0.0.5","pool":"","protocol":1,"mtime":1760000000,"size":640}
+ *
+ * Profiles whose mtime and size match the previous index are not parsed
+ * again, and the file is only rewritten (atomically) when something
+ * changed.  Readers must skip the file when version is not one they know.
+ */
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "scan.h"
+#include "bundle.h"
+#include "profiles.h"
+
+typedef struct {
+  gchar *file;
+  gchar *group;
+  gchar *name;
+  gchar *host;
+  gchar *pool;
+  gint protocol;
+  gint64 mtime;
+  gint64 size;
+} TscProfileEntry;
+
+
+static void
+tsc_profile_entry_free (TscProfileEntry *entry)
+{
+  g_free (entry->file);
+  g_free (entry->group);
+  g_free (entry->name);
+  g_free (entry->host);
+  g_free (entry->pool);
+  g_free (entry);
+}
+
+
+static gchar *
+tsc_profiles_file (void)
+{
+  gchar *home = tsc_home_path ();
+  gchar *file_name = g_build_path ("/", home, "profiles.idx", NULL);
+
+  g_free (home);
+  return file_name;
+}
+
+
+/*
+ * JSON string escaping: quote, backslash and the control characters,
+ * which g_strescape would write as \v or octal.  UTF-8 is left alone so
+ * readers can JSON.parse it.
+ */
+static gchar *
+tsc_profiles_escape (const gchar *value)
+{
+  GString *escaped = g_string_new (NULL);
+  const guchar *p;
+
+  for (p = (const guchar *) (value ? value : ""); *p; p++) {
+    switch (*p) {
+    case '"':  g_string_append (escaped, "\\\""); break;
+    case '\\': g_string_append (escaped, "\\\\"); break;
+    case '\b': g_string_append (escaped, "\\b"); break;
+    case '\f': g_string_append (escaped, "\\f"); break;
+    case '\n': g_string_append (escaped, "\\n"); break;
+    case '\r': g_string_append (escaped, "\\r"); break;
+    case '\t': g_string_append (escaped, "\\t"); break;
+    default:
+      if (*p < 0x20 || *p == 0x7f)
+        g_string_append_printf (escaped, "\\u%04x", *p);
+      else
+        g_string_append_c (escaped, *p);
+    }
+  }
+  return g_string_free (escaped, FALSE);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_profiles_read                  *
+*                                      *
+***************************************/
+
+/*
+ * GScanner knows every JSON escape but \uXXXX, so those become the octal
+ * escapes it does read.  An escaped backslash before a "u" is left alone.
+ */
+static gchar *
+tsc_profiles_unicode (const gchar *text)
+{
+  GString *line = g_string_new (NULL);
+  const gchar *p = text;
+
+  while (*p) {
+    if (*p != '\\') {
+      g_string_append_c (line, *p++);
+    } else if (p[1] == 'u' && g_ascii_isxdigit (p[2]) && g_ascii_isxdigit (p[3]) &&
+               g_ascii_isxdigit (p[4]) && g_ascii_isxdigit (p[5])) {
+      gchar utf8[6], hex[5];
+      gint i, n;
+
+      memcpy (hex, p + 2, 4);
+      hex[4] = '\0';
+      n = g_unichar_to_utf8 ((gunichar) g_ascii_strtoull (hex, NULL, 16), utf8);
+      for (i = 0; i < n; i++)
+        g_string_append_printf (line, "\\%03o", (guchar) utf8[i]);
+      p += 6;
+    } else {
+      g_string_append_c (line, *p++);
+      if (*p)
+        g_string_append_c (line, *p++);
+    }
+  }
+  return g_string_free (line, FALSE);
+}
+
+
+static TscProfileEntry *
+tsc_profiles_parse (const gchar *text, gint *version)
+{
+  GScanner *scanner = g_scanner_new (NULL);
+  TscProfileEntry *entry = g_new0 (TscProfileEntry, 1);
+  gchar *line = tsc_profiles_unicode (text);
+  gboolean success = FALSE;
+
+  scanner->config->store_int64 = TRUE;
+  g_scanner_input_text (scanner, line, strlen (line));
+  if (g_scanner_get_next_token (scanner) != '{') {
+    g_scanner_destroy (scanner);
+    g_free (line);
+    tsc_profile_entry_free (entry);
+    return NULL;
+  }
+
+  while (TRUE) {
+    GTokenType token = g_scanner_get_next_token (scanner);
+    gchar *key;
+
+    if (token == '}') {
+      success = TRUE;
+      break;
+    }
+    if (token != G_TOKEN_STRING)
+      break;
+    key = g_strdup (scanner->value.v_string);
+    if (g_scanner_get_next_token (scanner) != ':') {
+      g_free (key);
+      break;
+    }
+
+    token = g_scanner_get_next_token (scanner);
+    if (token == G_TOKEN_STRING) {
+      gchar **field = strcmp (key, "file") == 0 ? &entry->file :
+                      strcmp (key, "group") == 0 ? &entry->group :
+                      strcmp (key, "name") == 0 ? &entry->name :
+                      strcmp (key, "host") == 0 ? &entry->host :
+                      strcmp (key, "pool") == 0 ? &entry->pool : NULL;
+      if (field) {
+        g_free (*field);
+        *field = g_strdup (scanner->value.v_string);
+      }
+    } else if (token == G_TOKEN_INT) {
+      if (strcmp (key, "protocol") == 0)
+        entry->protocol = (gint) scanner->value.v_int64;
+      else if (strcmp (key, "mtime") == 0)
+        entry->mtime = scanner->value.v_int64;
+      else if (strcmp (key, "size") == 0)
+        entry->size = scanner->value.v_int64;
+      else if (strcmp (key, "version") == 0)
+        *version = (gint) scanner->value.v_int64;
+    } else {
+      g_free (key);
+      break;
+    }
+    g_free (key);
+
+    if (g_scanner_peek_next_token (scanner) == ',')
+      g_scanner_get_next_token (scanner);
+  }
+
+  g_scanner_destroy (scanner);
+  g_free (line);
+  if (!success || !entry->file) {
+    tsc_profile_entry_free (entry);
+    return NULL;
+  }
+  if (!entry->group)
+    entry->group = g_strdup ("");
+  if (!entry->name)
+    entry->name = g_strdup (entry->file);
+  return entry;
+}
+
+
+/* The previous index by file, or an empty table if it is missing or from another version. */
+static GHashTable *
+tsc_profiles_read (const gchar *file_name)
+{
+  GHashTable *entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                               (GDestroyNotify) tsc_profile_entry_free);
+  gchar *contents = NULL;
+  gchar **lines;
+  gint version = 0;
+  gint i;
+
+  if (!g_file_get_contents (file_name, &contents, NULL, NULL))
+    return entries;
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    TscProfileEntry *entry;
+
+    if (!*lines[i])
+      continue;
+    entry = tsc_profiles_parse (lines[i], &version);
+    if (!entry)
+      continue;
+    if (version != TSC_PROFILES_VERSION) {
+      tsc_profile_entry_free (entry);
+      break;
+    }
+    g_hash_table_replace (entries, entry->file, entry);
+  }
+
+  if (version != TSC_PROFILES_VERSION)
+    g_hash_table_remove_all (entries);
+  g_strfreev (lines);
+  g_free (contents);
+  return entries;
+}
+
+
+/* The files listed in the index, in its order; 1 when there is no usable index. */
+int tsc_profiles_cached (GSList **list)
+{
+  gchar *file_name = tsc_profiles_file ();
+  gchar *contents = NULL;
+  GSList *files = NULL;
+  gchar **lines;
+  gint version = 0;
+  gint i;
+
+  if (!g_file_get_contents (file_name, &contents, NULL, NULL)) {
+    g_free (file_name);
+    return 1;
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    TscProfileEntry *entry;
+
+    if (!*lines[i] || !(entry = tsc_profiles_parse (lines[i], &version)))
+      continue;
+    files = g_slist_prepend (files, entry->file);
+    entry->file = NULL;
+    tsc_profile_entry_free (entry);
+  }
+  g_strfreev (lines);
+  g_free (contents);
+  g_free (file_name);
+
+  if (version != TSC_PROFILES_VERSION) {
+    g_slist_free_full (files, g_free);
+    return 1;
+  }
+  *list = g_slist_concat (*list, g_slist_reverse (files));
+  return 0;
+}
+
+
+/* Call func for every profile in the index; 1 when there is no usable index. */
+int tsc_profiles_foreach (TscProfileFunc func, gpointer user_data)
+{
+  gchar *file_name = tsc_profiles_file ();
+  GHashTable *entries = tsc_profiles_read (file_name);
+  GHashTableIter iter;
+  TscProfileEntry *entry;
+  gint ret = g_hash_table_size (entries) == 0;
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+    func (entry->file, entry->host ? entry->host : "", entry->protocol,
+          entry->pool ? entry->pool : "", user_data);
+
+  g_hash_table_destroy (entries);
+  g_free (file_name);
+  return ret;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_profiles_update                *
+*                                      *
+***************************************/
+
+static gint
+tsc_profiles_compare (gconstpointer a, gconstpointer b)
+{
+  const TscProfileEntry *x = a, *y = b;
+  gint ret;
+
+  if (!*x->group != !*y->group)
+    return *x->group ? -1 : 1;
+  // "Lab" and "lab" are separate groups, each kept together
+  ret = g_ascii_strcasecmp (x->group, y->group);
+  if (!ret)
+    ret = strcmp (x->group, y->group);
+  return ret ? ret : g_ascii_strcasecmp (x->name, y->name);
+}
+
+
+static TscProfileEntry *
+tsc_profiles_load (const gchar *home, const gchar *file, gint64 mtime, gint64 size)
+{
+  TscProfileEntry *entry = g_new0 (TscProfileEntry, 1);
+  gchar *fqpath = g_build_path ("/", home, file, NULL);
+  gchar *base = g_path_get_basename (file);
+  gchar *group = g_path_get_dirname (file);
+  rdp_file *rdp = g_new0 (rdp_file, 1);
+
+  entry->file = g_strdup (file);
+  entry->group = strcmp (group, ".") == 0 ? g_strdup ("") : g_strdup (group);
+  entry->name = g_strndup (base, strlen (base) - strlen (".rdp"));
+  entry->mtime = mtime;
+  entry->size = size;
+
+  rdp_file_init (rdp);
+  if (rdp_file_load (rdp, fqpath) == 0) {
+    entry->host = g_strdup (rdp->full_address);
+    entry->pool = g_strdup (rdp->pool);
+    entry->protocol = rdp->protocol;
+  } else {
+    entry->pool = g_strdup ("");
+  }
+
+  rdp_file_free (rdp);
+  g_free (group);
+  g_free (base);
+  g_free (fqpath);
+  return entry;
+}
+
+
+static gboolean
+tsc_profiles_write (const gchar *file_name, GSList *entries)
+{
+  GString *out = g_string_new (NULL);
+  GError *err = NULL;
+  GSList *lptr;
+  gboolean ok;
+
+  g_string_append_printf (out, "{\"version\":%d,\"count\":%u}\n",
+                          TSC_PROFILES_VERSION, g_slist_length (entries));
+  for (lptr = entries; lptr; lptr = lptr->next) {
+    TscProfileEntry *entry = lptr->data;
+    gchar *file = tsc_profiles_escape (entry->file);
+    gchar *group = tsc_profiles_escape (entry->group);
+    gchar *name = tsc_profiles_escape (entry->name);
+    gchar *host = tsc_profiles_escape (entry->host);
+    gchar *pool = tsc_profiles_escape (entry->pool);
+
+    g_string_append_printf (out, "{\"file\":\"%s\",\"group\":\"%s\",\"name\":\"%s\","
+                            "\"host\":\"%s\",\"pool\":\"%s\",\"protocol\":%d,\"mtime\":%" G_GINT64_FORMAT
+                            ",\"size\":%" G_GINT64_FORMAT "}\n",
+                            file, group, name, host, pool, entry->protocol, entry->mtime, entry->size);
+    g_free (file);
+    g_free (group);
+    g_free (name);
+    g_free (host);
+    g_free (pool);
+  }
+
+  // readers only ever see the old index or the new one
+  ok = g_file_set_contents (file_name, out->str, out->len, &err);
+  if (!ok) {
+    g_warning ("Could not write %s: %s", file_name, err->message);
+    g_error_free (err);
+  }
+  g_string_free (out, TRUE);
+  return ok;
+}
+
+
+/*
+ * Bring profiles.idx in line with ~/.tsclient.  Returns 1 when the index
+ * was rewritten, 0 when it was already current, -1 on a write error.
+ */
+int tsc_profiles_update (void)
+{
+  GSList *files = NULL, *entries = NULL, *lptr;
+  GHashTable *old;
+  gchar *home, *file_name;
+  gboolean changed;
+  gint ret = 0;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_profiles_update\n");
+  #endif
+
+  home = tsc_home_path ();
+  file_name = tsc_profiles_file ();
+  old = tsc_profiles_read (file_name);
+  rdp_files_scan (&files);
+
+  // any profile gone, added or touched means a rewrite
+  changed = g_hash_table_size (old) != g_slist_length (files);
+  for (lptr = files; lptr; lptr = lptr->next) {
+    gchar *fqpath = g_build_path ("/", home, lptr->data, NULL);
+    TscProfileEntry *entry = g_hash_table_lookup (old, lptr->data);
+    gboolean found;
+    gint64 mtime, size;
+    gsize length;
+
+    found = tsc_scan_stat (fqpath, &mtime, &size) == 0;
+    // bundled profiles carry the bundle's mtime
+    if (!found && tsc_bundle_lookup (lptr->data, NULL, &length, &mtime)) {
+      size = length;
+      found = TRUE;
+    }
+    if (found) {
+      // entries from before "pool" was indexed are parsed once more
+      if (entry && entry->pool && entry->mtime == mtime && entry->size == size) {
+        g_hash_table_steal (old, lptr->data);
+      } else {
+        entry = tsc_profiles_load (home, lptr->data, mtime, size);
+        changed = TRUE;
+      }
+      entries = g_slist_prepend (entries, entry);
+    } else {
+      changed = TRUE;
+    }
+    g_free (fqpath);
+  }
+
+  if (changed || !g_file_test (file_name, G_FILE_TEST_EXISTS)) {
+    entries = g_slist_sort (entries, tsc_profiles_compare);
+    ret = tsc_profiles_write (file_name, entries) ? 1 : -1;
+  }
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_profiles_update: %u profiles, %s\n", g_slist_length (entries),
+          ret == 1 ? "rewritten" : ret == 0 ? "unchanged" : "failed");
+  #endif
+
+  g_slist_free_full (entries, (GDestroyNotify) tsc_profile_entry_free);
+  g_slist_free_full (files, g_free);
+  g_hash_table_destroy (old);
+  g_free (file_name);
+  g_free (home);
+  return ret;
+}
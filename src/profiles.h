@@ -0,0 +1,19 @@
+#ifndef PROFILES_H
+#define PROFILES_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_PROFILES_VERSION 1
+
+typedef void (*TscProfileFunc) (const gchar *file, const gchar *host, gint protocol,
+                                const gchar *pool, gpointer user_data);
+
+int tsc_profiles_cached (GSList **list);
+int tsc_profiles_foreach (TscProfileFunc func, gpointer user_data);
+int tsc_profiles_update (void);
+
+#endif /* PROFILES_H */
@@ -16,6 +16,13 @@
 
 #include "rdpfile.h"
 #include "support.h"
+#include "probe.h"
+#include "pool.h"
+#include "metrics.h"
+#include "profiles.h"
+#include "scan.h"
+#include "bundle.h"
+#include "tsc-trace.h"
 #include "tsc-presets.h"
 
 static int rdp_file_load_legacy (rdp_file *rdp_in, const char *fqpath);
@@ -23,6 +30,7 @@ static gboolean rdp_file_load_json_data (rdp_file *rdp_in, const gchar *data, gs
 static void rdp_file_json_add_string (GString *buffer, gboolean *first, const gchar *name, const gchar *value);
 static void rdp_file_json_add_int (GString *buffer, gboolean *first, const gchar *name, gint value);
 static gboolean rdp_file_apply_json_value (rdp_file *rdp, const gchar *key, GScanner *scanner, GTokenType token);
+static void rdp_files_revalidate (void);
 
 static const gchar *const tsc_tls_versions[] = {
   "",
@@ -32,6 +40,76 @@ static const gchar *const tsc_tls_versions[] = {
   NULL
 };
 
+/* rdp_client, graphics_codec, vnc_encoding and pool_policy, in the order of the form's lists */
+static const gchar *const tsc_rdp_clients[] = {
+  "",
+  "rdesktop",
+  "xfreerdp",
+  "xfreerdp3",
+  NULL
+};
+
+static const gchar *const tsc_graphics_codecs[] = {
+  "",
+  "avc444",
+  "avc420",
+  "rfx",
+  "off",
+  NULL
+};
+
+static const gchar *const tsc_vnc_encodings[] = {
+  "",
+  "tight",
+  "zrle",
+  "hextile",
+  "raw",
+  NULL
+};
+
+static const gchar *const tsc_pool_policies[] = {
+  "",
+  "random",
+  "rtt",
+  "sessions",
+  NULL
+};
+
+/* The string fields, each owned by its rdp_file; see rdp_file_free. */
+static const gsize rdp_file_strings[] = {
+  G_STRUCT_OFFSET (rdp_file, alternate_shell),
+  G_STRUCT_OFFSET (rdp_file, client_hostname),
+  G_STRUCT_OFFSET (rdp_file, description),
+  G_STRUCT_OFFSET (rdp_file, domain),
+  G_STRUCT_OFFSET (rdp_file, full_address),
+  G_STRUCT_OFFSET (rdp_file, graphics_codec),
+  G_STRUCT_OFFSET (rdp_file, keyboard_language),
+  G_STRUCT_OFFSET (rdp_file, local_codepage),
+  G_STRUCT_OFFSET (rdp_file, password),
+  G_STRUCT_OFFSET (rdp_file, win_password),
+  G_STRUCT_OFFSET (rdp_file, pool),
+  G_STRUCT_OFFSET (rdp_file, pool_policy),
+  G_STRUCT_OFFSET (rdp_file, progman_group),
+  G_STRUCT_OFFSET (rdp_file, proto_file),
+  G_STRUCT_OFFSET (rdp_file, protocols),
+  G_STRUCT_OFFSET (rdp_file, rdp_client),
+  G_STRUCT_OFFSET (rdp_file, shell_working_directory),
+  G_STRUCT_OFFSET (rdp_file, tls_version),
+  G_STRUCT_OFFSET (rdp_file, username),
+  G_STRUCT_OFFSET (rdp_file, vnc_encoding),
+  G_STRUCT_OFFSET (rdp_file, winposstr),
+};
+
+static gint
+tsc_value_index (const gchar *const *values, const gchar *value)
+{
+  for (gint i = 1; value && values[i]; i++) {
+    if (g_ascii_strcasecmp (value, values[i]) == 0)
+      return i;
+  }
+  return 0;
+}
+
 static gint
 tsc_tls_version_index (const gchar *value)
 {
@@ -63,6 +141,25 @@ tsc_screen_preset_index (gint width, gint height)
   return -1;
 }
 
+/* The form's list position for connection_type; unknown values are Custom. */
+static gint
+tsc_speed_preset_index (gint connection_type)
+{
+  for (guint i = 0; i < TSC_SPEED_PRESET_COUNT; i++) {
+    if (tsc_speed_presets[i].connection_type == connection_type)
+      return (gint) i;
+  }
+  return 0;
+}
+
+/* Replace a string field with value, which the rdp_file takes over. */
+static void
+rdp_file_take (char **field, char *value)
+{
+  g_free (*field);
+  *field = value;
+}
+
 static void
 rdp_file_json_add_string (GString *buffer, gboolean *first, const gchar *name, const gchar *value)
 {
@@ -92,7 +189,7 @@ rdp_file_apply_json_value (rdp_file *rdp, const gchar *key, GScanner *scanner, G
   if (g_strcmp0 (key, #field) == 0) { \
     if (token != G_TOKEN_STRING) \
       return FALSE; \
-    rdp->field = g_strdup (scanner->value.v_string ? scanner->value.v_string : ""); \
+    rdp_file_take (&rdp->field, g_strdup (scanner->value.v_string ? scanner->value.v_string : "")); \
     return TRUE; \
   }
 
@@ -111,6 +208,7 @@ rdp_file_apply_json_value (rdp_file *rdp, const gchar *key, GScanner *scanner, G
   SET_INT_FIELD (bitmapcachepersistenable);
   SET_STR_FIELD (client_hostname);
   SET_INT_FIELD (compression);
+  SET_INT_FIELD (connection_type);
   SET_STR_FIELD (description);
   SET_INT_FIELD (desktop_size_id);
   SET_INT_FIELD (desktopheight);
@@ -124,19 +222,26 @@ rdp_file_apply_json_value (rdp_file *rdp, const gchar *key, GScanner *scanner, G
   SET_INT_FIELD (enable_alternate_shell);
   SET_INT_FIELD (enable_wm_keys);
   SET_STR_FIELD (full_address);
+  SET_INT_FIELD (glyph_cache);
+  SET_STR_FIELD (graphics_codec);
   SET_INT_FIELD (hide_wm_decorations);
   SET_STR_FIELD (keyboard_language);
   SET_INT_FIELD (keyboardhook);
   SET_INT_FIELD (no_motion_events);
   SET_STR_FIELD (password);
   SET_STR_FIELD (win_password);
+  SET_STR_FIELD (pool);
+  SET_STR_FIELD (pool_policy);
   SET_STR_FIELD (progman_group);
   SET_INT_FIELD (protocol);
   SET_STR_FIELD (proto_file);
+  SET_STR_FIELD (protocols);
+  SET_STR_FIELD (rdp_client);
   SET_INT_FIELD (redirectcomports);
   SET_INT_FIELD (redirectdrives);
   SET_INT_FIELD (redirectprinters);
   SET_INT_FIELD (redirectsmartcards);
+  SET_INT_FIELD (restart_policy);
   SET_INT_FIELD (screen_mode_id);
   SET_INT_FIELD (session_bpp);
   SET_INT_FIELD (disable_encryption);
@@ -148,6 +253,9 @@ rdp_file_apply_json_value (rdp_file *rdp, const gchar *key, GScanner *scanner, G
   SET_STR_FIELD (tls_version);
   SET_STR_FIELD (local_codepage);
   SET_STR_FIELD (shell_working_directory);
+  SET_INT_FIELD (vnc_compress_level);
+  SET_STR_FIELD (vnc_encoding);
+  SET_INT_FIELD (vnc_quality);
   SET_STR_FIELD (username);
   SET_STR_FIELD (winposstr);
 
@@ -185,6 +293,11 @@ rdp_file_load_json_data (rdp_file *rdp, const gchar *data, gsize length)
       break;
     }
     token = g_scanner_get_next_token (scanner);
+    // GScanner reads -1 as '-' followed by 1
+    if (token == '-' && g_scanner_peek_next_token (scanner) == G_TOKEN_INT) {
+      token = g_scanner_get_next_token (scanner);
+      scanner->value.v_int = -scanner->value.v_int;
+    }
     if (!rdp_file_apply_json_value (rdp, key, scanner, token)) {
       g_free (key);
       break;
@@ -217,14 +330,15 @@ int rdp_file_init (rdp_file *rdp_in)
   /* swap the return array */
   rdp = rdp_in;
 
-  rdp->alternate_shell = "";
+  rdp->alternate_shell = g_strdup ("");
   rdp->attach_to_console = 0;
   rdp->audiomode = 0;
   rdp->auto_connect = 0;
   rdp->bitmapcachepersistenable = 0;
-  rdp->client_hostname = "";
+  rdp->client_hostname = g_strdup ("");
   rdp->compression = 0;
-  rdp->description = "";
+  rdp->connection_type = TSC_SPEED_CUSTOM;
+  rdp->description = g_strdup ("");
   rdp->desktop_size_id = 0;
   rdp->desktopheight = 0;
   rdp->desktopwidth = 0;
@@ -236,53 +350,132 @@ int rdp_file_init (rdp_file *rdp_in)
   rdp->disable_wallpaper = 0;
   rdp->disable_encryption = 0;
   rdp->displayconnectionbar = 0;
-  rdp->domain = "";
+  rdp->domain = g_strdup ("");
   rdp->enable_alternate_shell = 0;
   rdp->enable_wm_keys = 0;
   rdp->force_bitmap_updates = 0;
-  rdp->full_address = "";
+  rdp->full_address = g_strdup ("");
+  rdp->glyph_cache = 0;
+  rdp->graphics_codec = g_strdup ("");
   rdp->hide_wm_decorations = 0;
-  rdp->keyboard_language = "";
+  rdp->keyboard_language = g_strdup ("");
   rdp->keyboardhook = 0;
-  rdp->local_codepage = "";
+  rdp->local_codepage = g_strdup ("");
   rdp->no_motion_events = 0;
-  rdp->password = "";
-  rdp->win_password = "";
-  rdp->progman_group = "";
+  rdp->password = g_strdup ("");
+  rdp->win_password = g_strdup ("");
+  rdp->pool = g_strdup ("");
+  rdp->pool_policy = g_strdup ("");
+  rdp->progman_group = g_strdup ("");
   rdp->protocol = 0;
-  rdp->proto_file = "";
+  rdp->proto_file = g_strdup ("");
+  rdp->protocols = g_strdup ("");
+  rdp->rdp_client = g_strdup ("");
   rdp->redirectcomports = 0;
   rdp->redirectdrives = 0;
   rdp->redirectprinters = 0;
   rdp->redirectsmartcards = 0;
+  rdp->restart_policy = RDP_RESTART_NEVER;
   rdp->screen_mode_id = 0;
   rdp->session_bpp = 0;
   rdp->sync_numlock = 0;
-  rdp->shell_working_directory = "";
-  rdp->tls_version = "";
+  rdp->shell_working_directory = g_strdup ("");
+  rdp->tls_version = g_strdup ("");
   rdp->use_backing_store = 0;
-  rdp->username = "";
-  rdp->winposstr = "";
+  rdp->username = g_strdup ("");
+  rdp->vnc_compress_level = -1;
+  rdp->vnc_encoding = g_strdup ("");
+  rdp->vnc_quality = -1;
+  rdp->winposstr = g_strdup ("");
 
   return 0;
 
 }
 
+/* A copy of rdp_in with strings of its own; free it with rdp_file_free. */
+rdp_file *rdp_file_copy (const rdp_file *rdp_in)
+{
+  rdp_file *rdp = g_memdup2 (rdp_in, sizeof (rdp_file));
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (rdp_file_strings); i++)
+    G_STRUCT_MEMBER (char *, rdp, rdp_file_strings[i]) =
+      g_strdup (G_STRUCT_MEMBER (char *, rdp_in, rdp_file_strings[i]));
+  return rdp;
+}
+
+
+/* Free an rdp_file set up by rdp_file_init, with its strings. */
+void rdp_file_free (rdp_file *rdp_in)
+{
+  guint i;
+
+  if (!rdp_in)
+    return;
+  for (i = 0; i < G_N_ELEMENTS (rdp_file_strings); i++)
+    g_free (G_STRUCT_MEMBER (char *, rdp_in, rdp_file_strings[i]));
+  g_free (rdp_in);
+}
+
 /***************************************
 *                                      *
 *   rdp_file_load                      *
 *                                      *
 ***************************************/
 
+/* The name under ~/.tsclient of fqpath, or NULL when it lies elsewhere. */
+static const gchar *
+rdp_file_home_name (const gchar *fqpath)
+{
+  gchar *home = tsc_home_path ();
+  gsize len = strlen (home);
+  const gchar *name = NULL;
+
+  if (strncmp (fqpath, home, len) == 0 && fqpath[len] == '/')
+    name = fqpath + len + 1;
+  g_free (home);
+  return name;
+}
+
+
+/* A profile missing from ~/.tsclient may still be in a bundle. */
+static int
+rdp_file_load_bundled (rdp_file *rdp_in, const char *fqpath)
+{
+  const gchar *name, *data;
+  gsize length;
+
+  if (!(name = rdp_file_home_name (fqpath)))
+    return 1;
+  if (!tsc_bundle_lookup (name, &data, &length, NULL))
+    return 1;
+  return rdp_file_load_json_data (rdp_in, data, length) ? 0 : 1;
+}
+
+
+/* Whether fqpath is a profile, on disk or in a bundle. */
+gboolean rdp_profile_exists (const gchar *fqpath)
+{
+  const gchar *name;
+
+  if (g_file_test (fqpath, G_FILE_TEST_IS_REGULAR))
+    return TRUE;
+  name = rdp_file_home_name (fqpath);
+  return name && tsc_bundle_lookup (name, NULL, NULL, NULL);
+}
+
+
 int rdp_file_load (rdp_file *rdp_in, const char *fqpath)
 {
   gchar *contents = NULL;
   gsize length = 0;
+  int ret;
 
   #ifdef TSCLIENT_DEBUG
   printf ("rdp_file_load\n");
   #endif
 
+  TSC_TRACE1 (profile__load__start, fqpath);
   if (g_file_get_contents (fqpath, &contents, &length, NULL)) {
     const gchar *ptr = contents;
     while (ptr && g_ascii_isspace (*ptr))
@@ -290,14 +483,21 @@ int rdp_file_load (rdp_file *rdp_in, const char *fqpath)
     if (ptr && *ptr == '{') {
       gboolean ok = rdp_file_load_json_data (rdp_in, contents, length);
       g_free (contents);
-      if (ok)
+      if (ok) {
+        TSC_TRACE3 (profile__load__done, fqpath, "json", 0);
         return 0;
+      }
     } else {
       g_free (contents);
     }
+  } else if (rdp_file_load_bundled (rdp_in, fqpath) == 0) {
+    TSC_TRACE3 (profile__load__done, fqpath, "bundle", 0);
+    return 0;
   }
 
-  return rdp_file_load_legacy (rdp_in, fqpath);
+  ret = rdp_file_load_legacy (rdp_in, fqpath);
+  TSC_TRACE3 (profile__load__done, fqpath, "rdp", ret);
+  return ret;
 }
 
 static int
@@ -368,31 +568,37 @@ rdp_file_load_legacy (rdp_file *rdp_in, const char *fqpath)
 *                                      *
 ***************************************/
 
-int rdp_file_save (rdp_file *rdp_in, const char *fqpath)
+gchar *rdp_file_to_json (rdp_file *rdp_in)
 {
   rdp_file *rdp = rdp_in;
   GString *json = g_string_new ("{\n");
   gboolean first = TRUE;
-  gboolean ok;
 
   rdp_file_json_add_string (json, &first, "alternate_shell", rdp->alternate_shell);
   rdp_file_json_add_string (json, &first, "client_hostname", rdp->client_hostname);
   rdp_file_json_add_string (json, &first, "description", rdp->description);
   rdp_file_json_add_string (json, &first, "domain", rdp->domain);
   rdp_file_json_add_string (json, &first, "full_address", rdp->full_address);
+  rdp_file_json_add_string (json, &first, "graphics_codec", rdp->graphics_codec);
   rdp_file_json_add_string (json, &first, "keyboard_language", rdp->keyboard_language);
   rdp_file_json_add_string (json, &first, "password", rdp->password);
   rdp_file_json_add_string (json, &first, "win_password", rdp->win_password);
+  rdp_file_json_add_string (json, &first, "pool", rdp->pool);
+  rdp_file_json_add_string (json, &first, "pool_policy", rdp->pool_policy);
   rdp_file_json_add_string (json, &first, "progman_group", rdp->progman_group);
   rdp_file_json_add_string (json, &first, "proto_file", rdp->proto_file);
+  rdp_file_json_add_string (json, &first, "protocols", rdp->protocols);
+  rdp_file_json_add_string (json, &first, "rdp_client", rdp->rdp_client);
   rdp_file_json_add_string (json, &first, "shell_working_directory", rdp->shell_working_directory);
   rdp_file_json_add_string (json, &first, "username", rdp->username);
+  rdp_file_json_add_string (json, &first, "vnc_encoding", rdp->vnc_encoding);
   rdp_file_json_add_string (json, &first, "winposstr", rdp->winposstr);
   rdp_file_json_add_int (json, &first, "attach_to_console", rdp->attach_to_console);
   rdp_file_json_add_int (json, &first, "audiomode", rdp->audiomode);
   rdp_file_json_add_int (json, &first, "auto_connect", rdp->auto_connect);
   rdp_file_json_add_int (json, &first, "bitmapcachepersistenable", rdp->bitmapcachepersistenable);
   rdp_file_json_add_int (json, &first, "compression", rdp->compression);
+  rdp_file_json_add_int (json, &first, "connection_type", rdp->connection_type);
   rdp_file_json_add_int (json, &first, "desktop_size_id", rdp->desktop_size_id);
   rdp_file_json_add_int (json, &first, "desktopheight", rdp->desktopheight);
   rdp_file_json_add_int (json, &first, "desktopwidth", rdp->desktopwidth);
@@ -403,6 +609,7 @@ int rdp_file_save (rdp_file *rdp_in, const char *fqpath)
   rdp_file_json_add_int (json, &first, "displayconnectionbar", rdp->displayconnectionbar);
   rdp_file_json_add_int (json, &first, "enable_alternate_shell", rdp->enable_alternate_shell);
   rdp_file_json_add_int (json, &first, "enable_wm_keys", rdp->enable_wm_keys);
+  rdp_file_json_add_int (json, &first, "glyph_cache", rdp->glyph_cache);
   rdp_file_json_add_int (json, &first, "hide_wm_decorations", rdp->hide_wm_decorations);
   rdp_file_json_add_int (json, &first, "keyboardhook", rdp->keyboardhook);
   rdp_file_json_add_int (json, &first, "no_motion_events", rdp->no_motion_events);
@@ -411,6 +618,7 @@ int rdp_file_save (rdp_file *rdp_in, const char *fqpath)
   rdp_file_json_add_int (json, &first, "redirectdrives", rdp->redirectdrives);
   rdp_file_json_add_int (json, &first, "redirectprinters", rdp->redirectprinters);
   rdp_file_json_add_int (json, &first, "redirectsmartcards", rdp->redirectsmartcards);
+  rdp_file_json_add_int (json, &first, "restart_policy", rdp->restart_policy);
   rdp_file_json_add_int (json, &first, "screen_mode_id", rdp->screen_mode_id);
   rdp_file_json_add_int (json, &first, "session_bpp", rdp->session_bpp);
   rdp_file_json_add_int (json, &first, "disable_encryption", rdp->disable_encryption);
@@ -419,17 +627,78 @@ int rdp_file_save (rdp_file *rdp_in, const char *fqpath)
   rdp_file_json_add_int (json, &first, "use_backing_store", rdp->use_backing_store);
   rdp_file_json_add_int (json, &first, "disable_remote_ctrl", rdp->disable_remote_ctrl);
   rdp_file_json_add_int (json, &first, "sync_numlock", rdp->sync_numlock);
+  rdp_file_json_add_int (json, &first, "vnc_compress_level", rdp->vnc_compress_level);
+  rdp_file_json_add_int (json, &first, "vnc_quality", rdp->vnc_quality);
   rdp_file_json_add_string (json, &first, "tls_version", rdp->tls_version);
   rdp_file_json_add_string (json, &first, "local_codepage", rdp->local_codepage);
 
   g_string_append (json, "\n}\n");
-  ok = g_file_set_contents (fqpath, json->str, json->len, NULL);
-  g_string_free (json, TRUE);
+  return g_string_free (json, FALSE);
+}
+
+
+int rdp_file_save (rdp_file *rdp_in, const char *fqpath)
+{
+  gchar *json = rdp_file_to_json (rdp_in);
+  gboolean ok;
+
+  ok = g_file_set_contents (fqpath, json, -1, NULL);
+  g_free (json);
+
+  // a saved profile shows up in the applets' index after a background rescan
+  if (ok && g_str_has_suffix (fqpath, ".rdp"))
+    rdp_files_revalidate ();
 
   return ok ? 0 : 1;
 }
 
 
+/***************************************
+*                                      *
+*   rdp_file_apply_speed               *
+*                                      *
+***************************************/
+
+/* Overwrite the experience fields with the connection_type preset, if any. */
+void rdp_file_apply_speed (rdp_file *rdp_in)
+{
+  rdp_file_apply_preset (rdp_in, rdp_in->connection_type);
+}
+
+
+/* Overwrite the experience fields with the preset for connection_type. */
+void rdp_file_apply_preset (rdp_file *rdp_in, gint connection_type)
+{
+  const TscSpeedPreset *preset = &tsc_speed_presets[tsc_speed_preset_index (connection_type)];
+
+  if (preset->connection_type == TSC_SPEED_CUSTOM)
+    return;
+
+  rdp_in->compression = preset->compression;
+  rdp_in->disable_wallpaper = preset->disable_wallpaper;
+  rdp_in->disable_full_window_drag = preset->disable_full_window_drag;
+  rdp_in->disable_menu_anims = preset->disable_menu_anims;
+  rdp_in->disable_themes = preset->disable_themes;
+}
+
+
+/* The disable_* fields as rdesktop -x flags. */
+int rdp_file_performance_flags (rdp_file *rdp_in)
+{
+  int flags = 0;
+
+  if (rdp_in->disable_wallpaper == 1)
+    flags |= TSC_PERF_NO_WALLPAPER;
+  if (rdp_in->disable_full_window_drag == 1)
+    flags |= TSC_PERF_NO_FULLWINDOWDRAG;
+  if (rdp_in->disable_menu_anims == 1)
+    flags |= TSC_PERF_NO_MENUANIMATIONS;
+  if (rdp_in->disable_themes == 1)
+    flags |= TSC_PERF_NO_THEMING;
+  return flags;
+}
+
+
 /***************************************
 *                                      *
 *   rdp_file_set_screen                *
@@ -450,6 +719,7 @@ int rdp_file_set_screen (rdp_file *rdp_in, GtkWidget *main_window)
   GtkWidget *aln_color;
   GtkWidget *opt_color_specific;
   gboolean use_color_specific = FALSE;
+  rdp_file shown;
   
   #ifdef TSCLIENT_DEBUG
   printf ("rdp_file_set_screen\n");
@@ -489,7 +759,8 @@ int rdp_file_set_screen (rdp_file *rdp_in, GtkWidget *main_window)
   gtk_editable_insert_text((GtkEditable*) widget, (gchar *)rdp->password, strlen(rdp->password), &pos);
 
   /* win password (oh, ugly)*/
-  g_object_set_data (G_OBJECT (main_window), "win_password", rdp->win_password);
+  g_object_set_data_full (G_OBJECT (main_window), "win_password",
+                          g_strdup (rdp->win_password), g_free);
 
   widget = lookup_widget (main_window, "txtDomain");
   gtk_editable_delete_text ((GtkEditable*) widget, 0, -1);
@@ -503,6 +774,22 @@ int rdp_file_set_screen (rdp_file *rdp_in, GtkWidget *main_window)
   gtk_editable_delete_text ((GtkEditable*) widget, 0, -1);
   gtk_editable_insert_text((GtkEditable*) widget, (gchar *)rdp->proto_file, strlen(rdp->proto_file), &pos);
 
+  widget = lookup_widget (main_window, "txtProtocols");
+  if (widget) {
+    gtk_editable_delete_text ((GtkEditable*) widget, 0, -1);
+    gtk_editable_insert_text((GtkEditable*) widget, (gchar *)rdp->protocols, strlen(rdp->protocols), &pos);
+  }
+
+  widget = lookup_widget (main_window, "txtPool");
+  if (widget) {
+    gtk_editable_delete_text ((GtkEditable*) widget, 0, -1);
+    gtk_editable_insert_text((GtkEditable*) widget, (gchar *)rdp->pool, strlen(rdp->pool), &pos);
+  }
+
+  widget = lookup_widget (main_window, "optPoolPolicy");
+  if (widget)
+    tsc_dropdown_set_selected (widget, tsc_value_index (tsc_pool_policies, rdp->pool_policy));
+
   widget = lookup_widget (main_window, "optTlsVersion");
   if (widget)
     tsc_dropdown_set_selected (widget, tsc_tls_version_index (rdp->tls_version));
@@ -644,8 +931,49 @@ int rdp_file_set_screen (rdp_file *rdp_in, GtkWidget *main_window)
     widget = lookup_widget (main_window, "chkStartProgram");
     tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
   }
+
+  widget = lookup_widget (main_window, "optRestartPolicy");
+  if (widget)
+    tsc_dropdown_set_selected (widget, CLAMP (rdp->restart_policy, RDP_RESTART_NEVER, RDP_RESTART_ALWAYS));
   
-  // the checkboxes on the performance frame
+  // the checkboxes on the performance frame show the speed's preset, but
+  // the profile keeps its own values: the preset goes on a shallow copy,
+  // which only has ints overwritten and is never freed
+  shown = *rdp;
+  rdp_file_apply_speed (&shown);
+  widget = lookup_widget (main_window, "optConnectionSpeed");
+  if (widget)
+    tsc_dropdown_set_selected (widget, tsc_speed_preset_index (rdp->connection_type));
+
+  widget = lookup_widget (main_window, "chkCompression");
+  if (widget)
+    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), shown.compression == 1);
+
+  widget = lookup_widget (main_window, "optRdpClient");
+  if (widget)
+    tsc_dropdown_set_selected (widget, tsc_value_index (tsc_rdp_clients, rdp->rdp_client));
+
+  widget = lookup_widget (main_window, "optGraphicsCodec");
+  if (widget)
+    tsc_dropdown_set_selected (widget, tsc_value_index (tsc_graphics_codecs, rdp->graphics_codec));
+
+  widget = lookup_widget (main_window, "chkGlyphCache");
+  if (widget)
+    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), rdp->glyph_cache == 1);
+
+  // the level lists start with "viewer default" for -1
+  widget = lookup_widget (main_window, "optVncEncoding");
+  if (widget)
+    tsc_dropdown_set_selected (widget, tsc_value_index (tsc_vnc_encodings, rdp->vnc_encoding));
+
+  widget = lookup_widget (main_window, "optVncCompress");
+  if (widget)
+    tsc_dropdown_set_selected (widget, CLAMP (rdp->vnc_compress_level, -1, 9) + 1);
+
+  widget = lookup_widget (main_window, "optVncQuality");
+  if (widget)
+    tsc_dropdown_set_selected (widget, CLAMP (rdp->vnc_quality, -1, 9) + 1);
+
   widget = lookup_widget (main_window, "chkBitmapCache");
   if (rdp->bitmapcachepersistenable == 1)
     tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
@@ -653,28 +981,16 @@ int rdp_file_set_screen (rdp_file *rdp_in, GtkWidget *main_window)
     tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), FALSE);
 
   widget = lookup_widget (main_window, "chkDesktopBackground");
-  if (rdp->disable_wallpaper == 1)
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
-  else
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), FALSE);
+  tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), shown.disable_wallpaper != 1);
 
   widget = lookup_widget (main_window, "chkWindowContent");
-  if (rdp->disable_full_window_drag == 1)
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
-  else
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), FALSE);
+  tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), shown.disable_full_window_drag != 1);
 
   widget = lookup_widget (main_window, "chkAnimation");
-  if (rdp->disable_menu_anims == 1)
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
-  else
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), FALSE);
+  tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), shown.disable_menu_anims != 1);
 
   widget = lookup_widget (main_window, "chkThemes");
-  if (rdp->disable_themes == 1)
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), TRUE);
-  else
-    tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), FALSE);
+  tsc_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), shown.disable_themes != 1);
 
 
   // the checkboxes on the performance frame (extras)
@@ -764,7 +1080,7 @@ int rdp_file_get_screen (rdp_file *rdp_in, GtkWidget *main_window)
   
   widget = lookup_widget (main_window, "txtComputer");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->full_address = value;
+  if (value) rdp_file_take (&rdp->full_address, value);
 
   widget = lookup_widget (main_window, "optProtocol");
   switch (tsc_dropdown_get_selected (widget)) {
@@ -786,31 +1102,44 @@ int rdp_file_get_screen (rdp_file *rdp_in, GtkWidget *main_window)
   
   widget = lookup_widget (main_window, "txtUsername");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->username = value;
+  if (value) rdp_file_take (&rdp->username, value);
 
   widget = lookup_widget (main_window, "txtPassword");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->password = value;
+  if (value) rdp_file_take (&rdp->password, value);
 
   /* win password (oh, ugly)*/
-  rdp->win_password = g_object_get_data (G_OBJECT (main_window), "win_password");
+  rdp_file_take (&rdp->win_password, g_strdup (g_object_get_data (G_OBJECT (main_window), "win_password")));
   
   widget = lookup_widget (main_window, "txtDomain");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->domain = value;
+  if (value) rdp_file_take (&rdp->domain, value);
   
   widget = lookup_widget (main_window, "txtClientHostname");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->client_hostname = value;
+  if (value) rdp_file_take (&rdp->client_hostname, value);
     
   widget = lookup_widget (main_window, "txtProtoFile");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->proto_file = value;
+  if (value) rdp_file_take (&rdp->proto_file, value);
+
+  widget = lookup_widget (main_window, "txtProtocols");
+  value = widget ? gtk_editable_get_chars ((GtkEditable*) widget, 0, -1) : NULL;
+  if (value) rdp_file_take (&rdp->protocols, value);
+
+  widget = lookup_widget (main_window, "txtPool");
+  value = widget ? gtk_editable_get_chars ((GtkEditable*) widget, 0, -1) : NULL;
+  if (value) rdp_file_take (&rdp->pool, value);
+
+  widget = lookup_widget (main_window, "optPoolPolicy");
+  if (widget)
+    rdp_file_take (&rdp->pool_policy, g_strdup (tsc_pool_policies[MIN (tsc_dropdown_get_selected (widget),
+                                                                       G_N_ELEMENTS (tsc_pool_policies) - 2)]));
   
   widget = lookup_widget (main_window, "optTlsVersion");
   if (widget) {
     guint tls_idx = tsc_dropdown_get_selected (widget);
-    rdp->tls_version = g_strdup (tsc_tls_version_value (tls_idx));
+    rdp_file_take (&rdp->tls_version, g_strdup (tsc_tls_version_value (tls_idx)));
   }
   
   widget = lookup_widget (main_window, "chkDisableEncryption");
@@ -821,7 +1150,7 @@ int rdp_file_get_screen (rdp_file *rdp_in, GtkWidget *main_window)
   
   widget = lookup_widget (main_window, "txtKeyboardLang");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->keyboard_language = value;
+  if (value) rdp_file_take (&rdp->keyboard_language, value);
   
   widget = lookup_widget (main_window, "chkDisableCtrl");
   rdp->disable_remote_ctrl = widget && tsc_toggle_button_get_active (GTK_TOGGLE_BUTTON (widget)) ? 1 : 0;
@@ -831,7 +1160,7 @@ int rdp_file_get_screen (rdp_file *rdp_in, GtkWidget *main_window)
   
   widget = lookup_widget (main_window, "txtCodepage");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->local_codepage = value;
+  if (value) rdp_file_take (&rdp->local_codepage, value);
 
   rdp->desktop_size_id = 1;
   rdp->screen_mode_id = 1;
@@ -921,13 +1250,51 @@ int rdp_file_get_screen (rdp_file *rdp_in, GtkWidget *main_window)
 
   widget = lookup_widget (main_window, "txtProgramPath");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->alternate_shell =  value;
+  if (value) rdp_file_take (&rdp->alternate_shell, value);
   
   widget = lookup_widget (main_window, "txtStartFolder");
   value = gtk_editable_get_chars ((GtkEditable*) widget, 0, -1);
-  if (value) rdp->shell_working_directory = value;
+  if (value) rdp_file_take (&rdp->shell_working_directory, value);
+
+  widget = lookup_widget (main_window, "optRestartPolicy");
+  if (widget)
+    rdp->restart_policy = tsc_dropdown_get_selected (widget);
   
 
+  widget = lookup_widget (main_window, "optConnectionSpeed");
+  if (widget)
+    rdp->connection_type = tsc_speed_presets[MIN (tsc_dropdown_get_selected (widget),
+                                                  TSC_SPEED_PRESET_COUNT - 1)].connection_type;
+
+  widget = lookup_widget (main_window, "chkCompression");
+  rdp->compression = widget && tsc_toggle_button_get_active (GTK_TOGGLE_BUTTON (widget)) ? 1 : 0;
+
+  widget = lookup_widget (main_window, "optRdpClient");
+  if (widget)
+    rdp_file_take (&rdp->rdp_client, g_strdup (tsc_rdp_clients[MIN (tsc_dropdown_get_selected (widget),
+                                                                    G_N_ELEMENTS (tsc_rdp_clients) - 2)]));
+
+  widget = lookup_widget (main_window, "optGraphicsCodec");
+  if (widget)
+    rdp_file_take (&rdp->graphics_codec, g_strdup (tsc_graphics_codecs[MIN (tsc_dropdown_get_selected (widget),
+                                                                            G_N_ELEMENTS (tsc_graphics_codecs) - 2)]));
+
+  widget = lookup_widget (main_window, "chkGlyphCache");
+  rdp->glyph_cache = widget && tsc_toggle_button_get_active (GTK_TOGGLE_BUTTON (widget)) ? 1 : 0;
+
+  widget = lookup_widget (main_window, "optVncEncoding");
+  if (widget)
+    rdp_file_take (&rdp->vnc_encoding, g_strdup (tsc_vnc_encodings[MIN (tsc_dropdown_get_selected (widget),
+                                                                        G_N_ELEMENTS (tsc_vnc_encodings) - 2)]));
+
+  widget = lookup_widget (main_window, "optVncCompress");
+  if (widget)
+    rdp->vnc_compress_level = tsc_dropdown_get_selected (widget) <= 10 ? (gint) tsc_dropdown_get_selected (widget) - 1 : -1;
+
+  widget = lookup_widget (main_window, "optVncQuality");
+  if (widget)
+    rdp->vnc_quality = tsc_dropdown_get_selected (widget) <= 10 ? (gint) tsc_dropdown_get_selected (widget) - 1 : -1;
+
   widget = lookup_widget (main_window, "chkBitmapCache");
   if (tsc_toggle_button_get_active ((GtkToggleButton*)widget))
     rdp->bitmapcachepersistenable = 1;
@@ -1027,7 +1394,7 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
     rdp = rdp_in;
 
     if (strcmp(key, "alternate shell") == 0) {
-      rdp->alternate_shell = g_strdup(value);
+      rdp_file_take (&rdp->alternate_shell, g_strdup(value));
     }
     if (strcmp(key, "attach to console") == 0) {
       rdp->attach_to_console = atoi(value);
@@ -1042,13 +1409,16 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
       rdp->bitmapcachepersistenable = atoi(value);
     }
     if (strcmp(key, "client hostname") == 0) {
-      rdp->client_hostname = g_strdup(value);
+      rdp_file_take (&rdp->client_hostname, g_strdup(value));
     }
     if (strcmp(key, "compression") == 0) {
       rdp->compression = atoi(value);
     }
+    if (strcmp(key, "connection type") == 0) {
+      rdp->connection_type = atoi(value);
+    }
     if (strcmp(key, "description") == 0) {
-      rdp->description = g_strdup(value);
+      rdp_file_take (&rdp->description, g_strdup(value));
     }
     if (strcmp(key, "desktop size id") == 0) {
       rdp->desktop_size_id = atoi(value);
@@ -1075,7 +1445,7 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
       rdp->displayconnectionbar = atoi(value);
     }
     if (strcmp(key, "domain") == 0) {
-      rdp->domain = g_strdup(value);
+      rdp_file_take (&rdp->domain, g_strdup(value));
     }
     if (strcmp(key, "enable alternate shell") == 0) {
       rdp->enable_alternate_shell = atoi(value);
@@ -1084,13 +1454,13 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
       rdp->enable_wm_keys = atoi(value);
     }
     if (strcmp(key, "full address") == 0) {
-      rdp->full_address = g_strdup(value);
+      rdp_file_take (&rdp->full_address, g_strdup(value));
     }
     if (strcmp(key, "hide wm decorations") == 0) {
       rdp->hide_wm_decorations = atoi(value);
     }
     if (strcmp(key, "keyboard language") == 0) {
-      rdp->keyboard_language = g_strdup(value);
+      rdp_file_take (&rdp->keyboard_language, g_strdup(value));
     }
     if (strcmp(key, "keyboardhook") == 0) {
       rdp->keyboardhook = atoi(value);
@@ -1099,19 +1469,19 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
       rdp->no_motion_events = atoi(value);
     }
     if (strcmp(key, "password") == 0) {
-      rdp->password = g_strdup(value);
+      rdp_file_take (&rdp->password, g_strdup(value));
     }
     if (strcmp(key, "password 51") == 0) {
-      rdp->win_password = g_strdup(value);
+      rdp_file_take (&rdp->win_password, g_strdup(value));
     }
     if (strcmp(key, "progman group") == 0) {
-      rdp->progman_group = g_strdup(value);
+      rdp_file_take (&rdp->progman_group, g_strdup(value));
     }
     if (strcmp(key, "protocol") == 0) {
       rdp->protocol = atoi(value);
     }
     if (strcmp(key, "protocol file") == 0) {
-      rdp->proto_file = g_strdup(value);
+      rdp_file_take (&rdp->proto_file, g_strdup(value));
     }
     if (strcmp(key, "redirectcomports") == 0) {
       rdp->redirectcomports = atoi(value);
@@ -1125,6 +1495,9 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
     if (strcmp(key, "redirectsmartcards") == 0) {
       rdp->redirectsmartcards = atoi(value);
     }
+    if (strcmp(key, "restart policy") == 0) {
+      rdp->restart_policy = atoi(value);
+    }
     if (strcmp(key, "screen mode id") == 0) {
       rdp->screen_mode_id = atoi(value);
     }
@@ -1132,13 +1505,13 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
       rdp->session_bpp = atoi(value);
     }
     if (strcmp(key, "shell working directory") == 0) {
-      rdp->shell_working_directory = g_strdup(value);
+      rdp_file_take (&rdp->shell_working_directory, g_strdup(value));
     }
     if (strcmp(key, "username") == 0) {
-      rdp->username = g_strdup(value);
+      rdp_file_take (&rdp->username, g_strdup(value));
     }
     if (strcmp(key, "winposstr") == 0) {
-      rdp->winposstr = g_strdup(value);
+      rdp_file_take (&rdp->winposstr, g_strdup(value));
     }
 
     //smode_id = atoi(value);
@@ -1151,6 +1524,19 @@ int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in)
 }
 
 
+/* Let the prober annotate a profile row with the host it points at. */
+static void
+rdp_probe_profile (const gchar *file, const gchar *host, gint protocol,
+                   const gchar *pool, gpointer user_data)
+{
+  if (*host) {
+    tsc_probe_set_alias (file, host, protocol);
+    tsc_probe_host (host, protocol);
+  }
+  tsc_pool_watch (pool, protocol);
+}
+
+
 /***************************************
 *                                      *
 *   rdp_load_profile_launcher          *
@@ -1183,6 +1569,42 @@ int rdp_load_profile_launcher (GtkWidget *main_window)
 
   g_slist_free (lptr);
   gtk_widget_set_sensitive (opt, cnt > 0);
+  // hosts come from the index; profiles it does not know yet wait for the rescan
+  tsc_profiles_foreach (rdp_probe_profile, NULL);
+  // in stale-while-revalidate mode the listing already started the rescan
+  if (!tsc_config_get_boolean ("scan", "stale-while-revalidate", FALSE))
+    rdp_files_revalidate ();
+
+  /* complete successfully */
+  return 0;
+}
+
+
+/***************************************
+*                                      *
+*   rdp_load_group_launcher            *
+*                                      *
+***************************************/
+
+int rdp_load_group_launcher (GtkWidget *main_window)
+{
+  GtkWidget *opt;
+  GSList    *groups = NULL, *lptr;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("rdp_load_group_launcher\n");
+  #endif
+
+  opt = lookup_widget (main_window, "optGroupLauncher");
+  rdp_groups_to_list (&groups);
+  tsc_dropdown_clear (opt);
+  tsc_dropdown_append (opt, _("Launch Group"));
+
+  for (lptr = groups; lptr; lptr = lptr->next)
+    tsc_dropdown_append (opt, lptr->data);
+
+  gtk_widget_set_visible (opt, groups != NULL);
+  g_slist_free_full (groups, g_free);
 
   /* complete successfully */
   return 0;
@@ -1198,6 +1620,7 @@ void read_dir_list (gchar *dir_name, GSList **list, const gchar *value) {
   GDir *dir;
   const gchar *name;
   gchar *tmp_name;
+  gint found = 0;
 
   dir = g_dir_open (dir_name, 0, &error);
   while ((name = g_dir_read_name (dir)) != NULL) {
@@ -1213,43 +1636,225 @@ void read_dir_list (gchar *dir_name, GSList **list, const gchar *value) {
           tmp = g_build_path ("/", value, name, NULL);
         }
         *list = g_slist_append (*list, tmp);
+        found++;
       }
     }
     g_free (tmp_name);
   }
   g_dir_close (dir);
+  TSC_TRACE2 (profile__scan__dir, dir_name, found);
+}
+
+/***************************************
+*                                      *
+*   rdp_files_scan                     *
+*                                      *
+***************************************/
+
+/*
+ * Walk ~/.tsclient now, whatever the cache says.  [scan] threads=0 keeps
+ * the old one-stat-per-entry walker, for comparison.
+ */
+int rdp_files_scan (GSList** list)
+{
+  gchar *path_name = tsc_home_path ();
+  gint threads = tsc_config_get_int ("scan", "threads", TSC_SCAN_THREADS_DEFAULT);
+  GSList *files = NULL, *lptr;
+  GHashTable *own;
+
+  if (threads > 0)
+    tsc_scan_profiles (path_name, threads, &files);
+  else
+    read_dir_list (path_name, &files, "-1");
+
+  // bundled profiles follow, unless ~/.tsclient has one of the same name
+  own = g_hash_table_new (g_str_hash, g_str_equal);
+  for (lptr = files; lptr; lptr = lptr->next)
+    g_hash_table_add (own, lptr->data);
+  tsc_bundle_list (&files, own);
+  g_hash_table_destroy (own);
+
+  *list = g_slist_concat (*list, files);
+  g_free (path_name);
+  return 0;
+}
+
+
+/***************************************
+*                                      *
+*   rdp_files_revalidate               *
+*                                      *
+***************************************/
+
+static gboolean revalidating = FALSE;
+static gboolean revalidated = FALSE;
+static gboolean revalidate_again = FALSE;
+static GFunc changed_func = NULL;
+static gpointer changed_data = NULL;
+
+
+/* Called on the main thread when a background rescan changed the list. */
+void rdp_files_set_changed_func (GFunc func, gpointer user_data)
+{
+  changed_func = func;
+  changed_data = user_data;
+}
+
+
+static void
+rdp_files_revalidate_thread (GTask *task, gpointer source, gpointer task_data,
+                             GCancellable *cancellable)
+{
+  g_task_return_int (task, tsc_profiles_update ());
+}
+
+
+static void
+rdp_files_revalidate_done (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  gint64 start = GPOINTER_TO_SIZE (user_data);
+  gint ret = g_task_propagate_int (G_TASK (result), NULL);
+  GSList *files = NULL;
+
+  revalidating = FALSE;
+  if (tsc_profiles_cached (&files) == 0)
+    tsc_metrics_scan (g_slist_length (files), g_get_monotonic_time () - start);
+  g_slist_free_full (files, g_free);
+
+  // listing again from changed_func must not start another rescan
+  if (ret == 1 && changed_func) {
+    revalidated = TRUE;
+    changed_func (NULL, changed_data);
+    revalidated = FALSE;
+  }
+
+  // a profile saved while the rescan ran may have been walked past
+  if (revalidate_again) {
+    revalidate_again = FALSE;
+    rdp_files_revalidate ();
+  }
 }
 
+
+static void
+rdp_files_revalidate (void)
+{
+  GTask *task;
+
+  if (revalidated)
+    return;
+  if (revalidating) {
+    revalidate_again = TRUE;
+    return;
+  }
+
+  revalidating = TRUE;
+  task = g_task_new (NULL, NULL, rdp_files_revalidate_done,
+                     GSIZE_TO_POINTER (g_get_monotonic_time ()));
+  g_task_run_in_thread (task, rdp_files_revalidate_thread);
+  g_object_unref (task);
+}
+
+
 /***************************************
 *                                      *
 *   rdp_files_to_list                  *
 *                                      *
 ***************************************/
 
+/*
+ * With [scan] stale-while-revalidate, the listing comes from profiles.idx
+ * straight away and ~/.tsclient is walked again on a worker thread.
+ */
 int rdp_files_to_list (GSList** list)
 {
-  gchar *path_name;
-  gint i;
+  gint64 start;
 	
   #ifdef TSCLIENT_DEBUG
   printf ("rdp_files_to_list\n");
   #endif
 
-  // create .tsclient dir in ~/
-  path_name = tsc_home_path ();
-  
-  read_dir_list (path_name, list, "-1");
+  if (tsc_config_get_boolean ("scan", "stale-while-revalidate", FALSE) &&
+      tsc_profiles_cached (list) == 0) {
+    rdp_files_revalidate ();
+    return 0;
+  }
+
+  start = g_get_monotonic_time ();
+  rdp_files_scan (list);
+  tsc_metrics_scan (g_slist_length (*list), g_get_monotonic_time () - start);
   
   #ifdef TSCLIENT_DEBUG
   printf ("rdp_files_to_list count: %d\n", g_slist_length (*list));
   #endif
 
-  g_free (path_name);
   // complete successfully
   return 0;
 }
 
 
+/***************************************
+*                                      *
+*   rdp_groups_to_list                 *
+*                                      *
+***************************************/
+
+int rdp_groups_to_list (GSList** list)
+{
+  GSList *files = NULL, *lptr;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("rdp_groups_to_list\n");
+  #endif
+
+  rdp_files_to_list (&files);
+  for (lptr = files; lptr; lptr = lptr->next) {
+    gchar *group = g_path_get_dirname (lptr->data);
+    if (strcmp (group, ".") != 0 &&
+        !g_slist_find_custom (*list, group, (GCompareFunc) strcmp)) {
+      *list = g_slist_insert_sorted (*list, group, (GCompareFunc) g_ascii_strcasecmp);
+    } else {
+      g_free (group);
+    }
+  }
+  g_slist_free_full (files, g_free);
+
+  return 0;
+}
+
+
+/***************************************
+*                                      *
+*   rdp_files_in_group                 *
+*                                      *
+***************************************/
+
+int rdp_files_in_group (const gchar *group, GSList** list)
+{
+  GSList *files = NULL, *lptr;
+  gchar *home = tsc_home_path ();
+  gint cnt = 0;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("rdp_files_in_group: %s\n", group);
+  #endif
+
+  rdp_files_to_list (&files);
+  for (lptr = files; lptr; lptr = lptr->next) {
+    gchar *dir = g_path_get_dirname (lptr->data);
+    if (strcmp (dir, group) == 0) {
+      *list = g_slist_append (*list, g_build_path ("/", home, lptr->data, NULL));
+      cnt++;
+    }
+    g_free (dir);
+  }
+  g_slist_free_full (files, g_free);
+  g_free (home);
+
+  return cnt;
+}
+
+
 /***************************************
 *                                      *
 *   read_dir                           *
@@ -12,6 +12,11 @@
 #define MAX_VALUE_SIZE 2048
 #define MAX_BUFFER_SIZE 4096
 
+/* restart_policy: what the session supervisor does when a client exits */
+#define RDP_RESTART_NEVER 0
+#define RDP_RESTART_ON_FAILURE 1
+#define RDP_RESTART_ALWAYS 2
+
 typedef struct
 {
   char key[MAX_KEY_SIZE];
@@ -19,6 +24,7 @@ typedef struct
   char value[MAX_VALUE_SIZE];
 } rdp_rec;
 
+/* every char * below is owned by the rdp_file; list new ones in rdp_file_strings */
 typedef struct
 {
   char *alternate_shell;
@@ -28,6 +34,7 @@ typedef struct
   int bitmapcachepersistenable;
   char *client_hostname;
   int compression;
+  int connection_type;
   char *description;
   int desktop_size_id;
   int desktopheight;
@@ -45,6 +52,8 @@ typedef struct
   int enable_wm_keys;
   int force_bitmap_updates;
   char *full_address;
+  int glyph_cache;
+  char *graphics_codec;
   int hide_wm_decorations;
   char *keyboard_language;
   int keyboardhook;
@@ -52,13 +61,18 @@ typedef struct
   int no_motion_events;
   char *password;
   char *win_password;
+  char *pool;
+  char *pool_policy;
   char *progman_group;
   int protocol;
   char *proto_file;
+  char *protocols;
+  char *rdp_client;
   int redirectcomports;
   int redirectdrives;
   int redirectprinters;
   int redirectsmartcards;
+  int restart_policy;
   int screen_mode_id;
   int session_bpp;
   int sync_numlock;
@@ -66,18 +80,33 @@ typedef struct
   char *tls_version;
   int use_backing_store;
   char *username;
+  int vnc_compress_level;
+  char *vnc_encoding;
+  int vnc_quality;
   char *winposstr;
 } rdp_file;
 
 
 int rdp_file_init (rdp_file *rdp_in);
+rdp_file *rdp_file_copy (const rdp_file *rdp_in);
+void rdp_file_free (rdp_file *rdp_in);
 int rdp_file_load (rdp_file *rdp_in, const char *fqpath);
 int rdp_file_save (rdp_file *rdp_in, const char *fqpath);
+gchar *rdp_file_to_json (rdp_file *rdp_in);
+gboolean rdp_profile_exists (const gchar *fqpath);
+void rdp_file_apply_speed (rdp_file *rdp_in);
+void rdp_file_apply_preset (rdp_file *rdp_in, gint connection_type);
+int rdp_file_performance_flags (rdp_file *rdp_in);
 int rdp_file_set_screen (rdp_file *rdp_in, GtkWidget *main_window);
 int rdp_file_get_screen (rdp_file *rdp_in, GtkWidget *main_window);
 int rdp_file_set_from_line (rdp_file *rdp_in, const char *str_in);
 int rdp_load_profile_launcher (GtkWidget *main_window);
+int rdp_load_group_launcher (GtkWidget *main_window);
 int rdp_files_to_list (GSList** list);
+int rdp_files_scan (GSList** list);
+void rdp_files_set_changed_func (GFunc func, gpointer user_data);
+int rdp_groups_to_list (GSList** list);
+int rdp_files_in_group (const gchar *group, GSList** list);
 GHashTable* rdp_files_to_hash (void);
 
 #endif /* RDPFILE_H */
@@ -0,0 +1,368 @@
+/***************************************
+*                                      *
+*   Reconnect Engine                   *
+*                                      *
+***************************************/
+
+/*
+ * Decides what a client exit means and whether it is worth retrying.
+ * Auth, licensing and TLS handshake failures will fail the same way
+ * again, so only network errors and server-side drops are retried, with a capped
+ * exponential backoff and jitter so a WAN outage does not have every
+ * session reconnect in lockstep.
+ *
+ * Exit codes are read from a table per client (rdesktop's EXRD_*,
+ * FreeRDP's XF_EXIT_*); every other client, and any code a table does
+ * not list, is judged by what it printed on stderr.
+ *
+ * Tunables live in the [reconnect] group of ~/.tsclient/tsclient.conf:
+ * max-attempts, base-ms, cap-ms and stable-ms (how long a session has
+ * to stay up before its attempt counter resets).
+ */
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "reconnect.h"
+
+/* rdesktop's exit codes, see rdesktop.h (EXRD_*) */
+#define EXRD_DISCONNECT_BY_ADMIN 1
+#define EXRD_REPLACED 5
+#define EXRD_OUT_OF_MEM 6
+#define EXRD_DENIED 7
+#define EXRD_FRESH_CREDENTIALS_REQUIRED 10
+#define EXRD_RPC_DISCONNECT_BY_USER 11
+#define EXRD_DISCONNECT_BY_USER 12
+#define EXRD_LIC_INTERNAL 16
+#define EXRD_LIC_NOREMOTE 26
+#define EXRD_WINDOW_CLOSED 62
+#define EX_PROTOCOL 76
+
+/* FreeRDP's, see client/X11/xf_client.h (XF_EXIT_*) */
+#define XF_EXIT_DISCONNECT 1
+#define XF_EXIT_REPLACED 5
+#define XF_EXIT_OUT_OF_MEMORY 6
+#define XF_EXIT_DENIED 7
+#define XF_EXIT_FRESH_CREDENTIALS_REQUIRED 10
+#define XF_EXIT_DISCONNECT_BY_USER 11
+#define XF_EXIT_LICENSE_INTERNAL 16
+#define XF_EXIT_LICENSE_CANT_UPGRADE 26
+#define XF_EXIT_RDP 32
+#define XF_EXIT_RDP_LAST 127
+#define XF_EXIT_PARSE_ARGUMENTS 128
+#define XF_EXIT_MEMORY 129
+#define XF_EXIT_PROTOCOL 130
+#define XF_EXIT_CONN_FAILED 131
+#define XF_EXIT_AUTH_FAILURE 132
+#define XF_EXIT_NEGO_FAILURE 133
+#define XF_EXIT_LOGON_FAILURE 134
+#define XF_EXIT_ACCOUNT_LOCKED_OUT 135
+#define XF_EXIT_PRE_CONNECT_FAILED 136
+#define XF_EXIT_CONNECT_UNDEFINED 137
+#define XF_EXIT_POST_CONNECT_FAILED 138
+#define XF_EXIT_DNS_ERROR 139
+#define XF_EXIT_DNS_NAME_NOT_FOUND 140
+#define XF_EXIT_CONNECT_FAILED 141
+#define XF_EXIT_MCS_CONNECT_INITIAL_ERROR 142
+#define XF_EXIT_TLS_CONNECT_FAILED 143
+#define XF_EXIT_INSUFFICIENT_PRIVILEGES 144
+#define XF_EXIT_CONNECT_CANCELLED 145
+#define XF_EXIT_CONNECT_TRANSPORT_FAILED 147
+#define XF_EXIT_CONNECT_PASSWORD_EXPIRED 148
+#define XF_EXIT_CONNECT_KDC_UNREACHABLE 150
+#define XF_EXIT_CONNECT_NO_OR_MISSING_CREDENTIALS 159
+
+typedef struct {
+  gint low;
+  gint high;
+  TscFailure failure;
+} TscFailureCode;
+
+/* exit codes low..high, first hit wins; 0 always means a clean exit */
+static const TscFailureCode tsc_rdesktop_codes[] = {
+  // the session was ended on purpose, by the user or the server's policy
+  { EXRD_DISCONNECT_BY_ADMIN, EXRD_REPLACED, TSC_FAILURE_NONE },
+  { EXRD_OUT_OF_MEM, EXRD_OUT_OF_MEM, TSC_FAILURE_DISCONNECT },
+  { EXRD_DENIED, EXRD_FRESH_CREDENTIALS_REQUIRED, TSC_FAILURE_AUTH },
+  { EXRD_RPC_DISCONNECT_BY_USER, EXRD_DISCONNECT_BY_USER, TSC_FAILURE_NONE },
+  { EXRD_LIC_INTERNAL, EXRD_LIC_NOREMOTE, TSC_FAILURE_LICENSE },
+  { EXRD_WINDOW_CLOSED, EXRD_WINDOW_CLOSED, TSC_FAILURE_NONE },
+  { EX_PROTOCOL, EX_PROTOCOL, TSC_FAILURE_NETWORK },
+  { 0, -1, TSC_FAILURE_UNKNOWN }
+};
+
+static const TscFailureCode tsc_freerdp_codes[] = {
+  { XF_EXIT_DISCONNECT, XF_EXIT_REPLACED, TSC_FAILURE_NONE },
+  { XF_EXIT_OUT_OF_MEMORY, XF_EXIT_OUT_OF_MEMORY, TSC_FAILURE_DISCONNECT },
+  { XF_EXIT_DENIED, XF_EXIT_FRESH_CREDENTIALS_REQUIRED, TSC_FAILURE_AUTH },
+  { XF_EXIT_DISCONNECT_BY_USER, XF_EXIT_DISCONNECT_BY_USER, TSC_FAILURE_NONE },
+  { XF_EXIT_LICENSE_INTERNAL, XF_EXIT_LICENSE_CANT_UPGRADE, TSC_FAILURE_LICENSE },
+  // the server's own error info, ERRINFO_* offset into 32..127
+  { XF_EXIT_RDP, XF_EXIT_RDP_LAST, TSC_FAILURE_DISCONNECT },
+  { XF_EXIT_PARSE_ARGUMENTS, XF_EXIT_MEMORY, TSC_FAILURE_UNKNOWN },
+  { XF_EXIT_PROTOCOL, XF_EXIT_CONN_FAILED, TSC_FAILURE_NETWORK },
+  { XF_EXIT_AUTH_FAILURE, XF_EXIT_AUTH_FAILURE, TSC_FAILURE_AUTH },
+  { XF_EXIT_NEGO_FAILURE, XF_EXIT_NEGO_FAILURE, TSC_FAILURE_UNKNOWN },
+  { XF_EXIT_LOGON_FAILURE, XF_EXIT_ACCOUNT_LOCKED_OUT, TSC_FAILURE_AUTH },
+  { XF_EXIT_PRE_CONNECT_FAILED, XF_EXIT_PRE_CONNECT_FAILED, TSC_FAILURE_UNKNOWN },
+  { XF_EXIT_CONNECT_UNDEFINED, XF_EXIT_CONNECT_UNDEFINED, TSC_FAILURE_NETWORK },
+  { XF_EXIT_POST_CONNECT_FAILED, XF_EXIT_POST_CONNECT_FAILED, TSC_FAILURE_UNKNOWN },
+  { XF_EXIT_DNS_ERROR, XF_EXIT_MCS_CONNECT_INITIAL_ERROR, TSC_FAILURE_NETWORK },
+  // a TLS handshake that failed fails the same way on a retry
+  { XF_EXIT_TLS_CONNECT_FAILED, XF_EXIT_TLS_CONNECT_FAILED, TSC_FAILURE_TLS },
+  { XF_EXIT_INSUFFICIENT_PRIVILEGES, XF_EXIT_INSUFFICIENT_PRIVILEGES, TSC_FAILURE_AUTH },
+  { XF_EXIT_CONNECT_CANCELLED, XF_EXIT_CONNECT_CANCELLED, TSC_FAILURE_NONE },
+  { XF_EXIT_CONNECT_TRANSPORT_FAILED, XF_EXIT_CONNECT_TRANSPORT_FAILED, TSC_FAILURE_NETWORK },
+  { XF_EXIT_CONNECT_KDC_UNREACHABLE, XF_EXIT_CONNECT_KDC_UNREACHABLE, TSC_FAILURE_NETWORK },
+  { XF_EXIT_CONNECT_PASSWORD_EXPIRED, XF_EXIT_CONNECT_NO_OR_MISSING_CREDENTIALS, TSC_FAILURE_AUTH },
+  { 0, -1, TSC_FAILURE_UNKNOWN }
+};
+
+typedef struct {
+  const gchar *pattern;
+  TscFailure failure;
+} TscFailurePattern;
+
+/* matched case-insensitively against the client's stderr, first hit wins */
+static const TscFailurePattern tsc_failure_patterns[] = {
+  { "licens", TSC_FAILURE_LICENSE },
+  { "logon failure", TSC_FAILURE_AUTH },
+  { "authentication fail", TSC_FAILURE_AUTH },
+  { "authentication error", TSC_FAILURE_AUTH },
+  { "credssp", TSC_FAILURE_AUTH },
+  { "wrong password", TSC_FAILURE_AUTH },
+  { "wrong_password", TSC_FAILURE_AUTH },
+  { "incorrect password", TSC_FAILURE_AUTH },
+  { "password is incorrect", TSC_FAILURE_AUTH },
+  { "password expired", TSC_FAILURE_AUTH },
+  { "password_expired", TSC_FAILURE_AUTH },
+  { "password must be changed", TSC_FAILURE_AUTH },
+  { "password_must_change", TSC_FAILURE_AUTH },
+  { "access denied", TSC_FAILURE_AUTH },
+  { "connection refused", TSC_FAILURE_NETWORK },
+  { "connection timed out", TSC_FAILURE_NETWORK },
+  { "no route to host", TSC_FAILURE_NETWORK },
+  { "network is unreachable", TSC_FAILURE_NETWORK },
+  { "unable to connect", TSC_FAILURE_NETWORK },
+  { "failed to connect", TSC_FAILURE_NETWORK },
+  { "name or service not known", TSC_FAILURE_NETWORK },
+  { "temporary failure in name resolution", TSC_FAILURE_NETWORK },
+  { "connection reset", TSC_FAILURE_DISCONNECT },
+  { "broken pipe", TSC_FAILURE_DISCONNECT },
+  { "connection lost", TSC_FAILURE_DISCONNECT },
+  { "lost connection", TSC_FAILURE_DISCONNECT },
+  { "disconnected by server", TSC_FAILURE_DISCONNECT },
+  { "disconnected by the server", TSC_FAILURE_DISCONNECT },
+  { "server closed the connection", TSC_FAILURE_DISCONNECT },
+  { "connection closed", TSC_FAILURE_DISCONNECT },
+  { "end of stream", TSC_FAILURE_DISCONNECT },
+  { NULL, TSC_FAILURE_UNKNOWN }
+};
+
+static TscReconnectStats stats = {0};
+
+
+/* The exit code table for client, or NULL when its codes mean nothing. */
+static const TscFailureCode *
+tsc_reconnect_codes (const gchar *client)
+{
+  if (!client)
+    return NULL;
+  if (g_str_equal (client, "rdesktop"))
+    return tsc_rdesktop_codes;
+  if (strstr (client, "freerdp"))
+    return tsc_freerdp_codes;
+  return NULL;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_reconnect_classify             *
+*                                      *
+***************************************/
+
+/*
+ * client is the basename of the program that exited.  Only rdesktop and
+ * FreeRDP give their exit codes a meaning; vncviewer, Xephyr and wfica
+ * exit 1 on anything, so those are read from std_err alone.
+ */
+TscFailure tsc_reconnect_classify (const gchar *client, gint wait_status, const gchar *std_err)
+{
+  const TscFailureCode *codes = tsc_reconnect_codes (client);
+  gint code;
+
+  if (WIFSIGNALED (wait_status))
+    return TSC_FAILURE_UNKNOWN;
+
+  code = WIFEXITED (wait_status) ? WEXITSTATUS (wait_status) : -1;
+  if (code == 0)
+    return TSC_FAILURE_NONE;
+
+  for (gint i = 0; codes && codes[i].low <= codes[i].high; i++) {
+    if (code >= codes[i].low && code <= codes[i].high)
+      return codes[i].failure;
+  }
+
+  if (std_err && *std_err) {
+    gchar *lower = g_ascii_strdown (std_err, -1);
+    TscFailure failure = TSC_FAILURE_UNKNOWN;
+
+    for (gint i = 0; tsc_failure_patterns[i].pattern; i++) {
+      if (strstr (lower, tsc_failure_patterns[i].pattern)) {
+        failure = tsc_failure_patterns[i].failure;
+        break;
+      }
+    }
+    g_free (lower);
+    return failure;
+  }
+
+  return TSC_FAILURE_UNKNOWN;
+}
+
+
+gboolean tsc_reconnect_is_transient (TscFailure failure)
+{
+  return failure == TSC_FAILURE_NETWORK || failure == TSC_FAILURE_DISCONNECT;
+}
+
+
+const gchar *tsc_reconnect_describe (TscFailure failure)
+{
+  switch (failure) {
+  case TSC_FAILURE_NONE:
+    return _("The session ended.");
+  case TSC_FAILURE_AUTH:
+    return _("The server rejected the logon.");
+  case TSC_FAILURE_LICENSE:
+    return _("The server could not issue a license.");
+  case TSC_FAILURE_NETWORK:
+    return _("The server could not be reached.");
+  case TSC_FAILURE_DISCONNECT:
+    return _("The server closed the connection.");
+  case TSC_FAILURE_TLS:
+    return _("The TLS handshake with the server failed.");
+  default:
+    return _("An error has occurred.");
+  }
+}
+
+
+/* Short untranslated name, for logs and metric labels. */
+const gchar *tsc_reconnect_name (TscFailure failure)
+{
+  switch (failure) {
+  case TSC_FAILURE_NONE:
+    return "ok";
+  case TSC_FAILURE_AUTH:
+    return "auth";
+  case TSC_FAILURE_LICENSE:
+    return "license";
+  case TSC_FAILURE_NETWORK:
+    return "network";
+  case TSC_FAILURE_DISCONNECT:
+    return "disconnect";
+  case TSC_FAILURE_TLS:
+    return "tls";
+  default:
+    return "unknown";
+  }
+}
+
+
+gint tsc_reconnect_max_attempts (void)
+{
+  return tsc_config_get_int ("reconnect", "max-attempts", TSC_RECONNECT_ATTEMPTS_DEFAULT);
+}
+
+
+gint tsc_reconnect_stable_ms (void)
+{
+  return tsc_config_get_int ("reconnect", "stable-ms", TSC_RECONNECT_STABLE_DEFAULT);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_reconnect_delay                *
+*                                      *
+***************************************/
+
+/*
+ * Milliseconds to wait before retry number attempt (1-based): the base
+ * doubles per attempt up to the cap, and half of that is randomised
+ * ("equal jitter") so the wait never collapses to zero.
+ */
+gint tsc_reconnect_delay (gint attempt)
+{
+  gint base = MAX (tsc_config_get_int ("reconnect", "base-ms", TSC_RECONNECT_BASE_DEFAULT), 1);
+  gint cap = MAX (tsc_config_get_int ("reconnect", "cap-ms", TSC_RECONNECT_CAP_DEFAULT), base);
+  gint64 delay = base;
+
+  while (--attempt > 0 && delay < cap)
+    delay *= 2;
+  delay = MIN (delay, cap);
+
+  return delay / 2 + g_random_int_range (0, delay / 2 + 1);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_reconnect_record_*             *
+*                                      *
+***************************************/
+
+void tsc_reconnect_record_failure (TscFailure failure)
+{
+  if (failure != TSC_FAILURE_NONE)
+    stats.failures++;
+}
+
+
+void tsc_reconnect_record_attempt (void)
+{
+  stats.attempts++;
+}
+
+
+void tsc_reconnect_record_recovered (gint64 elapsed_us)
+{
+  stats.recovered++;
+  stats.reconnect_ms += elapsed_us / 1000;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_reconnect_record_recovered: %" G_GINT64_FORMAT " ms\n", elapsed_us / 1000);
+  #endif
+}
+
+
+void tsc_reconnect_record_given_up (void)
+{
+  stats.given_up++;
+}
+
+
+void tsc_reconnect_get_stats (TscReconnectStats *out)
+{
+  *out = stats;
+}
+
+
+/* NULL until something had to be retried. */
+gchar *tsc_reconnect_stats_text (void)
+{
+  if (!stats.attempts)
+    return NULL;
+
+  return g_strdup_printf (_("%d reconnect attempts, %d recovered (%d ms on average), %d given up"),
+                          stats.attempts, stats.recovered,
+                          stats.recovered ? (gint) (stats.reconnect_ms / stats.recovered) : 0,
+                          stats.given_up);
+}
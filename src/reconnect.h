@@ -0,0 +1,49 @@
+#ifndef RECONNECT_H
+#define RECONNECT_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_RECONNECT_ATTEMPTS_DEFAULT 5
+#define TSC_RECONNECT_BASE_DEFAULT 1000
+#define TSC_RECONNECT_CAP_DEFAULT 60000
+#define TSC_RECONNECT_STABLE_DEFAULT 30000
+
+typedef enum
+{
+  TSC_FAILURE_NONE,
+  TSC_FAILURE_AUTH,
+  TSC_FAILURE_LICENSE,
+  TSC_FAILURE_NETWORK,
+  TSC_FAILURE_DISCONNECT,
+  TSC_FAILURE_TLS,
+  TSC_FAILURE_UNKNOWN
+} TscFailure;
+
+typedef struct
+{
+  gint failures;
+  gint attempts;
+  gint recovered;
+  gint given_up;
+  gint64 reconnect_ms;
+} TscReconnectStats;
+
+TscFailure tsc_reconnect_classify (const gchar *client, gint wait_status, const gchar *std_err);
+gboolean tsc_reconnect_is_transient (TscFailure failure);
+const gchar *tsc_reconnect_describe (TscFailure failure);
+const gchar *tsc_reconnect_name (TscFailure failure);
+gint tsc_reconnect_max_attempts (void);
+gint tsc_reconnect_stable_ms (void);
+gint tsc_reconnect_delay (gint attempt);
+void tsc_reconnect_record_failure (TscFailure failure);
+void tsc_reconnect_record_attempt (void);
+void tsc_reconnect_record_recovered (gint64 elapsed_us);
+void tsc_reconnect_record_given_up (void);
+void tsc_reconnect_get_stats (TscReconnectStats *stats);
+gchar *tsc_reconnect_stats_text (void);
+
+#endif /* RECONNECT_H */
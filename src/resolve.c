@@ -0,0 +1,681 @@
+/***************************************
+*                                      *
+*   DNS Pre-resolution                 *
+*                                      *
+***************************************/
+
+/*
+ * The clients resolve the host themselves after we spawn them, so a
+ * slow resolver costs every connect.  We look names up with GResolver
+ * as soon as they are typed or picked, and at startup for the recent
+ * servers, which warms the system resolver and fills a cache kept in
+ * ~/.tsclient/dns.cache across runs.
+ *
+ * GResolver does not expose record TTLs, so entries live for the
+ * [resolver] ttl (seconds) from tsclient.conf.  With pass-address=true
+ * a fresh IPv4 address is handed to the client instead of the name;
+ * that is off by default because it changes the name the client checks
+ * the server's certificate against.
+ *
+ * A host with both IPv6 and IPv4 addresses can have one family routed
+ * nowhere, and a client trying it first stalls for its whole connect
+ * timeout.  With [preflight] happy-eyeballs (on by default) such a host
+ * is raced across both families before FreeRDP starts (see preflight.c),
+ * and it is handed the address that connected first along with the host
+ * name to check the certificate against.  The other clients have no way
+ * to be told that name, so they keep getting the name itself.  The
+ * winning family is kept in dns.cache and tried first next time.
+ *
+ * Launches ask from a worker thread, so the cache is under cache_lock,
+ * never held across a lookup or a connect; they get copies of entries.
+ * A lookup a launch waits for is bounded by [preflight] timeout-ms.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "probe.h"
+#include "preflight.h"
+#include "resolve.h"
+#include "tsc-trace.h"
+
+typedef struct {
+  gchar **addresses;
+  gint64 expires;
+  gint lookup_ms;
+  gint family;
+} TscResolveEntry;
+
+typedef struct {
+  gchar *host;
+  gint64 started;
+} TscResolveContext;
+
+typedef struct {
+  GMainLoop *loop;
+  GList *addresses;
+} TscResolveWait;
+
+static GHashTable *cache = NULL;
+static GMutex cache_lock;
+static GHashTable *resolving = NULL;
+static TscResolveStats stats = {0};
+static gint ttl = TSC_RESOLVE_TTL_DEFAULT;
+static guint later_id = 0;
+static gchar *later_address = NULL;
+
+
+static void
+tsc_resolve_entry_free (gpointer data)
+{
+  TscResolveEntry *entry = data;
+
+  g_strfreev (entry->addresses);
+  g_free (entry);
+}
+
+
+static gchar *
+tsc_resolve_cache_file (void)
+{
+  gchar *home = tsc_home_path ();
+  gchar *file_name = g_build_path ("/", home, "dns.cache", NULL);
+
+  g_free (home);
+  return file_name;
+}
+
+
+static TscResolveEntry *
+tsc_resolve_entry_copy (const TscResolveEntry *entry)
+{
+  TscResolveEntry *copy = g_memdup2 (entry, sizeof (TscResolveEntry));
+
+  copy->addresses = g_strdupv (entry->addresses);
+  return copy;
+}
+
+
+static void
+tsc_resolve_init (void)
+{
+  GKeyFile *keys;
+  gchar **groups;
+  gchar *file_name;
+  gint i;
+
+  g_mutex_lock (&cache_lock);
+  if (cache) {
+    g_mutex_unlock (&cache_lock);
+    return;
+  }
+
+  cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, tsc_resolve_entry_free);
+  resolving = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  ttl = MAX (tsc_config_get_int ("resolver", "ttl", TSC_RESOLVE_TTL_DEFAULT), 0);
+
+  keys = g_key_file_new ();
+  file_name = tsc_resolve_cache_file ();
+  if (g_key_file_load_from_file (keys, file_name, G_KEY_FILE_NONE, NULL)) {
+    groups = g_key_file_get_groups (keys, NULL);
+    for (i = 0; groups[i]; i++) {
+      TscResolveEntry *entry = g_new0 (TscResolveEntry, 1);
+      entry->addresses = g_key_file_get_string_list (keys, groups[i], "addresses", NULL, NULL);
+      entry->expires = g_key_file_get_int64 (keys, groups[i], "expires", NULL);
+      entry->lookup_ms = g_key_file_get_integer (keys, groups[i], "lookup-ms", NULL);
+      entry->family = g_key_file_get_integer (keys, groups[i], "family", NULL);
+      if (entry->addresses)
+        g_hash_table_replace (cache, g_strdup (groups[i]), entry);
+      else
+        tsc_resolve_entry_free (entry);
+    }
+    g_strfreev (groups);
+  }
+  g_free (file_name);
+  g_key_file_free (keys);
+  g_mutex_unlock (&cache_lock);
+}
+
+
+/* Called with cache_lock held, as are tsc_resolve_fresh and tsc_resolve_store. */
+static void
+tsc_resolve_save (void)
+{
+  GKeyFile *keys = g_key_file_new ();
+  GHashTableIter iter;
+  gpointer host, value;
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gchar *file_name = tsc_resolve_cache_file ();
+
+  g_hash_table_iter_init (&iter, cache);
+  while (g_hash_table_iter_next (&iter, &host, &value)) {
+    TscResolveEntry *entry = value;
+    // a stale entry is still worth its family
+    if (entry->expires <= now && !entry->family)
+      continue;
+    g_key_file_set_string_list (keys, host, "addresses",
+                                (const gchar * const *) entry->addresses,
+                                g_strv_length (entry->addresses));
+    g_key_file_set_int64 (keys, host, "expires", entry->expires);
+    g_key_file_set_integer (keys, host, "lookup-ms", entry->lookup_ms);
+    if (entry->family)
+      g_key_file_set_integer (keys, host, "family", entry->family);
+  }
+
+  if (!g_key_file_save_to_file (keys, file_name, NULL))
+    g_warning ("Could not write %s", file_name);
+  g_free (file_name);
+  g_key_file_free (keys);
+}
+
+
+/*
+ * Split "host", "host:port", "host::port" or "[host]:port" into the
+ * name to look up and the rest.  NULL for IP literals, which need no
+ * lookup.
+ */
+static gchar *
+tsc_resolve_split (const gchar *address, const gchar **suffix)
+{
+  const gchar *end;
+  gchar *host;
+
+  if (!address || !*address || g_hostname_is_ip_address (address))
+    return NULL;
+
+  if (address[0] == '[') {
+    end = strchr (address, ']');
+    if (!end)
+      return NULL;
+    host = g_strndup (address + 1, end - address - 1);
+    *suffix = end + 1;
+  } else {
+    end = strchr (address, ':');
+    host = end ? g_strndup (address, end - address) : g_strdup (address);
+    *suffix = end ? end : address + strlen (address);
+  }
+
+  if (!*host || g_hostname_is_ip_address (host)) {
+    g_free (host);
+    return NULL;
+  }
+  return g_ascii_strdown (host, -1);
+}
+
+
+static TscResolveEntry *
+tsc_resolve_fresh (const gchar *host)
+{
+  TscResolveEntry *entry = g_hash_table_lookup (cache, host);
+
+  if (entry && entry->expires > g_get_real_time () / G_USEC_PER_SEC)
+    return entry;
+  return NULL;
+}
+
+
+/* Whether a and b hold the same addresses, in any order (round-robin DNS rotates them). */
+static gboolean
+tsc_resolve_same (gchar **a, gchar **b)
+{
+  gint i;
+
+  if (g_strv_length (a) != g_strv_length (b))
+    return FALSE;
+  for (i = 0; a[i]; i++) {
+    if (!g_strv_contains ((const gchar * const *) b, a[i]))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+
+/*
+ * Cache addresses for host, found in lookup_ms; takes host.  dns.cache
+ * is only rewritten when the addresses changed: a renewed expiry is not
+ * worth a write, the next run just looks the name up again.
+ */
+static TscResolveEntry *
+tsc_resolve_store (gchar *host, GList *addresses, gint lookup_ms)
+{
+  TscResolveEntry *entry, *old;
+  gboolean changed;
+  GList *lptr;
+  gint i = 0;
+
+  entry = g_new0 (TscResolveEntry, 1);
+  entry->addresses = g_new0 (gchar *, g_list_length (addresses) + 1);
+  for (lptr = addresses; lptr; lptr = lptr->next)
+    entry->addresses[i++] = g_inet_address_to_string (lptr->data);
+  entry->expires = g_get_real_time () / G_USEC_PER_SEC + ttl;
+  entry->lookup_ms = lookup_ms;
+  old = g_hash_table_lookup (cache, host);
+  if (old)
+    entry->family = old->family;
+  changed = !old || !tsc_resolve_same (old->addresses, entry->addresses);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_resolve_store: %s -> %s in %d ms\n", host, entry->addresses[0], entry->lookup_ms);
+  #endif
+
+  stats.lookups++;
+  g_hash_table_replace (cache, host, entry);
+  if (changed)
+    tsc_resolve_save ();
+  return entry;
+}
+
+
+static void
+tsc_resolve_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  TscResolveContext *ctx = user_data;
+  GList *addresses;
+  GError *err = NULL;
+
+  g_mutex_lock (&cache_lock);
+  g_hash_table_remove (resolving, ctx->host);
+  g_mutex_unlock (&cache_lock);
+  addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (source), res, &err);
+  if (!addresses) {
+    #ifdef TSCLIENT_DEBUG
+    printf ("tsc_resolve_done: %s: %s\n", ctx->host, err->message);
+    #endif
+    g_error_free (err);
+    g_free (ctx->host);
+    g_free (ctx);
+    return;
+  }
+
+  g_mutex_lock (&cache_lock);
+  tsc_resolve_store (ctx->host, addresses, (g_get_monotonic_time () - ctx->started) / 1000);
+  g_mutex_unlock (&cache_lock);
+  g_resolver_free_addresses (addresses);
+  g_free (ctx);
+}
+
+
+static void
+tsc_resolve_now_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  TscResolveWait *wait = user_data;
+
+  wait->addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (source), res, NULL);
+  g_main_loop_quit (wait->loop);
+}
+
+
+static gboolean
+tsc_resolve_now_timeout (gpointer user_data)
+{
+  g_cancellable_cancel (user_data);
+  return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * A copy of a fresh entry for host, looked up now if need be; NULL if it
+ * has no address or the lookup took longer than [preflight] timeout-ms.
+ * The lookup runs on a main context of its own, so this can be called
+ * from any thread.  Free the entry with tsc_resolve_entry_free.
+ */
+static TscResolveEntry *
+tsc_resolve_now (const gchar *host)
+{
+  TscResolveEntry *entry;
+  TscResolveWait wait = { NULL, NULL };
+  GMainContext *context;
+  GCancellable *cancellable;
+  GResolver *resolver;
+  GSource *timeout;
+  GList *addresses;
+  gint64 started;
+  gint timeout_ms;
+
+  g_mutex_lock (&cache_lock);
+  entry = tsc_resolve_fresh (host);
+  entry = entry ? tsc_resolve_entry_copy (entry) : NULL;
+  g_mutex_unlock (&cache_lock);
+  if (entry)
+    return entry;
+
+  started = g_get_monotonic_time ();
+  timeout_ms = tsc_config_get_int ("preflight", "timeout-ms", TSC_PREFLIGHT_TIMEOUT_DEFAULT);
+  context = g_main_context_new ();
+  cancellable = g_cancellable_new ();
+  g_main_context_push_thread_default (context);
+  wait.loop = g_main_loop_new (context, FALSE);
+  timeout = g_timeout_source_new (MAX (timeout_ms, 1));
+  g_source_set_callback (timeout, tsc_resolve_now_timeout, cancellable, NULL);
+  g_source_attach (timeout, context);
+  resolver = g_resolver_get_default ();
+  g_resolver_lookup_by_name_async (resolver, host, cancellable, tsc_resolve_now_done, &wait);
+  g_main_loop_run (wait.loop);
+  g_object_unref (resolver);
+  g_source_destroy (timeout);
+  g_source_unref (timeout);
+  g_main_loop_unref (wait.loop);
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+  g_object_unref (cancellable);
+
+  addresses = wait.addresses;
+  if (!addresses)
+    return NULL;
+  g_mutex_lock (&cache_lock);
+  entry = tsc_resolve_store (g_strdup (host), addresses, (g_get_monotonic_time () - started) / 1000);
+  entry = tsc_resolve_entry_copy (entry);
+  g_mutex_unlock (&cache_lock);
+  g_resolver_free_addresses (addresses);
+  return entry;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_resolve_host                   *
+*                                      *
+***************************************/
+
+/* Start a lookup of address's host unless a fresh one is cached. */
+void tsc_resolve_host (const gchar *address)
+{
+  TscResolveContext *ctx;
+  GResolver *resolver;
+  const gchar *suffix;
+  gchar *host;
+
+  tsc_resolve_init ();
+  if (!ttl)
+    return;
+
+  host = tsc_resolve_split (address, &suffix);
+  g_mutex_lock (&cache_lock);
+  if (!host || tsc_resolve_fresh (host) || g_hash_table_contains (resolving, host)) {
+    g_mutex_unlock (&cache_lock);
+    g_free (host);
+    return;
+  }
+
+  g_hash_table_add (resolving, g_strdup (host));
+  g_mutex_unlock (&cache_lock);
+  ctx = g_new0 (TscResolveContext, 1);
+  ctx->host = host;
+  ctx->started = g_get_monotonic_time ();
+
+  resolver = g_resolver_get_default ();
+  g_resolver_lookup_by_name_async (resolver, host, NULL, tsc_resolve_done, ctx);
+  g_object_unref (resolver);
+}
+
+
+static gboolean
+tsc_resolve_later_cb (gpointer user_data)
+{
+  later_id = 0;
+  tsc_resolve_host (later_address);
+  g_clear_pointer (&later_address, g_free);
+  return G_SOURCE_REMOVE;
+}
+
+
+/* Same, once the user stops typing. */
+void tsc_resolve_host_later (const gchar *address)
+{
+  g_free (later_address);
+  later_address = g_strdup (address);
+  if (later_id)
+    g_source_remove (later_id);
+  later_id = g_timeout_add (TSC_RESOLVE_DELAY, tsc_resolve_later_cb, NULL);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_resolve_connect_address        *
+*                                      *
+***************************************/
+
+/* The port a client of protocol connects to given the suffix after the host; 0 for none. */
+static guint16
+tsc_resolve_port (const gchar *suffix, gint protocol)
+{
+  gint port;
+
+  if (!tsc_probe_default_port (protocol))
+    return 0;
+  // vncviewer's host::port
+  if (g_str_has_prefix (suffix, "::"))
+    return atoi (suffix + 2);
+  if (*suffix != ':')
+    return tsc_probe_default_port (protocol);
+  port = atoi (suffix + 1);
+  // and its host:N for display N
+  if (protocol == 1 && port < 100)
+    port += TSC_PORT_VNC;
+  return port;
+}
+
+
+static gboolean
+tsc_resolve_dual_stack (TscResolveEntry *entry)
+{
+  gboolean v4 = FALSE, v6 = FALSE;
+  gint i;
+
+  for (i = 0; entry->addresses[i]; i++) {
+    if (strchr (entry->addresses[i], ':'))
+      v6 = TRUE;
+    else
+      v4 = TRUE;
+  }
+  return v4 && v6;
+}
+
+
+/* The address of entry that took a connection first, with suffix; NULL if none did. */
+static gchar *
+tsc_resolve_eyeballs (const gchar *host, TscResolveEntry *entry, const gchar *suffix, gint protocol)
+{
+  guint16 port = tsc_resolve_port (suffix, protocol);
+  const gchar *winner;
+  gint i, ms = -1;
+
+  if (!port || !tsc_resolve_dual_stack (entry))
+    return NULL;
+
+  i = tsc_preflight_eyeballs (entry->addresses, entry->family, port, &ms);
+  if (i < 0)
+    return NULL;
+  winner = entry->addresses[i];
+  TSC_TRACE3 (launch__eyeballs, host, strchr (winner, ':') ? 6 : 4, ms);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_resolve_eyeballs: %s port %d -> %s in %d ms\n", host, port, winner, ms);
+  #endif
+
+  if (entry->family != (strchr (winner, ':') ? 6 : 4)) {
+    TscResolveEntry *cached;
+
+    entry->family = strchr (winner, ':') ? 6 : 4;
+    g_mutex_lock (&cache_lock);
+    cached = g_hash_table_lookup (cache, host);
+    if (cached && cached->family != entry->family) {
+      cached->family = entry->family;
+      tsc_resolve_save ();
+    }
+    g_mutex_unlock (&cache_lock);
+  }
+  if (strchr (winner, ':'))
+    return g_strconcat ("[", winner, "]", suffix, NULL);
+  return g_strconcat (winner, suffix, NULL);
+}
+
+
+/*
+ * Called as a client of protocol is about to connect to address: counts
+ * a cache hit or miss, and returns the address to pass instead, NULL to
+ * pass address itself.  That is the winner of a family race for a host
+ * with both families when the client can still be told the name to
+ * check the certificate against (cert_name), or with pass-address an
+ * IPv4 address; either keeps the original port suffix.
+ */
+gchar *tsc_resolve_connect_address (const gchar *address, gint protocol, gboolean cert_name)
+{
+  TscResolveEntry *entry;
+  const gchar *suffix;
+  gchar *host, *ret = NULL;
+  gboolean eyeballs = cert_name && tsc_config_get_boolean ("preflight", "happy-eyeballs", TRUE);
+  gboolean hit;
+  gint i;
+
+  tsc_resolve_init ();
+  host = tsc_resolve_split (address, &suffix);
+  if (!host || (!ttl && !eyeballs)) {
+    g_free (host);
+    return NULL;
+  }
+
+  g_mutex_lock (&cache_lock);
+  entry = tsc_resolve_fresh (host);
+  entry = entry ? tsc_resolve_entry_copy (entry) : NULL;
+  hit = entry != NULL;
+  if (hit)
+    stats.hits++;
+  else
+    stats.misses++;
+  g_mutex_unlock (&cache_lock);
+  if (!hit) {
+    // the client would have looked it up anyway
+    if (eyeballs && tsc_probe_default_port (protocol))
+      entry = tsc_resolve_now (host);
+    else
+      tsc_resolve_host (address);
+  }
+  if (!entry) {
+    g_free (host);
+    return NULL;
+  }
+
+  if (eyeballs)
+    ret = tsc_resolve_eyeballs (host, entry, suffix, protocol);
+
+  if (!ret && tsc_config_get_boolean ("resolver", "pass-address", FALSE)) {
+    // an IPv6 literal would need brackets some clients do not take
+    for (i = 0; entry->addresses[i]; i++) {
+      if (!strchr (entry->addresses[i], ':')) {
+        ret = g_strconcat (entry->addresses[i], suffix, NULL);
+        break;
+      }
+    }
+  }
+
+  // only a client handed the address skips the lookup
+  if (ret && hit) {
+    g_mutex_lock (&cache_lock);
+    stats.saved_ms += entry->lookup_ms;
+    g_mutex_unlock (&cache_lock);
+  }
+
+  tsc_resolve_entry_free (entry);
+  g_free (host);
+  return ret;
+}
+
+
+/* The host's addresses, looked up now unless cached; NULL if it has none. */
+gchar **tsc_resolve_addresses (const gchar *address)
+{
+  TscResolveEntry *entry;
+  const gchar *suffix;
+  gchar *host;
+  gchar **addresses;
+
+  tsc_resolve_init ();
+  host = tsc_resolve_split (address, &suffix);
+  entry = host ? tsc_resolve_now (host) : NULL;
+  g_free (host);
+  if (!entry)
+    return NULL;
+  addresses = g_strdupv (entry->addresses);
+  tsc_resolve_entry_free (entry);
+  return addresses;
+}
+
+
+/* The family (4 or 6) that last connected first to address's host, 0 if unknown. */
+gint tsc_resolve_family (const gchar *address)
+{
+  TscResolveEntry *entry;
+  const gchar *suffix;
+  gchar *host;
+  gint family;
+
+  tsc_resolve_init ();
+  host = tsc_resolve_split (address, &suffix);
+  g_mutex_lock (&cache_lock);
+  entry = host ? g_hash_table_lookup (cache, host) : NULL;
+  family = entry ? entry->family : 0;
+  g_mutex_unlock (&cache_lock);
+  g_free (host);
+  return family;
+}
+
+
+void tsc_resolve_set_family (const gchar *address, gint family)
+{
+  TscResolveEntry *entry;
+  const gchar *suffix;
+  gchar *host;
+
+  tsc_resolve_init ();
+  host = tsc_resolve_split (address, &suffix);
+  g_mutex_lock (&cache_lock);
+  entry = host ? g_hash_table_lookup (cache, host) : NULL;
+  if (entry && entry->family != family) {
+    entry->family = family;
+    tsc_resolve_save ();
+  }
+  g_mutex_unlock (&cache_lock);
+  g_free (host);
+}
+
+
+/* The host name in address, NULL for an address literal. */
+gchar *tsc_resolve_host_name (const gchar *address)
+{
+  const gchar *suffix;
+
+  return tsc_resolve_split (address, &suffix);
+}
+
+
+void tsc_resolve_get_stats (TscResolveStats *out)
+{
+  g_mutex_lock (&cache_lock);
+  *out = stats;
+  g_mutex_unlock (&cache_lock);
+}
+
+
+/* NULL until a connect has consulted the cache. */
+gchar *tsc_resolve_stats_text (void)
+{
+  TscResolveStats now;
+  gint total;
+
+  tsc_resolve_get_stats (&now);
+  total = now.hits + now.misses;
+  if (!total)
+    return NULL;
+
+  return g_strdup_printf (_("DNS cache: %d%% hits (%d of %d), about %d ms saved"),
+                          now.hits * 100 / total, now.hits, total,
+                          (gint) now.saved_ms);
+}
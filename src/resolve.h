@@ -0,0 +1,31 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_RESOLVE_TTL_DEFAULT 300
+#define TSC_RESOLVE_DELAY 400
+
+typedef struct
+{
+  gint hits;
+  gint misses;
+  gint lookups;
+  gint64 saved_ms;
+} TscResolveStats;
+
+void tsc_resolve_host (const gchar *address);
+void tsc_resolve_host_later (const gchar *address);
+gchar *tsc_resolve_connect_address (const gchar *address, gint protocol, gboolean cert_name);
+gchar **tsc_resolve_addresses (const gchar *address);
+gint tsc_resolve_family (const gchar *address);
+void tsc_resolve_set_family (const gchar *address, gint family);
+gchar *tsc_resolve_host_name (const gchar *address);
+void tsc_resolve_get_stats (TscResolveStats *stats);
+gchar *tsc_resolve_stats_text (void);
+
+#endif /* RESOLVE_H */
@@ -0,0 +1,199 @@
+/***************************************
+*                                      *
+*   Profile Directory Scanner          *
+*                                      *
+***************************************/
+
+/*
+ * Walks ~/.tsclient for .rdp profiles with as few metadata round trips as
+ * possible, for home directories on NFS where every stat is one:
+ *
+ *  - entry types come from readdir's d_type; only DT_UNKNOWN and symlinks
+ *    are stat'ed, with statx (AT_STATX_DONT_SYNC) so the client may answer
+ *    from its attribute cache instead of asking the server;
+ *  - each group directory is walked on its own thread, up to [scan]
+ *    threads at once (1 walks them one after another).
+ *
+ * Profiles directly in the root come first, then each group's in
+ * directory order, as "name.rdp" or "group/name.rdp".
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "scan.h"
+#include "tsc-trace.h"
+
+typedef struct {
+  gchar *dir_name;
+  gchar *value;
+  GSList *list;
+} TscScanJob;
+
+
+static gboolean
+tsc_scan_is_dir (int dfd, const struct dirent *entry)
+{
+#ifdef HAVE_STATX
+  struct statx stx;
+#else
+  struct stat st;
+#endif
+
+  switch (entry->d_type) {
+  case DT_DIR:
+    return TRUE;
+  case DT_UNKNOWN:
+  case DT_LNK:
+    break;
+  default:
+    return FALSE;
+  }
+
+  // links are followed, as g_file_test (G_FILE_TEST_IS_DIR) did
+#ifdef HAVE_STATX
+  if (statx (dfd, entry->d_name, AT_STATX_DONT_SYNC, STATX_TYPE, &stx) != 0)
+    return FALSE;
+  return S_ISDIR (stx.stx_mode);
+#else
+  if (fstatat (dfd, entry->d_name, &st, 0) != 0)
+    return FALSE;
+  return S_ISDIR (st.st_mode);
+#endif
+}
+
+
+/*
+ * Prepend the profiles in dir_name to *list.  Subdirectories are
+ * walked in place, or handed back in subdirs when that is not NULL.
+ */
+static void
+tsc_scan_walk (const gchar *dir_name, const gchar *value, GSList **list, GPtrArray *subdirs)
+{
+  struct dirent *entry;
+  gint found = 0;
+  DIR *dir;
+
+  dir = opendir (dir_name);
+  if (!dir)
+    return;
+
+  while ((entry = readdir (dir)) != NULL) {
+    if (strcmp (entry->d_name, ".") == 0 || strcmp (entry->d_name, "..") == 0)
+      continue;
+
+    if (tsc_scan_is_dir (dirfd (dir), entry)) {
+      gchar *sub_name = g_build_path ("/", dir_name, entry->d_name, NULL);
+      if (subdirs) {
+        g_ptr_array_add (subdirs, sub_name);
+      } else {
+        tsc_scan_walk (sub_name, entry->d_name, list, NULL);
+        g_free (sub_name);
+      }
+    } else if (g_str_has_suffix (entry->d_name, ".rdp")) {
+      *list = g_slist_prepend (*list, value ? g_build_path ("/", value, entry->d_name, NULL)
+                                            : g_strdup (entry->d_name));
+      found++;
+    }
+  }
+  closedir (dir);
+  TSC_TRACE2 (profile__scan__dir, dir_name, found);
+}
+
+
+static void
+tsc_scan_job (TscScanJob *job, gpointer user_data)
+{
+  tsc_scan_walk (job->dir_name, job->value, &job->list, NULL);
+}
+
+
+/***************************************
+*                                      *
+*   tsc_scan_profiles                  *
+*                                      *
+***************************************/
+
+/* Append every profile under root to *list; returns how many were found. */
+int tsc_scan_profiles (const gchar *root, gint threads, GSList **list)
+{
+  GPtrArray *subdirs = g_ptr_array_new_with_free_func (g_free);
+  TscScanJob *jobs;
+  GSList *found = NULL;
+  guint i;
+  gint count;
+
+  tsc_scan_walk (root, NULL, &found, subdirs);
+
+  jobs = g_new0 (TscScanJob, subdirs->len);
+  for (i = 0; i < subdirs->len; i++) {
+    jobs[i].dir_name = g_ptr_array_index (subdirs, i);
+    jobs[i].value = g_path_get_basename (jobs[i].dir_name);
+  }
+
+  if (threads > 1 && subdirs->len > 1) {
+    GThreadPool *pool = g_thread_pool_new ((GFunc) tsc_scan_job, NULL,
+                                           MIN ((guint) threads, subdirs->len), FALSE, NULL);
+    for (i = 0; i < subdirs->len; i++)
+      g_thread_pool_push (pool, &jobs[i], NULL);
+    // waits for every queued job
+    g_thread_pool_free (pool, FALSE, TRUE);
+  } else {
+    for (i = 0; i < subdirs->len; i++)
+      tsc_scan_job (&jobs[i], NULL);
+  }
+
+  // every list is newest first, so stack them up and reverse once
+  for (i = 0; i < subdirs->len; i++) {
+    found = g_slist_concat (jobs[i].list, found);
+    g_free (jobs[i].value);
+  }
+  g_free (jobs);
+  g_ptr_array_free (subdirs, TRUE);
+
+  found = g_slist_reverse (found);
+  count = g_slist_length (found);
+  *list = g_slist_concat (*list, found);
+  return count;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_scan_stat                      *
+*                                      *
+***************************************/
+
+/* mtime and size of a profile, from the attribute cache where possible. */
+int tsc_scan_stat (const gchar *path, gint64 *mtime, gint64 *size)
+{
+#ifdef HAVE_STATX
+  struct statx stx;
+
+  if (statx (AT_FDCWD, path, AT_STATX_DONT_SYNC, STATX_MTIME | STATX_SIZE, &stx) != 0)
+    return 1;
+  *mtime = stx.stx_mtime.tv_sec;
+  *size = stx.stx_size;
+#else
+  GStatBuf st;
+
+  if (g_stat (path, &st) != 0)
+    return 1;
+  *mtime = st.st_mtime;
+  *size = st.st_size;
+#endif
+  return 0;
+}
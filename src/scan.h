@@ -0,0 +1,15 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_SCAN_THREADS_DEFAULT 4
+
+int tsc_scan_profiles (const gchar *root, gint threads, GSList **list);
+int tsc_scan_stat (const gchar *path, gint64 *mtime, gint64 *size);
+
+#endif /* SCAN_H */
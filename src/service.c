@@ -0,0 +1,292 @@
+/***************************************
+*                                      *
+*   D-Bus Launcher Service             *
+*                                      *
+***************************************/
+
+/*
+ * The primary instance exports com.tsclient.Launcher on the session
+ * bus, next to the GApplication object.  The CLI and the panel applets
+ * hand profiles to it with Launch() instead of cold-starting a new
+ * tsclient for every click; it answers from the warm supervisor.
+ *
+ *   Launch (s profile) -> (u id)
+ *     profile is a file, a name under ~/.tsclient (".rdp" optional)
+ *     or a bare host, which is opened with the last.tsc settings.
+ *   ListSessions () -> (a(ussi))   id, name, state, pid
+ *   Stats () -> (a{sv})
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "session.h"
+#include "resolve.h"
+#include "service.h"
+
+static const gchar tsc_service_xml[] =
+  "<node>"
+  "  <interface name='" TSC_SERVICE_IFACE "'>"
+  "    <method name='Launch'>"
+  "      <arg type='s' name='profile' direction='in'/>"
+  "      <arg type='u' name='id' direction='out'/>"
+  "    </method>"
+  "    <method name='ListSessions'>"
+  "      <arg type='a(ussi)' name='sessions' direction='out'/>"
+  "    </method>"
+  "    <method name='Stats'>"
+  "      <arg type='a{sv}' name='stats' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+static GDBusConnection *service_connection = NULL;
+static guint service_id = 0;
+static gint64 service_started = 0;
+
+static const gchar *const tsc_session_state_names[] = {
+  "queued",
+  "running",
+  "exited",
+  "failed",
+  "retrying"
+};
+
+
+/***************************************
+*                                      *
+*   tsc_service_load_profile           *
+*                                      *
+***************************************/
+
+/*
+ * Resolve a Launch() argument to a loaded profile; *name gets a label
+ * and *path the profile's file, NULL for a bare host.
+ */
+rdp_file *tsc_service_load_profile (const gchar *profile, gchar **name, gchar **path)
+{
+  gchar *home = tsc_home_path ();
+  gchar *file_name = NULL;
+  rdp_file *rdp;
+
+  if (g_file_test (profile, G_FILE_TEST_IS_REGULAR)) {
+    file_name = g_strdup (profile);
+  } else {
+    file_name = g_build_path ("/", home, profile, NULL);
+    if (!rdp_profile_exists (file_name)) {
+      g_free (file_name);
+      file_name = g_strconcat (home, "/", profile, ".rdp", NULL);
+      if (!rdp_profile_exists (file_name))
+        g_clear_pointer (&file_name, g_free);
+    }
+  }
+
+  rdp = g_new0 (rdp_file, 1);
+  rdp_file_init (rdp);
+
+  if (file_name) {
+    rdp_file_load (rdp, file_name);
+    *name = g_path_get_basename (file_name);
+    if (g_str_has_suffix (*name, ".rdp"))
+      (*name)[strlen (*name) - 4] = '\0';
+  } else {
+    // not a profile: a host from the MRU list, use the last settings
+    gchar *last = g_build_path ("/", home, "last.tsc", NULL);
+    if (g_file_test (last, G_FILE_TEST_EXISTS))
+      rdp_file_load (rdp, last);
+    g_free (rdp->full_address);
+    rdp->full_address = g_strdup (profile);
+    *name = g_strdup (profile);
+    g_free (last);
+  }
+
+  *path = file_name;
+  g_free (home);
+  return rdp;
+}
+
+
+static void
+tsc_service_method_call (GDBusConnection *connection,
+                         const gchar *sender,
+                         const gchar *object_path,
+                         const gchar *interface_name,
+                         const gchar *method_name,
+                         GVariant *parameters,
+                         GDBusMethodInvocation *invocation,
+                         gpointer user_data)
+{
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_service_method_call: %s\n", method_name);
+  #endif
+
+  if (g_strcmp0 (method_name, "Launch") == 0) {
+    const gchar *profile;
+    gchar *name = NULL, *path = NULL;
+    TscTiming *timing;
+    rdp_file *rdp;
+    gint64 start;
+
+    g_variant_get (parameters, "(&s)", &profile);
+    if (!profile[0]) {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_INVALID_ARGS,
+                                             "No profile given");
+      return;
+    }
+
+    timing = tsc_timing_new ();
+    start = g_get_monotonic_time ();
+    rdp = tsc_service_load_profile (profile, &name, &path);
+    tsc_timing_since (timing, TSC_PHASE_PROFILE_LOAD, start);
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(u)", tsc_session_queue (rdp, name, path, FALSE, timing)));
+    g_free (name);
+    g_free (path);
+
+  } else if (g_strcmp0 (method_name, "ListSessions") == 0) {
+    GVariantBuilder builder;
+    GList *lptr;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ussi)"));
+    for (lptr = tsc_session_list (); lptr; lptr = lptr->next) {
+      TscSession *session = lptr->data;
+      g_variant_builder_add (&builder, "(ussi)", session->id, session->name,
+                             tsc_session_state_names[session->state],
+                             (gint32) session->pid);
+    }
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(a(ussi))", &builder));
+
+  } else if (g_strcmp0 (method_name, "Stats") == 0) {
+    GVariantBuilder builder;
+    TscSessionStats stats;
+    TscReconnectStats reconnect;
+    TscResolveStats resolve;
+
+    tsc_session_get_stats (&stats);
+    tsc_reconnect_get_stats (&reconnect);
+    tsc_resolve_get_stats (&resolve);
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&builder, "{sv}", "running", g_variant_new_int32 (stats.running));
+    g_variant_builder_add (&builder, "{sv}", "queued", g_variant_new_int32 (stats.queued));
+    g_variant_builder_add (&builder, "{sv}", "started", g_variant_new_int32 (stats.started));
+    g_variant_builder_add (&builder, "{sv}", "exited", g_variant_new_int32 (stats.exited));
+    g_variant_builder_add (&builder, "{sv}", "failed", g_variant_new_int32 (stats.failed));
+    g_variant_builder_add (&builder, "{sv}", "restarts", g_variant_new_int32 (stats.restarts));
+    g_variant_builder_add (&builder, "{sv}", "reconnect-attempts", g_variant_new_int32 (reconnect.attempts));
+    g_variant_builder_add (&builder, "{sv}", "reconnect-recovered", g_variant_new_int32 (reconnect.recovered));
+    g_variant_builder_add (&builder, "{sv}", "reconnect-given-up", g_variant_new_int32 (reconnect.given_up));
+    g_variant_builder_add (&builder, "{sv}", "reconnect-ms", g_variant_new_int64 (reconnect.reconnect_ms));
+    g_variant_builder_add (&builder, "{sv}", "dns-hits", g_variant_new_int32 (resolve.hits));
+    g_variant_builder_add (&builder, "{sv}", "dns-misses", g_variant_new_int32 (resolve.misses));
+    g_variant_builder_add (&builder, "{sv}", "dns-saved-ms", g_variant_new_int64 (resolve.saved_ms));
+    g_variant_builder_add (&builder, "{sv}", "uptime-ms",
+                           g_variant_new_int64 ((g_get_monotonic_time () - service_started) / 1000));
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(a{sv})", &builder));
+  }
+}
+
+
+static const GDBusInterfaceVTable tsc_service_vtable = {
+  tsc_service_method_call,
+  NULL,
+  NULL,
+  { 0 }
+};
+
+
+/***************************************
+*                                      *
+*   tsc_service_register               *
+*                                      *
+***************************************/
+
+/* Called from "startup", so only the primary instance exports it. */
+void tsc_service_register (GApplication *app)
+{
+  GDBusNodeInfo *info;
+  GError *err = NULL;
+
+  service_connection = g_application_get_dbus_connection (app);
+  if (!service_connection || service_id)
+    return;
+
+  info = g_dbus_node_info_new_for_xml (tsc_service_xml, NULL);
+  service_id = g_dbus_connection_register_object (service_connection,
+                                                  g_application_get_dbus_object_path (app),
+                                                  info->interfaces[0],
+                                                  &tsc_service_vtable,
+                                                  NULL, NULL, &err);
+  g_dbus_node_info_unref (info);
+
+  if (!service_id) {
+    g_warning ("could not export %s: %s", TSC_SERVICE_IFACE, err->message);
+    g_error_free (err);
+    return;
+  }
+  service_started = g_get_monotonic_time ();
+}
+
+
+void tsc_service_unregister (void)
+{
+  if (service_connection && service_id)
+    g_dbus_connection_unregister_object (service_connection, service_id);
+  service_id = 0;
+  service_connection = NULL;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_service_launch                 *
+*                                      *
+***************************************/
+
+/*
+ * Client side: hand a profile to a running instance.  Returns 0 when
+ * it was accepted and 1 when there is no instance (or it refused), so
+ * the caller can fall back to launching on its own.
+ */
+int tsc_service_launch (const gchar *profile, gchar **error)
+{
+  GDBusConnection *connection;
+  GVariant *ret;
+  GError *err = NULL;
+
+  if (error)
+    *error = NULL;
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+  if (!connection)
+    return 1;
+
+  ret = g_dbus_connection_call_sync (connection, TSC_SERVICE_NAME, TSC_SERVICE_PATH,
+                                     TSC_SERVICE_IFACE, "Launch",
+                                     g_variant_new ("(s)", profile),
+                                     G_VARIANT_TYPE ("(u)"),
+                                     G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                     TSC_SERVICE_TIMEOUT, NULL, &err);
+  g_object_unref (connection);
+
+  if (!ret) {
+    #ifdef TSCLIENT_DEBUG
+    printf ("tsc_service_launch: %s\n", err->message);
+    #endif
+    if (error)
+      *error = g_strdup (err->message);
+    g_error_free (err);
+    return 1;
+  }
+
+  g_variant_unref (ret);
+  return 0;
+}
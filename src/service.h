@@ -0,0 +1,20 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_SERVICE_NAME "com.tsclient.app"
+#define TSC_SERVICE_PATH "/com/tsclient/app"
+#define TSC_SERVICE_IFACE "com.tsclient.Launcher"
+#define TSC_SERVICE_TIMEOUT 2000
+
+void tsc_service_register (GApplication *app);
+void tsc_service_unregister (void);
+int tsc_service_launch (const gchar *profile, gchar **error);
+rdp_file *tsc_service_load_profile (const gchar *profile, gchar **name, gchar **path);
+
+#endif /* SERVICE_H */
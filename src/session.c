@@ -0,0 +1,926 @@
+/***************************************
+*                                      *
+*   Session Supervisor                 *
+*                                      *
+***************************************/
+
+/*
+ * Keeps track of every client we spawn asynchronously.  Sessions are
+ * queued and started no more than max-sessions at a time, with a
+ * stagger (plus random jitter) between starts so a group launch does
+ * not hit the broker with every connect at once.  When a client exits
+ * its stderr and exit status are classified (see reconnect.c): transient
+ * failures are retried with backoff, and a clean exit goes back on the
+ * queue only under RDP_RESTART_ALWAYS.
+ *
+ * Limits come from the [supervisor] group of ~/.tsclient/tsclient.conf
+ * and can be overridden from the command line.
+ *
+ * Building a command line can resolve names, probe pool members and
+ * measure the link, so it runs on a worker thread against a copy of the
+ * profile; the client is spawned from the main loop once it is done.
+ * A session being built still counts against max-sessions.
+ */
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "rdpfile.h"
+#include "support.h"
+#include "session.h"
+#include "history.h"
+#include "metrics.h"
+#include "cache.h"
+#include "pool.h"
+#include "mrulist.h"
+#include "tsc-trace.h"
+
+static void tsc_session_pump (void);
+static void tsc_session_start (TscSession *session);
+static void tsc_session_finish (TscSession *session, TscSessionState state);
+static void tsc_session_release_cache (TscSession *session);
+static void tsc_session_child_exited (GPid pid, gint status, gpointer user_data);
+static gboolean tsc_session_stagger_cb (gpointer user_data);
+static gboolean tsc_session_retry_cb (gpointer user_data);
+static gboolean tsc_session_stderr_cb (gint fd, GIOCondition condition, gpointer user_data);
+static gboolean tsc_session_stdout_cb (gint fd, GIOCondition condition, gpointer user_data);
+static void tsc_session_close_stdout (TscSession *session);
+
+static GList *sessions = NULL;
+static GQueue pending = G_QUEUE_INIT;
+static guint next_id = 1;
+static guint stagger_id = 0;
+static gint64 next_start = 0;
+
+static gboolean limits_loaded = FALSE;
+static gint max_sessions = TSC_SESSION_MAX_DEFAULT;
+static gint stagger_ms = TSC_SESSION_STAGGER_DEFAULT;
+static gint jitter_ms = TSC_SESSION_JITTER_DEFAULT;
+static gint max_restarts = TSC_SESSION_RESTARTS_DEFAULT;
+
+static gint count_running = 0;
+static gint count_building = 0;
+static gint count_started = 0;
+static gint count_exited = 0;
+static gint count_failed = 0;
+static gint count_restarts = 0;
+
+typedef struct {
+  TscSessionNotify func;
+  gpointer data;
+} TscSessionListener;
+
+static GSList *listeners = NULL;
+
+// host -> clients running there, read by pool picks on the build thread
+static GHashTable *running_hosts = NULL;
+static GMutex running_hosts_lock;
+
+typedef struct {
+  rdp_file *rdp;
+  gchar *target;
+  gint protocol;
+  gchar *error;
+  gchar **argv;
+  gint64 argv_us;
+  gint64 find_program_us;
+} TscSessionBuild;
+
+
+static void
+tsc_session_load_limits (void)
+{
+  if (limits_loaded)
+    return;
+
+  max_sessions = tsc_config_get_int ("supervisor", "max-sessions", TSC_SESSION_MAX_DEFAULT);
+  stagger_ms = tsc_config_get_int ("supervisor", "stagger-ms", TSC_SESSION_STAGGER_DEFAULT);
+  jitter_ms = tsc_config_get_int ("supervisor", "jitter-ms", TSC_SESSION_JITTER_DEFAULT);
+  max_restarts = tsc_config_get_int ("supervisor", "max-restarts", TSC_SESSION_RESTARTS_DEFAULT);
+  stagger_ms = MAX (stagger_ms, 0);
+  jitter_ms = MAX (jitter_ms, 0);
+  limits_loaded = TRUE;
+}
+
+
+static void
+tsc_session_notify (TscSession *session)
+{
+  GSList *lptr, *next;
+
+  // a listener may remove itself
+  for (lptr = listeners; lptr; lptr = next) {
+    TscSessionListener *listener = lptr->data;
+
+    next = lptr->next;
+    listener->func (session, listener->data);
+  }
+  tsc_metrics_changed ();
+}
+
+
+/***************************************
+*                                      *
+*   tsc_session_set_limits             *
+*                                      *
+***************************************/
+
+/* Override the configured limits; pass -1 to keep a value. */
+void tsc_session_set_limits (gint max, gint stagger, gint jitter)
+{
+  tsc_session_load_limits ();
+
+  if (max >= 0)
+    max_sessions = max;
+  if (stagger >= 0)
+    stagger_ms = stagger;
+  if (jitter >= 0)
+    jitter_ms = jitter;
+}
+
+
+/* Call notify on every state change; adding the same pair twice has no effect. */
+void tsc_session_add_notify (TscSessionNotify notify, gpointer user_data)
+{
+  TscSessionListener *listener;
+  GSList *lptr;
+
+  for (lptr = listeners; lptr; lptr = lptr->next) {
+    listener = lptr->data;
+    if (listener->func == notify && listener->data == user_data)
+      return;
+  }
+
+  listener = g_new0 (TscSessionListener, 1);
+  listener->func = notify;
+  listener->data = user_data;
+  listeners = g_slist_append (listeners, listener);
+}
+
+
+void tsc_session_remove_notify (TscSessionNotify notify, gpointer user_data)
+{
+  GSList *lptr;
+
+  for (lptr = listeners; lptr; lptr = lptr->next) {
+    TscSessionListener *listener = lptr->data;
+    if (listener->func == notify && listener->data == user_data) {
+      listeners = g_slist_delete_link (listeners, lptr);
+      g_free (listener);
+      return;
+    }
+  }
+}
+
+
+/***************************************
+*                                      *
+*   tsc_session_queue                  *
+*                                      *
+***************************************/
+
+/*
+ * Takes ownership of rdp and timing (which may be NULL, or carry the
+ * phases measured before the session was queued); returns the new
+ * session id.  Interactive sessions come from the main window: they
+ * jump the queue and always get reconnected after a transient failure,
+ * whatever the profile's restart policy says.  profile is the file rdp
+ * came from, if any.
+ */
+guint tsc_session_queue (rdp_file *rdp, const gchar *name, const gchar *profile,
+                         gboolean interactive, TscTiming *timing)
+{
+  TscSession *session;
+  guint id;
+
+  tsc_session_load_limits ();
+
+  session = g_new0 (TscSession, 1);
+  session->id = id = next_id++;
+  session->name = g_strdup (name && strlen (name) ? name
+                            : rdp->full_address && *rdp->full_address ? rdp->full_address : rdp->pool);
+  session->rdp = rdp;
+  session->protocol = rdp->protocol;
+  session->state = TSC_SESSION_QUEUED;
+  session->profile = g_strdup (profile);
+  session->interactive = interactive;
+  session->timing = timing ? timing : tsc_timing_new ();
+  session->connect_ms = -1;
+  session->std_err = g_string_new (NULL);
+  session->err_fd = -1;
+  session->out_fd = -1;
+  session->display = -1;
+  session->cache_fd = -1;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_session_queue: %u %s\n", session->id, session->name);
+  #endif
+
+  TSC_TRACE2 (session__queue, id, interactive);
+  sessions = g_list_append (sessions, session);
+  if (interactive)
+    g_queue_push_head (&pending, session);
+  else
+    g_queue_push_tail (&pending, session);
+  tsc_session_notify (session);
+  // the session may already be gone if it failed to start
+  tsc_session_pump ();
+
+  return id;
+}
+
+
+int tsc_session_queue_file (const gchar *fqpath, gchar **error)
+{
+  TscTiming *timing;
+  rdp_file *rdp;
+  gchar *name;
+  gint64 start;
+
+  if (error)
+    *error = NULL;
+
+  if (!rdp_profile_exists (fqpath)) {
+    if (error)
+      *error = g_strdup_printf (_("%s does not exist."), fqpath);
+    return 1;
+  }
+
+  timing = tsc_timing_new ();
+  start = g_get_monotonic_time ();
+  rdp = g_new0 (rdp_file, 1);
+  rdp_file_init (rdp);
+  if (rdp_file_load (rdp, fqpath) != 0) {
+    if (error)
+      *error = g_strdup_printf (_("Could not read %s."), fqpath);
+    rdp_file_free (rdp);
+    g_free (timing);
+    return 1;
+  }
+  tsc_timing_since (timing, TSC_PHASE_PROFILE_LOAD, start);
+
+  name = g_path_get_basename (fqpath);
+  if (g_str_has_suffix (name, ".rdp"))
+    name[strlen (name) - 4] = '\0';
+  tsc_session_queue (rdp, name, fqpath, FALSE, timing);
+  g_free (name);
+
+  return 0;
+}
+
+
+/* Queue every profile in a ~/.tsclient subfolder; returns how many. */
+int tsc_session_queue_group (const gchar *group)
+{
+  GSList *files = NULL, *lptr;
+  gint cnt = 0;
+
+  rdp_files_in_group (group, &files);
+  for (lptr = files; lptr; lptr = lptr->next) {
+    gchar *error = NULL;
+    if (tsc_session_queue_file (lptr->data, &error) == 0) {
+      cnt++;
+    } else {
+      g_warning ("%s", error);
+      g_free (error);
+    }
+  }
+  g_slist_free_full (files, g_free);
+
+  return cnt;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_session_pump                   *
+*                                      *
+***************************************/
+
+static void
+tsc_session_pump (void)
+{
+  while (!g_queue_is_empty (&pending) &&
+         (max_sessions <= 0 || count_running + count_building < max_sessions)) {
+    gint64 now = g_get_monotonic_time ();
+
+    if (stagger_id)
+      return;
+
+    if (next_start > now) {
+      stagger_id = g_timeout_add ((next_start - now) / 1000 + 1,
+                                  tsc_session_stagger_cb, NULL);
+      return;
+    }
+
+    next_start = now + (gint64) (stagger_ms + g_random_int_range (0, jitter_ms + 1)) * 1000;
+    tsc_session_start (g_queue_pop_head (&pending));
+  }
+}
+
+
+static gboolean
+tsc_session_stagger_cb (gpointer user_data)
+{
+  stagger_id = 0;
+  tsc_session_pump ();
+  return G_SOURCE_REMOVE;
+}
+
+
+/* The host the client was started on: the pool's pick, or the profile's. */
+static const gchar *
+tsc_session_host (TscSession *session)
+{
+  return session->target ? session->target : session->rdp->full_address;
+}
+
+
+/* Note a connect, or how the session ended, in the recent list. */
+static void
+tsc_session_remember (TscSession *session)
+{
+  TscMruEntry visit;
+
+  // nothing to say about a session that never started
+  if (!session->started)
+    return;
+
+  mru_entry_init (&visit);
+  visit.server = (gchar *) tsc_session_host (session);
+  visit.protocol = session->protocol;
+  visit.profile = session->profile;
+  if (session->state == TSC_SESSION_RUNNING) {
+    // reconnects and restarts are the same visit
+    visit.visits = session->attempts || session->restarts ? 0 : 1;
+  } else {
+    visit.status = tsc_reconnect_name (session->failure);
+    visit.connect_ms = session->connect_ms;
+    visit.duration_s = (g_get_monotonic_time () - session->started) / G_USEC_PER_SEC;
+  }
+  mru_add_visit (&visit);
+}
+
+
+/*
+ * Log one client start to the launch history and the metrics, then
+ * clear the timings.  status is -1 when the client never started.
+ */
+static void
+tsc_session_record (TscSession *session, gint status, const gchar *outcome)
+{
+  tsc_history_append (session->timing, tsc_session_host (session),
+                      session->protocol, session->client, status);
+  session->connect_ms = status < 0 ? -1 : tsc_timing_connect (session->timing) / 1000;
+  tsc_metrics_launch (session->protocol, outcome);
+  tsc_timing_reset (session->timing);
+}
+
+
+/* Count a client starting (delta 1) or gone (-1) on the session's host. */
+static void
+tsc_session_count_running (TscSession *session, gint delta)
+{
+  const gchar *host = tsc_session_host (session);
+  gint count;
+
+  g_mutex_lock (&running_hosts_lock);
+  if (!running_hosts)
+    running_hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  count = GPOINTER_TO_INT (g_hash_table_lookup (running_hosts, host)) + delta;
+  if (count > 0)
+    g_hash_table_insert (running_hosts, g_strdup (host), GINT_TO_POINTER (count));
+  else
+    g_hash_table_remove (running_hosts, host);
+  g_mutex_unlock (&running_hosts_lock);
+}
+
+
+static void
+tsc_session_build_free (TscSessionBuild *build)
+{
+  rdp_file_free (build->rdp);
+  g_free (build->target);
+  g_free (build->error);
+  g_strfreev (build->argv);
+  g_free (build);
+}
+
+
+/* Worker thread: everything tsc_build_argv looks up or measures blocks. */
+static void
+tsc_session_build_thread (GTask *task, gpointer source, gpointer task_data,
+                          GCancellable *cancellable)
+{
+  TscSessionBuild *build = task_data;
+  gint64 start = g_get_monotonic_time ();
+
+  tsc_find_program_elapsed ();
+  build->argv = tsc_build_argv (build->rdp, &build->target, &build->protocol, &build->error);
+  build->argv_us = g_get_monotonic_time () - start;
+  build->find_program_us = tsc_find_program_elapsed ();
+  g_task_return_boolean (task, TRUE);
+}
+
+
+static void
+tsc_session_spawn (TscSession *session, gchar **c_argv)
+{
+  GError *err = NULL;
+  gint64 start;
+  gint *out_fd;
+
+  if (!c_argv) {
+    if (!session->error)
+      session->error = g_strdup (_("No computer was specified."));
+    session->failure = TSC_FAILURE_UNKNOWN;
+    tsc_session_record (session, -1, "spawn");
+    tsc_session_finish (session, TSC_SESSION_FAILED);
+    return;
+  }
+  g_free (session->client);
+  session->client = g_path_get_basename (c_argv[0]);
+  if (session->protocol == 0 || session->protocol == 4)
+    session->cache_fd = tsc_cache_checkout (tsc_session_host (session), session->client);
+
+  // stderr is what tells an auth failure from a dropped link
+  // and a nested X server says which display it took on stdout
+  out_fd = session->protocol == 2 ? &session->out_fd : NULL;
+  session->display = -1;
+  session->display_read = 0;
+  start = g_get_monotonic_time ();
+  if (!g_spawn_async_with_pipes (NULL, c_argv, NULL,
+                                 G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                 NULL, NULL, &session->pid,
+                                 NULL, out_fd, &session->err_fd, &err)) {
+    g_warning ("failed: spawn_async of %s", c_argv[0]);
+    g_free (session->error);
+    session->error = g_strdup (err->message);
+    session->failure = TSC_FAILURE_UNKNOWN;
+    g_error_free (err);
+    tsc_session_release_cache (session);
+    tsc_session_record (session, -1, "spawn");
+    tsc_session_finish (session, TSC_SESSION_FAILED);
+    return;
+  }
+  tsc_timing_since (session->timing, TSC_PHASE_SPAWN, start);
+  TSC_TRACE3 (launch__spawn, session->id, (gint) session->pid, session->client);
+
+  session->state = TSC_SESSION_RUNNING;
+  session->started = g_get_monotonic_time ();
+  session->timing->spawned = session->started;
+  tsc_metrics_connect (tsc_timing_connect (session->timing));
+  count_running++;
+  count_started++;
+  tsc_session_count_running (session, 1);
+  if (session->failed_at) {
+    tsc_reconnect_record_recovered (session->started - session->failed_at);
+    session->failed_at = 0;
+  }
+  tsc_session_remember (session);
+  // restarts and reconnects keep the watch their first start took
+  if (!session->pool_watched && session->rdp->pool && *session->rdp->pool) {
+    tsc_pool_watch (session->rdp->pool, session->rdp->protocol);
+    session->pool_watched = TRUE;
+  }
+
+  g_unix_set_fd_nonblocking (session->err_fd, TRUE, NULL);
+  session->err_watch = g_unix_fd_add (session->err_fd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                      tsc_session_stderr_cb, session);
+  if (session->out_fd >= 0) {
+    g_unix_set_fd_nonblocking (session->out_fd, TRUE, NULL);
+    session->out_watch = g_unix_fd_add (session->out_fd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                        tsc_session_stdout_cb, session);
+  }
+  g_child_watch_add (session->pid, tsc_session_child_exited, session);
+  tsc_session_notify (session);
+}
+
+
+/* Back on the main loop with the command line: spawn it, unless cancelled meanwhile. */
+static void
+tsc_session_built (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  TscSession *session = user_data;
+  TscSessionBuild *build = g_task_get_task_data (G_TASK (result));
+
+  session->building = FALSE;
+  count_building--;
+  tsc_timing_set (session->timing, TSC_PHASE_ARGV, build->argv_us);
+  tsc_timing_set (session->timing, TSC_PHASE_FIND_PROGRAM, build->find_program_us);
+  if (session->cancelled) {
+    tsc_session_finish (session, TSC_SESSION_FAILED);
+    tsc_session_pump ();
+    return;
+  }
+
+  session->target = g_steal_pointer (&build->target);
+  session->protocol = build->protocol;
+  g_free (session->error);
+  session->error = g_steal_pointer (&build->error);
+  tsc_session_spawn (session, build->argv);
+  tsc_session_pump ();
+}
+
+
+static void
+tsc_session_start (TscSession *session)
+{
+  TscSessionBuild *build;
+  GTask *task;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_session_start: %u %s\n", session->id, session->name);
+  #endif
+
+  g_clear_pointer (&session->error, g_free);
+  g_clear_pointer (&session->target, g_free);
+  g_string_truncate (session->std_err, 0);
+
+  build = g_new0 (TscSessionBuild, 1);
+  build->rdp = rdp_file_copy (session->rdp);
+  session->building = TRUE;
+  count_building++;
+  task = g_task_new (NULL, NULL, tsc_session_built, session);
+  g_task_set_task_data (task, build, (GDestroyNotify) tsc_session_build_free);
+  g_task_run_in_thread (task, tsc_session_build_thread);
+  g_object_unref (task);
+}
+
+
+/* Drain what the client wrote to stderr, keeping only the tail. */
+static gboolean
+tsc_session_read_stderr (TscSession *session)
+{
+  gchar buf[1024];
+  gssize len;
+
+  while ((len = read (session->err_fd, buf, sizeof (buf))) > 0) {
+    if (session->timing->phase[TSC_PHASE_FIRST_OUTPUT] < 0)
+      tsc_timing_since (session->timing, TSC_PHASE_FIRST_OUTPUT, session->timing->spawned);
+    g_string_append_len (session->std_err, buf, len);
+    if (session->std_err->len > TSC_SESSION_STDERR_MAX)
+      g_string_erase (session->std_err, 0,
+                      session->std_err->len - TSC_SESSION_STDERR_MAX);
+  }
+
+  // TRUE while the pipe is still open
+  return len < 0;
+}
+
+
+static gboolean
+tsc_session_stderr_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+  TscSession *session = user_data;
+
+  if (tsc_session_read_stderr (session))
+    return G_SOURCE_CONTINUE;
+
+  session->err_watch = 0;
+  return G_SOURCE_REMOVE;
+}
+
+
+/* Read the display number a nested X server reports with -displayfd 1. */
+static gboolean
+tsc_session_stdout_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+  TscSession *session = user_data;
+  gchar buf[64];
+  gssize len, i;
+
+  while ((len = read (fd, buf, sizeof (buf))) > 0) {
+    for (i = 0; i < len && session->display < 0; i++) {
+      if (g_ascii_isdigit (buf[i])) {
+        session->display_read = session->display_read * 10 + g_ascii_digit_value (buf[i]);
+      } else if (buf[i] == '\n') {
+        session->display = session->display_read;
+        tsc_session_notify (session);
+      }
+    }
+  }
+
+  // anything after the number is drained, so the server never blocks on it
+  if (len < 0)
+    return G_SOURCE_CONTINUE;
+
+  session->out_watch = 0;
+  return G_SOURCE_REMOVE;
+}
+
+
+static void
+tsc_session_close_stdout (TscSession *session)
+{
+  if (session->out_fd < 0)
+    return;
+
+  if (session->out_watch)
+    g_source_remove (session->out_watch);
+  session->out_watch = 0;
+  close (session->out_fd);
+  session->out_fd = -1;
+}
+
+
+static void
+tsc_session_close_stderr (TscSession *session)
+{
+  if (session->err_fd < 0)
+    return;
+
+  tsc_session_read_stderr (session);
+  if (session->err_watch)
+    g_source_remove (session->err_watch);
+  session->err_watch = 0;
+  close (session->err_fd);
+  session->err_fd = -1;
+}
+
+
+static void
+tsc_session_release_cache (TscSession *session)
+{
+  tsc_cache_checkin (tsc_session_host (session), session->cache_fd);
+  session->cache_fd = -1;
+}
+
+
+/* Back off, then put the session back at the head of the queue. */
+static void
+tsc_session_retry (TscSession *session)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint delay;
+
+  if (!session->failed_at)
+    session->failed_at = now;
+  session->attempts++;
+  delay = tsc_reconnect_delay (session->attempts);
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_session_retry: %u %s attempt %d in %d ms\n",
+          session->id, session->name, session->attempts, delay);
+  #endif
+
+  TSC_TRACE3 (session__reconnect, session->id, session->attempts, delay);
+  count_restarts++;
+  tsc_reconnect_record_attempt ();
+  session->state = TSC_SESSION_RETRYING;
+  session->retry_at = now + (gint64) delay * 1000;
+  session->retry_id = g_timeout_add (delay, tsc_session_retry_cb, session);
+  tsc_session_notify (session);
+}
+
+
+static gboolean
+tsc_session_retry_cb (gpointer user_data)
+{
+  TscSession *session = user_data;
+
+  session->retry_id = 0;
+  session->retry_at = 0;
+  session->state = TSC_SESSION_QUEUED;
+  g_queue_push_head (&pending, session);
+  tsc_session_notify (session);
+  tsc_session_pump ();
+  return G_SOURCE_REMOVE;
+}
+
+
+static void
+tsc_session_child_exited (GPid pid, gint status, gpointer user_data)
+{
+  TscSession *session = user_data;
+  gboolean failed;
+  gint policy;
+
+  g_spawn_close_pid (pid);
+  count_running--;
+  tsc_session_count_running (session, -1);
+  session->pid = 0;
+  session->exit_status = status;
+  tsc_session_close_stderr (session);
+  tsc_session_close_stdout (session);
+  tsc_session_release_cache (session);
+  tsc_timing_since (session->timing, TSC_PHASE_EXIT, session->timing->spawned);
+  while (session->std_err->len &&
+         g_ascii_isspace (session->std_err->str[session->std_err->len - 1]))
+    g_string_truncate (session->std_err, session->std_err->len - 1);
+
+  session->failure = tsc_reconnect_classify (session->client, status, session->std_err->str);
+  failed = session->failure != TSC_FAILURE_NONE;
+  tsc_reconnect_record_failure (session->failure);
+  TSC_TRACE4 (session__exit, session->id, (gint) pid, status, (gint) session->failure);
+  tsc_session_record (session, WIFEXITED (status) ? WEXITSTATUS (status) : status,
+                      tsc_reconnect_name (session->failure));
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_session_child_exited: %u %s status %d failure %d\n",
+          session->id, session->name, status, session->failure);
+  #endif
+
+  if (failed) {
+    g_free (session->error);
+    session->error = g_strdup (session->std_err->len ? session->std_err->str
+                               : tsc_reconnect_describe (session->failure));
+  }
+  // a retry goes to another host of the pool
+  if (session->target && session->failure == TSC_FAILURE_NETWORK)
+    tsc_pool_mark_down (session->target, session->rdp->protocol);
+
+  // a session that stayed up for a while starts its backoff over
+  if (g_get_monotonic_time () - session->started >=
+      (gint64) tsc_reconnect_stable_ms () * 1000)
+    session->attempts = 0;
+
+  policy = session->rdp->restart_policy;
+  if (failed && tsc_reconnect_is_transient (session->failure) &&
+      (session->interactive || policy != RDP_RESTART_NEVER)) {
+    if (session->attempts < tsc_reconnect_max_attempts ()) {
+      tsc_session_retry (session);
+      tsc_session_pump ();
+      return;
+    }
+    tsc_reconnect_record_given_up ();
+  } else if (!failed && policy == RDP_RESTART_ALWAYS &&
+             session->restarts < max_restarts) {
+    session->restarts++;
+    count_restarts++;
+    session->state = TSC_SESSION_QUEUED;
+    g_queue_push_tail (&pending, session);
+    tsc_session_notify (session);
+    tsc_session_pump ();
+    return;
+  }
+
+  tsc_session_finish (session, failed ? TSC_SESSION_FAILED : TSC_SESSION_EXITED);
+  tsc_session_pump ();
+}
+
+
+/* Between sessions, hold the bitmap caches to their budget; reconnects keep theirs. */
+static void
+tsc_session_trim_cache (void)
+{
+  GPtrArray *busy = g_ptr_array_new ();
+  GList *lptr;
+
+  for (lptr = sessions; lptr; lptr = lptr->next)
+    g_ptr_array_add (busy, (gpointer) tsc_session_host (lptr->data));
+  tsc_cache_trim (busy);
+  g_ptr_array_free (busy, TRUE);
+}
+
+
+/* Report the final state, then forget the session. */
+static void
+tsc_session_finish (TscSession *session, TscSessionState state)
+{
+  session->state = state;
+  if (state == TSC_SESSION_FAILED)
+    count_failed++;
+  else
+    count_exited++;
+
+  tsc_session_remember (session);
+  tsc_session_notify (session);
+
+  sessions = g_list_remove (sessions, session);
+  tsc_session_close_stderr (session);
+  tsc_session_close_stdout (session);
+  tsc_session_release_cache (session);
+  tsc_session_trim_cache ();
+  if (session->pool_watched)
+    tsc_pool_unwatch (session->rdp->pool);
+  if (session->retry_id)
+    g_source_remove (session->retry_id);
+  g_string_free (session->std_err, TRUE);
+  g_free (session->timing);
+  g_free (session->client);
+  g_free (session->profile);
+  g_free (session->target);
+  rdp_file_free (session->rdp);
+  g_free (session->error);
+  g_free (session->name);
+  g_free (session);
+}
+
+
+static TscSession *
+tsc_session_find (guint id)
+{
+  GList *lptr;
+
+  for (lptr = sessions; lptr; lptr = lptr->next) {
+    TscSession *session = lptr->data;
+    if (session->id == id)
+      return session;
+  }
+  return NULL;
+}
+
+
+/* Skip the rest of the backoff of a session waiting to reconnect. */
+gboolean tsc_session_retry_now (guint id)
+{
+  TscSession *session = tsc_session_find (id);
+
+  if (!session || session->state != TSC_SESSION_RETRYING)
+    return FALSE;
+
+  g_source_remove (session->retry_id);
+  tsc_session_retry_cb (session);
+  return TRUE;
+}
+
+
+/*
+ * Drop a session that has not started yet or is waiting to reconnect.
+ * One whose command line is still being built goes once that is done.
+ */
+gboolean tsc_session_cancel (guint id)
+{
+  TscSession *session = tsc_session_find (id);
+
+  if (!session)
+    return FALSE;
+
+  if (session->building) {
+    session->cancelled = TRUE;
+    return TRUE;
+  }
+
+  if (session->state == TSC_SESSION_QUEUED)
+    g_queue_remove (&pending, session);
+  else if (session->state != TSC_SESSION_RETRYING)
+    return FALSE;
+
+  session->cancelled = TRUE;
+  tsc_session_finish (session, TSC_SESSION_FAILED);
+  tsc_session_pump ();
+  return TRUE;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_session_get_stats              *
+*                                      *
+***************************************/
+
+void tsc_session_get_stats (TscSessionStats *stats)
+{
+  stats->queued = g_queue_get_length (&pending) + count_building;
+  stats->running = count_running;
+  stats->started = count_started;
+  stats->exited = count_exited;
+  stats->failed = count_failed;
+  stats->restarts = count_restarts;
+}
+
+
+gchar *tsc_session_stats_text (void)
+{
+  TscSessionStats stats;
+
+  tsc_session_get_stats (&stats);
+  return g_strdup_printf (_("%d running, %d queued, %d exited, %d failed, %d restarted"),
+                          stats.running, stats.queued, stats.exited,
+                          stats.failed, stats.restarts);
+}
+
+
+/* Sessions still queued, running or waiting to reconnect. */
+GList *tsc_session_list (void)
+{
+  return sessions;
+}
+
+
+/* TRUE while anything is queued or still running. */
+gboolean tsc_session_pending (void)
+{
+  return sessions != NULL;
+}
+
+
+/* How many sessions have a client running on host; safe from any thread. */
+gint tsc_session_count_host (const gchar *host)
+{
+  gint count = 0;
+
+  g_mutex_lock (&running_hosts_lock);
+  if (running_hosts)
+    count = GPOINTER_TO_INT (g_hash_table_lookup (running_hosts, host));
+  g_mutex_unlock (&running_hosts_lock);
+  return count;
+}
@@ -0,0 +1,91 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "reconnect.h"
+#include "history.h"
+
+/***************************************
+*                                      *
+*   Definitions                        *
+*                                      *
+***************************************/
+
+#define TSC_SESSION_MAX_DEFAULT 4
+#define TSC_SESSION_STAGGER_DEFAULT 500
+#define TSC_SESSION_JITTER_DEFAULT 250
+#define TSC_SESSION_RESTARTS_DEFAULT 3
+#define TSC_SESSION_STDERR_MAX 4096
+
+typedef enum
+{
+  TSC_SESSION_QUEUED,
+  TSC_SESSION_RUNNING,
+  TSC_SESSION_EXITED,
+  TSC_SESSION_FAILED,
+  TSC_SESSION_RETRYING
+} TscSessionState;
+
+typedef struct
+{
+  guint id;
+  gchar *name;
+  rdp_file *rdp;
+  GPid pid;
+  TscSessionState state;
+  gint restarts;
+  gint exit_status;
+  gint64 started;
+  gchar *error;
+  gboolean interactive;
+  gboolean cancelled;
+  gboolean building;
+  TscFailure failure;
+  gint attempts;
+  gint64 failed_at;
+  gint64 retry_at;
+  guint retry_id;
+  GString *std_err;
+  gint err_fd;
+  guint err_watch;
+  gint out_fd;
+  guint out_watch;
+  gint display;
+  gint display_read;
+  gint cache_fd;
+  TscTiming *timing;
+  gchar *client;
+  gchar *profile;
+  gint connect_ms;
+  gchar *target;
+  gint protocol;
+  gboolean pool_watched;
+} TscSession;
+
+typedef struct
+{
+  gint queued;
+  gint running;
+  gint started;
+  gint exited;
+  gint failed;
+  gint restarts;
+} TscSessionStats;
+
+typedef void (*TscSessionNotify) (TscSession *session, gpointer user_data);
+
+void tsc_session_set_limits (gint max_sessions, gint stagger_ms, gint jitter_ms);
+void tsc_session_add_notify (TscSessionNotify notify, gpointer user_data);
+void tsc_session_remove_notify (TscSessionNotify notify, gpointer user_data);
+guint tsc_session_queue (rdp_file *rdp, const gchar *name, const gchar *profile,
+                         gboolean interactive, TscTiming *timing);
+int tsc_session_queue_file (const gchar *fqpath, gchar **error);
+int tsc_session_queue_group (const gchar *group);
+gboolean tsc_session_retry_now (guint id);
+gboolean tsc_session_cancel (guint id);
+void tsc_session_get_stats (TscSessionStats *stats);
+gchar *tsc_session_stats_text (void);
+GList *tsc_session_list (void);
+gboolean tsc_session_pending (void);
+gint tsc_session_count_host (const gchar *host);
+
+#endif /* SESSION_H */
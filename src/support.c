@@ -32,6 +32,17 @@
 #include "rdpfile.h"
 #include "support.h"
 #include "connect.h"
+#include "mrulist.h"
+#include "session.h"
+#include "probe.h"
+#include "resolve.h"
+#include "tsc-trace.h"
+#include "tsc-presets.h"
+#include "adapt.h"
+#include "cache.h"
+#include "preflight.h"
+#include "pool.h"
+#include "handshake.h"
 
 /* Stolen from jirka's vicious lib */
 #define VE_IGNORE_EINTR(expr)                   \
@@ -255,11 +266,36 @@ tsc_dropdown_get_string (GtkWidget *dropdown, guint idx) {
   return gtk_string_list_get_string (model, idx);
 }
 
+/* Row of each label, first one wins; built on first use, kept by append and clear. */
+static GHashTable *
+tsc_dropdown_rows (GtkWidget *dropdown, GtkStringList *model) {
+  GHashTable *rows = g_object_get_data (G_OBJECT (dropdown), "tsc-rows");
+  guint items, i;
+
+  if (rows)
+    return rows;
+  rows = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  items = g_list_model_get_n_items (G_LIST_MODEL (model));
+  for (i = 0; i < items; i++) {
+    const gchar *text = gtk_string_list_get_string (model, i);
+    if (!g_hash_table_contains (rows, text))
+      g_hash_table_insert (rows, g_strdup (text), GUINT_TO_POINTER (i));
+  }
+  g_object_set_data_full (G_OBJECT (dropdown), "tsc-rows", rows,
+                          (GDestroyNotify) g_hash_table_destroy);
+  return rows;
+}
+
 void
 tsc_dropdown_append (GtkWidget *dropdown, const gchar *label) {
   GtkStringList *model = tsc_dropdown_get_model (dropdown);
+  GHashTable *rows;
   if (!model)
     return;
+  rows = g_object_get_data (G_OBJECT (dropdown), "tsc-rows");
+  if (rows && !g_hash_table_contains (rows, label))
+    g_hash_table_insert (rows, g_strdup (label),
+                         GUINT_TO_POINTER (g_list_model_get_n_items (G_LIST_MODEL (model))));
   gtk_string_list_append (model, label);
 }
 
@@ -268,6 +304,7 @@ tsc_dropdown_clear (GtkWidget *dropdown) {
   GtkStringList *model = tsc_dropdown_get_model (dropdown);
   if (!model)
     return;
+  g_object_set_data (G_OBJECT (dropdown), "tsc-rows", NULL);
   guint items = g_list_model_get_n_items (G_LIST_MODEL (model));
   while (items > 0) {
     gtk_string_list_remove (model, items - 1);
@@ -275,6 +312,117 @@ tsc_dropdown_clear (GtkWidget *dropdown) {
   }
 }
 
+static void
+tsc_dropdown_annotate_setup (GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+  GtkWidget *label = gtk_label_new (NULL);
+  gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+  gtk_list_item_set_child (item, label);
+}
+
+static void
+tsc_dropdown_annotate_bind (GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+  GSList *annotators = g_object_get_data (G_OBJECT (user_data), "tsc-annotate");
+  const gchar *text = gtk_string_object_get_string (GTK_STRING_OBJECT (gtk_list_item_get_item (item)));
+  GString *label = g_string_new (text);
+  gboolean first = TRUE;
+
+  for (; annotators; annotators = annotators->next) {
+    TscDropdownAnnotate annotate = (TscDropdownAnnotate) annotators->data;
+    gchar *note = annotate (text);
+    if (!note)
+      continue;
+    g_string_append (label, first ? "  (" : " · ");
+    g_string_append (label, note);
+    first = FALSE;
+    g_free (note);
+  }
+  if (!first)
+    g_string_append_c (label, ')');
+
+  gtk_label_set_text (GTK_LABEL (gtk_list_item_get_child (item)), label->str);
+  g_string_free (label, TRUE);
+}
+
+/*
+ * Popup rows get the notes of every annotate added, in order; the
+ * button keeps the plain label.
+ */
+void
+tsc_dropdown_add_annotate (GtkWidget *dropdown, TscDropdownAnnotate annotate) {
+  GSList *annotators = g_object_steal_data (G_OBJECT (dropdown), "tsc-annotate");
+
+  if (!annotators) {
+    GtkListItemFactory *factory = gtk_signal_list_item_factory_new ();
+
+    g_signal_connect (factory, "setup", G_CALLBACK (tsc_dropdown_annotate_setup), NULL);
+    g_signal_connect (factory, "bind", G_CALLBACK (tsc_dropdown_annotate_bind), dropdown);
+    gtk_drop_down_set_list_factory (GTK_DROP_DOWN (dropdown), factory);
+    g_object_unref (factory);
+  }
+
+  annotators = g_slist_append (annotators, (gpointer) annotate);
+  g_object_set_data_full (G_OBJECT (dropdown), "tsc-annotate", annotators,
+                          (GDestroyNotify) g_slist_free);
+}
+
+/* Rebind every row but the selected one so the notes are redrawn. */
+void
+tsc_dropdown_refresh (GtkWidget *dropdown) {
+  GtkStringList *model = tsc_dropdown_get_model (dropdown);
+  guint selected, items, i;
+
+  if (!model)
+    return;
+  selected = gtk_drop_down_get_selected (GTK_DROP_DOWN (dropdown));
+  items = g_list_model_get_n_items (G_LIST_MODEL (model));
+  for (i = 0; i < items; i++) {
+    gchar *text;
+    if (i == selected)
+      continue;
+    text = g_strdup (gtk_string_list_get_string (model, i));
+    gtk_string_list_splice (model, i, 1, (const gchar * const []) { text, NULL });
+    g_free (text);
+  }
+}
+
+/* Rebind the row showing label, unless it is the selected one. */
+void
+tsc_dropdown_refresh_label (GtkWidget *dropdown, const gchar *label) {
+  GtkStringList *model = tsc_dropdown_get_model (dropdown);
+  gpointer row;
+  guint i;
+
+  if (!model ||
+      !g_hash_table_lookup_extended (tsc_dropdown_rows (dropdown, model), label, NULL, &row))
+    return;
+  i = GPOINTER_TO_UINT (row);
+  if (i == gtk_drop_down_get_selected (GTK_DROP_DOWN (dropdown)))
+    return;
+  gtk_string_list_splice (model, i, 1, (const gchar * const []) { label, NULL });
+}
+
+/* The protocol code (see rdp_file) selected in the main window. */
+gint
+tsc_screen_protocol (GtkWidget *main_window) {
+  GtkWidget *widget = main_window ? lookup_widget (main_window, "optProtocol") : NULL;
+
+  if (!widget)
+    return 4;
+
+  switch (tsc_dropdown_get_selected (widget)) {
+  case 0:
+    return 0;
+  case 2:
+    return 1;
+  case 3:
+    return 2;
+  case 4:
+    return 3;
+  default:
+    return 4;
+  }
+}
+
 
 /***************************************
 *                                      *
@@ -331,6 +479,79 @@ gchar *tsc_home_path () {
 }
 
 
+/***************************************
+*                                      *
+*   tsc_config_get_int                 *
+*                                      *
+***************************************/
+
+static GKeyFile *tsc_config = NULL;
+static GMutex tsc_config_lock;
+
+/* Read once, then only read from, so launches can ask from their worker threads. */
+static GKeyFile *
+tsc_config_load (void)
+{
+  gchar *home, *file_name;
+
+  g_mutex_lock (&tsc_config_lock);
+  if (tsc_config) {
+    g_mutex_unlock (&tsc_config_lock);
+    return tsc_config;
+  }
+
+  home = tsc_home_path ();
+  file_name = g_build_path ("/", home, "tsclient.conf", NULL);
+  tsc_config = g_key_file_new ();
+  // a missing or broken file just means every key takes its default
+  g_key_file_load_from_file (tsc_config, file_name, G_KEY_FILE_NONE, NULL);
+  g_free (file_name);
+  g_free (home);
+  g_mutex_unlock (&tsc_config_lock);
+  return tsc_config;
+}
+
+gint tsc_config_get_int (const gchar *group, const gchar *key, gint fallback)
+{
+  GKeyFile *config = tsc_config_load ();
+  GError *err = NULL;
+  gint value;
+
+  value = g_key_file_get_integer (config, group, key, &err);
+  if (err) {
+    g_error_free (err);
+    return fallback;
+  }
+  return value;
+}
+
+gboolean tsc_config_get_boolean (const gchar *group, const gchar *key, gboolean fallback)
+{
+  GKeyFile *config = tsc_config_load ();
+  GError *err = NULL;
+  gboolean value;
+
+  value = g_key_file_get_boolean (config, group, key, &err);
+  if (err) {
+    g_error_free (err);
+    return fallback;
+  }
+  return value;
+}
+
+/* NULL when the key is unset or empty; free the result. */
+gchar *tsc_config_get_string (const gchar *group, const gchar *key)
+{
+  GKeyFile *config = tsc_config_load ();
+  gchar *value;
+
+  value = g_key_file_get_string (config, group, key, NULL);
+  if (value && !*g_strstrip (value))
+    g_clear_pointer (&value, g_free);
+  return value;
+}
+
+
 /**
  * tsc_get_free_display
  * @start: Start at this display, use 0 as safe value.
@@ -451,47 +672,837 @@ int tsc_get_free_display (int start, uid_t server_uid)
 
 /***************************************
 *                                      *
-*   tsc_launch_remote                  *
+*   tsc_find_program                   *
 *                                      *
 ***************************************/
 
-int tsc_launch_remote (rdp_file *rdp_in, int launch_async, gchar** error)
+/*
+ * g_find_program_in_path with a cache, so a resident instance does not
+ * walk $PATH for every launch.  Only hits are cached, and a cached path
+ * is dropped again if the binary goes away.  Launches look programs up
+ * from worker threads, so the path returned is only good for testing.
+ */
+static GPrivate find_program_us = G_PRIVATE_INIT (g_free);
+static GMutex find_program_lock;
+
+
+/* Time spent looking, per thread, so launches built side by side each count their own. */
+static gint64 *
+tsc_find_program_counter (void)
 {
-  rdp_file *rdp = NULL;
-  gchar *c_argv[MAX_ARGVS];
-  gchar buffer[MAX_ARGV_LEN];
+  gint64 *us = g_private_get (&find_program_us);
+
+  if (!us) {
+    us = g_new0 (gint64, 1);
+    g_private_set (&find_program_us, us);
+  }
+  return us;
+}
+
+
+/* Called with find_program_lock held. */
+static const gchar *
+tsc_find_program_cached (const gchar *program)
+{
+  static GHashTable *programs = NULL;
+  gchar *path;
+
+  if (!programs)
+    programs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  path = g_hash_table_lookup (programs, program);
+  if (path && g_file_test (path, G_FILE_TEST_IS_EXECUTABLE))
+    return path;
+
+  path = g_find_program_in_path (program);
+  if (!path) {
+    g_hash_table_remove (programs, program);
+    return NULL;
+  }
+  g_hash_table_replace (programs, g_strdup (program), path);
+  return path;
+}
+
+const gchar *tsc_find_program (const gchar *program)
+{
+  gint64 start = g_get_monotonic_time ();
+  const gchar *path;
+
+  g_mutex_lock (&find_program_lock);
+  path = tsc_find_program_cached (program);
+  g_mutex_unlock (&find_program_lock);
+  *tsc_find_program_counter () += g_get_monotonic_time () - start;
+  return path;
+}
+
+/* Microseconds this thread spent in tsc_find_program since its last call. */
+gint64 tsc_find_program_elapsed (void)
+{
+  gint64 *us = tsc_find_program_counter ();
+  gint64 elapsed = *us;
+
+  *us = 0;
+  return elapsed;
+}
+
+
+#define TSC_PROGRAM_TIMEOUT_MS 2000
+
+typedef struct {
+  GMainLoop *loop;
+  gchar *out;
+  gchar *err;
+} TscProgramOutput;
+
+
+static void
+tsc_program_output_done (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  TscProgramOutput *output = user_data;
+
+  g_subprocess_communicate_utf8_finish (G_SUBPROCESS (source), result,
+                                        &output->out, &output->err, NULL);
+  g_main_loop_quit (output->loop);
+}
+
+
+static gboolean
+tsc_program_output_timeout (gpointer user_data)
+{
+  g_cancellable_cancel (user_data);
+  return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * What program writes to stdout and stderr when run with arg, or NULL
+ * when it cannot be started.  One that has not finished after
+ * TSC_PROGRAM_TIMEOUT_MS is killed and whatever it wrote is lost.
+ */
+static gchar *
+tsc_program_output (const gchar *program, const gchar *arg)
+{
+  GMainContext *context = g_main_context_new ();
+  GCancellable *cancellable = g_cancellable_new ();
+  TscProgramOutput output = { NULL, NULL, NULL };
+  GSubprocess *process;
+  GSource *timeout;
+  gchar *text = NULL;
+
+  g_main_context_push_thread_default (context);
+  process = g_subprocess_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_PIPE,
+                              NULL, program, arg, NULL);
+  if (process) {
+    output.loop = g_main_loop_new (context, FALSE);
+    timeout = g_timeout_source_new (TSC_PROGRAM_TIMEOUT_MS);
+    g_source_set_callback (timeout, tsc_program_output_timeout, cancellable, NULL);
+    g_source_attach (timeout, context);
+    g_subprocess_communicate_utf8_async (process, NULL, cancellable,
+                                         tsc_program_output_done, &output);
+    g_main_loop_run (output.loop);
+    g_source_destroy (timeout);
+    g_source_unref (timeout);
+    g_main_loop_unref (output.loop);
+
+    if (g_cancellable_is_cancelled (cancellable))
+      g_subprocess_force_exit (process);
+    else
+      text = g_strconcat (output.out ? output.out : "", output.err ? output.err : "", NULL);
+    g_free (output.out);
+    g_free (output.err);
+    g_object_unref (process);
+  }
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+  g_object_unref (cancellable);
+
+  #ifdef TSCLIENT_DEBUG
+  if (process && !text)
+    printf ("tsc_program_output: %s %s timed out\n", program, arg);
+  #endif
+
+  return text;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_rdp_client                     *
+*                                      *
+***************************************/
+
+/*
+ * Profile fields FreeRDP has no option for: rdesktop's -L codepage, -e
+ * and -b.  "auto" leaves a profile that sets one of them with rdesktop.
+ */
+static gboolean
+tsc_rdp_needs_rdesktop (rdp_file *rdp)
+{
+  return (rdp->local_codepage && *rdp->local_codepage) ||
+         rdp->disable_encryption == 1 || rdp->force_bitmap_updates == 1;
+}
+
+
+/*
+ * The RDP client for rdp: the profile's rdp_client, else [rdp] client,
+ * else rdesktop.  "auto" takes xfreerdp3, then xfreerdp, then rdesktop,
+ * whichever is installed.  RDPv4 always goes to rdesktop; FreeRDP does
+ * not speak it.
+ */
+static const gchar *
+tsc_rdp_client (rdp_file *rdp)
+{
+  static const gchar *const clients[] = { "xfreerdp3", "xfreerdp", "rdesktop", NULL };
+  gchar *config = NULL;
+  const gchar *client = "rdesktop";
+  gboolean automatic;
+  gint i;
+
+  if (rdp->protocol != 4)
+    return client;
+
+  if (!rdp->rdp_client || !*rdp->rdp_client)
+    config = tsc_config_get_string ("rdp", "client");
+  client = rdp->rdp_client && *rdp->rdp_client ? rdp->rdp_client : config ? config : "rdesktop";
+  automatic = strcmp (client, "auto") == 0;
+  if (automatic && tsc_rdp_needs_rdesktop (rdp))
+    client = "rdesktop";
+
+  for (i = 0; clients[i]; i++) {
+    if (strcmp (client, clients[i]) == 0)
+      break;
+    if (automatic && tsc_find_program (clients[i]))
+      break;
+  }
+  g_free (config);
+  return clients[i] ? clients[i] : "rdesktop";
+}
+
+
+static GHashTable *freerdp_versions = NULL;
+static GMutex freerdp_versions_lock;
+
+/* "This is FreeRDP version 3.5.1 (...)"; 2 if unsure. */
+static gint
+tsc_freerdp_parse_version (const gchar *out)
+{
+  const gchar *found = out ? strstr (out, "version ") : NULL;
+
+  return found ? MAX (2, atoi (found + strlen ("version "))) : 2;
+}
+
+
+static void
+tsc_freerdp_set_version (const gchar *program, gint version)
+{
+  g_mutex_lock (&freerdp_versions_lock);
+  if (!freerdp_versions)
+    freerdp_versions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_hash_table_insert (freerdp_versions, g_strdup (program), GINT_TO_POINTER (version));
+  g_mutex_unlock (&freerdp_versions_lock);
+}
+
+
+/* FreeRDP's major version, from --version once per program; 2 if unsure. */
+static gint
+tsc_freerdp_version (const gchar *program)
+{
+  gchar *out;
+  gpointer cached;
+  gboolean known;
+  gint version;
+
+  if (strcmp (program, "xfreerdp3") == 0)
+    return 3;
+  g_mutex_lock (&freerdp_versions_lock);
+  known = freerdp_versions &&
+          g_hash_table_lookup_extended (freerdp_versions, program, NULL, &cached);
+  g_mutex_unlock (&freerdp_versions_lock);
+  if (known)
+    return GPOINTER_TO_INT (cached);
+
+  // only when tsc_freerdp_prefetch has not answered yet
+  out = tsc_program_output (program, "--version");
+  version = tsc_freerdp_parse_version (out);
+  g_free (out);
+
+  tsc_freerdp_set_version (program, version);
+  return version;
+}
+
+
+static void
+tsc_freerdp_prefetch_done (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  gchar *program = user_data;
+  gchar *out = NULL;
+
+  if (g_subprocess_communicate_utf8_finish (G_SUBPROCESS (source), result, &out, NULL, NULL))
+    tsc_freerdp_set_version (program, tsc_freerdp_parse_version (out));
+  g_free (out);
+  g_free (program);
+}
+
+
+/*
+ * Asks an installed xfreerdp for its version in the background, so a
+ * launch does not wait for it on the main loop.
+ */
+void tsc_freerdp_prefetch (void)
+{
+  gchar *path = g_find_program_in_path ("xfreerdp");
+  GSubprocess *process;
+
+  if (!path)
+    return;
+  process = g_subprocess_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+                              NULL, path, "--version", NULL);
+  if (process) {
+    g_subprocess_communicate_utf8_async (process, NULL, NULL, tsc_freerdp_prefetch_done,
+                                         g_strdup ("xfreerdp"));
+    g_object_unref (process);
+  }
+  g_free (path);
+}
+
+
+/* The layout id for one of rdesktop's keymap names, for FreeRDP's /kbd:. */
+static const struct {
+  const gchar *keymap;
+  guint layout;
+} tsc_keymap_layouts[] = {
+  { "ar", 0x401 },    { "cs", 0x405 },    { "da", 0x406 },    { "de", 0x407 },
+  { "de-ch", 0x807 }, { "en-gb", 0x809 }, { "en-us", 0x409 }, { "es", 0x40a },
+  { "et", 0x425 },    { "fi", 0x40b },    { "fo", 0x438 },    { "fr", 0x40c },
+  { "fr-be", 0x80c }, { "fr-ca", 0xc0c }, { "fr-ch", 0x100c }, { "he", 0x40d },
+  { "hr", 0x41a },    { "hu", 0x40e },    { "is", 0x40f },    { "it", 0x410 },
+  { "ja", 0x411 },    { "ko", 0x412 },    { "lt", 0x427 },    { "lv", 0x426 },
+  { "mk", 0x42f },    { "nl", 0x413 },    { "nl-be", 0x813 }, { "no", 0x414 },
+  { "pl", 0x415 },    { "pt", 0x816 },    { "pt-br", 0x416 }, { "ru", 0x419 },
+  { "sl", 0x424 },    { "sv", 0x41d },    { "th", 0x41e },    { "tr", 0x41f },
+};
+
+/* keyboard_language as FreeRDP takes it: a known keymap's id, else as given. */
+static gchar *
+tsc_freerdp_keyboard (const gchar *keymap)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (tsc_keymap_layouts); i++) {
+    if (g_ascii_strcasecmp (keymap, tsc_keymap_layouts[i].keymap) == 0)
+      return g_strdup_printf ("0x%x", tsc_keymap_layouts[i].layout);
+  }
+  return g_strdup (keymap);
+}
+
+
+/* The /network: value for a connection_type preset, or NULL for Custom. */
+static const gchar *
+tsc_freerdp_network (gint connection_type)
+{
+  switch (connection_type) {
+  case TSC_SPEED_MODEM:
+    return "modem";
+  case TSC_SPEED_LOW_BROADBAND:
+    return "broadband-low";
+  case TSC_SPEED_BROADBAND:
+    return "broadband-high";
+  case TSC_SPEED_LAN:
+    return "lan";
+  case TSC_SPEED_AUTO:
+    return "auto";
+  default:
+    return NULL;
+  }
+}
+
+
+/*
+ * Fill c_argv for xfreerdp or xfreerdp3; returns the new argc.  FreeRDP
+ * syncs the lock keys on focus by itself, so sync_numlock needs nothing;
+ * see tsc_rdp_needs_rdesktop for the fields it cannot take.
+ */
+static gint
+tsc_build_freerdp_argv (rdp_file *rdp, const gchar *cmd, gchar **c_argv)
+{
+  gint version = tsc_freerdp_version (cmd);
+  const gchar *network = tsc_freerdp_network (rdp->connection_type);
+  const gchar *codec = rdp->graphics_codec ? rdp->graphics_codec : "";
   gint c_argc = 0;
-  GError *err = NULL;
-  GSpawnFlags sflags = 0;
-  gint cnt = 0;
-  gchar *cmd;
-  gchar *std_out;
-  gchar *std_err;
-  gint exit_stat = 0;
-  gint retval = 0;
+  gchar *address;
+  gchar *persist_file = NULL;
+
+  c_argv[c_argc++] = g_strdup (cmd);
+  c_argv[c_argc++] = g_strdup_printf ("/title:%s - %s", rdp->full_address, _("Terminal Server Client"));
+
+  // FreeRDP blanks /p: in its own argv once it has read it
+  if (rdp->username && *rdp->username)
+    c_argv[c_argc++] = g_strdup_printf ("/u:%s", rdp->username);
+  if (rdp->password && *rdp->password)
+    c_argv[c_argc++] = g_strdup_printf ("/p:%s", rdp->password);
+  if (rdp->domain && *rdp->domain)
+    c_argv[c_argc++] = g_strdup_printf ("/d:%s", rdp->domain);
+  if (rdp->client_hostname && *rdp->client_hostname)
+    c_argv[c_argc++] = g_strdup_printf ("/client-hostname:%s", rdp->client_hostname);
+
+  if (rdp->screen_mode_id == 2)
+    c_argv[c_argc++] = g_strdup ("/f");
+  else if (rdp->desktopwidth > 0 && rdp->desktopheight > 0)
+    c_argv[c_argc++] = g_strdup_printf ("/size:%dx%d", rdp->desktopwidth, rdp->desktopheight);
+
+  if (rdp->session_bpp > 0)
+    c_argv[c_argc++] = g_strdup_printf ("/bpp:%d", rdp->session_bpp);
+
+  if (rdp->keyboard_language && *rdp->keyboard_language) {
+    gchar *layout = tsc_freerdp_keyboard (rdp->keyboard_language);
+    c_argv[c_argc++] = g_strdup_printf (version >= 3 ? "/kbd:layout:%s" : "/kbd:%s", layout);
+    g_free (layout);
+  }
+
+  // the graphics pipeline; an empty codec lets client and server agree on one
+  if (g_ascii_strcasecmp (codec, "avc444") == 0)
+    c_argv[c_argc++] = g_strdup ("/gfx:AVC444");
+  else if (g_ascii_strcasecmp (codec, "avc420") == 0)
+    c_argv[c_argc++] = g_strdup ("/gfx:AVC420");
+  else if (g_ascii_strcasecmp (codec, "rfx") == 0)
+    c_argv[c_argc++] = g_strdup ("/gfx:RFX");
+  else if (g_ascii_strcasecmp (codec, "off") != 0)
+    c_argv[c_argc++] = g_strdup ("/gfx");
+
+  // a preset becomes /network: (auto turns on FreeRDP's own detection)
+  if (network) {
+    c_argv[c_argc++] = g_strdup_printf ("/network:%s", network);
+  } else {
+    c_argv[c_argc++] = g_strdup (rdp->disable_wallpaper == 1 ? "-wallpaper" : "+wallpaper");
+    c_argv[c_argc++] = g_strdup (rdp->disable_full_window_drag == 1 ? "-window-drag" : "+window-drag");
+    c_argv[c_argc++] = g_strdup (rdp->disable_menu_anims == 1 ? "-menu-anims" : "+menu-anims");
+    c_argv[c_argc++] = g_strdup (rdp->disable_themes == 1 ? "-themes" : "+themes");
+  }
+  if (rdp->compression == 1)
+    c_argv[c_argc++] = g_strdup ("+compression");
+
+  // a persistent cache of its own for each host, see cache.c
+  if (rdp->bitmapcachepersistenable == 1)
+    persist_file = tsc_cache_persist_file (rdp->full_address, version >= 3 ? "freerdp3.bin" : "freerdp2.bin");
+
+  if (version >= 3) {
+    gchar *persist = persist_file ? g_strconcat (",persist,persist-file:", persist_file, NULL)
+                     : g_strdup (rdp->bitmapcachepersistenable == 1 ? ",persist" : "");
+
+    c_argv[c_argc++] = g_strdup_printf ("/cache:bitmap:on,glyph:%s%s",
+                                        rdp->glyph_cache == 1 ? "on" : "off", persist);
+    g_free (persist);
+  } else {
+    c_argv[c_argc++] = g_strdup ("+bitmap-cache");
+    if (rdp->glyph_cache == 1)
+      c_argv[c_argc++] = g_strdup ("+glyph-cache");
+    if (rdp->bitmapcachepersistenable == 1)
+      c_argv[c_argc++] = g_strdup ("+persist-cache");
+    if (persist_file)
+      c_argv[c_argc++] = g_strdup_printf ("/persist-cache-file:%s", persist_file);
+  }
+  g_free (persist_file);
+
+  if (rdp->audiomode == 0)
+    c_argv[c_argc++] = g_strdup ("/sound");
+  else
+    c_argv[c_argc++] = g_strdup_printf ("/audio-mode:%d", rdp->audiomode == 1 ? 1 : 2);
+  c_argv[c_argc++] = g_strdup ("+clipboard");
+
+  // there is no terminal to answer the certificate prompt on
+  c_argv[c_argc++] = g_strdup (version >= 3 ? "/cert:tofu" : "/cert-tofu");
+
+  // rdesktop's -V; FreeRDP 2 can only insist on 1.2, older ones need seclevel 0
+  if (rdp->tls_version && *rdp->tls_version) {
+    if (version >= 3)
+      c_argv[c_argc++] = g_strdup_printf ("/tls:enforce:%s", rdp->tls_version);
+    else if (strcmp (rdp->tls_version, "1.2") == 0)
+      c_argv[c_argc++] = g_strdup ("/enforce-tlsv1_2");
+    if (strcmp (rdp->tls_version, "1.2") != 0)
+      c_argv[c_argc++] = g_strdup (version >= 3 ? "/tls:seclevel:0" : "/tls-seclevel:0");
+  }
+
+  if (rdp->enable_wm_keys == 1)
+    c_argv[c_argc++] = g_strdup ("-grab-keyboard");
+  if (rdp->hide_wm_decorations == 1)
+    c_argv[c_argc++] = g_strdup ("-decorations");
+  if (rdp->no_motion_events == 1)
+    c_argv[c_argc++] = g_strdup ("-mouse-motion");
+  if (rdp->attach_to_console == 1)
+    c_argv[c_argc++] = g_strdup ("/admin");
+
+  if (rdp->enable_alternate_shell == 1) {
+    if (rdp->alternate_shell && *rdp->alternate_shell)
+      c_argv[c_argc++] = g_strdup_printf ("/shell:%s", rdp->alternate_shell);
+    if (rdp->shell_working_directory && *rdp->shell_working_directory)
+      c_argv[c_argc++] = g_strdup_printf ("/shell-dir:%s", rdp->shell_working_directory);
+  }
+
+  address = tsc_resolve_connect_address (rdp->full_address, rdp->protocol, TRUE);
+  if (address) {
+    gchar *host = tsc_resolve_host_name (rdp->full_address);
+
+    // the certificate still has to match the name, not the address
+    c_argv[c_argc++] = g_strdup_printf (version >= 3 ? "/cert:name:%s" : "/cert-name:%s", host);
+    g_free (host);
+  }
+  c_argv[c_argc++] = g_strdup_printf ("/v:%s", address ? address : rdp->full_address);
+  g_free (address);
+
+  return c_argc;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_vnc_viewer                     *
+*                                      *
+***************************************/
+
+typedef enum {
+  TSC_VNC_LEGACY,
+  TSC_VNC_TIGERVNC,
+  TSC_VNC_TIGHTVNC,
+  TSC_VNC_REALVNC
+} TscVncFamily;
+
+/* family names for [vnc] family, in TscVncFamily order */
+static const gchar *const tsc_vnc_families[] = { "auto", "tigervnc", "tightvnc", "realvnc", NULL };
+
+
+/*
+ * Which viewer program is: [vnc] family if set, else from its name or
+ * the banner of its -help text, once per program.  TSC_VNC_LEGACY gets
+ * only the options every vncviewer has always had, and is what a viewer
+ * that does not answer -help in time is taken for.
+ */
+static TscVncFamily
+tsc_vnc_family (const gchar *program)
+{
+  static GHashTable *families = NULL;
+  static GMutex families_lock;
+  gchar *config, *text;
+  TscVncFamily family = TSC_VNC_LEGACY;
+  gboolean known;
+  gpointer cached;
+  gint i;
+
+  config = tsc_config_get_string ("vnc", "family");
+  for (i = 1; config && tsc_vnc_families[i]; i++) {
+    if (g_ascii_strcasecmp (config, tsc_vnc_families[i]) == 0) {
+      g_free (config);
+      return (TscVncFamily) i;
+    }
+  }
+  g_free (config);
+
+  if (strcmp (program, "xtigervncviewer") == 0)
+    return TSC_VNC_TIGERVNC;
+  if (strcmp (program, "xtightvncviewer") == 0)
+    return TSC_VNC_TIGHTVNC;
+  g_mutex_lock (&families_lock);
+  if (!families)
+    families = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  known = g_hash_table_lookup_extended (families, program, NULL, &cached);
+  g_mutex_unlock (&families_lock);
+  if (known)
+    return GPOINTER_TO_INT (cached);
+
+  // each names itself in its usage text, on stdout or stderr
+  text = tsc_program_output (program, "-help");
+  if (text) {
+    if (strstr (text, "TigerVNC"))
+      family = TSC_VNC_TIGERVNC;
+    else if (strstr (text, "TightVNC"))
+      family = TSC_VNC_TIGHTVNC;
+    else if (strstr (text, "RealVNC") || strstr (text, "VNC(R)"))
+      family = TSC_VNC_REALVNC;
+    g_free (text);
+  }
 
   #ifdef TSCLIENT_DEBUG
-  printf ("tsc_launch_remote\n");
+  printf ("tsc_vnc_family: %s is %s\n", program, family ? tsc_vnc_families[family] : "legacy");
   #endif
 
-  if(error) {
-    *error=NULL;
+  g_mutex_lock (&families_lock);
+  g_hash_table_insert (families, g_strdup (program), GINT_TO_POINTER (family));
+  g_mutex_unlock (&families_lock);
+  return family;
+}
+
+
+/* TightVNC's -encodings list with encoding first; it has no ZRLE, zlib is nearest. */
+static const gchar *
+tsc_vnc_tight_encodings (const gchar *encoding)
+{
+  if (g_ascii_strcasecmp (encoding, "tight") == 0)
+    return "copyrect tight zlib hextile raw";
+  if (g_ascii_strcasecmp (encoding, "zrle") == 0)
+    return "copyrect zlib tight hextile raw";
+  if (g_ascii_strcasecmp (encoding, "hextile") == 0)
+    return "copyrect hextile raw";
+  if (g_ascii_strcasecmp (encoding, "raw") == 0)
+    return "raw";
+  return NULL;
+}
+
+
+/* TigerVNC's and RealVNC's PreferredEncoding; RealVNC has no Tight, ZRLE is nearest. */
+static const gchar *
+tsc_vnc_preferred_encoding (const gchar *encoding, TscVncFamily family)
+{
+  if (g_ascii_strcasecmp (encoding, "tight") == 0)
+    return family == TSC_VNC_REALVNC ? "ZRLE" : "Tight";
+  if (g_ascii_strcasecmp (encoding, "zrle") == 0)
+    return "ZRLE";
+  if (g_ascii_strcasecmp (encoding, "hextile") == 0)
+    return "Hextile";
+  if (g_ascii_strcasecmp (encoding, "raw") == 0)
+    return "Raw";
+  return NULL;
+}
+
+
+/* Fill c_argv for the vncviewer cmd; returns the new argc. */
+static gint
+tsc_build_vnc_argv (rdp_file *rdp, const gchar *cmd, gchar **c_argv)
+{
+  TscVncFamily family = tsc_vnc_family (cmd);
+  const gchar *encoding = rdp->vnc_encoding ? rdp->vnc_encoding : "";
+  const gchar *preferred = tsc_vnc_preferred_encoding (encoding, family);
+  gboolean fixed_depth = rdp->session_bpp > 0;
+  gint c_argc = 0;
+  gchar *address;
+
+  c_argv[c_argc++] = g_strdup (cmd);
+
+  switch (family) {
+  case TSC_VNC_TIGERVNC:
+  case TSC_VNC_REALVNC:
+    if (rdp->screen_mode_id == 2)
+      c_argv[c_argc++] = g_strdup ("-FullScreen");
+    // left on, these viewers pick encoding and colors themselves
+    if (preferred || fixed_depth || rdp->vnc_quality >= 0)
+      c_argv[c_argc++] = g_strdup ("-AutoSelect=0");
+    if (preferred)
+      c_argv[c_argc++] = g_strdup_printf ("-PreferredEncoding=%s", preferred);
+    // neither has a 16-bit mode: 8 bits is their 256 colors, the rest full color
+    if (fixed_depth) {
+      const gchar *colour = family == TSC_VNC_REALVNC ? "Colour" : "Color";
+
+      c_argv[c_argc++] = g_strdup_printf ("-Full%s=%d", colour, rdp->session_bpp > 8);
+      if (rdp->session_bpp <= 8)
+        c_argv[c_argc++] = g_strdup_printf ("-Low%sLevel=2", colour);
+    }
+    // RealVNC 4 has neither setting
+    if (family == TSC_VNC_TIGERVNC) {
+      if (rdp->vnc_compress_level >= 0)
+        c_argv[c_argc++] = g_strdup_printf ("-CompressLevel=%d", MIN (rdp->vnc_compress_level, 9));
+      if (rdp->vnc_quality >= 0)
+        c_argv[c_argc++] = g_strdup_printf ("-QualityLevel=%d", MIN (rdp->vnc_quality, 9));
+    }
+    if (rdp->no_motion_events == 1)
+      c_argv[c_argc++] = g_strdup ("-ViewOnly");
+    break;
+
+  case TSC_VNC_TIGHTVNC:
+    if (rdp->screen_mode_id == 2)
+      c_argv[c_argc++] = g_strdup ("-fullscreen");
+    if (tsc_vnc_tight_encodings (encoding)) {
+      c_argv[c_argc++] = g_strdup ("-encodings");
+      c_argv[c_argc++] = g_strdup (tsc_vnc_tight_encodings (encoding));
+    }
+    if (rdp->vnc_compress_level >= 0) {
+      c_argv[c_argc++] = g_strdup ("-compresslevel");
+      c_argv[c_argc++] = g_strdup_printf ("%d", MIN (rdp->vnc_compress_level, 9));
+    }
+    if (rdp->vnc_quality >= 0) {
+      c_argv[c_argc++] = g_strdup ("-quality");
+      c_argv[c_argc++] = g_strdup_printf ("%d", MIN (rdp->vnc_quality, 9));
+    }
+    if (rdp->session_bpp == 8) {
+      c_argv[c_argc++] = g_strdup ("-bgr233");
+    } else if (fixed_depth) {
+      c_argv[c_argc++] = g_strdup ("-depth");
+      c_argv[c_argc++] = g_strdup_printf ("%d", MIN (rdp->session_bpp, 24));
+    }
+    if (rdp->no_motion_events == 1)
+      c_argv[c_argc++] = g_strdup ("-viewonly");
+    break;
+
+  default:
+    if (rdp->screen_mode_id == 2)
+      c_argv[c_argc++] = g_strdup ("-fullscreen");
+    if (rdp->no_motion_events == 1)
+      c_argv[c_argc++] = g_strdup ("-v");
+    break;
   }
-  rdp = rdp_in;
-  
-  if (strlen(rdp->full_address)) {
 
-    cmd = NULL;
+  if (rdp->screen_mode_id != 2 && rdp->desktopwidth > 0 && rdp->desktopheight > 0) {
+    c_argv[c_argc++] = g_strdup ("-geometry");
+    c_argv[c_argc++] = g_strdup_printf ("%dx%d", rdp->desktopwidth, rdp->desktopheight);
+  }
+
+  if (strlen (rdp->proto_file) && g_file_test (rdp->proto_file, G_FILE_TEST_EXISTS)) {
+    c_argv[c_argc++] = g_strdup ("-passwd");
+    c_argv[c_argc++] = g_strdup (rdp->proto_file);
+  }
+
+  address = tsc_resolve_connect_address (rdp->full_address, 1, FALSE);
+  c_argv[c_argc++] = g_strdup (address ? address : rdp->full_address);
+  g_free (address);
+
+  return c_argc;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_nested_x                       *
+*                                      *
+***************************************/
+
+/* Whether X server program lists option in its -help text, read once per program. */
+static gboolean
+tsc_xserver_has_option (const gchar *program, const gchar *option)
+{
+  static GHashTable *usage = NULL;
+  static GMutex usage_lock;
+  gchar *text, *pattern;
+  gboolean found;
+
+  g_mutex_lock (&usage_lock);
+  if (!usage)
+    usage = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  text = g_strdup (g_hash_table_lookup (usage, program));
+  g_mutex_unlock (&usage_lock);
+  if (!text) {
+    // the usage goes to stderr, and the exit status is not 0
+    text = tsc_program_output (program, "-help");
+    if (!text)
+      text = g_strdup ("");
+    g_mutex_lock (&usage_lock);
+    g_hash_table_insert (usage, g_strdup (program), g_strdup (text));
+    g_mutex_unlock (&usage_lock);
+  }
+
+  pattern = g_strconcat (option, " ", NULL);
+  found = strstr (text, pattern) != NULL;
+  g_free (pattern);
+  g_free (text);
+  return found;
+}
+
 
-    if (rdp->protocol == 0 || rdp->protocol == 4) {
-      if (g_find_program_in_path ("rdesktop")) {
-        sflags += G_SPAWN_SEARCH_PATH;
+/*
+ * Fill c_argv for a nested X server querying rdp's host: Xephyr, which
+ * has RENDER, Composite, XVideo and MIT-SHM to the real display, else
+ * Xnest.  Either picks its own display and reports it on stdout with
+ * -displayfd, where the supervisor reads it (TscSession display); only
+ * servers too old for that get a probed one.  Returns
+ * the new argc, or -1 with *error set.
+ */
+static gint
+tsc_build_nested_x_argv (rdp_file *rdp, const gchar *cmd, gchar **c_argv, gchar **error)
+{
+  gboolean xephyr = strcmp (cmd, "Xephyr") == 0;
+  gint c_argc = 0;
+  gchar *address;
+  gint depth;
+
+  c_argv[c_argc++] = g_strdup (cmd);
+
+  if (tsc_xserver_has_option (cmd, "-displayfd")) {
+    c_argv[c_argc++] = g_strdup ("-displayfd");
+    c_argv[c_argc++] = g_strdup ("1");
+  } else {
+    /* Starting search from :1 (assuming we run at :0) */
+    gint display = tsc_get_free_display (1, getuid ());
+
+    if (display == -1) {
+      if (error)
+        *error = g_strdup (_("Could not find a free X display."));
+      return -1;
+    }
+    c_argv[c_argc++] = g_strdup_printf (":%d", display);
+  }
+  c_argv[c_argc++] = g_strdup ("-once");
+
+  depth = rdp->session_bpp == 32 ? 24 : rdp->session_bpp;
+  if (xephyr) {
+    if (tsc_xserver_has_option (cmd, "-title")) {
+      c_argv[c_argc++] = g_strdup ("-title");
+      c_argv[c_argc++] = g_strdup_printf ("%s - %s", rdp->full_address, _("Terminal Server Client"));
+    }
+    if (rdp->screen_mode_id == 2) {
+      c_argv[c_argc++] = g_strdup ("-fullscreen");
+    } else if (rdp->desktopwidth > 0 && rdp->desktopheight > 0) {
+      c_argv[c_argc++] = g_strdup ("-screen");
+      c_argv[c_argc++] = depth > 0 ? g_strdup_printf ("%dx%dx%d", rdp->desktopwidth, rdp->desktopheight, depth)
+                                   : g_strdup_printf ("%dx%d", rdp->desktopwidth, rdp->desktopheight);
+    }
+    // resizing the window resizes the remote desktop through RandR
+    if (rdp->screen_mode_id != 2 && tsc_xserver_has_option (cmd, "-resizeable"))
+      c_argv[c_argc++] = g_strdup ("-resizeable");
+  } else {
+    if (rdp->desktopwidth > 0 && rdp->desktopheight > 0) {
+      c_argv[c_argc++] = g_strdup ("-geometry");
+      c_argv[c_argc++] = g_strdup_printf ("%dx%d", rdp->desktopwidth, rdp->desktopheight);
+    }
+    if (depth > 0) {
+      c_argv[c_argc++] = g_strdup ("-depth");
+      c_argv[c_argc++] = g_strdup_printf ("%d", depth);
+    }
+  }
+
+  c_argv[c_argc++] = g_strdup ("-query");
+  address = tsc_resolve_connect_address (rdp->full_address, 2, FALSE);
+  c_argv[c_argc++] = g_strdup (address ? address : rdp->full_address);
+  g_free (address);
+
+  return c_argc;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_build_argv                     *
+*                                      *
+***************************************/
+
+static gchar **
+tsc_build_client_argv (rdp_file *rdp, gchar** error)
+{
+  gchar **c_argv;
+  gchar buffer[MAX_ARGV_LEN];
+  gint c_argc = 0;
+  gchar *cmd;
+  gchar *address;
+
+  if (rdp->full_address && strlen(rdp->full_address)) {
+
+    c_argv = g_new0 (gchar *, MAX_ARGVS);
+    cmd = (gchar *) tsc_rdp_client (rdp);
+
+    if (strcmp (cmd, "rdesktop") != 0) {
+      if (!tsc_find_program (cmd)) {
+	if(error) {
+	  *error = g_strdup_printf (_("%s was not found in your path.\nPlease verify your FreeRDP installation."), cmd);
+	}
+        g_strfreev (c_argv);
+        return NULL;
+      }
+      c_argc = tsc_build_freerdp_argv (rdp, cmd, c_argv);
+
+    } else if (rdp->protocol == 0 || rdp->protocol == 4) {
+      if (tsc_find_program ("rdesktop")) {
         cmd = "rdesktop";
       } else {
 	if(error) {
 	  *error = g_strdup(_("rdesktop was not found in your path.\nPlease verify your rdesktop installation."));
 	}
-        return 1;
+        g_strfreev (c_argv);
+        return NULL;
       }
       g_strlcpy(buffer, cmd, sizeof(buffer));
       c_argv[c_argc++] = g_strdup (buffer);
@@ -594,6 +1605,17 @@ int tsc_launch_remote (rdp_file *rdp_in, int launch_async, gchar** error)
         c_argv[c_argc++] = g_strdup (buffer);
       }
 
+      // RDP5 experience from a preset or Auto; Custom keeps rdesktop's default
+      if (rdp->protocol == 4 && rdp->connection_type != TSC_SPEED_CUSTOM) {
+        c_argv[c_argc++] = g_strdup ("-x");
+        sprintf(buffer, "0x%02x", rdp_file_performance_flags (rdp));
+        c_argv[c_argc++] = g_strdup (buffer);
+      }
+
+      if (rdp->compression == 1) {
+        c_argv[c_argc++] = g_strdup ("-z");
+      }
+
       if (rdp->disable_encryption == 1) {
         c_argv[c_argc++] = g_strdup ("-e");
       }
@@ -674,196 +1696,56 @@ int tsc_launch_remote (rdp_file *rdp_in, int launch_async, gchar** error)
       }
 
       // do this shit for all modes
-      sprintf(buffer, "%s", (char*)g_strescape(rdp->full_address, NULL));
+      address = tsc_resolve_connect_address (rdp->full_address, rdp->protocol, FALSE);
+      sprintf(buffer, "%s", (char*)g_strescape(address ? address : rdp->full_address, NULL));
       c_argv[c_argc++] = g_strdup (buffer);
+      g_free (address);
 
     } else if (rdp->protocol == 1) {
 
       // it's a vnc call
 
-      if (g_find_program_in_path ("vncviewer")) {
+      if (tsc_find_program ("vncviewer")) {
         cmd = "vncviewer";
-      } else if (g_find_program_in_path ("xvncviewer")) {
+      } else if (tsc_find_program ("xtigervncviewer")) {
+        cmd = "xtigervncviewer";
+      } else if (tsc_find_program ("xvncviewer")) {
         cmd = "xvncviewer";
-      } else if (g_find_program_in_path ("xtightvncviewer")) {
+      } else if (tsc_find_program ("xtightvncviewer")) {
         cmd = "xtightvncviewer";
-      } else if (g_find_program_in_path ("svncviewer")) {
+      } else if (tsc_find_program ("svncviewer")) {
         cmd = "svncviewer";
       } else {
 	if(error) {
 	  *error = g_strdup(_("vncviewer or xvncviewer were\n not found in your path.\nPlease verify your vnc installation."));
 	}
-        return 1;
-      }
-      sflags += G_SPAWN_SEARCH_PATH;
-      
-      g_strlcpy(buffer, cmd, sizeof(buffer));
-      c_argv[c_argc++] = g_strdup (buffer);
-
-      if (rdp->screen_mode_id == 2) {
-        sprintf(buffer, "-fullscreen");
-        c_argv[c_argc++] = g_strdup (buffer);
-      } else {
-        switch (rdp->desktopwidth) {
-        case 640:
-          sprintf(buffer, "-geometry");
-          c_argv[c_argc++] = g_strdup (buffer);
-          sprintf(buffer, "640x480");
-          c_argv[c_argc++] = g_strdup (buffer);
-          break;
-        case 800:
-          sprintf(buffer, "-geometry");
-          c_argv[c_argc++] = g_strdup (buffer);
-          sprintf(buffer, "800x600");
-          c_argv[c_argc++] = g_strdup (buffer);
-          break;
-        case 1024:
-          sprintf(buffer, "-geometry");
-          c_argv[c_argc++] = g_strdup (buffer);
-          sprintf(buffer, "1024x768");
-          c_argv[c_argc++] = g_strdup (buffer);
-          break;
-        case 1152:
-          sprintf(buffer, "-geometry");
-          c_argv[c_argc++] = g_strdup (buffer);
-          sprintf(buffer, "1152x864");
-          c_argv[c_argc++] = g_strdup (buffer);
-          break;
-        case 1280:
-          sprintf(buffer, "-geometry");
-          c_argv[c_argc++] = g_strdup (buffer);
-          sprintf(buffer, "1280x960");
-          c_argv[c_argc++] = g_strdup (buffer);
-          break;
-        default:
-          break;
-        }
+        g_strfreev (c_argv);
+        return NULL;
       }
-
-      /*  this is diff in all vnc vers
-      switch (rdp->session_bpp) {
-      case 8:
-        sprintf(buffer, "-bgr233");
-        c_argv[c_argc++] = g_strdup (buffer);
-        sprintf(buffer, "-depth");
-        c_argv[c_argc++] = g_strdup (buffer);
-        sprintf(buffer, "8");
-        c_argv[c_argc++] = g_strdup (buffer);
-        break;
-      case 15:
-        sprintf(buffer, "-depth");
-        c_argv[c_argc++] = g_strdup (buffer);
-        sprintf(buffer, "15");
-        c_argv[c_argc++] = g_strdup (buffer);
-        break;
-      case 16:
-        sprintf(buffer, "-depth");
-        c_argv[c_argc++] = g_strdup (buffer);
-        sprintf(buffer, "16");
-        c_argv[c_argc++] = g_strdup (buffer);
-        break;
-      case 24:
-        sprintf(buffer, "-depth");
-        c_argv[c_argc++] = g_strdup (buffer);
-        sprintf(buffer, "24");
-        c_argv[c_argc++] = g_strdup (buffer);
-        break;
-      default:
-        break;
-      }
-      */
-
-      if (rdp->no_motion_events == 1) {
-        sprintf(buffer, "-v");
-        c_argv[c_argc++] = g_strdup (buffer);
-      }
-
-      if (strlen(rdp->proto_file) && g_file_test (rdp->proto_file, G_FILE_TEST_EXISTS)) {
-        sprintf(buffer, "-passwd");
-        c_argv[c_argc++] = g_strdup (buffer);
-        sprintf(buffer, "%s", (char*)g_strescape(rdp->proto_file, NULL));
-        c_argv[c_argc++] = g_strdup (buffer);
-      }
-
-      // do this shit for all modes
-      sprintf(buffer, "%s", (char*)g_strescape(rdp->full_address, NULL));
-      //buffer[strlen(buffer)-4] = '\0';
-      c_argv[c_argc++] = g_strdup (buffer);
+      c_argc = tsc_build_vnc_argv (rdp, cmd, c_argv);
 
     } else if (rdp->protocol == 2) {
-      int display;
-    
-      if (g_find_program_in_path ("Xnest")) {
-        sflags += G_SPAWN_SEARCH_PATH;
-        
-        g_strlcpy(buffer, "Xnest", sizeof(buffer));
-        c_argv[c_argc++] = strdup(buffer);
-      } else {
-	if(error) {
-	  *error = g_strdup(_("Xnest was not found in your path.\nPlease verify your Xnest installation."));
-	}
-        return 1;
-      }
-        
-      /* Starting search from :1 (assuming we run at :0) */
-      display = tsc_get_free_display (1, getuid());
-      if (-1 == display) {
+
+      if (tsc_find_program ("Xephyr")) {
+        cmd = "Xephyr";
+      } else if (tsc_find_program ("Xnest")) {
+        cmd = "Xnest";
+      } else {
 	if(error) {
-	  *error = g_strdup(_("Could not find a free X display."));
+	  *error = g_strdup(_("Neither Xephyr nor Xnest was found in your path.\nPlease verify your Xephyr installation."));
 	}
-        return 1;
+        g_strfreev (c_argv);
+        return NULL;
       }
-      sprintf(buffer, ":%d", display);
-      c_argv[c_argc++] = strdup(buffer);
-
-      sprintf(buffer, "-once");
-      c_argv[c_argc++] = strdup(buffer);
-
-      switch (rdp->desktopwidth) {
-      case 640:
-        sprintf(buffer, "-geometry");
-        c_argv[c_argc++] = strdup(buffer);
-        sprintf(buffer, "640x480");
-        c_argv[c_argc++] = strdup(buffer);
-        break;
-      case 800:
-        sprintf(buffer, "-geometry");
-        c_argv[c_argc++] = strdup(buffer);
-        sprintf(buffer, "800x600");
-        c_argv[c_argc++] = strdup(buffer);
-        break;
-      case 1024:
-        sprintf(buffer, "-geometry");
-        c_argv[c_argc++] = strdup(buffer);
-        sprintf(buffer, "1024x768");
-        c_argv[c_argc++] = strdup(buffer);
-        break;
-      case 1152:
-        sprintf(buffer, "-geometry");
-        c_argv[c_argc++] = strdup(buffer);
-        sprintf(buffer, "1152x864");
-        c_argv[c_argc++] = strdup(buffer);
-        break;
-      case 1280:
-        sprintf(buffer, "-geometry");
-        c_argv[c_argc++] = strdup(buffer);
-        sprintf(buffer, "1280x960");
-        c_argv[c_argc++] = strdup(buffer);
-        break;
-      default:
-        break;
+      c_argc = tsc_build_nested_x_argv (rdp, cmd, c_argv, error);
+      if (c_argc < 0) {
+        g_strfreev (c_argv);
+        return NULL;
       }
 
-      sprintf(buffer, "-query");
-      c_argv[c_argc++] = strdup(buffer);
-
-      sprintf(buffer, "%s", (char*)g_strescape(rdp->full_address, NULL));
-      //buffer[strlen(buffer)-2] = '\0';
-      c_argv[c_argc++] = strdup(buffer);
-
     } else if (rdp->protocol == 3) {
       // ICA/Citrix Connection
-      if (g_find_program_in_path ("wfica")) {
+      if (tsc_find_program ("wfica")) {
         cmd = "wfica";
       } else if (g_file_test ("/usr/lib/ICAClient/wfica", G_FILE_TEST_EXISTS)) {
         cmd = "wfica";
@@ -871,7 +1753,8 @@ int tsc_launch_remote (rdp_file *rdp_in, int launch_async, gchar** error)
 	if(error) {
 	  *error = g_strdup(_("wfica was not found in your path.\nPlease verify your ICAClient installation."));
 	}
-        return 1;
+        g_strfreev (c_argv);
+        return NULL;
       }
       g_strlcpy(buffer, cmd, sizeof(buffer));
       c_argv[c_argc++] = g_strdup (buffer);
@@ -984,104 +1867,278 @@ int tsc_launch_remote (rdp_file *rdp_in, int launch_async, gchar** error)
 		
     }
 
+    TSC_TRACE3 (launch__argv, rdp->full_address, rdp->protocol, c_argc);
     c_argv[c_argc++] = NULL;
-    
-    // complete events in gtk queue
-    while (g_main_context_iteration (NULL, FALSE));
+    return c_argv;
+  }
 
-    if (launch_async == 0) {
-      if (!g_spawn_sync (NULL, (gchar**)c_argv, NULL, G_SPAWN_SEARCH_PATH,
-			 NULL, NULL, &std_out, &std_err, &exit_stat, &err)) {
-	g_warning ("failed: spawn_sync of %s\n", cmd);
-	if(error) {
-	  *error = g_strdup(_("Failed to spawn.\nPlease verify your installation."));
-	}
-      }
-      if (exit_stat && std_err && strlen(std_err)) {
-	g_warning ("\n%s\n", std_err);
-	if(error) {
-	  *error = g_strdup((gchar*)std_err);
-	}
-	retval = 1;
+  return NULL;
+}
+
+
+/* With [preflight] handshake on, refuse rdp when the server says it would fail. */
+static int
+tsc_build_handshake (rdp_file *rdp, gchar **error)
+{
+  TscHandshakeResult result;
+  const gchar *client;
+  int ret;
+
+  if (!tsc_config_get_boolean ("preflight", "handshake", FALSE) ||
+      (rdp->protocol != 0 && rdp->protocol != 1 && rdp->protocol != 4))
+    return 0;
+
+  client = rdp->protocol == 1 ? "vncviewer" : tsc_rdp_client (rdp);
+  // only rdesktop is given a TLS version
+  tsc_handshake_check (rdp->full_address, rdp->protocol,
+                       strcmp (client, "rdesktop") == 0, &result);
+  ret = tsc_handshake_apply (rdp, client, &result, NULL, error);
+  tsc_handshake_result_clear (&result);
+  return ret;
+}
+
+
+/*
+ * The client's command line for rdp_in.  When the profile has a host
+ * pool, *target (if given) is set to the host picked from it, else to
+ * NULL; free it.  *protocol (if given) is set to the protocol launched,
+ * which a preflight race may have picked over the profile's.
+ */
+gchar **tsc_build_argv (rdp_file *rdp_in, gchar** target, gint *protocol, gchar** error)
+{
+  rdp_file *adapted;
+  TscPreflightResult race;
+  gchar *member = NULL;
+  gchar **c_argv;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_build_argv\n");
+  #endif
+
+  if(error) {
+    *error=NULL;
+  }
+  if (target)
+    *target = NULL;
+  if (protocol)
+    *protocol = rdp_in->protocol;
+  // pool picks, presets, link adaptation and protocol racing work on a
+  // copy, so a restart measures again
+  adapted = rdp_file_copy (rdp_in);
+  memset (&race, 0, sizeof (race));
+  if (adapted->pool && adapted->pool[0]) {
+    member = tsc_pool_pick (adapted->pool, adapted->pool_policy, adapted->protocol, error);
+    if (!member) {
+      rdp_file_free (adapted);
+      return NULL;
+    }
+    g_free (adapted->full_address);
+    adapted->full_address = g_strdup (member);
+  }
+  if (adapted->full_address && adapted->full_address[0] && adapted->protocols && adapted->protocols[0]) {
+    gint raced = tsc_preflight_race (adapted->full_address, adapted->protocol, adapted->protocols,
+                                     &race, error);
+
+    if (!raced) {
+      adapted->protocol = race.protocol;
+      g_free (adapted->full_address);
+      adapted->full_address = g_strdup (race.address);
+    }
+    tsc_preflight_result_clear (&race);
+    if (raced) {
+      rdp_file_free (adapted);
+      g_free (member);
+      return NULL;
+    }
+  }
+  if (tsc_build_handshake (adapted, error)) {
+    rdp_file_free (adapted);
+    g_free (member);
+    return NULL;
+  }
+  // a connection speed other than Custom decides the experience fields
+  if (adapted->connection_type == TSC_SPEED_AUTO && (adapted->protocol == 0 || adapted->protocol == 4))
+    tsc_adapt_apply (adapted, NULL);
+  else
+    rdp_file_apply_speed (adapted);
+
+  c_argv = tsc_build_client_argv (adapted, error);
+  if (protocol)
+    *protocol = adapted->protocol;
+  rdp_file_free (adapted);
+  if (target && c_argv)
+    *target = member;
+  else
+    g_free (member);
+  return c_argv;
+}
+
+
+/***************************************
+*                                      *
+*   tsc_launch_remote                  *
+*                                      *
+***************************************/
+
+int tsc_launch_remote (rdp_file *rdp_in, int launch_async, gchar** error)
+{
+  gchar **c_argv;
+  GError *err = NULL;
+  gchar *std_out = NULL;
+  gchar *std_err = NULL;
+  gint exit_stat = 0;
+  gint retval = 0;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_launch_remote\n");
+  #endif
+
+  c_argv = tsc_build_argv (rdp_in, NULL, NULL, error);
+  if (!c_argv) {
+    // clean up and exit
+    return 1;
+  }
+
+  // complete events in gtk queue
+  while (g_main_context_iteration (NULL, FALSE));
+
+  if (launch_async == 0) {
+    if (!g_spawn_sync (NULL, c_argv, NULL, G_SPAWN_SEARCH_PATH,
+                       NULL, NULL, &std_out, &std_err, &exit_stat, &err)) {
+      g_warning ("failed: spawn_sync of %s\n", c_argv[0]);
+      if(error) {
+        *error = g_strdup(_("Failed to spawn.\nPlease verify your installation."));
       }
-    } else {
-      if (!g_spawn_async (NULL, (gchar**)c_argv, NULL, G_SPAWN_SEARCH_PATH,
-			  NULL, NULL, NULL, &err)) 
-	{
-	  g_warning ("failed: spawn_async of %s\n", cmd);
-	}
     }
-    if (err) {
-      g_warning ("message %s\n", err->message);
+    if (exit_stat && std_err && strlen(std_err)) {
+      g_warning ("\n%s\n", std_err);
       if(error) {
-	*error = g_strdup( err->message);
+        *error = g_strdup((gchar*)std_err);
       }
       retval = 1;
     }
+  } else {
+    if (!g_spawn_async (NULL, c_argv, NULL, G_SPAWN_SEARCH_PATH,
+                        NULL, NULL, NULL, &err)) {
+      g_warning ("failed: spawn_async of %s\n", c_argv[0]);
+    }
+  }
+  if (err) {
+    g_warning ("message %s\n", err->message);
+    if(error) {
+      *error = g_strdup( err->message);
+    }
+    g_error_free (err);
+    retval = 1;
+  }
 
-    for (cnt = 0; cnt < c_argc; cnt++) {
 #ifdef TSCLIENT_DEBUG
-      printf ("arg %d:  %s\n", cnt, c_argv[cnt]);
-#endif
-      free (c_argv[cnt]);
-    }
-    return retval;
-  } else {
-    // clean up and exit
-    return 1;  
+  for (gint cnt = 0; c_argv[cnt]; cnt++) {
+    printf ("arg %d:  %s\n", cnt, c_argv[cnt]);
   }
-  // clean up and exit
+#endif
+  g_strfreev (c_argv);
+  g_free (std_out);
+  g_free (std_err);
   return retval;
 }
 
 
+/*
+ * One reconnect dialog for the whole process.  A session waiting out
+ * its backoff shows the countdown here, and a session that failed for
+ * good shows why, with a Reconnect button that queues it again.  A
+ * later failure refreshes this window instead of stacking a new one.
+ */
 typedef struct {
   GtkWindow *window;
+  GtkLabel *heading;
   GtkLabel *countdown;
-  GMainLoop *loop;
-  gint response;
-  gint timeout_left;
+  GtkLabel *detail;
+  guint session_id;
+  rdp_file *rdp;
+  gint attempt;
+  gint64 retry_at;
   guint timeout_id;
 } TscConnectDialogState;
 
+static TscConnectDialogState *connect_dialog = NULL;
+
 static void
-tsc_connect_error_finish (TscConnectDialogState *state, gint response)
+tsc_connect_error_close (void)
 {
-  state->response = response;
-  if (state->timeout_id) {
+  TscConnectDialogState *state = connect_dialog;
+
+  if (!state)
+    return;
+
+  connect_dialog = NULL;
+  if (state->timeout_id)
     g_source_remove (state->timeout_id);
-    state->timeout_id = 0;
-  }
-  if (gtk_widget_get_visible (GTK_WIDGET (state->window)))
-    gtk_window_destroy (state->window);
-  if (state->loop && g_main_loop_is_running (state->loop))
-    g_main_loop_quit (state->loop);
+  gtk_window_destroy (state->window);
+  rdp_file_free (state->rdp);
+  g_free (state);
 }
 
 static gboolean
 tsc_connect_error_close_request (GtkWindow *window, gpointer user_data)
 {
-  TscConnectDialogState *state = user_data;
-  tsc_connect_error_finish (state, GTK_RESPONSE_CANCEL);
-  return FALSE;
+  guint id = connect_dialog ? connect_dialog->session_id : 0;
+
+  tsc_connect_error_close ();
+  // stop waiting; the session reports back as failed
+  if (id)
+    tsc_session_cancel (id);
+  return TRUE;
 }
 
 static void
 tsc_connect_error_button_clicked (GtkButton *button, gpointer user_data)
 {
-  TscConnectDialogState *state = user_data;
   gint response = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (button), "response-id"));
-  tsc_connect_error_finish (state, response);
+  guint id;
+  rdp_file *rdp;
+
+  if (!connect_dialog)
+    return;
+
+  if (response != GTK_RESPONSE_OK) {
+    tsc_connect_error_close_request (connect_dialog->window, NULL);
+    return;
+  }
+
+  id = connect_dialog->session_id;
+  rdp = connect_dialog->rdp;
+  connect_dialog->rdp = NULL;
+  tsc_connect_error_close ();
+
+  if (id) {
+    tsc_session_retry_now (id);
+    rdp_file_free (rdp);
+  } else if (rdp) {
+    tsc_connect_session (rdp, NULL);
+  }
 }
 
 static void
 tsc_connect_error_update_label (TscConnectDialogState *state)
 {
-  if (!state->countdown)
+  gint64 left;
+  gchar *txt;
+
+  if (!state->retry_at) {
+    gtk_widget_set_visible (GTK_WIDGET (state->countdown), FALSE);
     return;
+  }
 
-  gchar *txt = g_strdup_printf (_("Reconnect in %d sec"), state->timeout_left);
+  left = (state->retry_at - g_get_monotonic_time () + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC;
+  if (left > 0)
+    txt = g_strdup_printf (_("Reconnect in %d sec (attempt %d of %d)"), (gint) left,
+                           state->attempt, tsc_reconnect_max_attempts ());
+  else
+    txt = g_strdup (_("Reconnecting..."));
   gtk_label_set_text (state->countdown, txt);
+  gtk_widget_set_visible (GTK_WIDGET (state->countdown), TRUE);
   g_free (txt);
 }
 
@@ -1089,40 +2146,25 @@ static gboolean
 tsc_connect_error_timeout_cb (gpointer user_data)
 {
   TscConnectDialogState *state = user_data;
-  if (!gtk_widget_get_visible (GTK_WIDGET (state->window))) {
-    state->timeout_id = 0;
-    return G_SOURCE_REMOVE;
-  }
-
-  if (state->timeout_left <= 0) {
-    state->timeout_id = 0;
-    tsc_connect_error_finish (state, GTK_RESPONSE_OK);
-    return G_SOURCE_REMOVE;
-  }
 
   tsc_connect_error_update_label (state);
-  state->timeout_left--;
   return G_SOURCE_CONTINUE;
 }
 
-void tsc_connect_error (rdp_file * rdp, const gchar* error)
+static TscConnectDialogState *
+tsc_connect_error_dialog (void)
 {
   GtkWidget *dialog, *err_label, *label, *label_detail, *image, *hbox, *vbox, *expander;
   GtkWidget *content, *button_box, *btn_reconnect, *btn_cancel;
-  TscConnectDialogState state = {0};
-  
-#ifdef TSCLIENT_DEBUG
-  printf ("tsc_connect_error\n");
-#endif
-  
-  if (!error)
-    error = "";
+  TscConnectDialogState *state;
+
+  if (connect_dialog)
+    return connect_dialog;
 
   /* create the widgets */
   dialog = gtk_window_new ();
   gtk_window_set_title (GTK_WINDOW (dialog), _("Terminal Server Client Error"));
-  gtk_window_set_modal (GTK_WINDOW (dialog), TRUE);
-  if (gConnect)
+  if (gConnect && gtk_widget_get_visible (gConnect))
     gtk_window_set_transient_for (GTK_WINDOW (dialog), GTK_WINDOW (gConnect));
 
   content = gtk_box_new (GTK_ORIENTATION_VERTICAL, 12);
@@ -1134,7 +2176,6 @@ void tsc_connect_error (rdp_file * rdp, const gchar* error)
   hbox      = gtk_hbox_new (FALSE, 12);
   vbox      = gtk_vbox_new (FALSE, 0);
 
-  gtk_label_set_markup (GTK_LABEL (err_label), g_strconcat ("<span weight=\"bold\">", _("An error has occurred."), "</span>", NULL));
   gtk_label_set_justify (GTK_LABEL (err_label), GTK_JUSTIFY_LEFT);
 
   /* add the label, and show everything we've added to the dialog. */
@@ -1147,7 +2188,7 @@ void tsc_connect_error (rdp_file * rdp, const gchar* error)
   /* Create the expander */
   expander = gtk_expander_new (_("Details"));
   gtk_box_append (GTK_BOX (content), expander);
-  label_detail = gtk_label_new (error);
+  label_detail = gtk_label_new ("");
   gtk_expander_set_child (GTK_EXPANDER (expander), label_detail);
 
   button_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
@@ -1161,44 +2202,68 @@ void tsc_connect_error (rdp_file * rdp, const gchar* error)
   g_object_set_data (G_OBJECT (btn_cancel), "response-id", GINT_TO_POINTER (GTK_RESPONSE_CANCEL));
   gtk_box_append (GTK_BOX (button_box), btn_cancel);
 
-  state.window = GTK_WINDOW (dialog);
-  state.countdown = GTK_LABEL (label);
-  state.loop = g_main_loop_new (NULL, FALSE);
-  state.response = GTK_RESPONSE_CANCEL;
-  state.timeout_left = 30;
+  state = g_new0 (TscConnectDialogState, 1);
+  state->window = GTK_WINDOW (dialog);
+  state->heading = GTK_LABEL (err_label);
+  state->countdown = GTK_LABEL (label);
+  state->detail = GTK_LABEL (label_detail);
 
   g_signal_connect (dialog, "close-request",
-                    G_CALLBACK (tsc_connect_error_close_request), &state);
+                    G_CALLBACK (tsc_connect_error_close_request), NULL);
   g_signal_connect (btn_reconnect, "clicked",
-                    G_CALLBACK (tsc_connect_error_button_clicked), &state);
+                    G_CALLBACK (tsc_connect_error_button_clicked), NULL);
   g_signal_connect (btn_cancel, "clicked",
-                    G_CALLBACK (tsc_connect_error_button_clicked), &state);
+                    G_CALLBACK (tsc_connect_error_button_clicked), NULL);
 
-  tsc_connect_error_update_label (&state);
-  state.timeout_id = g_timeout_add_seconds (1, tsc_connect_error_timeout_cb, &state);
+  state->timeout_id = g_timeout_add_seconds (1, tsc_connect_error_timeout_cb, state);
+  connect_dialog = state;
+  return state;
+}
 
-  gtk_widget_set_visible (dialog, TRUE);
-  g_main_loop_run (state.loop);
+static void
+tsc_connect_error_show (const gchar *heading, const gchar *error, rdp_file *rdp,
+                        guint session_id, gint attempt, gint64 retry_at)
+{
+  TscConnectDialogState *state = tsc_connect_error_dialog ();
+  gchar *markup;
+
+  markup = g_markup_printf_escaped ("<span weight=\"bold\">%s</span>", heading);
+  gtk_label_set_markup (state->heading, markup);
+  g_free (markup);
+  gtk_label_set_text (state->detail, error ? error : "");
+
+  rdp_file_free (state->rdp);
+  state->rdp = rdp ? rdp_file_copy (rdp) : NULL;
+  state->session_id = session_id;
+  state->attempt = attempt;
+  state->retry_at = retry_at;
+  tsc_connect_error_update_label (state);
 
-  if (state.timeout_id) {
-    g_source_remove (state.timeout_id);
-    state.timeout_id = 0;
-  }
+  gtk_widget_set_visible (GTK_WIDGET (state->window), TRUE);
+  gtk_window_present (state->window);
+}
 
-  if (state.loop)
-    g_main_loop_unref (state.loop);
+/* Show a connect failure; Reconnect queues rdp again. */
+void tsc_connect_error (rdp_file * rdp, const gchar* error)
+{
+#ifdef TSCLIENT_DEBUG
+  printf ("tsc_connect_error\n");
+#endif
 
-  if (state.response == GTK_RESPONSE_OK) {
-    gchar **err2 = g_malloc (sizeof (gchar*));
-    if (tsc_launch_remote (rdp, 0, err2) != 0 && err2 && *err2) {
-      tsc_connect_error (rdp, *err2);
-    }
-    if (err2) {
-      if (*err2)
-        g_free (*err2);
-      g_free (err2);
-    }
-  }
+  tsc_connect_error_show (_("An error has occurred."), error, rdp, 0, 0, 0);
+}
+
+/* Count down to the next attempt of a session waiting to reconnect. */
+static void
+tsc_connect_retry (TscSession *session)
+{
+#ifdef TSCLIENT_DEBUG
+  printf ("tsc_connect_retry\n");
+#endif
+
+  tsc_connect_error_show (tsc_reconnect_describe (session->failure), session->error,
+                          session->rdp, session->id, session->attempts,
+                          session->retry_at);
 }
 
 void tsc_error_message (gchar *message)
@@ -1217,6 +2282,153 @@ void tsc_error_message (gchar *message)
 }
 
 
+
+typedef struct {
+  rdp_file *rdp;
+  gchar **hosts;
+  const gchar *client;
+  GString *detail;
+  GString *changes;
+  gchar *error;
+  gboolean answered;
+} TscConnectTest;
+
+
+static void
+tsc_connect_test_free (TscConnectTest *test)
+{
+  rdp_file_free (test->rdp);
+  g_strfreev (test->hosts);
+  g_string_free (test->detail, TRUE);
+  g_string_free (test->changes, TRUE);
+  g_free (test->error);
+  g_free (test);
+}
+
+
+/* Worker thread: each host's check can take handshake-timeout-ms. */
+static void
+tsc_connect_test_thread (GTask *task, gpointer source, gpointer task_data,
+                         GCancellable *cancellable)
+{
+  TscConnectTest *test = task_data;
+  gint i;
+
+  for (i = 0; test->hosts[i] && !test->error; i++) {
+    TscHandshakeResult result;
+    gchar *text;
+
+    tsc_handshake_check (test->hosts[i], test->rdp->protocol, TRUE, &result);
+    text = tsc_handshake_describe (&result);
+    g_string_append_printf (test->detail, "%s\n%s\n", test->hosts[i], text);
+    g_free (text);
+    test->answered |= result.answered;
+    tsc_handshake_apply (test->rdp, test->client, &result, test->changes, &test->error);
+    tsc_handshake_result_clear (&result);
+  }
+  g_task_return_boolean (task, TRUE);
+}
+
+
+/* Back on the main loop: show what was found, and put what changed in the form. */
+static void
+tsc_connect_test_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  TscConnectTest *test = g_task_get_task_data (G_TASK (res));
+  GtkAlertDialog *alert;
+  GtkWidget *button;
+  const gchar *heading;
+
+  if (test->error) {
+    heading = _("This connection would fail.");
+    g_string_append (test->detail, test->error);
+  } else if (!test->answered) {
+    heading = _("The server did not answer.");
+  } else {
+    heading = _("The server answered.");
+    if (test->changes->len)
+      g_string_append_printf (test->detail, "%s\n%s", _("Changed to suit the server:"),
+                              test->changes->str);
+  }
+
+  // only the fields the check changes, so edits made meanwhile stay
+  if (!test->error && test->changes->len && gConnect) {
+    rdp_file *form = g_new0 (rdp_file, 1);
+
+    rdp_file_init (form);
+    rdp_file_get_screen (form, gConnect);
+    form->disable_encryption = test->rdp->disable_encryption;
+    form->disable_client_encryption = test->rdp->disable_client_encryption;
+    g_free (form->tls_version);
+    form->tls_version = g_strdup (test->rdp->tls_version);
+    rdp_file_set_screen (form, gConnect);
+    rdp_file_free (form);
+  }
+
+  button = gConnect ? lookup_widget (gConnect, "btnTest") : NULL;
+  if (button)
+    gtk_widget_set_sensitive (button, TRUE);
+
+  alert = gtk_alert_dialog_new ("%s", heading);
+  gtk_alert_dialog_set_detail (alert, g_strchomp (test->detail->str));
+  gtk_alert_dialog_show (alert,
+                         gConnect ? GTK_WINDOW (gConnect) : NULL);
+  g_object_unref (alert);
+}
+
+
+/*
+ * Check rdp's handshake with its host, or with each host of its pool,
+ * on a worker thread, then show what was found and change the main
+ * window's form to suit the server.  Takes rdp.
+ */
+void tsc_connect_test (rdp_file *rdp)
+{
+  TscConnectTest *test;
+  GtkWidget *button;
+  gchar **hosts;
+  GTask *task;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_connect_test\n");
+  #endif
+
+  if (rdp->protocol != 0 && rdp->protocol != 1 && rdp->protocol != 4) {
+    tsc_error_message (_("Only RDP and VNC connections can be tested."));
+    rdp_file_free (rdp);
+    return;
+  }
+  if (rdp->pool && rdp->pool[0])
+    hosts = tsc_pool_members (rdp->pool);
+  else {
+    hosts = g_new0 (gchar *, 2);
+    hosts[0] = g_strdup (rdp->full_address ? rdp->full_address : "");
+  }
+  if (!hosts || !hosts[0] || !hosts[0][0]) {
+    g_strfreev (hosts);
+    tsc_error_message (_("Enter the computer to connect to first."));
+    rdp_file_free (rdp);
+    return;
+  }
+
+  test = g_new0 (TscConnectTest, 1);
+  test->rdp = rdp;
+  test->hosts = hosts;
+  test->client = rdp->protocol == 1 ? "vncviewer" : tsc_rdp_client (rdp);
+  test->detail = g_string_new (NULL);
+  test->changes = g_string_new (NULL);
+
+  // one test at a time
+  button = gConnect ? lookup_widget (gConnect, "btnTest") : NULL;
+  if (button)
+    gtk_widget_set_sensitive (button, FALSE);
+
+  task = g_task_new (NULL, NULL, tsc_connect_test_done, NULL);
+  g_task_set_task_data (task, test, (GDestroyNotify) tsc_connect_test_free);
+  g_task_run_in_thread (task, tsc_connect_test_thread);
+  g_object_unref (task);
+}
+
 void tsc_about_dialog ()
 {
   const gchar *name      = _("Terminal Server Client");
@@ -1284,8 +2496,8 @@ void tsc_quick_pick_activate (GtkDropDown *widget, GParamSpec *pspec, gpointer u
 
   // build path to file
   file_name = g_build_path ("/", home, (const gchar *)rdp_name, NULL);
-  // check for file in ~/
-  if (g_file_test (file_name, G_FILE_TEST_EXISTS)) {
+  // check for file in ~/ or a bundle
+  if (rdp_profile_exists (file_name)) {
     rdp = g_new0 (rdp_file, 1);
     rdp_file_init (rdp);
     if (rdp_file_load (rdp, file_name) == 0) {
@@ -1294,7 +2506,7 @@ void tsc_quick_pick_activate (GtkDropDown *widget, GParamSpec *pspec, gpointer u
     } else {
       g_warning ("Failed to load profile %s", file_name);
     }
-    g_free (rdp);
+    rdp_file_free (rdp);
   } else {
     g_warning ("Quick connect profile missing: %s", file_name);
   }
@@ -1307,9 +2519,127 @@ void tsc_quick_pick_activate (GtkDropDown *widget, GParamSpec *pspec, gpointer u
   return;
 }
 
+static void
+tsc_session_changed (TscSession *session, gpointer user_data)
+{
+  (void) user_data;
+
+  switch (session->state) {
+  case TSC_SESSION_RUNNING:
+    if (connect_dialog && connect_dialog->session_id == session->id)
+      tsc_connect_error_close ();
+    break;
+  case TSC_SESSION_RETRYING:
+    if (session->interactive)
+      tsc_connect_retry (session);
+    break;
+  case TSC_SESSION_FAILED:
+    if (session->error)
+      g_warning ("%s: %s", session->name, session->error);
+    if (session->interactive && !session->cancelled)
+      tsc_connect_error_show (tsc_reconnect_describe (session->failure), session->error,
+                              session->rdp, 0, 0, 0);
+    break;
+  default:
+    break;
+  }
+
+  // the main window stays hidden while its own session is up
+  if (session->interactive && gConnect &&
+      (session->state == TSC_SESSION_EXITED || session->state == TSC_SESSION_FAILED)) {
+    mru_to_screen (gConnect);
+    gtk_widget_set_visible (gConnect, TRUE);
+  }
+
+  tsc_session_status_update ();
+}
+
+/* Refuse up front when the prober just saw the host down. */
+void tsc_connect_unreachable (rdp_file *rdp)
+{
+  const TscProbeResult *result = tsc_probe_lookup (rdp->full_address, rdp->protocol);
+  gchar *heading, *detail;
+
+  heading = g_strdup_printf (_("%s is not responding."), rdp->full_address);
+  detail = g_strdup_printf (_("Nothing answered on port %u %d seconds ago.\n"
+                              "Press Reconnect to try anyway."),
+                            result ? result->port : 0,
+                            result ? (gint) ((g_get_monotonic_time () - result->checked) / G_USEC_PER_SEC) : 0);
+  tsc_connect_error_show (heading, detail, rdp, 0, 0, 0);
+  g_free (detail);
+  g_free (heading);
+}
+
+/*
+ * Run rdp for the main window, which is hidden until the session ends.
+ * timing (may be NULL) carries the phases measured before the click.
+ */
+void tsc_connect_session (rdp_file *rdp, TscTiming *timing)
+{
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_connect_session\n");
+  #endif
+
+  if (gConnect)
+    gtk_widget_set_visible (gConnect, FALSE);
+  tsc_session_add_notify (tsc_session_changed, NULL);
+  tsc_session_queue (rdp, NULL, NULL, TRUE, timing);
+}
+
+/* Show the supervisor's aggregate status in the main window. */
+void tsc_session_status_update (void)
+{
+  GtkWidget *label;
+  gchar *text;
+
+  if (!gConnect)
+    return;
+
+  label = lookup_widget (gConnect, "lblSessionStatus");
+  if (!label)
+    return;
+
+  if (!tsc_session_pending ()) {
+    gtk_widget_set_visible (label, FALSE);
+    return;
+  }
+
+  text = tsc_session_stats_text ();
+  gtk_label_set_text (GTK_LABEL (label), text);
+  gtk_widget_set_visible (label, TRUE);
+  g_free (text);
+}
+
+void tsc_group_launch_activate (GtkDropDown *widget, GParamSpec *pspec, gpointer user_data)
+{
+  gchar *group;
+  (void) pspec;
+  (void) user_data;
+
+  #ifdef TSCLIENT_DEBUG
+  printf ("tsc_group_launch_activate\n");
+  #endif
+
+  /* Do nothing if it's the first element (just a instruction)*/
+  if (gtk_drop_down_get_selected (widget) == 0)
+    return;
+
+  group = tsc_dropdown_get_selected_text (GTK_WIDGET (widget));
+  tsc_session_add_notify (tsc_session_changed, NULL);
+  if (tsc_session_queue_group (group) == 0)
+    g_warning ("No profiles found in group %s", group);
+  g_free (group);
+
+  gtk_drop_down_set_selected (widget, 0);
+}
+
 void
 tsc_set_protocol_widgets (GtkWidget *main_win, gint protocol)
 {
+  static const gchar *const vnc_widgets[] = {
+    "lblVncEncoding", "optVncEncoding", "lblVncCompress", "optVncCompress",
+    "lblVncQuality", "optVncQuality", NULL
+  };
   #ifdef TSCLIENT_DEBUG
   printf ("tsc_set_protocol_widgets: %d\n", protocol);
   #endif
@@ -1328,6 +2658,8 @@ tsc_set_protocol_widgets (GtkWidget *main_win, gint protocol)
     gtk_widget_set_sensitive ((GtkWidget*) g_object_get_data (G_OBJECT (main_win), "txtStartFolder"), FALSE);
   }
   gtk_widget_set_sensitive ((GtkWidget*) g_object_get_data (G_OBJECT (main_win), "chkHideWMDecorations"), FALSE);
+  for (gint i = 0; vnc_widgets[i]; i++)
+    gtk_widget_set_sensitive ((GtkWidget*) g_object_get_data (G_OBJECT (main_win), vnc_widgets[i]), protocol == 1);
 
   switch (protocol) {
   case 0:  // rdp v4
@@ -8,6 +8,7 @@
 
 #include <gtk/gtk.h>
 #include "gtkcompat.h"
+#include "history.h"
 
 #ifdef TSCLIENT_DEBUG
 #define DEBUG 1
@@ -17,7 +18,7 @@
 
 #define TSC_WM_COMPLEX 0
 #define TSC_WM_COMPACT 1
-#define MAX_ARGVS 16
+#define MAX_ARGVS 64
 #define MAX_ARGV_LEN 255
 
 #define HOOKUP_OBJECT(component,widget,name) \
@@ -51,19 +52,38 @@ gchar *tsc_dropdown_get_selected_text (GtkWidget *dropdown);
 const gchar *tsc_dropdown_get_string (GtkWidget *dropdown, guint idx);
 void tsc_dropdown_append (GtkWidget *dropdown, const gchar *label);
 void tsc_dropdown_clear (GtkWidget *dropdown);
+typedef gchar *(*TscDropdownAnnotate) (const gchar *label);
+void tsc_dropdown_add_annotate (GtkWidget *dropdown, TscDropdownAnnotate annotate);
+void tsc_dropdown_refresh (GtkWidget *dropdown);
+void tsc_dropdown_refresh_label (GtkWidget *dropdown, const gchar *label);
+gint tsc_screen_protocol (GtkWidget *main_window);
 
 int tsc_check_files ();
 
 gchar *tsc_home_path ();
 
+gint tsc_config_get_int (const gchar *group, const gchar *key, gint fallback);
+gboolean tsc_config_get_boolean (const gchar *group, const gchar *key, gboolean fallback);
+gchar *tsc_config_get_string (const gchar *group, const gchar *key);
+
+const gchar *tsc_find_program (const gchar *program);
+gint64 tsc_find_program_elapsed (void);
+void tsc_freerdp_prefetch (void);
+gchar **tsc_build_argv (rdp_file *rdp_in, gchar** target, gint *protocol, gchar** error);
+
 int tsc_launch_remote (rdp_file *rdp_in, int launch_async, gchar** error);
 
+void tsc_connect_session (rdp_file *rdp, TscTiming *timing);
+void tsc_connect_unreachable (rdp_file *rdp);
 void tsc_connect_error (rdp_file * rdp, const gchar* error);
 void tsc_error_message (gchar *message);
+void tsc_connect_test (rdp_file *rdp);
 
 void tsc_about_dialog ();
 
 void tsc_quick_pick_activate (GtkDropDown *widget, GParamSpec *pspec, gpointer user_data);
+void tsc_group_launch_activate (GtkDropDown *widget, GParamSpec *pspec, gpointer user_data);
+void tsc_session_status_update (void);
 
 void tsc_set_protocol_widgets (GtkWidget *main_win, gint protocol);
 
@@ -31,3 +31,43 @@ static const TscScreenPreset tsc_screen_presets[] = {
 };
 
 #define TSC_SCREEN_PRESET_COUNT (G_N_ELEMENTS (tsc_screen_presets))
+
+/* connection_type, with the values .rdp files use for "connection type" */
+#define TSC_SPEED_CUSTOM 0
+#define TSC_SPEED_MODEM 1
+#define TSC_SPEED_LOW_BROADBAND 2
+#define TSC_SPEED_BROADBAND 4
+#define TSC_SPEED_LAN 6
+#define TSC_SPEED_AUTO 7
+
+/* rdesktop -x performance flags */
+#define TSC_PERF_NO_WALLPAPER 0x01
+#define TSC_PERF_NO_FULLWINDOWDRAG 0x02
+#define TSC_PERF_NO_MENUANIMATIONS 0x04
+#define TSC_PERF_NO_THEMING 0x08
+
+typedef struct {
+  gint connection_type;
+  const char *label;
+  gint compression;
+  gint disable_wallpaper;
+  gint disable_full_window_drag;
+  gint disable_menu_anims;
+  gint disable_themes;
+} TscSpeedPreset;
+
+/*
+ * In the order of the form's list.  Custom leaves the profile's own
+ * choices; rdesktop cannot measure the link, so Auto starts as Broadband.
+ * The persistent bitmap cache is always the profile's own choice.
+ */
+static const TscSpeedPreset tsc_speed_presets[] = {
+  { TSC_SPEED_CUSTOM,        N_("Custom"),                        0, 0, 0, 0, 0 },
+  { TSC_SPEED_MODEM,         N_("Modem (56 Kbps)"),               1, 1, 1, 1, 1 },
+  { TSC_SPEED_LOW_BROADBAND, N_("Low-speed broadband (256 Kbps - 2 Mbps)"), 1, 1, 1, 1, 0 },
+  { TSC_SPEED_BROADBAND,     N_("Broadband (2 Mbps - 10 Mbps)"),  1, 1, 0, 0, 0 },
+  { TSC_SPEED_LAN,           N_("LAN (10 Mbps or higher)"),       0, 0, 0, 0, 0 },
+  { TSC_SPEED_AUTO,          N_("Detect connection quality automatically"), 1, 1, 0, 0, 0 },
+};
+
+#define TSC_SPEED_PRESET_COUNT (G_N_ELEMENTS (tsc_speed_presets))
@@ -0,0 +1,39 @@
+#ifndef TSC_TRACE_H
+#define TSC_TRACE_H
+
+/*
+ * USDT probes for bpftrace, perf and systemtap, under the "tsclient"
+ * provider.  Each probe site is a single nop until a tracer attaches,
+ * and compiles to nothing when <sys/sdt.h> (systemtap-sdt-dev) was not
+ * found at configure time.  See tools/ for scripts that use them.
+ *
+ *   profile__load__start   path
+ *   profile__load__done    path, format ("json", "rdp" or "bundle"), result
+ *   profile__scan__dir     directory, .rdp files found in it
+ *   mru__add               server
+ *   session__queue         session id, interactive
+ *   launch__pool           host picked, pool policy, hosts in the pool
+ *   launch__preflight      address, protocol, handshake time (ms)
+ *   launch__eyeballs       host, winning address family (4 or 6), connect time (ms)
+ *   launch__handshake      address, security layers accepted, handshake time (ms)
+ *   launch__adapt          address, handshake rtt (ms), chosen connection speed
+ *   launch__argv           address, protocol, argc
+ *   launch__spawn          session id, pid, client
+ *   session__exit          session id, pid, wait status, failure
+ *   session__reconnect     session id, attempt, delay (ms)
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define TSC_TRACE1(name, a) DTRACE_PROBE1 (tsclient, name, a)
+#  define TSC_TRACE2(name, a, b) DTRACE_PROBE2 (tsclient, name, a, b)
+#  define TSC_TRACE3(name, a, b, c) DTRACE_PROBE3 (tsclient, name, a, b, c)
+#  define TSC_TRACE4(name, a, b, c, d) DTRACE_PROBE4 (tsclient, name, a, b, c, d)
+#else
+#  define TSC_TRACE1(name, a) do { } while (0)
+#  define TSC_TRACE2(name, a, b) do { } while (0)
+#  define TSC_TRACE3(name, a, b, c) do { } while (0)
+#  define TSC_TRACE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* TSC_TRACE_H */
@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# Link adaptation against a local listener behind netem, which delays
+# (and rate-limits) everything on lo.  In each case what an automatic
+# profile would get, via `tsclient --adapt`, must be the expected speed
+# tier with its color depth, compression and experience flags.  Needs
+# root, tc (iproute2) and python3:
+#
+#   sudo tools/adapt-delay.sh [path/to/tsclient]
+#
+# netem delays both directions, so the handshake RTT is about twice the
+# delay.  The second port streams zeros and serves as [adapt]
+# bandwidth-endpoint; each case starts without earlier RTTs.
+
+set -e
+
+tsclient=${1:-tsclient}
+port=13389
+stream_port=13390
+home=$(mktemp -d)
+status=0
+
+cleanup () {
+  tc qdisc del dev lo root 2>/dev/null || true
+  [ -n "$server" ] && kill "$server" 2>/dev/null || true
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+python3 - "$port" "$stream_port" <<'EOF' &
+import socket, sys, threading
+
+def serve(port, stream):
+    sock = socket.socket()
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("127.0.0.1", port))
+    sock.listen(64)
+    while True:
+        conn, _ = sock.accept()
+        threading.Thread(target=handle, args=(conn, stream), daemon=True).start()
+
+def handle(conn, stream):
+    try:
+        while stream:
+            conn.sendall(bytes(65536))
+    except OSError:
+        pass
+    conn.close()
+
+threading.Thread(target=serve, args=(int(sys.argv[2]), True), daemon=True).start()
+serve(int(sys.argv[1]), False)
+EOF
+server=$!
+sleep 1
+
+mkdir -p "$home/.tsclient"
+printf '[adapt]\nbandwidth-endpoint=127.0.0.1:%s\n' "$stream_port" > "$home/.tsclient/tsclient.conf"
+
+# run DELAY RATE EXPECT: the settings line --adapt prints must start with EXPECT
+run () {
+  tc qdisc del dev lo root 2>/dev/null || true
+  tc qdisc add dev lo root netem delay "$1" rate "$2"
+  rm -f "$home/.tsclient/adapt.jsonl"
+  HOME="$home" DBUS_SESSION_BUS_ADDRESS=disabled: "$tsclient" --adapt "127.0.0.1:$port" \
+    > "$home/adapt.out" 2>&1 || true
+  got=$(sed -n 's/^  speed /speed /p' "$home/adapt.out")
+  case "$got" in
+    "$3"*)
+      echo "  delay $1, rate $2: ok ($got)" ;;
+    *)
+      echo "  delay $1, rate $2: FAILED, expected '$3', got '$got'"
+      sed 's/^/    /' "$home/adapt.out"
+      status=1 ;;
+  esac
+}
+
+run 1ms 1gbit "speed lan, 32 bit color, compression off, experience flags 0x00"
+run 10ms 5mbit "speed broadband, 32 bit color, compression on, experience flags 0x01"
+run 40ms 1mbit "speed low-broadband, 16 bit color, compression on, experience flags 0x07"
+run 100ms 128kbit "speed modem, 15 bit color, compression on, experience flags 0x0f"
+exit $status
@@ -0,0 +1,214 @@
+#!/bin/sh
+#
+# Client command lines against golden copies: each profile is launched
+# with `tsclient -x` and a stand-in rdesktop, xfreerdp or xfreerdp3 (on
+# PATH, so no server is needed) that writes its argv, one word a line,
+# and exits.  The argv must match the expected one below word for word:
+#
+#   tools/argv-check.sh [path/to/tsclient]
+#
+# The stand-in xfreerdp says it is FreeRDP 2 when asked for --version.
+# Persistent caches are off ([cache] budget-mb=0), so no cache file
+# paths show up in the FreeRDP lines.  A case can add to tsclient.conf
+# by writing $home/conf/NAME.
+
+tsclient=${1:-tsclient}
+home=$(mktemp -d)
+status=0
+
+cleanup () {
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+mkdir -p "$home/bin" "$home/expect" "$home/conf"
+for client in rdesktop xfreerdp xfreerdp3; do
+  cat > "$home/bin/$client" <<'EOF'
+#!/bin/sh
+if [ "$1" = "--version" ]; then
+  echo "This is FreeRDP version 2.11.5 (stand-in)"
+  exit 0
+fi
+printf '%s\n' "$0" "$@" | sed '1s|.*/||' > "$TSC_ARGV_OUT"
+EOF
+  chmod +x "$home/bin/$client"
+done
+printf '[preflight]\nhappy-eyeballs=false\n[cache]\nbudget-mb=0\n' > "$home/tsclient.conf"
+
+# profile NAME JSON-FIELDS: a 127.0.0.1 RDPv5 profile with the fields given
+profile () {
+  printf '{\n  "full_address": "127.0.0.1",\n  "protocol": 4%s\n}\n' "$2" > "$home/$1.rdp"
+}
+
+# Custom speed: no -x, the profile's own bitmap cache choice
+profile rdesktop-custom ',
+  "rdp_client": "rdesktop",
+  "bitmapcachepersistenable": 1'
+cat > "$home/expect/rdesktop-custom" <<'EOF'
+rdesktop
+-T127.0.0.1 - Terminal Server Client
+-rsound:local
+-rclipboard:PRIMARYCLIPBOARD
+-P
+127.0.0.1
+EOF
+
+# a preset sets -x and -z but leaves the bitmap cache off
+profile rdesktop-broadband ',
+  "rdp_client": "rdesktop",
+  "connection_type": 4,
+  "bitmapcachepersistenable": 0'
+cat > "$home/expect/rdesktop-broadband" <<'EOF'
+rdesktop
+-T127.0.0.1 - Terminal Server Client
+-rsound:local
+-rclipboard:PRIMARYCLIPBOARD
+-x
+0x01
+-z
+127.0.0.1
+EOF
+
+profile rdesktop-modem ',
+  "rdp_client": "rdesktop",
+  "connection_type": 1,
+  "bitmapcachepersistenable": 1,
+  "keyboard_language": "de",
+  "sync_numlock": 1'
+cat > "$home/expect/rdesktop-modem" <<'EOF'
+rdesktop
+-T127.0.0.1 - Terminal Server Client
+-rsound:local
+-rclipboard:PRIMARYCLIPBOARD
+-P
+-x
+0x0f
+-z
+-k
+de
+-N
+127.0.0.1
+EOF
+
+profile freerdp3-custom ',
+  "rdp_client": "xfreerdp3"'
+cat > "$home/expect/freerdp3-custom" <<'EOF'
+xfreerdp3
+/title:127.0.0.1 - Terminal Server Client
+/gfx
++wallpaper
++window-drag
++menu-anims
++themes
+/cache:bitmap:on,glyph:off
+/sound
++clipboard
+/cert:tofu
+/v:127.0.0.1
+EOF
+
+profile freerdp2-lan ',
+  "rdp_client": "xfreerdp",
+  "connection_type": 6,
+  "bitmapcachepersistenable": 1,
+  "glyph_cache": 1'
+cat > "$home/expect/freerdp2-lan" <<'EOF'
+xfreerdp
+/title:127.0.0.1 - Terminal Server Client
+/gfx
+/network:lan
++bitmap-cache
++glyph-cache
++persist-cache
+/sound
++clipboard
+/cert-tofu
+/v:127.0.0.1
+EOF
+
+# no client picked anywhere: rdesktop, though FreeRDP is installed
+profile default-client ''
+cat > "$home/expect/default-client" <<'EOF'
+rdesktop
+-T127.0.0.1 - Terminal Server Client
+-rsound:local
+-rclipboard:PRIMARYCLIPBOARD
+127.0.0.1
+EOF
+
+# auto keeps rdesktop for a codepage FreeRDP cannot take
+profile auto-codepage ',
+  "local_codepage": "ISO-8859-1"'
+printf '[rdp]\nclient=auto\n' > "$home/conf/auto-codepage"
+cat > "$home/expect/auto-codepage" <<'EOF'
+rdesktop
+-T127.0.0.1 - Terminal Server Client
+-rsound:local
+-rclipboard:PRIMARYCLIPBOARD
+-L
+ISO-8859-1
+127.0.0.1
+EOF
+
+profile auto-fields ',
+  "keyboard_language": "de",
+  "tls_version": "1.0",
+  "no_motion_events": 1,
+  "sync_numlock": 1'
+printf '[rdp]\nclient=auto\n' > "$home/conf/auto-fields"
+cat > "$home/expect/auto-fields" <<'EOF'
+xfreerdp3
+/title:127.0.0.1 - Terminal Server Client
+/kbd:layout:0x407
+/gfx
++wallpaper
++window-drag
++menu-anims
++themes
+/cache:bitmap:on,glyph:off
+/sound
++clipboard
+/cert:tofu
+/tls:enforce:1.0
+/tls:seclevel:0
+-mouse-motion
+/v:127.0.0.1
+EOF
+
+profile freerdp2-fields ',
+  "rdp_client": "xfreerdp",
+  "keyboard_language": "fr-ch",
+  "tls_version": "1.2"'
+cat > "$home/expect/freerdp2-fields" <<'EOF'
+xfreerdp
+/title:127.0.0.1 - Terminal Server Client
+/kbd:0x100c
+/gfx
++wallpaper
++window-drag
++menu-anims
++themes
++bitmap-cache
+/sound
++clipboard
+/cert-tofu
+/enforce-tlsv1_2
+/v:127.0.0.1
+EOF
+
+# no session bus, so no run hands its profile to a running tsclient
+for expect in "$home"/expect/*; do
+  name=$(basename "$expect")
+  mkdir -p "$home/$name/.tsclient"
+  cat "$home/tsclient.conf" "$home/conf/$name" > "$home/$name/.tsclient/tsclient.conf" 2>/dev/null
+  HOME="$home/$name" PATH="$home/bin:$PATH" LC_ALL=C LANGUAGE=C TSC_ARGV_OUT="$home/$name.argv" \
+    DBUS_SESSION_BUS_ADDRESS=disabled: "$tsclient" -x "$home/$name.rdp" >/dev/null 2>&1
+  if diff -u "$expect" "$home/$name.argv" > "$home/$name.diff" 2>&1; then
+    echo "  $name: ok"
+  else
+    echo "  $name: FAILED"
+    sed 's/^/    /' "$home/$name.diff"
+    status=1
+  fi
+done
+exit $status
@@ -0,0 +1,22 @@
+// Applet side of tools/bench-index.sh: read and group profiles.idx the
+// way applet/cinnamon-tsclient does, best of 20 runs.
+//
+//   gjs -I applet/cinnamon-tsclient tools/bench-index.js ~/.tsclient/profiles.idx
+
+const GLib = imports.gi.GLib;
+const ByteArray = imports.byteArray;
+const Profiles = imports.profiles;
+
+const filename = ARGV[0];
+let best = Infinity;
+let index = null;
+
+for (let run = 0; run < 20; run++) {
+    const start = GLib.get_monotonic_time();
+    const [ok, contents] = GLib.file_get_contents(filename);
+    index = Profiles.parseIndex(ByteArray.toString(contents));
+    best = Math.min(best, GLib.get_monotonic_time() - start);
+}
+
+print(`applet menu model:   ${(best / 1000).toFixed(1)} ms for ` +
+      `${index.groups.length} groups, ${index.loose.length} ungrouped`);
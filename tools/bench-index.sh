@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Profile index benchmark: builds a throwaway ~/.tsclient with N profiles
+# (default 10000) spread over 200 groups, times `tsclient --index` cold
+# (every profile parsed) and warm (nothing changed), then times what the
+# Cinnamon applet does with the result:
+#
+#   tools/bench-index.sh [N] [path/to/tsclient]
+#
+# The applet part needs gjs.  It covers reading and grouping the index,
+# not creating the actors, which Cinnamon only allows inside the shell;
+# with lazy submenus that is one item per group at open time.
+
+set -e
+
+count=${1:-10000}
+tsclient=${2:-tsclient}
+groups=200
+here=$(cd "$(dirname "$0")" && pwd)
+home=$(mktemp -d)
+trap 'rm -rf "$home"' EXIT
+
+mkdir -p "$home/.tsclient"
+i=0
+while [ $i -lt $count ]; do
+  group=$(printf 'site%03d' $((i % groups)))
+  mkdir -p "$home/.tsclient/$group"
+  printf '{\n  "full_address": "ts%05d.example.com",\n  "protocol": 4\n}\n' $i \
+    > "$home/.tsclient/$group/ts$i.rdp"
+  i=$((i + 1))
+done
+
+now () {
+  date +%s%N
+}
+
+start=$(now)
+HOME="$home" "$tsclient" --index
+cold=$(( ($(now) - start) / 1000000 ))
+
+start=$(now)
+HOME="$home" "$tsclient" --index
+warm=$(( ($(now) - start) / 1000000 ))
+
+echo "profiles:            $count in $groups groups"
+echo "index size:          $(wc -c < "$home/.tsclient/profiles.idx") bytes"
+echo "tsclient --index:    ${cold} ms cold, ${warm} ms unchanged"
+
+if command -v gjs >/dev/null 2>&1; then
+  gjs -I "$here/../applet/cinnamon-tsclient" "$here/bench-index.js" "$home/.tsclient/profiles.idx"
+else
+  echo "applet menu model:   skipped, gjs not found"
+fi
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Profile scan benchmark on a loopback NFSv4 export, comparing the old
+# one-stat-per-entry walker ([scan] threads=0) with the d_type/statx
+# walker at 1 and 8 threads.  Needs root and nfs-kernel-server (or
+# nfs-utils):
+#
+#   sudo tools/bench-scan.sh [N] [path/to/tsclient]
+#
+# The export is mounted with actimeo=0, so every attribute the client
+# wants costs a round trip, as on a cold cache.  Each run is an unchanged
+# `tsclient --index`: a walk plus one attribute check per profile.
+
+set -e
+
+count=${1:-10000}
+tsclient=${2:-tsclient}
+groups=200
+export_dir=$(mktemp -d /srv/tsclient-bench.XXXXXX)
+mount_dir=$(mktemp -d)
+
+cleanup () {
+  umount "$mount_dir" 2>/dev/null || true
+  exportfs -u "localhost:$export_dir" 2>/dev/null || true
+  rm -rf "$export_dir" "$mount_dir"
+}
+trap cleanup EXIT
+
+mkdir -p "$export_dir/.tsclient"
+i=0
+while [ $i -lt $count ]; do
+  group=$(printf 'site%03d' $((i % groups)))
+  mkdir -p "$export_dir/.tsclient/$group"
+  printf '{\n  "full_address": "ts%05d.example.com",\n  "protocol": 4\n}\n' $i \
+    > "$export_dir/.tsclient/$group/ts$i.rdp"
+  i=$((i + 1))
+done
+
+exportfs -o rw,no_root_squash,insecure,fsid=$$ "localhost:$export_dir"
+mount -t nfs4 -o actimeo=0 "localhost:$export_dir" "$mount_dir"
+
+# build the index once so the timed runs find nothing to parse
+HOME="$mount_dir" "$tsclient" --index
+
+run () {
+  printf '[scan]\nthreads=%s\n' "$1" > "$mount_dir/.tsclient/tsclient.conf"
+  best=
+  for attempt in 1 2 3; do
+    sync
+    echo 3 > /proc/sys/vm/drop_caches
+    start=$(date +%s%N)
+    HOME="$mount_dir" "$tsclient" --index
+    ms=$(( ($(date +%s%N) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then
+      best=$ms
+    fi
+  done
+  echo "$2 ${best} ms"
+}
+
+echo "profiles:            $count in $groups groups, NFSv4 over loopback"
+run 0 "old walker:         "
+run 1 "d_type, 1 thread:   "
+run 8 "d_type, 8 threads:  "
@@ -0,0 +1,119 @@
+#!/bin/sh
+#
+# Happy eyeballs against loopback stand-ins, via `tsclient --preflight`:
+# an RDP server on ::1 and 127.0.0.1 that either answers, refuses (no
+# listener) or blackholes (a listener whose accept queue is full, so SYNs
+# go unanswered).  Needs python3 and a NAME that resolves to both ::1
+# and 127.0.0.1, such as localhost with "::1 localhost" in /etc/hosts:
+#
+#   tools/eyeballs-race.sh [NAME [path/to/tsclient]]
+#
+# In each case the address that answered first must be the healthy
+# one and the one FreeRDP is given.  A blackholed family must cost about
+# [preflight] attempt-delay-ms, a refused one nothing, and neither the
+# timeout.
+
+name=${1:-localhost}
+tsclient=${2:-tsclient}
+port=13389
+home=$(mktemp -d)
+status=0
+
+cleanup () {
+  [ -n "$server" ] && kill "$server" 2>/dev/null || true
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+if ! getent ahosts "$name" | grep -q '^::1 ' || ! getent ahosts "$name" | grep -q '^127\.0\.0\.1 '; then
+  echo "$name does not resolve to both ::1 and 127.0.0.1" >&2
+  exit 1
+fi
+
+mkdir -p "$home/.tsclient"
+printf '[preflight]\nattempt-delay-ms=500\ntimeout-ms=3000\n' > "$home/.tsclient/tsclient.conf"
+
+serve () {
+  [ -n "$server" ] && kill "$server" 2>/dev/null
+  python3 - "$port" "$1" "$2" <<'PY' &
+import socket, sys, threading, time
+
+CONFIRM = bytes([0x03, 0x00, 0x00, 0x13, 0x0e, 0xd0, 0x00, 0x00, 0x12, 0x34, 0x00,
+                 0x02, 0x00, 0x08, 0x00, 0x01, 0x00, 0x00, 0x00])
+
+def answer(conn):
+    conn.recv(64)
+    conn.sendall(CONFIRM)
+    time.sleep(1)
+    conn.close()
+
+def listen(family, host, port, mode):
+    if mode == "refuse":
+        return
+    sock = socket.socket(family)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((host, port))
+    if mode == "blackhole":
+        sock.listen(0)
+        held = []
+        for _ in range(8):
+            c = socket.socket(family)
+            c.settimeout(0.2)
+            try:
+                c.connect((host, port))
+            except OSError:
+                break
+            held.append(c)
+        time.sleep(3600)
+    sock.listen(64)
+    while True:
+        conn, _ = sock.accept()
+        threading.Thread(target=answer, args=(conn,), daemon=True).start()
+
+port = int(sys.argv[1])
+threading.Thread(target=listen, args=(socket.AF_INET6, "::1", port, sys.argv[2]), daemon=True).start()
+listen(socket.AF_INET, "127.0.0.1", port, sys.argv[3])
+time.sleep(3600)
+PY
+  server=$!
+  sleep 2
+}
+
+# run V6-MODE V4-MODE WINNER MIN-MS MAX-MS: WINNER must answer first and
+# be handed to FreeRDP, within MIN-MS..MAX-MS
+run () {
+  serve "$1" "$2"
+  case "$3" in
+    *:*) given="[$3]:$port" ;;
+    *)   given="$3:$port" ;;
+  esac
+  start=$(date +%s%N)
+  HOME="$home" DBUS_SESSION_BUS_ADDRESS=disabled: LC_ALL=C LANGUAGE=C \
+    "$tsclient" --preflight "$name" "rdp:$port" > "$home/race.out" 2>&1
+  took=$(( ($(date +%s%N) - start) / 1000000 ))
+  healthy=$(awk '$4 == "healthy" { print $3 }' "$home/race.out")
+  got=$(sed -n 's/.*, given to FreeRDP as //p' "$home/race.out")
+  if [ "$healthy" != "$3" ]; then
+    why="expected $3 to answer, got '$healthy'"
+  elif [ "$got" != "$given" ]; then
+    why="expected FreeRDP to be given $given, got '$got'"
+  elif [ $took -lt $4 ] || [ $took -gt $5 ]; then
+    why="took $took ms, expected $4..$5"
+  else
+    echo "  IPv6 $1, IPv4 $2: ok ($got, $took ms)"
+    return
+  fi
+  echo "  IPv6 $1, IPv4 $2: FAILED, $why"
+  sed 's/^/    /' "$home/race.out"
+  status=1
+}
+
+rm -f "$home/.tsclient/dns.cache"
+run answer answer ::1 0 500
+run refuse answer 127.0.0.1 0 500
+rm -f "$home/.tsclient/dns.cache"
+run blackhole answer 127.0.0.1 500 3000
+# IPv4 now tried first
+run blackhole answer 127.0.0.1 0 500
+run answer blackhole ::1 500 3000
+exit $status
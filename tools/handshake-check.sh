@@ -0,0 +1,161 @@
+#!/bin/sh
+#
+# Handshake checks against local stand-ins, via `tsclient --handshake`:
+# loopback ports play RDP servers that only take NLA, that require TLS,
+# that predate TLS or only speak TLS 1.0, VNC servers that ask for a
+# password or refuse, and a web server on the wrong port.  Needs python3
+# and openssl:
+#
+#   tools/handshake-check.sh [path/to/tsclient]
+#
+# Every case's report must have the expected X.224 result, TLS version
+# or RFB security types, and what each client is told.  The TLS 1.0
+# server is only as old as the local OpenSSL lets python be; where it
+# cannot go that low nothing listens on its port, and that is accepted.
+
+tsclient=${1:-tsclient}
+base=13500
+home=$(mktemp -d)
+status=0
+
+cleanup () {
+  [ -n "$server" ] && kill "$server" 2>/dev/null || true
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+  -keyout "$home/key.pem" -out "$home/cert.pem" >/dev/null 2>&1
+
+python3 - "$base" "$home" <<'PY' &
+import socket, ssl, struct, sys, threading, warnings
+
+warnings.simplefilter("ignore", DeprecationWarning)
+
+base, home = int(sys.argv[1]), sys.argv[2]
+
+def confirm(selected):
+    return bytes([3, 0, 0, 19, 14, 0xd0, 0, 0, 0x12, 0x34, 0, 2, 0, 8, 0]) + struct.pack("<I", selected)
+
+def failure(code):
+    return bytes([3, 0, 0, 19, 14, 0xd0, 0, 0, 0x12, 0x34, 0, 3, 0, 8, 0]) + struct.pack("<I", code)
+
+def tls_context(old):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    ctx.load_cert_chain(home + "/cert.pem", home + "/key.pem")
+    if old:
+        ctx.set_ciphers("DEFAULT:@SECLEVEL=0")
+        ctx.minimum_version = ssl.TLSVersion.TLSv1
+        ctx.maximum_version = ssl.TLSVersion.TLSv1
+    return ctx
+
+def rdp(conn, answer, ctx):
+    request = conn.recv(19)
+    offer = request[15] if len(request) >= 19 else 0
+    reply = answer(offer)
+    conn.sendall(reply)
+    if ctx and reply[11] == 2 and reply[15] in (1, 2):
+        try:
+            ctx.wrap_socket(conn, server_side=True).close()
+        except (OSError, ssl.SSLError):
+            pass
+
+def nla_only(offer):
+    return confirm(2) if offer & 2 else failure(5)
+
+def tls_only(offer):
+    return confirm(1) if offer & 1 else failure(1)
+
+def legacy(offer):
+    return bytes([3, 0, 0, 11, 6, 0xd0, 0, 0, 0x12, 0x34, 0])
+
+def vnc(conn, refuse):
+    conn.sendall(b"RFB 003.008\n")
+    conn.recv(12)
+    if refuse:
+        reason = b"Too many security failures"
+        conn.sendall(b"\0" + struct.pack(">I", len(reason)) + reason)
+    else:
+        conn.sendall(b"\1\2")
+
+def http(conn):
+    conn.recv(64)
+    conn.sendall(b"HTTP/1.0 400 Bad Request\r\n\r\n")
+
+def serve(port, handler):
+    sock = socket.socket()
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("127.0.0.1", port))
+    sock.listen(16)
+    while True:
+        conn, _ = sock.accept()
+        def run(conn=conn):
+            try:
+                handler(conn)
+            except OSError:
+                pass
+            conn.close()
+        threading.Thread(target=run, daemon=True).start()
+
+try:
+    old = tls_context(True)
+except (ssl.SSLError, ValueError):
+    old = None
+cases = [
+    (1, lambda c: rdp(c, nla_only, tls_context(False))),
+    (2, lambda c: rdp(c, tls_only, tls_context(False))),
+    (3, lambda c: rdp(c, legacy, None)),
+    (5, lambda c: vnc(c, False)),
+    (6, lambda c: vnc(c, True)),
+    (7, http),
+]
+if old:
+    cases.append((4, lambda c: rdp(c, tls_only, old)))
+for offset, handler in cases:
+    threading.Thread(target=serve, args=(base + offset, handler), daemon=True).start()
+threading.Event().wait()
+PY
+server=$!
+sleep 2
+
+mkdir -p "$home/.tsclient"
+printf '[preflight]\nhandshake-timeout-ms=2000\n' > "$home/.tsclient/tsclient.conf"
+
+# run NAME OFFSET PROTOCOL PATTERN...: each extended regular expression
+# PATTERN must match a line of the report
+run () {
+  name=$1
+  port=$(( base + $2 ))
+  protocol=$3
+  shift 3
+  HOME="$home" DBUS_SESSION_BUS_ADDRESS=disabled: LC_ALL=C LANGUAGE=C \
+    "$tsclient" --handshake "127.0.0.1:$port" "$protocol" > "$home/check.out" 2>&1
+  missing=
+  for pattern in "$@"; do
+    grep -Eq "$pattern" "$home/check.out" || missing="$missing
+    $pattern"
+  done
+  if [ -z "$missing" ]; then
+    echo "  $name: ok"
+  else
+    echo "  $name: FAILED, no line matching:$missing"
+    sed 's/^/    /' "$home/check.out"
+    status=1
+  fi
+}
+
+run "NLA only" 1 rdp "^  RDP security no, TLS no, NLA yes$" "^  TLS 1\.[23], handshake" \
+  "^  rdesktop +The server only accepts NLA" "^  xfreerdp +ok$"
+run "TLS required" 2 rdp "^  RDP security no, TLS yes, NLA no$" "^  TLS 1\.[23], handshake" \
+  "^  rdesktop +ok$" "^  xfreerdp +ok$"
+run "TLS required, as RDPv4" 2 rdp4 "^  RDP security no, TLS yes, NLA no$" \
+  "^  rdesktop +The server requires TLS or NLA, which RDPv4 cannot do"
+run "before TLS" 3 rdp "^  RDP security yes, TLS no, NLA no$" "^  rdesktop +ok$" "^  xfreerdp +ok$"
+run "TLS 1.0 only" 4 rdp "^  (TLS 1\.0, handshake|TLS handshake failed \(|port $(( base + 4 )): no connection)"
+run "VNC password" 5 vnc "^  RFB 003\.008$" "^  security types: VNC password$" "^  vncviewer +ok$"
+run "VNC refusing" 6 vnc "^  RFB 003\.008$" "^  refused: Too many security failures$" \
+  "^  vncviewer +The VNC server refused the connection: Too many security failures$"
+run "web server" 7 rdp "^  answered as some other server$" \
+  "^  rdesktop +The server answered, but not as an RDP server"
+run "nothing listening" 9 rdp "^  port $(( base + 9 )): no connection$" "^  rdesktop +left to the client$"
+exit $status
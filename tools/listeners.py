@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+#
+# Loopback stand-ins for the hosts the tools/*.sh checks point tsclient
+# at, one per MODE:PORT argument, until killed:
+#
+#   python3 tools/listeners.py up:13601 blackhole:13603
+#
+# up accepts every connection and closes it at once; blackhole takes
+# connections but never completes them (a listener whose accept queue
+# is filled first, so further SYNs go unanswered).  A port with no
+# listener here plays a closed host.
+
+import socket
+import sys
+import threading
+import time
+
+
+def listen(port, blackhole):
+    sock = socket.socket()
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("127.0.0.1", port))
+    if blackhole:
+        sock.listen(0)
+        held = []
+        for _ in range(8):
+            c = socket.socket()
+            c.settimeout(0.2)
+            try:
+                c.connect(("127.0.0.1", port))
+            except OSError:
+                break
+            held.append(c)
+        time.sleep(3600)
+        return
+    sock.listen(64)
+    while True:
+        conn, _ = sock.accept()
+        conn.close()
+
+
+threads = []
+for arg in sys.argv[1:]:
+    mode, port = arg.split(":")
+    if mode not in ("up", "blackhole"):
+        sys.exit("listeners.py: unknown mode %s" % mode)
+    threads.append(threading.Thread(target=listen, args=(int(port), mode == "blackhole"), daemon=True))
+    threads[-1].start()
+for thread in threads:
+    thread.join()
@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# Metrics exposition check: two `tsclient -x` runs share one .prom file,
+# each starting a stand-in rdesktop (on PATH, so no server is needed)
+# that runs for a second.  The file must then parse as the Prometheus
+# text format and hold both runs' launches.  Needs python3; promtool is
+# used as well when it is installed:
+#
+#   tools/metrics-check.sh [path/to/tsclient]
+
+tsclient=${1:-tsclient}
+home=$(mktemp -d)
+prom="$home/tsclient.prom"
+
+cleanup () {
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+mkdir -p "$home/.tsclient" "$home/bin"
+printf '#!/bin/sh\nsleep 1\n' > "$home/bin/rdesktop"
+chmod +x "$home/bin/rdesktop"
+printf '[rdp]\nclient=rdesktop\n[metrics]\nfile=%s\ninterval-ms=0\n' "$prom" > "$home/.tsclient/tsclient.conf"
+for n in 1 2; do
+  printf 'full address:s:127.0.0.1\r\nprotocol:i:4\r\n' > "$home/run$n.rdp"
+done
+
+# no session bus, so neither run hands its profile to a running tsclient
+for n in 1 2; do
+  HOME="$home" PATH="$home/bin:$PATH" DBUS_SESSION_BUS_ADDRESS=disabled: \
+    "$tsclient" -x "$home/run$n.rdp" >/dev/null 2>&1 &
+done
+wait
+
+python3 - "$prom" <<'EOF'
+import re, sys
+
+sample = re.compile(r'^([a-zA-Z_:][a-zA-Z0-9_:]*)(\{[^}]*\})? (\S+)$')
+families, seen, errors = {}, set(), []
+family = None
+for n, line in enumerate(open(sys.argv[1]), 1):
+    line = line.rstrip("\n")
+    if line.startswith("# HELP ") or line.startswith("# TYPE "):
+        name = line.split(" ")[2]
+        if line.startswith("# TYPE "):
+            if name in families:
+                errors.append("%d: %s declared twice" % (n, name))
+            families[name] = {"type": line.split(" ")[3], "samples": {}}
+            family = name
+        continue
+    m = sample.match(line)
+    if not m:
+        errors.append("%d: not a sample: %r" % (n, line))
+        continue
+    name, labels, value = m.group(1), m.group(2) or "", float(m.group(3))
+    base = re.sub(r'_(bucket|sum|count)$', '', name)
+    if family not in (name, base):
+        errors.append("%d: %s outside its family" % (n, name))
+    if name + labels in seen:
+        errors.append("%d: %s%s repeated" % (n, name, labels))
+    seen.add(name + labels)
+    families[family]["samples"][name + labels] = value
+
+for name, f in families.items():
+    if f["type"] != "histogram":
+        continue
+    s = f["samples"]
+    buckets = [v for k, v in s.items() if k.startswith(name + "_bucket")]
+    if buckets != sorted(buckets):
+        errors.append("%s: buckets not cumulative" % name)
+    if s.get(name + '_bucket{le="+Inf"}') != s.get(name + "_count"):
+        errors.append("%s: +Inf bucket is not the count" % name)
+
+launches = sum(families.get("tsclient_launches_total", {"samples": {}})["samples"].values())
+connects = families.get("tsclient_connect_seconds", {"samples": {}})["samples"].get("tsclient_connect_seconds_count")
+if launches != 2:
+    errors.append("expected 2 launches, found %g" % launches)
+if connects != 2:
+    errors.append("expected 2 connect observations, found %s" % connects)
+
+for e in errors:
+    print("  " + e)
+print("  %s: %d families, %s" % (sys.argv[1], len(families), "ok" if not errors else "FAILED"))
+sys.exit(1 if errors else 0)
+EOF
+status=$?
+
+if command -v promtool >/dev/null; then
+  promtool check metrics < "$prom" || status=1
+fi
+exit $status
@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Host pool selection against local stand-ins, via `tsclient --pool`:
+# three loopback ports play the pool's hosts, one answering, one
+# blackholed (a listener whose accept queue is full, so SYNs go
+# unanswered) and one closed.  Needs python3:
+#
+#   tools/pool-select.sh [path/to/tsclient]
+#
+# Each run checks the hosts once and takes a turn, as a launch would, so
+# the closed host drops out of rotation after the first run and comes
+# back once [pool] quarantine-s is over.  The host each run launches on
+# must be the expected one below.  Without sessions running the
+# sessions policy takes turns like round-robin, so its load is checked
+# apart: `tsclient -x` starts a stand-in rdesktop on one host, then a
+# profile pooling that host and another, which must get the idle one.
+
+tsclient=${1:-tsclient}
+tools=$(dirname "$0")
+up=13401
+blackhole=13402
+closed=13403
+idle=13404
+home=$(mktemp -d)
+status=0
+
+cleanup () {
+  [ -n "$server" ] && kill "$server" 2>/dev/null || true
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+python3 "$tools/listeners.py" "up:$up" "blackhole:$blackhole" "up:$idle" &
+server=$!
+sleep 2
+
+mkdir -p "$home/.tsclient"
+printf '[pool]\nquarantine-s=3\n[preflight]\ntimeout-ms=1000\n' > "$home/.tsclient/tsclient.conf"
+
+# run LIST POLICY EXPECT...: --pool must launch on one of the EXPECT hosts
+run () {
+  list=$1
+  policy=$2
+  shift 2
+  HOME="$home" DBUS_SESSION_BUS_ADDRESS=disabled: LC_ALL=C LANGUAGE=C \
+    "$tsclient" --pool "$list" "$policy" > "$home/pool.out" 2>&1
+  got=$(sed -n 's/^  launch on //p' "$home/pool.out")
+  for host in "$@"; do
+    if [ "$got" = "127.0.0.1:$host" ]; then
+      echo "  $policy: ok (launch on $got)"
+      return
+    fi
+  done
+  echo "  $policy: FAILED, expected port $*, got '$got'"
+  sed 's/^/    /' "$home/pool.out"
+  status=1
+}
+
+pool="127.0.0.1:$up,127.0.0.1:$closed,127.0.0.1:$blackhole"
+# the first host; the closed one goes out of rotation
+run "$pool" round-robin $up
+# the closed host's turn, skipped while it is out
+run "$pool" round-robin $blackhole
+run "$pool" round-robin $up
+sleep 4
+# back in rotation, found down again, skipped again
+run "$pool" round-robin $blackhole
+# the first host, without waiting for the blackholed one
+run "$pool" rtt $up
+run "$pool" sessions $blackhole
+run "$pool" random $up $blackhole
+# the closed host anyway, there being no other
+run "127.0.0.1:$closed" round-robin $closed
+
+# sessions load: the pooled profile's turn falls on the busy host
+mkdir -p "$home/bin"
+cat > "$home/bin/rdesktop" <<'EOF2'
+#!/bin/sh
+for host; do :; done
+echo "$host" >> "$TSC_HOSTS_OUT"
+sleep 3
+EOF2
+chmod +x "$home/bin/rdesktop"
+printf '[preflight]\nhappy-eyeballs=false\n[cache]\nbudget-mb=0\n' > "$home/.tsclient/tsclient.conf"
+printf '{\n  "full_address": "127.0.0.1:%s",\n  "protocol": 4,\n  "rdp_client": "rdesktop"\n}\n' \
+  "$up" > "$home/busy.rdp"
+printf '{\n  "full_address": "",\n  "pool": "127.0.0.1:%s,127.0.0.1:%s",\n  "pool_policy": "sessions",\n  "protocol": 4,\n  "rdp_client": "rdesktop"\n}\n' \
+  "$up" "$idle" > "$home/pooled.rdp"
+HOME="$home" PATH="$home/bin:$PATH" TSC_HOSTS_OUT="$home/hosts" DBUS_SESSION_BUS_ADDRESS=disabled: \
+  "$tsclient" --stagger 1000 -x "$home/busy.rdp" "$home/pooled.rdp" >/dev/null 2>&1
+printf '127.0.0.1:%s\n127.0.0.1:%s\n' "$up" "$idle" > "$home/hosts.expect"
+if diff -u "$home/hosts.expect" "$home/hosts" > "$home/hosts.diff" 2>&1; then
+  echo "  sessions load: ok"
+else
+  echo "  sessions load: FAILED"
+  sed 's/^/    /' "$home/hosts.diff"
+  status=1
+fi
+exit $status
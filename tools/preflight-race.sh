@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# Protocol racing against local stand-ins, via `tsclient --preflight`:
+# an RDP server that confirms the X.224 connection request after a delay,
+# a VNC server that sends its banner at once, a port that takes the
+# connection and says nothing, and a closed port.  Needs python3:
+#
+#   tools/preflight-race.sh [path/to/tsclient]
+#
+# Each case must launch the expected protocol at the expected port, or
+# fail when nothing answers, and none of them may take anywhere near
+# [preflight] timeout-ms except the one where nothing but the silent
+# port took the connection.
+
+tsclient=${1:-tsclient}
+rdp=13389
+vnc=15901
+silent=13390
+closed=13391
+home=$(mktemp -d)
+status=0
+
+cleanup () {
+  [ -n "$server" ] && kill "$server" 2>/dev/null || true
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+python3 - "$rdp" "$vnc" "$silent" <<'EOF' &
+import socket, sys, threading, time
+
+# TPKT + X.224 Connection Confirm + RDP_NEG_RSP choosing TLS
+CONFIRM = bytes([0x03, 0x00, 0x00, 0x13, 0x0e, 0xd0, 0x00, 0x00, 0x12, 0x34, 0x00,
+                 0x02, 0x00, 0x08, 0x00, 0x01, 0x00, 0x00, 0x00])
+
+def serve(port, handle):
+    sock = socket.socket()
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("127.0.0.1", port))
+    sock.listen(64)
+    while True:
+        conn, _ = sock.accept()
+        threading.Thread(target=handle, args=(conn,), daemon=True).start()
+
+def rdp(conn):
+    if conn.recv(64)[5:6] == b"\xe0":
+        time.sleep(0.2)
+        conn.sendall(CONFIRM)
+    time.sleep(1)
+    conn.close()
+
+def vnc(conn):
+    conn.sendall(b"RFB 003.008\n")
+    time.sleep(1)
+    conn.close()
+
+def silent(conn):
+    time.sleep(30)
+    conn.close()
+
+threading.Thread(target=serve, args=(int(sys.argv[1]), rdp), daemon=True).start()
+threading.Thread(target=serve, args=(int(sys.argv[2]), vnc), daemon=True).start()
+serve(int(sys.argv[3]), silent)
+EOF
+server=$!
+sleep 1
+
+mkdir -p "$home/.tsclient"
+
+# run LIST POLICY EXPECT MIN-MS MAX-MS: the race over LIST must end in
+# the EXPECT launch line (empty: no launch at all) within MIN-MS..MAX-MS
+run () {
+  printf '[preflight]\npolicy=%s\ngrace-ms=500\ntimeout-ms=2000\n' "$2" > "$home/.tsclient/tsclient.conf"
+  start=$(date +%s%N)
+  HOME="$home" DBUS_SESSION_BUS_ADDRESS=disabled: LC_ALL=C LANGUAGE=C \
+    "$tsclient" --preflight 127.0.0.1 "$1" > "$home/race.out" 2>&1
+  ret=$?
+  took=$(( ($(date +%s%N) - start) / 1000000 ))
+  got=$(sed -n 's/^  launch \([a-z0-9]*\) at \([^,]*\).*/\1 \2/p' "$home/race.out")
+  if [ -z "$3" ] && [ $ret = 0 ]; then
+    why="expected no launch, exit $ret"
+  elif [ -n "$3" ] && [ $ret != 0 ]; then
+    why="exit $ret"
+  elif [ "$got" != "$3" ]; then
+    why="expected '$3', got '$got'"
+  elif [ $took -lt $4 ] || [ $took -gt $5 ]; then
+    why="took $took ms, expected $4..$5"
+  else
+    echo "  $1 $2: ok (${got:-no launch}, $took ms)"
+    return
+  fi
+  echo "  $1 $2: FAILED, $why"
+  sed 's/^/    /' "$home/race.out"
+  status=1
+}
+
+run "rdp:$rdp,vnc:$vnc" first "vnc 127.0.0.1::$vnc" 0 1000
+# the RDP entry is still pending when VNC answers, and answers within grace-ms
+run "rdp:$rdp,vnc:$vnc" order "rdp 127.0.0.1:$rdp" 0 1000
+run "rdp:$closed,vnc:$vnc" order "vnc 127.0.0.1::$vnc" 0 1000
+# without waiting for the silent port
+run "rdp:$silent,vnc:$vnc" first "vnc 127.0.0.1::$vnc" 0 1000
+# the silent port, which took the connection, once timeout-ms is out
+run "rdp:$closed,rdp:$silent" first "rdp 127.0.0.1:$silent" 2000 3500
+run "rdp:$closed" first "" 0 1000
+exit $status
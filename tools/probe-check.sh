@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+# Reachability checks against local listeners, via `tsclient --probe`:
+# profiles point at a loopback port that accepts, one that is closed and
+# one that takes connections but never completes them (a listener whose
+# accept queue is full).  The hosts come from profiles.idx, which is
+# written first, so the probe itself parses no profile.  Needs python3:
+#
+#   tools/probe-check.sh [path/to/tsclient]
+#
+# Each profile's state must match the expected one below, an up host
+# having answered well within timeout-ms.  With timeout-ms=1000 the
+# whole run should take about a second, the blackholed host being the
+# one that waits it out.
+
+tsclient=${1:-tsclient}
+tools=$(dirname "$0")
+up=13601
+closed=13602
+blackhole=13603
+home=$(mktemp -d)
+status=0
+
+cleanup () {
+  [ -n "$server" ] && kill "$server" 2>/dev/null || true
+  rm -rf "$home"
+}
+trap cleanup EXIT
+
+python3 "$tools/listeners.py" "up:$up" "blackhole:$blackhole" &
+server=$!
+sleep 2
+
+mkdir -p "$home/.tsclient/lab"
+printf '[probe]\ntimeout-ms=1000\nmax-inflight=2\n' > "$home/.tsclient/tsclient.conf"
+
+profile () {
+  printf 'full address:s:127.0.0.1:%s\r\nprotocol:i:%s\r\n' "$2" "$3" > "$home/.tsclient/$1.rdp"
+}
+
+profile up "$up" 4
+profile closed "$closed" 4
+profile lab/blackhole "$blackhole" 4
+profile lab/vnc "$up" 1
+
+start=$(date +%s%N)
+HOME="$home" DBUS_SESSION_BUS_ADDRESS=disabled: LC_ALL=C LANGUAGE=C \
+  "$tsclient" --probe > "$home/probe.out" 2>&1
+took=$(( ($(date +%s%N) - start) / 1000000 ))
+
+# check FILE STATE: the state --probe reports for FILE, with an up
+# host's round trip under 500 ms
+check () {
+  note=$(awk -v file="$1" '$1 == file { $1 = ""; sub (/^ /, ""); print }' "$home/probe.out")
+  case "$2:$note" in
+    "up:up, "*" ms")
+      rtt=${note#up, }
+      rtt=${rtt% ms}
+      [ "$rtt" -lt 500 ] && ok=1 || ok=0 ;;
+    "down:down")
+      ok=1 ;;
+    *)
+      ok=0 ;;
+  esac
+  if [ $ok = 1 ]; then
+    echo "  $1: ok ($note)"
+  else
+    echo "  $1: FAILED, expected $2, got '$note'"
+    status=1
+  fi
+}
+
+check up.rdp up
+check closed.rdp down
+check lab/blackhole.rdp down
+check lab/vnc.rdp up
+
+# the blackholed host waits out timeout-ms, and no longer
+if [ "$took" -ge 900 ] && [ "$took" -lt 3000 ]; then
+  echo "  took $took ms: ok"
+else
+  echo "  took $took ms: FAILED, expected about timeout-ms"
+  status=1
+fi
+
+# the index lists every host, the probe having read them from there
+for entry in up:$up closed:$closed lab/blackhole:$blackhole lab/vnc:$up; do
+  file=${entry%:*}.rdp
+  if grep -q "\"file\":\"$file\".*\"host\":\"127.0.0.1:${entry##*:}\"" "$home/.tsclient/profiles.idx"; then
+    echo "  index $file: ok"
+  else
+    echo "  index $file: FAILED"
+    status=1
+  fi
+done
+
+[ $status = 0 ] || sed 's/^/    /' "$home/probe.out"
+exit $status
@@ -16,7 +16,7 @@ Vendor:		Erick Woods <erick@gnomepro.com>
 Source:		%{name}-%{version}.tar.gz
 BuildRoot:	/var/tmp/%{name}-%{version}
 Requires:	glib2 >= 2.76.0, gtk4 >= 4.10, rdesktop >= 1.3.0, vnc >= 4.0
-BuildRequires:	glib2-devel >= 2.76.0, gtk4-devel >= 4.10
+BuildRequires:	glib2-devel >= 2.76.0, gtk4-devel >= 4.10, systemtap-sdt-devel
 
 
 %description